@@ -33,6 +33,247 @@ extern "C" {
     LIBCOUCHBASE_API
     libcouchbase_syncmode_t libcouchbase_behavior_get_syncmode(libcouchbase_t instance);
 
+    /**
+     * Specify if the get operations should use GETK/GETKQ instead of
+     * GET/GETQ. The server returns the key as part of the response for
+     * these commands, so the key passed to the get callback points
+     * directly into the received packet instead of being looked up (and
+     * possibly copied) from the sent command. Get operations specifying
+     * a new expiration time are not affected.
+     *
+     * @param instance the instance to modify
+     * @param enable non-zero to use GETK/GETKQ
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_getk(libcouchbase_t instance, int enable);
+
+    LIBCOUCHBASE_API
+    int libcouchbase_behavior_get_getk(libcouchbase_t instance);
+
+    /**
+     * Specify if a get for a key should be attached to a get already in
+     * flight for the same key instead of being sent to the server. The
+     * response from the server is passed to the get callback once for
+     * each of the requests (with their own cookie). Get operations
+     * specifying a new expiration time and get-and-lock are never
+     * coalesced.
+     *
+     * The number of requests coalesced is reported as "get_coalesced"
+     * by libcouchbase_get_client_stats().
+     *
+     * @param instance the instance to modify
+     * @param enable non-zero to coalesce gets
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_coalesce_gets(libcouchbase_t instance,
+                                                 int enable);
+
+    LIBCOUCHBASE_API
+    int libcouchbase_behavior_get_coalesce_gets(libcouchbase_t instance);
+
+    /**
+     * Specify the number of connections to open to each server. The
+     * commands for a vbucket are always sent over the same connection
+     * (so the commands for a key are executed in order), and the
+     * vbuckets are spread over the connections. The new value is used
+     * the next time the library receives a cluster configuration, so
+     * you should set it before calling libcouchbase_connect().
+     *
+     * @param instance the instance to modify
+     * @param num the number of connections (0 is treated as 1)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_connections_per_node(libcouchbase_t instance,
+                                                        libcouchbase_size_t num);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_behavior_get_connections_per_node(libcouchbase_t instance);
+
+    /**
+     * Send the commands carrying a value of at least the given size over
+     * a connection of their own, so that they don't delay the small
+     * commands to the same server. This requires at least two
+     * connections per server (the last one is used for the large
+     * values). Please note that a large value and a later command for
+     * the same key may then be executed in any order.
+     *
+     * @param instance the instance to modify
+     * @param nbytes the threshold in bytes (0 disables it)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_large_value_threshold(libcouchbase_t instance,
+                                                         libcouchbase_size_t nbytes);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_behavior_get_large_value_threshold(libcouchbase_t instance);
+
+    /**
+     * Share the cluster configuration with the other instances in the
+     * process using the same bucket (and bootstrap node). Only one of
+     * them opens the streaming connection to the cluster and passes
+     * every new configuration on to the others through their
+     * submission queues (the queue is enabled by libcouchbase_connect).
+     * If the instance running the stream is destroyed one of the
+     * others takes it over. This must be set before libcouchbase_connect,
+     * and isn't available on windows.
+     *
+     * @param instance the instance to update
+     * @param enable 1 to share the configuration, 0 to use a stream of its own
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_shared_config(libcouchbase_t instance,
+                                                 int enable);
+
+    LIBCOUCHBASE_API
+    int libcouchbase_behavior_get_shared_config(libcouchbase_t instance);
+
+    /**
+     * The buffers used for the connections to the servers are kept in
+     * a pool when they're released, and reused by the next connection
+     * needing a buffer of the same size. This sets the max number of
+     * bytes kept in the pool of the instance (the rest is released).
+     * The default is 8KB, so the big buffers given back when a burst
+     * is over are freed. It has no effect if the instance uses the
+     * pool shared by the process.
+     *
+     * @param instance the instance to update
+     * @param nbytes the max number of bytes to keep (0 disables the pool)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_buffer_pool_size(libcouchbase_t instance,
+                                                    libcouchbase_size_t nbytes);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_behavior_get_buffer_pool_size(libcouchbase_t instance);
+
+    /**
+     * Use the buffer pool shared by all of the instances in the process
+     * (which is protected by a lock) instead of a pool of its own. This
+     * lets a process with many mostly idle instances keep a single set
+     * of spare buffers. It must be set before libcouchbase_connect.
+     *
+     * @param instance the instance to update
+     * @param enable 1 to use the shared pool, 0 to use a pool of its own
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_shared_buffer_pool(libcouchbase_t instance,
+                                                      int enable);
+
+    LIBCOUCHBASE_API
+    int libcouchbase_behavior_get_shared_buffer_pool(libcouchbase_t instance);
+
+    /**
+     * Set the max number of bytes the buffers of the instance may use.
+     * Once the buffers (for the connections to the servers and the view
+     * requests) use more than that, new operations fail with
+     * LIBCOUCHBASE_EMEMLIMIT until the servers catch up. The memory
+     * limit callback is called when the limit is hit and again when
+     * we accept operations again. Each connection keeps a buffer for
+     * the input of at least 16KB, so the limit should be well above
+     * that times the number of connections.
+     *
+     * @param instance the instance to update
+     * @param nbytes the number of bytes (0 means no limit, the default)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_memory_limit(libcouchbase_t instance,
+                                                libcouchbase_size_t nbytes);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_behavior_get_memory_limit(libcouchbase_t instance);
+
+    /**
+     * Limit the number of commands sent to a connection and not yet
+     * completed. The window for each connection starts at this size and
+     * is cut in half when the server falls behind (a command times out,
+     * the server returns a temporary failure or the responses get a lot
+     * slower), and it grows back by one for every window of responses.
+     * The commands that don't fit in the window wait in the library in
+     * the order they were issued, and they fail with
+     * LIBCOUCHBASE_ETIMEDOUT if they time out before they're sent.
+     *
+     * @param instance the instance to update
+     * @param nops the max size of the window (0 means no window, the default)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_inflight_window(libcouchbase_t instance,
+                                                   libcouchbase_size_t nops);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_behavior_get_inflight_window(libcouchbase_t instance);
+
+    /**
+     * Retry the commands the server fails with a temporary failure
+     * (LIBCOUCHBASE_ETMPFAIL or LIBCOUCHBASE_ENOMEM, for instance while
+     * it's warming up) instead of passing the error to the callback.
+     * The first retry is sent after about the given delay, and the
+     * delay is doubled for every retry of the command (up to half a
+     * second). The error is passed to the callback if the command would
+     * time out before it's retried.
+     *
+     * @param instance the instance to update
+     * @param usec the delay before the first retry (0 means no retries,
+     *             the default)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_retry_backoff(libcouchbase_t instance,
+                                                 libcouchbase_uint32_t usec);
+
+    LIBCOUCHBASE_API
+    libcouchbase_uint32_t libcouchbase_behavior_get_retry_backoff(libcouchbase_t instance);
+
+    /**
+     * Stop using a server after it failed the given number of times in
+     * a row (the connection failed, or commands timed out on it). The
+     * connection is closed, and the commands for the server fail right
+     * away with LIBCOUCHBASE_ENODE_DOWN instead of waiting for the
+     * timeout. After a while we connect to the server again, and the
+     * first response makes us use it like before. If it's still down,
+     * we wait twice as long before the next try (up to 30 seconds).
+     *
+     * @param instance the instance to update
+     * @param nfailures the number of failures in a row (0 means never
+     *                  stop using a server, the default)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_breaker_threshold(libcouchbase_t instance,
+                                                     libcouchbase_size_t nfailures);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_behavior_get_breaker_threshold(libcouchbase_t instance);
+
+    /**
+     * Set how long we wait before we connect to a server we stopped
+     * using (see libcouchbase_behavior_set_breaker_threshold).
+     *
+     * @param instance the instance to update
+     * @param usec the time to wait the first time (the default is one
+     *             second)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_breaker_reset(libcouchbase_t instance,
+                                                 libcouchbase_uint32_t usec);
+
+    LIBCOUCHBASE_API
+    libcouchbase_uint32_t libcouchbase_behavior_get_breaker_reset(libcouchbase_t instance);
+
+    /**
+     * Send a NOOP to the connections that have been idle for the given
+     * time, so that a connection that died while it was idle is found
+     * before it's used again. If the server doesn't respond within
+     * the same time, the connection is closed and we connect again.
+     * Note that the timer keeps the event loop busy while it's set.
+     *
+     * @param instance the instance to update
+     * @param usec the idle time (0 means no probes, the default)
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_behavior_set_keepalive_interval(libcouchbase_t instance,
+                                                      libcouchbase_uint32_t usec);
+
+    LIBCOUCHBASE_API
+    libcouchbase_uint32_t libcouchbase_behavior_get_keepalive_interval(libcouchbase_t instance);
+
 #ifdef __cplusplus
 }
 #endif
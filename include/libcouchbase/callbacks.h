@@ -41,6 +41,52 @@ extern "C" {
                                               libcouchbase_size_t nbytes,
                                               libcouchbase_uint32_t flags,
                                               libcouchbase_cas_t cas);
+
+    /**
+     * The result for one of the keys in a batched multi-get (see
+     * libcouchbase_set_get_batch_callback). The key and the value are
+     * only valid until the callback returns.
+     */
+    typedef struct {
+        libcouchbase_error_t error;
+        const void *key;
+        libcouchbase_size_t nkey;
+        const void *bytes;
+        libcouchbase_size_t nbytes;
+        libcouchbase_uint32_t flags;
+        libcouchbase_cas_t cas;
+    } libcouchbase_get_result_t;
+
+    /**
+     * Called with the results of a multi-get when the get batch callback
+     * is set. The results arrived since the last call are passed in one
+     * array, so the callback is called at most once for each iteration
+     * of the event loop (and once when the last result arrives).
+     *
+     * @param instance the instance the multi-get was sent from
+     * @param cookie the cookie passed to libcouchbase_mget
+     * @param results the results
+     * @param nresults the number of results
+     */
+    typedef void (*libcouchbase_get_batch_callback)(libcouchbase_t instance,
+                                                    const void *cookie,
+                                                    const libcouchbase_get_result_t *results,
+                                                    libcouchbase_size_t nresults);
+
+    /**
+     * Called by a streaming multi-get to get the next key to fetch. The
+     * key must stay valid until the callback is called again.
+     *
+     * @param instance the instance running the multi-get
+     * @param cookie the cookie passed to libcouchbase_mget_stream_producer
+     * @param key where to store the pointer to the key
+     * @param nkey where to store the number of bytes in the key
+     * @return non-zero if a key was returned, 0 if there is no more keys
+     */
+    typedef int (*libcouchbase_key_producer_callback)(libcouchbase_t instance,
+                                                      const void *cookie,
+                                                      const void **key,
+                                                      libcouchbase_size_t *nkey);
     typedef void (*libcouchbase_storage_callback)(libcouchbase_t instance,
                                                   const void *cookie,
                                                   libcouchbase_storage_t operation,
@@ -160,6 +206,35 @@ extern "C" {
                                                  const void *key,
                                                  libcouchbase_size_t nkey);
 
+    /**
+     * Called when the memory used for the buffers of the instance
+     * reaches the limit (see libcouchbase_behavior_set_memory_limit),
+     * and when it drops below it again. The operations fail with
+     * LIBCOUCHBASE_EMEMLIMIT in between, so this is the time to stop
+     * (and resume) submitting operations.
+     *
+     * @param instance the instance
+     * @param exceeded 1 if the limit is reached, 0 if it's below it again
+     */
+    typedef void (*libcouchbase_memory_limit_callback)(libcouchbase_t instance,
+                                                       int exceeded);
+
+    /**
+     * Called by libcouchbase_get_client_stats() once for each counter.
+     *
+     * @param instance the instance the counters belong to
+     * @param cookie the cookie passed to libcouchbase_get_client_stats
+     * @param server_endpoint the server the counter belongs to, or NULL
+     *                        for the counters for the instance
+     * @param name the name of the counter
+     * @param value the current value of the counter
+     */
+    typedef void (*libcouchbase_client_stat_callback)(libcouchbase_t instance,
+                                                      const void *cookie,
+                                                      const char *server_endpoint,
+                                                      const char *name,
+                                                      libcouchbase_uint64_t value);
+
     LIBCOUCHBASE_API
     libcouchbase_get_callback libcouchbase_set_get_callback(libcouchbase_t,
                                                             libcouchbase_get_callback);
@@ -228,6 +303,21 @@ extern "C" {
     libcouchbase_unlock_callback libcouchbase_set_unlock_callback(libcouchbase_t,
                                                                   libcouchbase_unlock_callback);
 
+    LIBCOUCHBASE_API
+    libcouchbase_memory_limit_callback libcouchbase_set_memory_limit_callback(libcouchbase_t,
+                                                                              libcouchbase_memory_limit_callback);
+
+    /**
+     * Deliver the results of libcouchbase_mget (and
+     * libcouchbase_mget_by_key) in batches to this callback instead of
+     * calling the get callback for each key. The near cache, the
+     * negative cache and the coalescing of gets is not used for these
+     * commands. Pass NULL to turn it off again.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_get_batch_callback libcouchbase_set_get_batch_callback(libcouchbase_t,
+                                                                        libcouchbase_get_batch_callback);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,9 @@
 #include <libcouchbase/callbacks.h>
 #include <libcouchbase/tap_filter.h>
 #include <libcouchbase/timings.h>
+#include <libcouchbase/nearcache.h>
+#include <libcouchbase/queue.h>
+#include <libcouchbase/sharded.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -195,6 +198,60 @@ extern "C" {
     LIBCOUCHBASE_API
     void libcouchbase_wait(libcouchbase_t instance);
 
+    /**
+     * Send a number of operations and wait for them to complete. The
+     * callbacks registered for the instance are not called for these
+     * operations. The result of each operation is stored in the
+     * operation itself. Unlike libcouchbase_wait we return as soon as
+     * these operations completed, even if other commands are still in
+     * progress.
+     *
+     * @param instance the instance to send the operations from
+     * @param ops the operations to execute
+     * @param nops the number of operations
+     * @return LIBCOUCHBASE_SUCCESS if the operations were executed (look
+     *         at the error in each of them for the result)
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_execute_ops(libcouchbase_t instance,
+                                                  libcouchbase_op_t *ops,
+                                                  libcouchbase_size_t nops);
+
+    /**
+     * Run the event loop once without blocking for more than max_usec
+     * microseconds. The sockets that are ready and the timers that have
+     * expired are handled before we return. This allows you to drive
+     * the instance from a loop you own (call it with 0 when one of the
+     * sockets from libcouchbase_get_pollfds is ready, or once every
+     * iteration of your loop). You should not call this function from
+     * within your callbacks.
+     *
+     * @param instance the instance to run the event loop for
+     * @param max_usec the max time to wait for events (in usec)
+     * @return LIBCOUCHBASE_SUCCESS, or LIBCOUCHBASE_EINVAL if called
+     *         from within libcouchbase_tick
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_tick(libcouchbase_t instance,
+                                           libcouchbase_uint32_t max_usec);
+
+    /**
+     * Get the sockets used by the instance and the events the instance
+     * is waiting for on each of them, so that you may add them to your
+     * own poll set. The set changes as the instance runs, so you should
+     * get it again after each call to libcouchbase_tick.
+     *
+     * @param instance the instance to get the sockets for
+     * @param fds where to store the sockets
+     * @param nfds the number of entries in fds
+     * @return the number of sockets (if it's bigger than nfds only the
+     *         first nfds sockets are stored)
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_get_pollfds(libcouchbase_t instance,
+                                                 libcouchbase_pollfd_t *fds,
+                                                 libcouchbase_size_t nfds);
+
     /**
      * Get a number of values from the cache. You need to run the
      * event loop yourself (or call libcouchbase_execute) to retrieve
@@ -248,6 +305,113 @@ extern "C" {
                                                   const libcouchbase_size_t *nkey,
                                                   const libcouchbase_time_t *exp);
 
+    /**
+     * Get a single value from the cache, and pass the result to the
+     * given callback instead of the get callback registered for the
+     * instance. The near cache, the negative cache and the coalescing
+     * of gets is not used for these commands.
+     *
+     * @param instance the instance used to batch the requests from
+     * @param command_cookie A cookie passed to the callback
+     * @param callback the callback to receive the result
+     * @param hashkey the key to use for hashing (NULL to use the key)
+     * @param nhashkey the number of bytes in hashkey
+     * @param key the key to get
+     * @param nkey the number of bytes in the key
+     * @param exp the new expiration time for the object (or NULL)
+     * @return The status of the operation
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_get_with_callback(libcouchbase_t instance,
+                                                        const void *command_cookie,
+                                                        libcouchbase_get_callback callback,
+                                                        const void *hashkey,
+                                                        libcouchbase_size_t nhashkey,
+                                                        const void *key,
+                                                        libcouchbase_size_t nkey,
+                                                        const libcouchbase_time_t *exp);
+
+    /**
+     * Get a (possibly very large) number of values from the cache. Unlike
+     * libcouchbase_mget the requests aren't encoded up front, but the
+     * library keeps at most <code>window</code> commands queued for each
+     * server and sends the next one as soon as a command completes. The
+     * results are passed to the get callback as they arrive.
+     *
+     * The keys are sent in the order they appear in the array. A key for
+     * a server with a full window is set aside (one per server) and the
+     * library continues with the next key, so a slow server doesn't hold
+     * up the others. It only waits for a server when a second key for it
+     * comes up while one is already set aside. The arrays must stay valid
+     * until all of the results are delivered.
+     *
+     * @param instance the instance used to batch the requests from
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param window the max number of commands queued for each server
+     * @param num_keys the number of keys to get
+     * @param keys the array containing the keys to get
+     * @param nkey the array containing the lengths of the keys
+     * @return The status of the operation
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mget_stream(libcouchbase_t instance,
+                                                  const void *command_cookie,
+                                                  libcouchbase_size_t window,
+                                                  libcouchbase_size_t num_keys,
+                                                  const void *const *keys,
+                                                  const libcouchbase_size_t *nkey);
+
+    /**
+     * Get a (possibly very large) number of values from the cache. This
+     * works like libcouchbase_mget_stream, but the keys are requested one
+     * at a time from the producer callback until it reports that there
+     * is no more keys.
+     *
+     * @param instance the instance used to batch the requests from
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command (and the producer)
+     * @param window the max number of commands queued for each server
+     * @param producer the callback returning the next key to get
+     * @return The status of the operation
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mget_stream_producer(libcouchbase_t instance,
+                                                           const void *command_cookie,
+                                                           libcouchbase_size_t window,
+                                                           libcouchbase_key_producer_callback producer);
+
+    /**
+     * Get a number of values from the cache, and read the value from the
+     * first replica if the master doesn't respond within the given delay
+     * (or if it fails). The first successful response is passed to the
+     * get callback, and the response from the other node is ignored.
+     * A "key not found" from the master is trusted and not retried on
+     * the replica.
+     *
+     * Please note that a get already sent to a node can't be cancelled,
+     * so the hedge adds load to the replicas. Use a delay close to the
+     * high percentiles of your get latency.
+     *
+     * @param instance the instance used to batch the requests from
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param num_keys the number of keys to get
+     * @param keys the array containing the keys to get
+     * @param nkey the array containing the lengths of the keys
+     * @param delay the number of usec to wait for the master before
+     *              asking the replica (0 means only ask the replica if
+     *              the master fails)
+     * @return The status of the operation
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mget_hedged(libcouchbase_t instance,
+                                                  const void *command_cookie,
+                                                  libcouchbase_size_t num_keys,
+                                                  const void *const *keys,
+                                                  const libcouchbase_size_t *nkey,
+                                                  libcouchbase_uint32_t delay);
+
     /**
      * Get an item with a lock that has a timeout. It can then be unlocked
      * with either a CAS operation or with an explicit unlock command.
@@ -441,6 +605,59 @@ extern "C" {
     LIBCOUCHBASE_API
     libcouchbase_error_t libcouchbase_server_versions(libcouchbase_t instance,
                                                       const void *command_cookie);
+
+    /**
+     * Get the counters collected by the client library (not the server).
+     * The callback is called (before the function returns) once for
+     * each of the counters. Counters for the instance are reported with
+     * a NULL server endpoint.
+     *
+     * @param instance the instance to get the counters for
+     * @param cookie a cookie passed to all of the callbacks
+     * @param callback the callback to receive the counters
+     * @return The status of the operation
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_get_client_stats(libcouchbase_t instance,
+                                                       const void *cookie,
+                                                       libcouchbase_client_stat_callback callback);
+
+    /**
+     * Get the number of bytes allocated by the library for the
+     * instance (this is also reported as the "resident_bytes" client
+     * stat). The memory used by the io plugin and the parsed cluster
+     * configuration isn't included.
+     *
+     * @param instance the instance to get the size of
+     * @return the number of bytes
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_get_resident_bytes(libcouchbase_t instance);
+
+    /**
+     * Get the number of bytes allocated for the buffers of the
+     * instance (this is also reported as the "buffered_bytes" client
+     * stat). This is the number checked against the memory limit (see
+     * libcouchbase_behavior_set_memory_limit).
+     *
+     * @param instance the instance to get the size of
+     * @return the number of bytes
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_get_buffered_bytes(libcouchbase_t instance);
+
+    /**
+     * Release the buffers of the connections without any commands in
+     * flight. They're allocated again when they're needed, so this is
+     * meant to be called for instances you expect to be idle for a
+     * while.
+     *
+     * @param instance the instance to shrink
+     * @return the number of bytes released
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_release_idle_buffers(libcouchbase_t instance);
+
     /**
      * Spool a store operation to the cluster. The operation <b>may</b> be
      * sent immediately, but you won't be sure (or get the result) until you
@@ -518,6 +735,108 @@ extern "C" {
                                                    libcouchbase_time_t exp,
                                                    libcouchbase_cas_t cas);
 
+    /**
+     * Spool a store operation to the cluster, and pass the result to
+     * the given callback instead of the storage callback registered for
+     * the instance. See libcouchbase_store_by_key() for a description of
+     * the other arguments.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to the callback
+     * @param callback the callback to receive the result
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_store_with_callback(libcouchbase_t instance,
+                                                          const void *command_cookie,
+                                                          libcouchbase_storage_callback callback,
+                                                          libcouchbase_storage_t operation,
+                                                          const void *hashkey,
+                                                          libcouchbase_size_t nhashkey,
+                                                          const void *key,
+                                                          libcouchbase_size_t nkey,
+                                                          const void *bytes,
+                                                          libcouchbase_size_t nbytes,
+                                                          libcouchbase_uint32_t flags,
+                                                          libcouchbase_time_t exp,
+                                                          libcouchbase_cas_t cas);
+
+    /**
+     * Spool a number of store operations to the cluster. The operations
+     * use the "quiet" versions of the storage commands followed by a
+     * NOOP, so the servers will only send a response for the operations
+     * that fail. The storage callback is still called for each key, but
+     * the cas value for the successful operations is reported as 0.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param operation constraints for the storage operations (add/replace etc)
+     * @param num_keys the number of items to store
+     * @param keys the array containing the keys to set
+     * @param nkey the array containing the lengths of the keys
+     * @param bytes the array containing the values to set
+     * @param nbytes the array containing the sizes of the values
+     * @param flags the array containing the user-defined flags for the
+     *              items (or NULL to use 0 for all of them)
+     * @param exp the array containing the expiration times for the items
+     *            (or NULL if the items shouldn't expire)
+     * @param cas the array containing the cas identifiers for the existing
+     *            objects (or NULL if you don't want to limit to any cas
+     *            value)
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mstore(libcouchbase_t instance,
+                                             const void *command_cookie,
+                                             libcouchbase_storage_t operation,
+                                             libcouchbase_size_t num_keys,
+                                             const void *const *keys,
+                                             const libcouchbase_size_t *nkey,
+                                             const void *const *bytes,
+                                             const libcouchbase_size_t *nbytes,
+                                             const libcouchbase_uint32_t *flags,
+                                             const libcouchbase_time_t *exp,
+                                             const libcouchbase_cas_t *cas);
+
+    /**
+     * Spool a number of store operations to the cluster. See
+     * libcouchbase_mstore() for a description of the arguments.
+     *
+     * Set <code>nhashkey</code> to 0 if you want to hash each individual
+     * key.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param operation constraints for the storage operations (add/replace etc)
+     * @param hashkey the key to use for hashing
+     * @param nhashkey the number of bytes in hashkey
+     * @param num_keys the number of items to store
+     * @param keys the array containing the keys to set
+     * @param nkey the array containing the lengths of the keys
+     * @param bytes the array containing the values to set
+     * @param nbytes the array containing the sizes of the values
+     * @param flags the array containing the user-defined flags (or NULL)
+     * @param exp the array containing the expiration times (or NULL)
+     * @param cas the array containing the cas identifiers (or NULL)
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mstore_by_key(libcouchbase_t instance,
+                                                    const void *command_cookie,
+                                                    libcouchbase_storage_t operation,
+                                                    const void *hashkey,
+                                                    libcouchbase_size_t nhashkey,
+                                                    libcouchbase_size_t num_keys,
+                                                    const void *const *keys,
+                                                    const libcouchbase_size_t *nkey,
+                                                    const void *const *bytes,
+                                                    const libcouchbase_size_t *nbytes,
+                                                    const libcouchbase_uint32_t *flags,
+                                                    const libcouchbase_time_t *exp,
+                                                    const libcouchbase_cas_t *cas);
+
     /**
      * Spool an arithmetic operation to the cluster. The operation <b>may</b> be
      * sent immediately, but you won't be sure (or get the result) until you
@@ -576,6 +895,98 @@ extern "C" {
                                                         int create,
                                                         libcouchbase_uint64_t initial);
 
+    /**
+     * Spool an arithmetic operation to the cluster, and pass the result
+     * to the given callback instead of the arithmetic callback
+     * registered for the instance. See libcouchbase_arithmetic_by_key()
+     * for a description of the other arguments.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to the callback
+     * @param callback the callback to receive the result
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_arithmetic_with_callback(libcouchbase_t instance,
+                                                               const void *command_cookie,
+                                                               libcouchbase_arithmetic_callback callback,
+                                                               const void *hashkey,
+                                                               libcouchbase_size_t nhashkey,
+                                                               const void *key,
+                                                               libcouchbase_size_t nkey,
+                                                               libcouchbase_int64_t delta,
+                                                               libcouchbase_time_t exp,
+                                                               int create,
+                                                               libcouchbase_uint64_t initial);
+
+    /**
+     * Spool a number of arithmetic operations to the cluster. The
+     * operations use the INCREMENTQ/DECREMENTQ commands followed by a
+     * NOOP, so the servers will only send a response for the operations
+     * that fail. The arithmetic callback is still called for each key,
+     * but the new value and cas for the successful operations are
+     * reported as 0.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param num_keys the number of keys to update
+     * @param keys the array containing the keys to update
+     * @param nkey the array containing the lengths of the keys
+     * @param delta the array containing the amount to add / subtract
+     *              for each key
+     * @param exp When the objects should expire
+     * @param create set to true if you want the objects to be created if
+     *               they don't exist.
+     * @param initial The initial value of the objects if we create them
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_marithmetic(libcouchbase_t instance,
+                                                  const void *command_cookie,
+                                                  libcouchbase_size_t num_keys,
+                                                  const void *const *keys,
+                                                  const libcouchbase_size_t *nkey,
+                                                  const libcouchbase_int64_t *delta,
+                                                  libcouchbase_time_t exp,
+                                                  int create,
+                                                  libcouchbase_uint64_t initial);
+
+    /**
+     * Spool a number of arithmetic operations to the cluster. See
+     * libcouchbase_marithmetic() for a description of the arguments.
+     *
+     * Set <code>nhashkey</code> to 0 if you want to hash each individual
+     * key.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param hashkey the key to use for hashing
+     * @param nhashkey the number of bytes in hashkey
+     * @param num_keys the number of keys to update
+     * @param keys the array containing the keys to update
+     * @param nkey the array containing the lengths of the keys
+     * @param delta the array containing the amount to add / subtract
+     * @param exp When the objects should expire
+     * @param create set to true if you want the objects to be created if
+     *               they don't exist.
+     * @param initial The initial value of the objects if we create them
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_marithmetic_by_key(libcouchbase_t instance,
+                                                         const void *command_cookie,
+                                                         const void *hashkey,
+                                                         libcouchbase_size_t nhashkey,
+                                                         libcouchbase_size_t num_keys,
+                                                         const void *const *keys,
+                                                         const libcouchbase_size_t *nkey,
+                                                         const libcouchbase_int64_t *delta,
+                                                         libcouchbase_time_t exp,
+                                                         int create,
+                                                         libcouchbase_uint64_t initial);
+
     /**
      * Spool a remove operation to the cluster. The operation <b>may</b> be
      * sent immediately, but you won't be sure (or get the result) until you
@@ -620,6 +1031,80 @@ extern "C" {
                                                     libcouchbase_size_t nkey,
                                                     libcouchbase_cas_t cas);
 
+    /**
+     * Spool a remove operation to the cluster, and pass the result to
+     * the given callback instead of the remove callback registered for
+     * the instance. See libcouchbase_remove_by_key() for a description
+     * of the other arguments.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to the callback
+     * @param callback the callback to receive the result
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_remove_with_callback(libcouchbase_t instance,
+                                                           const void *command_cookie,
+                                                           libcouchbase_remove_callback callback,
+                                                           const void *hashkey,
+                                                           libcouchbase_size_t nhashkey,
+                                                           const void *key,
+                                                           libcouchbase_size_t nkey,
+                                                           libcouchbase_cas_t cas);
+
+    /**
+     * Spool a number of remove operations to the cluster. The operations
+     * use the DELETEQ command followed by a NOOP, so the servers will
+     * only send a response for the operations that fail. The remove
+     * callback is still called for each key.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param num_keys the number of keys to delete
+     * @param keys the array containing the keys to delete
+     * @param nkey the array containing the lengths of the keys
+     * @param cas the array containing the cas values for the objects (or
+     *            NULL if you don't care)
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mremove(libcouchbase_t instance,
+                                              const void *command_cookie,
+                                              libcouchbase_size_t num_keys,
+                                              const void *const *keys,
+                                              const libcouchbase_size_t *nkey,
+                                              const libcouchbase_cas_t *cas);
+
+    /**
+     * Spool a number of remove operations to the cluster. See
+     * libcouchbase_mremove() for a description of the arguments.
+     *
+     * Set <code>nhashkey</code> to 0 if you want to hash each individual
+     * key.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to all of the notifications
+     *                       from this command
+     * @param hashkey the key to use for hashing
+     * @param nhashkey the number of bytes in hashkey
+     * @param num_keys the number of keys to delete
+     * @param keys the array containing the keys to delete
+     * @param nkey the array containing the lengths of the keys
+     * @param cas the array containing the cas values for the objects (or
+     *            NULL if you don't care)
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_mremove_by_key(libcouchbase_t instance,
+                                                     const void *command_cookie,
+                                                     const void *hashkey,
+                                                     libcouchbase_size_t nhashkey,
+                                                     libcouchbase_size_t num_keys,
+                                                     const void *const *keys,
+                                                     const libcouchbase_size_t *nkey,
+                                                     const libcouchbase_cas_t *cas);
+
 
     /**
      * Get a textual descrtiption for the given error code
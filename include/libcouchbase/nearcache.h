@@ -0,0 +1,140 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the API for the client side caches in front of
+ * the get operations: the near cache (values) and the negative cache
+ * (missing keys).
+ */
+#ifndef LIBCOUCHBASE_NEARCACHE_H
+#define LIBCOUCHBASE_NEARCACHE_H 1
+
+#ifndef LIBCOUCHBASE_COUCHBASE_H
+#error "Include libcouchbase/couchbase.h instead"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * Start caching the values returned by get operations. Subsequent
+     * gets for the same key (without a new expiration time) are answered
+     * from the cache (the get callback is still called from the event
+     * loop, never from within the get call).
+     *
+     * An entry is removed from the cache when:
+     * <ul>
+     *   <li>it is modified (or touched) through this instance</li>
+     *   <li>it is modified on the cluster and the instance is connected
+     *       to a TAP stream with libcouchbase_near_cache_tap()</li>
+     *   <li>its time-to-live, or the expiration time specified by a
+     *       get-and-touch, has passed</li>
+     *   <li>it is the least recently used entry and the cache needs
+     *       room for a new entry</li>
+     * </ul>
+     *
+     * Without a TAP stream the cache will return stale values for keys
+     * modified by other clients until the time-to-live passes.
+     *
+     * The counters for the cache are reported by
+     * libcouchbase_get_client_stats().
+     *
+     * @param instance the handle to libcouchbase
+     * @param max_bytes the max amount of memory used by the cache
+     * @param ttl the max time (in usec) an entry is used
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_enable_near_cache(libcouchbase_t instance,
+                                                        libcouchbase_size_t max_bytes,
+                                                        libcouchbase_uint32_t ttl);
+
+    /**
+     * Stop caching (and release all of the entries). Hits already found
+     * by get operations are passed to the get callback before the
+     * function returns.
+     *
+     * @param instance the handle to libcouchbase
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_disable_near_cache(libcouchbase_t instance);
+
+    /**
+     * Keep the near cache coherent with the cluster by removing the
+     * entries modified, deleted or flushed on the cluster. The TAP
+     * stream runs on a second (connected) instance of libcouchbase using
+     * the same event loop, since a connection receiving a TAP stream may
+     * not be used for other operations. The tap callbacks registered for
+     * that instance are still called, and it should not be used for
+     * anything but the TAP stream.
+     *
+     * A filter with keys_only set is recommended, since the values are
+     * not used.
+     *
+     * @param instance the instance with the near cache
+     * @param tap the instance to receive the TAP stream
+     * @param filter the filter for the TAP stream (may be NULL)
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_near_cache_tap(libcouchbase_t instance,
+                                                     libcouchbase_t tap,
+                                                     libcouchbase_tap_filter_t filter);
+
+    /**
+     * Start remembering the keys reported as missing by get operations.
+     * Subsequent gets for such a key (without a new expiration time) are
+     * answered with LIBCOUCHBASE_KEY_ENOENT without asking the server
+     * (the get callback is still called from the event loop).
+     *
+     * An entry is removed when the time-to-live passes, or when the key
+     * is stored (or modified in any other way) through this instance.
+     * Keys created by other clients are reported as missing until the
+     * entry expires, so the time-to-live should be short.
+     *
+     * The counters for the cache are reported by
+     * libcouchbase_get_client_stats().
+     *
+     * @param instance the handle to libcouchbase
+     * @param max_keys the max number of keys to remember (the ones
+     *                 expiring first are dropped to make room for new)
+     * @param ttl the time (in usec) to remember a missing key
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_enable_negative_cache(libcouchbase_t instance,
+                                                            libcouchbase_size_t max_keys,
+                                                            libcouchbase_uint32_t ttl);
+
+    /**
+     * Stop remembering missing keys. Misses already found by get
+     * operations are passed to the get callback before the function
+     * returns.
+     *
+     * @param instance the handle to libcouchbase
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_disable_negative_cache(libcouchbase_t instance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the API to submit operations to an instance from
+ * other threads than the one running its event loop.
+ */
+#ifndef LIBCOUCHBASE_QUEUE_H
+#define LIBCOUCHBASE_QUEUE_H 1
+
+#ifndef LIBCOUCHBASE_COUCHBASE_H
+#error "Include libcouchbase/couchbase.h instead"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * Create the submission queue for the instance. The queue lets any
+     * thread submit operations with the libcouchbase_queue_* functions
+     * below. The operations are passed to the instance (and the
+     * callbacks are called) by the thread running the event loop for
+     * the instance. The callbacks may post the results to a queue of
+     * your own if they are to be processed by another thread.
+     *
+     * The submission doesn't take a lock. The thread running the event
+     * loop is woken up (with an eventfd or a pipe) when the queue goes
+     * from empty to non-empty, so a burst of operations only costs one
+     * wakeup.
+     *
+     * This function must be called from the thread running the event
+     * loop before the other threads start to submit operations, and
+     * the instance must be in asynchronous mode.
+     *
+     * @param instance the handle to libcouchbase
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_enable_submission_queue(libcouchbase_t instance);
+
+    /**
+     * Pass the operations in the submission queue to the instance and
+     * release the queue. This function must be called from the thread
+     * running the event loop after the other threads stopped submitting
+     * operations.
+     *
+     * @param instance the handle to libcouchbase
+     * @return Status of the operation.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_disable_submission_queue(libcouchbase_t instance);
+
+    /**
+     * Submit a get operation from any thread. The key is copied, and
+     * the result is passed to the get callback with the cookie.
+     *
+     * @param instance the handle to libcouchbase
+     * @param command_cookie A cookie passed to the get callback
+     * @param key the key to get
+     * @param nkey the number of bytes in the key
+     * @return LIBCOUCHBASE_SUCCESS if the operation was queued
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_queue_get(libcouchbase_t instance,
+                                                const void *command_cookie,
+                                                const void *key,
+                                                libcouchbase_size_t nkey);
+
+    /**
+     * Submit a store operation from any thread. The key and the value
+     * are copied. See libcouchbase_store() for the arguments.
+     *
+     * @return LIBCOUCHBASE_SUCCESS if the operation was queued
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_queue_store(libcouchbase_t instance,
+                                                  const void *command_cookie,
+                                                  libcouchbase_storage_t operation,
+                                                  const void *key,
+                                                  libcouchbase_size_t nkey,
+                                                  const void *bytes,
+                                                  libcouchbase_size_t nbytes,
+                                                  libcouchbase_uint32_t flags,
+                                                  libcouchbase_time_t exp,
+                                                  libcouchbase_cas_t cas);
+
+    /**
+     * Submit an arithmetic operation from any thread. The key is copied.
+     * See libcouchbase_arithmetic() for the arguments.
+     *
+     * @return LIBCOUCHBASE_SUCCESS if the operation was queued
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_queue_arithmetic(libcouchbase_t instance,
+                                                       const void *command_cookie,
+                                                       const void *key,
+                                                       libcouchbase_size_t nkey,
+                                                       libcouchbase_int64_t delta,
+                                                       libcouchbase_time_t exp,
+                                                       int create,
+                                                       libcouchbase_uint64_t initial);
+
+    /**
+     * Submit a remove operation from any thread. The key is copied.
+     * See libcouchbase_remove() for the arguments.
+     *
+     * @return LIBCOUCHBASE_SUCCESS if the operation was queued
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_queue_remove(libcouchbase_t instance,
+                                                   const void *command_cookie,
+                                                   const void *key,
+                                                   libcouchbase_size_t nkey,
+                                                   libcouchbase_cas_t cas);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the API for the sharded client: a number of
+ * instances (shards), each with its own event loop, sharing a single
+ * configuration stream.
+ */
+#ifndef LIBCOUCHBASE_SHARDED_H
+#define LIBCOUCHBASE_SHARDED_H 1
+
+#ifndef LIBCOUCHBASE_COUCHBASE_H
+#error "Include libcouchbase/couchbase.h instead"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct libcouchbase_sharded_st *libcouchbase_sharded_t;
+
+    /**
+     * Create a sharded client. Each of the shards is an instance with
+     * its own event loop, and the operations for a key are passed to
+     * the shard owning the server the key maps to (server index modulo
+     * the number of shards). Only the first shard connects to the REST
+     * port, and the configuration it receives is passed on to the
+     * other shards, so the cluster sees one configuration stream.
+     *
+     * The library doesn't start any threads. The application should
+     * run the event loop of each shard in a thread of its own with
+     * libcouchbase_sharded_run(), and may pin those threads to cores.
+     * The callbacks are set on each of the shards (see
+     * libcouchbase_sharded_get_shard()), and are called from the thread
+     * running the event loop for the shard.
+     *
+     * @param host The host (with optional port) to connect to retrieve the
+     *             vbucket list from
+     * @param user the username to use
+     * @param passwd The password
+     * @param bucket The bucket to connect to
+     * @param nshards The number of shards
+     * @return A handle to the sharded client, or NULL if an error occured.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_sharded_t libcouchbase_sharded_create(const char *host,
+                                                       const char *user,
+                                                       const char *passwd,
+                                                       const char *bucket,
+                                                       libcouchbase_size_t nshards);
+
+    /**
+     * Destroy the sharded client and all of its shards. The threads
+     * running the event loops must be stopped first.
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_sharded_destroy(libcouchbase_sharded_t sharded);
+
+    /**
+     * Start to receive the configuration for the cluster. The shards
+     * won't accept operations until the first configuration arrives.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_sharded_connect(libcouchbase_sharded_t sharded);
+
+    LIBCOUCHBASE_API
+    libcouchbase_size_t libcouchbase_sharded_get_num_shards(libcouchbase_sharded_t sharded);
+
+    /**
+     * Get the instance for a shard (to set the callbacks etc). The
+     * instance may only be used from the thread running its event loop.
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_t libcouchbase_sharded_get_shard(libcouchbase_sharded_t sharded,
+                                                  libcouchbase_size_t idx);
+
+    /**
+     * Run the event loop for a shard. This doesn't return until the
+     * event loop is stopped.
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_sharded_run(libcouchbase_sharded_t sharded,
+                                  libcouchbase_size_t idx);
+
+    /**
+     * Stop the event loop for a shard. This must be called from the
+     * thread running the event loop (for instance from a callback).
+     */
+    LIBCOUCHBASE_API
+    void libcouchbase_sharded_stop(libcouchbase_sharded_t sharded,
+                                   libcouchbase_size_t idx);
+
+    /**
+     * The operations below may be called from any thread. They're
+     * passed to the shard owning the key through its submission queue
+     * (see libcouchbase_queue_get() etc).
+     */
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_sharded_get(libcouchbase_sharded_t sharded,
+                                                  const void *command_cookie,
+                                                  const void *key,
+                                                  libcouchbase_size_t nkey);
+
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_sharded_store(libcouchbase_sharded_t sharded,
+                                                    const void *command_cookie,
+                                                    libcouchbase_storage_t operation,
+                                                    const void *key,
+                                                    libcouchbase_size_t nkey,
+                                                    const void *bytes,
+                                                    libcouchbase_size_t nbytes,
+                                                    libcouchbase_uint32_t flags,
+                                                    libcouchbase_time_t exp,
+                                                    libcouchbase_cas_t cas);
+
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_sharded_arithmetic(libcouchbase_sharded_t sharded,
+                                                         const void *command_cookie,
+                                                         const void *key,
+                                                         libcouchbase_size_t nkey,
+                                                         libcouchbase_int64_t delta,
+                                                         libcouchbase_time_t exp,
+                                                         int create,
+                                                         libcouchbase_uint64_t initial);
+
+    LIBCOUCHBASE_API
+    libcouchbase_error_t libcouchbase_sharded_remove(libcouchbase_sharded_t sharded,
+                                                     const void *command_cookie,
+                                                     const void *key,
+                                                     libcouchbase_size_t nkey,
+                                                     libcouchbase_cas_t cas);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -73,7 +73,9 @@ extern "C" {
         LIBCOUCHBASE_PROTOCOL_ERROR = 0x15,
         LIBCOUCHBASE_ETIMEDOUT = 0x16,
         LIBCOUCHBASE_CONNECT_ERROR = 0x17,
-        LIBCOUCHBASE_BUCKET_ENOENT = 0x18
+        LIBCOUCHBASE_BUCKET_ENOENT = 0x18,
+        LIBCOUCHBASE_EMEMLIMIT = 0x19,
+        LIBCOUCHBASE_ENODE_DOWN = 0x1a
     } libcouchbase_error_t;
 
     /**
@@ -269,6 +271,60 @@ extern "C" {
         LIBCOUCHBASE_SYNCHRONOUS = 0xff
     } libcouchbase_syncmode_t;
 
+    /**
+     * The operations supported by libcouchbase_execute_ops
+     */
+    typedef enum {
+        LIBCOUCHBASE_OP_GET = 0x01,
+        LIBCOUCHBASE_OP_STORE = 0x02,
+        LIBCOUCHBASE_OP_ARITHMETIC = 0x03,
+        LIBCOUCHBASE_OP_REMOVE = 0x04
+    } libcouchbase_op_type_t;
+
+    /**
+     * An operation for libcouchbase_execute_ops. Fill in the type, the
+     * key and the arguments used by the type of operation, and the
+     * result is stored in the same structure.
+     */
+    typedef struct {
+        libcouchbase_op_type_t type;
+        const void *key;
+        libcouchbase_size_t nkey;
+        /** The storage operation (LIBCOUCHBASE_OP_STORE only) */
+        libcouchbase_storage_t operation;
+        /**
+         * The value to store, or the value we got. The value we got is
+         * valid until the next call to libcouchbase_execute_ops.
+         */
+        const void *bytes;
+        libcouchbase_size_t nbytes;
+        /** The flags to store, or the flags we got */
+        libcouchbase_uint32_t flags;
+        /** The expiration time (a get with a non-zero time touches it) */
+        libcouchbase_time_t exp;
+        /** The cas to check for store and remove, and the new cas */
+        libcouchbase_cas_t cas;
+        /** The arguments to LIBCOUCHBASE_OP_ARITHMETIC */
+        libcouchbase_int64_t delta;
+        int create;
+        libcouchbase_uint64_t initial;
+
+        /** The result of the operation */
+        libcouchbase_error_t error;
+        /** The new value (LIBCOUCHBASE_OP_ARITHMETIC only) */
+        libcouchbase_uint64_t value;
+    } libcouchbase_op_t;
+
+    /**
+     * A socket used by the instance, and the events it's waiting for
+     * (see libcouchbase_get_pollfds)
+     */
+    typedef struct {
+        libcouchbase_socket_t sock;
+        /** LIBCOUCHBASE_READ_EVENT and/or LIBCOUCHBASE_WRITE_EVENT */
+        short events;
+    } libcouchbase_pollfd_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,21 @@ libcouchbase_error_t libcouchbase_arithmetic_by_key(libcouchbase_t instance,
                                                     const void *key, libcouchbase_size_t nkey,
                                                     int64_t delta, libcouchbase_time_t exp,
                                                     int create, libcouchbase_uint64_t initial)
+{
+    return libcouchbase_arithmetic_with_callback(instance, command_cookie, NULL,
+                                                 hashkey, nhashkey, key, nkey,
+                                                 delta, exp, create, initial);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_arithmetic_with_callback(libcouchbase_t instance,
+                                                           const void *command_cookie,
+                                                           libcouchbase_arithmetic_callback callback,
+                                                           const void *hashkey,
+                                                           libcouchbase_size_t nhashkey,
+                                                           const void *key, libcouchbase_size_t nkey,
+                                                           int64_t delta, libcouchbase_time_t exp,
+                                                           int create, libcouchbase_uint64_t initial)
 {
     libcouchbase_server_t *server;
     protocol_binary_request_incr req;
@@ -51,6 +66,10 @@ libcouchbase_error_t libcouchbase_arithmetic_by_key(libcouchbase_t instance,
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
     }
 
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
     if (nhashkey == 0) {
         nhashkey = nkey;
         hashkey = key;
@@ -60,7 +79,7 @@ libcouchbase_error_t libcouchbase_arithmetic_by_key(libcouchbase_t instance,
         /* the config says that there is no server yet at that position (-1) */
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
     }
-    server = instance->servers + idx;
+    server = libcouchbase_get_server(instance, idx, vb, 0);
 
     memset(&req, 0, sizeof(req));
     req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -85,10 +104,120 @@ libcouchbase_error_t libcouchbase_arithmetic_by_key(libcouchbase_t instance,
                sizeof(req.message.body.expiration));
     }
 
-    libcouchbase_server_start_packet(server, command_cookie, req.bytes, sizeof(req.bytes));
+    libcouchbase_cache_invalidate(instance, vb, key, nkey);
+    if (callback != NULL) {
+        struct libcouchbase_command_data_st ct;
+        ct.start = gethrtime();
+        ct.cookie = command_cookie;
+        ct.callback.arithmetic = callback;
+        ct.retries = 0;
+        /* Use the retry function so that we may pass our own command data */
+        libcouchbase_server_retry_packet(server, &ct, req.bytes, sizeof(req.bytes));
+    } else {
+        libcouchbase_server_start_packet(server, command_cookie, req.bytes, sizeof(req.bytes));
+    }
     libcouchbase_server_write_packet(server, key, nkey);
     libcouchbase_server_end_packet(server);
     libcouchbase_server_send_packets(server);
 
     return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
 }
+
+/**
+ * libcouchbase_marithmetic use the INCREMENTQ/DECREMENTQ commands
+ * followed by a NOOP command to avoid transferring the responses for
+ * the successful operations. All of the success callbacks are generated
+ * implicit by receiving a later response or the NOOP.
+ */
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_marithmetic(libcouchbase_t instance,
+                                              const void *command_cookie,
+                                              libcouchbase_size_t num_keys,
+                                              const void *const *keys,
+                                              const libcouchbase_size_t *nkey,
+                                              const libcouchbase_int64_t *delta,
+                                              libcouchbase_time_t exp,
+                                              int create,
+                                              libcouchbase_uint64_t initial)
+{
+    return libcouchbase_marithmetic_by_key(instance, command_cookie, NULL, 0,
+                                           num_keys, keys, nkey, delta, exp,
+                                           create, initial);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_marithmetic_by_key(libcouchbase_t instance,
+                                                     const void *command_cookie,
+                                                     const void *hashkey,
+                                                     libcouchbase_size_t nhashkey,
+                                                     libcouchbase_size_t num_keys,
+                                                     const void *const *keys,
+                                                     const libcouchbase_size_t *nkey,
+                                                     const libcouchbase_int64_t *delta,
+                                                     libcouchbase_time_t exp,
+                                                     int create,
+                                                     libcouchbase_uint64_t initial)
+{
+    struct libcouchbase_multi_st multi;
+    libcouchbase_error_t err;
+    libcouchbase_size_t ii;
+
+    /* we need a vbucket config before we can start getting data.. */
+    if (instance->vbucket_config == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
+    }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    if (num_keys == 1) {
+        return libcouchbase_arithmetic_by_key(instance, command_cookie,
+                                              hashkey, nhashkey,
+                                              keys[0], nkey[0], delta[0],
+                                              exp, create, initial);
+    }
+
+    err = libcouchbase_multi_start(&multi, instance, command_cookie,
+                                   hashkey, nhashkey, num_keys, keys, nkey);
+    if (err != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, err);
+    }
+
+    for (ii = 0; ii < num_keys; ++ii) {
+        protocol_binary_request_incr req;
+        int vb = libcouchbase_multi_vbucket(&multi, ii);
+        libcouchbase_server_t *server = libcouchbase_multi_server(&multi, ii, 0);
+
+        memset(&req, 0, sizeof(req));
+        req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_INCREMENTQ;
+        req.message.header.request.keylen = ntohs((libcouchbase_uint16_t)nkey[ii]);
+        req.message.header.request.extlen = 20;
+        req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        req.message.header.request.vbucket = ntohs((libcouchbase_uint16_t)vb);
+        req.message.header.request.bodylen = ntohl((libcouchbase_uint32_t)(nkey[ii] + 20));
+        req.message.header.request.opaque = ++instance->seqno;
+        req.message.body.delta = ntohll((libcouchbase_uint64_t)(delta[ii]));
+        req.message.body.initial = ntohll(initial);
+        req.message.body.expiration = ntohl((libcouchbase_uint32_t)exp);
+
+        if (delta[ii] < 0) {
+            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_DECREMENTQ;
+            req.message.body.delta = ntohll((libcouchbase_uint64_t)(delta[ii] * -1));
+        }
+
+        if (!create) {
+            memset(&req.message.body.expiration, 0xff,
+                   sizeof(req.message.body.expiration));
+        }
+
+        libcouchbase_cache_invalidate(instance, vb, keys[ii], nkey[ii]);
+        libcouchbase_server_start_packet(server, command_cookie, req.bytes, sizeof(req.bytes));
+        libcouchbase_server_write_packet(server, keys[ii], nkey[ii]);
+        libcouchbase_server_end_packet(server);
+    }
+    libcouchbase_multi_end(&multi, 1);
+
+    return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LIBCOUCHBASE_ATOMICS_H
+#define LIBCOUCHBASE_ATOMICS_H 1
+
+/*
+ * The few atomic operations used by the parts of the library that may
+ * be called from other threads than the one running the event loop
+ * (see queue.c, sharded.c and configprovider.c).
+ */
+
+/** A counter modified with atomic_incr/atomic_decr */
+typedef volatile long atomic_counter_t;
+/** A lock taken with spin_lock (only for short and rare sections) */
+typedef volatile long spinlock_t;
+
+#ifdef _WIN32
+#define atomic_cas_ptr(ptr, oldval, newval) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)(ptr), \
+                                       (newval), (oldval)) == (oldval))
+#define atomic_incr(ptr) InterlockedIncrement(ptr)
+#define atomic_decr(ptr) InterlockedDecrement(ptr)
+#define memory_barrier() MemoryBarrier()
+#define spin_lock(ptr) while (InterlockedExchange((ptr), 1) != 0) { }
+#define spin_unlock(ptr) (void)InterlockedExchange((ptr), 0)
+#else
+#define atomic_cas_ptr(ptr, oldval, newval) \
+    __sync_bool_compare_and_swap((ptr), (oldval), (newval))
+#define atomic_incr(ptr) __sync_add_and_fetch((ptr), 1)
+#define atomic_decr(ptr) __sync_sub_and_fetch((ptr), 1)
+#define memory_barrier() __sync_synchronize()
+#define spin_lock(ptr) while (__sync_lock_test_and_set((ptr), 1) != 0) { }
+#define spin_unlock(ptr) __sync_lock_release(ptr)
+#endif
+
+#endif
@@ -27,3 +27,199 @@ libcouchbase_syncmode_t libcouchbase_behavior_get_syncmode(libcouchbase_t instan
 {
     return instance->syncmode;
 }
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_getk(libcouchbase_t instance, int enable)
+{
+    instance->getk = enable ? 1 : 0;
+}
+
+LIBCOUCHBASE_API
+int libcouchbase_behavior_get_getk(libcouchbase_t instance)
+{
+    return instance->getk;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_coalesce_gets(libcouchbase_t instance, int enable)
+{
+    instance->coalesce.enabled = enable ? 1 : 0;
+}
+
+LIBCOUCHBASE_API
+int libcouchbase_behavior_get_coalesce_gets(libcouchbase_t instance)
+{
+    return instance->coalesce.enabled;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_connections_per_node(libcouchbase_t instance,
+                                                    libcouchbase_size_t num)
+{
+    instance->connections_per_node = num ? num : 1;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_behavior_get_connections_per_node(libcouchbase_t instance)
+{
+    return instance->connections_per_node;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_large_value_threshold(libcouchbase_t instance,
+                                                     libcouchbase_size_t nbytes)
+{
+    instance->large_value_threshold = nbytes;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_behavior_get_large_value_threshold(libcouchbase_t instance)
+{
+    return instance->large_value_threshold;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_shared_config(libcouchbase_t instance,
+                                             int enable)
+{
+    instance->shared_config = enable;
+}
+
+LIBCOUCHBASE_API
+int libcouchbase_behavior_get_shared_config(libcouchbase_t instance)
+{
+    return instance->shared_config;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_buffer_pool_size(libcouchbase_t instance,
+                                                libcouchbase_size_t nbytes)
+{
+    if (instance->buffer_pool != libcouchbase_buffer_pool_get_shared()) {
+        libcouchbase_buffer_pool_set_max_bytes(instance->buffer_pool, nbytes);
+    }
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_behavior_get_buffer_pool_size(libcouchbase_t instance)
+{
+    return libcouchbase_buffer_pool_get_max_bytes(instance->buffer_pool);
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_shared_buffer_pool(libcouchbase_t instance,
+                                                  int enable)
+{
+    struct libcouchbase_buffer_pool_st *shared = libcouchbase_buffer_pool_get_shared();
+
+    if (instance->servers != NULL) {
+        /* The buffers of the servers belong to the current pool */
+        return;
+    }
+
+    if (enable && instance->buffer_pool != shared) {
+        libcouchbase_buffer_pool_destroy(instance->buffer_pool);
+        instance->buffer_pool = shared;
+    } else if (!enable && instance->buffer_pool == shared) {
+        struct libcouchbase_buffer_pool_st *pool;
+        pool = libcouchbase_buffer_pool_create(LIBCOUCHBASE_DEFAULT_BUFFER_POOL_SIZE);
+        if (pool != NULL) {
+            instance->buffer_pool = pool;
+        }
+    }
+}
+
+LIBCOUCHBASE_API
+int libcouchbase_behavior_get_shared_buffer_pool(libcouchbase_t instance)
+{
+    return instance->buffer_pool == libcouchbase_buffer_pool_get_shared();
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_memory_limit(libcouchbase_t instance,
+                                            libcouchbase_size_t nbytes)
+{
+    instance->memory_limit = nbytes;
+    libcouchbase_update_memory_limit(instance);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_behavior_get_memory_limit(libcouchbase_t instance)
+{
+    return instance->memory_limit;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_inflight_window(libcouchbase_t instance,
+                                               libcouchbase_size_t nops)
+{
+    libcouchbase_size_t ii;
+
+    instance->max_window = nops;
+    for (ii = 0; ii < instance->nconnections; ++ii) {
+        libcouchbase_server_t *server = instance->servers + ii;
+        libcouchbase_window_reset(server);
+        if (libcouchbase_window_release(server) > 0) {
+            libcouchbase_server_send_packets(server);
+        }
+    }
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_behavior_get_inflight_window(libcouchbase_t instance)
+{
+    return instance->max_window;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_retry_backoff(libcouchbase_t instance,
+                                             libcouchbase_uint32_t usec)
+{
+    instance->retry_backoff = usec;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_uint32_t libcouchbase_behavior_get_retry_backoff(libcouchbase_t instance)
+{
+    return instance->retry_backoff;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_breaker_threshold(libcouchbase_t instance,
+                                                 libcouchbase_size_t nfailures)
+{
+    instance->breaker_threshold = nfailures;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_behavior_get_breaker_threshold(libcouchbase_t instance)
+{
+    return instance->breaker_threshold;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_breaker_reset(libcouchbase_t instance,
+                                             libcouchbase_uint32_t usec)
+{
+    instance->breaker_reset = usec;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_uint32_t libcouchbase_behavior_get_breaker_reset(libcouchbase_t instance)
+{
+    return instance->breaker_reset;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_behavior_set_keepalive_interval(libcouchbase_t instance,
+                                                  libcouchbase_uint32_t usec)
+{
+    instance->keepalive_interval = usec;
+    libcouchbase_keepalive_update(instance);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_uint32_t libcouchbase_behavior_get_keepalive_interval(libcouchbase_t instance)
+{
+    return instance->keepalive_interval;
+}
@@ -0,0 +1,130 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the circuit breaker for the connections to the
+ * servers. When a connection fails (or commands time out on it)
+ * instance->breaker_threshold times in a row the breaker opens: the
+ * connection is closed, and the commands for it fail right away with
+ * LIBCOUCHBASE_ENODE_DOWN instead of waiting for the timeout.
+ *
+ * Once the breaker has been open for server->breaker_backoff usec, it
+ * is half open and the next command makes us connect again. The first
+ * response closes the breaker. If the connection fails again, the
+ * breaker opens for twice as long (up to LIBCOUCHBASE_MAX_BREAKER_BACKOFF),
+ * so a dead node isn't hammered with connection attempts.
+ */
+
+#include "internal.h"
+
+static void breaker_open(libcouchbase_server_t *server, hrtime_t now)
+{
+    server->breaker = LIBCOUCHBASE_BREAKER_OPEN;
+    server->breaker_opened = now;
+    server->breaker_failures = 0;
+    ++server->breaker_trips;
+}
+
+/**
+ * Close the breaker (and forget about the failures) when the server
+ * responds to a command
+ */
+void libcouchbase_breaker_success(libcouchbase_server_t *server)
+{
+    server->breaker_failures = 0;
+    if (server->breaker != LIBCOUCHBASE_BREAKER_CLOSED) {
+        server->breaker = LIBCOUCHBASE_BREAKER_CLOSED;
+        server->breaker_backoff = 0;
+    }
+}
+
+/**
+ * Count a failure for the connection (a network error, a failed
+ * connect or commands timing out)
+ *
+ * @param server the server that failed
+ * @param now the current time
+ */
+void libcouchbase_breaker_failure(libcouchbase_server_t *server, hrtime_t now)
+{
+    libcouchbase_t instance = server->instance;
+
+    if (instance->breaker_threshold == 0 ||
+            server->breaker == LIBCOUCHBASE_BREAKER_OPEN) {
+        return;
+    }
+
+    if (server->breaker == LIBCOUCHBASE_BREAKER_HALF_OPEN) {
+        /* The node is still down, wait longer before the next try */
+        server->breaker_backoff *= 2;
+        if (server->breaker_backoff > LIBCOUCHBASE_MAX_BREAKER_BACKOFF) {
+            server->breaker_backoff = LIBCOUCHBASE_MAX_BREAKER_BACKOFF;
+        }
+        breaker_open(server, now);
+    } else if (++server->breaker_failures >= instance->breaker_threshold) {
+        server->breaker_backoff = instance->breaker_reset;
+        breaker_open(server, now);
+    }
+}
+
+/**
+ * Check if we may connect to the server. This moves an open breaker
+ * to half open when it has been open long enough.
+ *
+ * @param server the server to connect to
+ * @return non-zero if we may try to connect
+ */
+int libcouchbase_breaker_allow(libcouchbase_server_t *server)
+{
+    hrtime_t backoff;
+
+    if (server->breaker != LIBCOUCHBASE_BREAKER_OPEN) {
+        return 1;
+    }
+
+    backoff = server->breaker_backoff;
+    backoff *= 1000;
+    if (gethrtime() < server->breaker_opened + backoff) {
+        return 0;
+    }
+    server->breaker = LIBCOUCHBASE_BREAKER_HALF_OPEN;
+    return 1;
+}
+
+/**
+ * Check if the breaker was opened while we still have a socket to
+ * the server. The caller should fail out the server to close it.
+ */
+int libcouchbase_breaker_tripped(libcouchbase_server_t *server)
+{
+    return server->breaker == LIBCOUCHBASE_BREAKER_OPEN &&
+           server->sock != INVALID_SOCKET;
+}
+
+/**
+ * Fail the commands queued for a server with an open breaker
+ *
+ * @param server the server to fail the commands for
+ */
+void libcouchbase_breaker_reject(libcouchbase_server_t *server)
+{
+    libcouchbase_size_t nbytes = ringbuffer_get_nbytes(&server->pending_cookies);
+
+    nbytes += ringbuffer_get_nbytes(&server->held_cookies);
+    server->breaker_rejected += nbytes / sizeof(struct libcouchbase_command_data_st);
+    libcouchbase_failout_server(server, LIBCOUCHBASE_ENODE_DOWN);
+}
@@ -0,0 +1,228 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the pool of the buffers used by the ringbuffers
+ * of the servers. The ringbuffers always grow to a power of two, so
+ * the released buffers are kept on a free list per size and handed
+ * out again instead of going through malloc. The buffers above the
+ * largest size class (large values) are allocated and released
+ * directly, so they don't stay around after the value is gone.
+ *
+ * Each instance has a pool of its own, but the instances may use the
+ * pool shared by the process instead (which is protected by a lock).
+ */
+
+#include "internal.h"
+
+#define POOL_MIN_SHIFT 7
+#define POOL_MAX_SHIFT 20
+#define POOL_NCLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/** The max number of bytes kept by the pool shared by the process */
+#define SHARED_POOL_MAX_BYTES (16 * 1024 * 1024)
+
+struct pooled_buffer_st {
+    struct pooled_buffer_st *next;
+};
+
+struct libcouchbase_buffer_pool_st {
+    /** The free buffers for each size class */
+    struct pooled_buffer_st *buffers[POOL_NCLASSES];
+    /** The number of bytes in the free buffers */
+    libcouchbase_size_t nbytes;
+    /** The max number of bytes to keep in the free buffers */
+    libcouchbase_size_t max_bytes;
+    /** The number of buffers we could (or couldn't) hand out */
+    libcouchbase_uint64_t hits;
+    libcouchbase_uint64_t misses;
+    /** Set for the pool shared by the process */
+    int shared;
+    spinlock_t lock;
+};
+
+static struct libcouchbase_buffer_pool_st shared_pool = {
+    { NULL }, 0, SHARED_POOL_MAX_BYTES, 0, 0, 1, 0
+};
+
+/**
+ * Get the size class for a buffer
+ * @return the index of the class or -1 if it isn't pooled
+ */
+static int size_class(libcouchbase_size_t size)
+{
+    int ii;
+    for (ii = 0; ii < POOL_NCLASSES; ++ii) {
+        if (size == ((libcouchbase_size_t)1 << (ii + POOL_MIN_SHIFT))) {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+struct libcouchbase_buffer_pool_st *libcouchbase_buffer_pool_create(libcouchbase_size_t max_bytes)
+{
+    struct libcouchbase_buffer_pool_st *pool = calloc(1, sizeof(*pool));
+    if (pool != NULL) {
+        pool->max_bytes = max_bytes;
+    }
+    return pool;
+}
+
+struct libcouchbase_buffer_pool_st *libcouchbase_buffer_pool_get_shared(void)
+{
+    return &shared_pool;
+}
+
+void libcouchbase_buffer_pool_set_max_bytes(struct libcouchbase_buffer_pool_st *pool,
+                                            libcouchbase_size_t max_bytes)
+{
+    pool->max_bytes = max_bytes;
+    libcouchbase_buffer_pool_trim(pool);
+}
+
+libcouchbase_size_t libcouchbase_buffer_pool_get_max_bytes(struct libcouchbase_buffer_pool_st *pool)
+{
+    return pool->max_bytes;
+}
+
+/**
+ * Release the free buffers until we're within the limit (starting
+ * with the biggest ones)
+ */
+static void pool_trim(struct libcouchbase_buffer_pool_st *pool,
+                      libcouchbase_size_t max_bytes)
+{
+    int ii = POOL_NCLASSES - 1;
+
+    while (pool->nbytes > max_bytes && ii >= 0) {
+        struct pooled_buffer_st *buffer = pool->buffers[ii];
+        if (buffer == NULL) {
+            --ii;
+            continue;
+        }
+        pool->buffers[ii] = buffer->next;
+        pool->nbytes -= (libcouchbase_size_t)1 << (ii + POOL_MIN_SHIFT);
+        free(buffer);
+    }
+}
+
+void libcouchbase_buffer_pool_trim(struct libcouchbase_buffer_pool_st *pool)
+{
+    if (pool->shared) {
+        spin_lock(&pool->lock);
+    }
+    pool_trim(pool, pool->max_bytes);
+    if (pool->shared) {
+        spin_unlock(&pool->lock);
+    }
+}
+
+libcouchbase_size_t libcouchbase_buffer_pool_purge(struct libcouchbase_buffer_pool_st *pool)
+{
+    libcouchbase_size_t nbytes;
+
+    if (pool->shared) {
+        /* The other instances may still need them */
+        return 0;
+    }
+    nbytes = pool->nbytes;
+    pool_trim(pool, 0);
+    return nbytes;
+}
+
+void libcouchbase_buffer_pool_destroy(struct libcouchbase_buffer_pool_st *pool)
+{
+    if (pool == NULL || pool->shared) {
+        return;
+    }
+    pool_trim(pool, 0);
+    free(pool);
+}
+
+void *libcouchbase_buffer_pool_alloc(struct libcouchbase_buffer_pool_st *pool,
+                                     libcouchbase_size_t size)
+{
+    struct pooled_buffer_st *buffer = NULL;
+    int idx = size_class(size);
+
+    if (idx == -1) {
+        return malloc(size);
+    }
+
+    if (pool->shared) {
+        spin_lock(&pool->lock);
+    }
+    if ((buffer = pool->buffers[idx]) != NULL) {
+        pool->buffers[idx] = buffer->next;
+        pool->nbytes -= size;
+        ++pool->hits;
+    } else {
+        ++pool->misses;
+    }
+    if (pool->shared) {
+        spin_unlock(&pool->lock);
+    }
+
+    if (buffer == NULL) {
+        return malloc(size);
+    }
+    return buffer;
+}
+
+void libcouchbase_buffer_pool_release(struct libcouchbase_buffer_pool_st *pool,
+                                      void *ptr,
+                                      libcouchbase_size_t size)
+{
+    struct pooled_buffer_st *buffer = ptr;
+    int idx = size_class(size);
+
+    if (buffer == NULL) {
+        return;
+    }
+
+    if (idx != -1) {
+        if (pool->shared) {
+            spin_lock(&pool->lock);
+        }
+        if (pool->nbytes + size <= pool->max_bytes) {
+            buffer->next = pool->buffers[idx];
+            pool->buffers[idx] = buffer;
+            pool->nbytes += size;
+            buffer = NULL;
+        }
+        if (pool->shared) {
+            spin_unlock(&pool->lock);
+        }
+    }
+    free(buffer);
+}
+
+libcouchbase_size_t libcouchbase_buffer_pool_nbytes(struct libcouchbase_buffer_pool_st *pool)
+{
+    return pool->nbytes;
+}
+
+libcouchbase_uint64_t libcouchbase_buffer_pool_hits(struct libcouchbase_buffer_pool_st *pool)
+{
+    return pool->hits;
+}
+
+libcouchbase_uint64_t libcouchbase_buffer_pool_misses(struct libcouchbase_buffer_pool_st *pool)
+{
+    return pool->misses;
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LIBCOUCHBASE_BUFPOOL_H
+#define LIBCOUCHBASE_BUFPOOL_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * A pool of the buffers used by the ringbuffers (see bufpool.c).
+     * The buffers are kept per power-of-two size, so buffers of other
+     * sizes (or bigger than the biggest size kept) are allocated and
+     * released with malloc and free.
+     */
+    struct libcouchbase_buffer_pool_st;
+
+    struct libcouchbase_buffer_pool_st *libcouchbase_buffer_pool_create(libcouchbase_size_t max_bytes);
+    struct libcouchbase_buffer_pool_st *libcouchbase_buffer_pool_get_shared(void);
+    void libcouchbase_buffer_pool_destroy(struct libcouchbase_buffer_pool_st *pool);
+    void libcouchbase_buffer_pool_set_max_bytes(struct libcouchbase_buffer_pool_st *pool,
+                                                libcouchbase_size_t max_bytes);
+    libcouchbase_size_t libcouchbase_buffer_pool_get_max_bytes(struct libcouchbase_buffer_pool_st *pool);
+    void libcouchbase_buffer_pool_trim(struct libcouchbase_buffer_pool_st *pool);
+    libcouchbase_size_t libcouchbase_buffer_pool_purge(struct libcouchbase_buffer_pool_st *pool);
+    void *libcouchbase_buffer_pool_alloc(struct libcouchbase_buffer_pool_st *pool,
+                                         libcouchbase_size_t size);
+    void libcouchbase_buffer_pool_release(struct libcouchbase_buffer_pool_st *pool,
+                                          void *ptr,
+                                          libcouchbase_size_t size);
+    libcouchbase_size_t libcouchbase_buffer_pool_nbytes(struct libcouchbase_buffer_pool_st *pool);
+    libcouchbase_uint64_t libcouchbase_buffer_pool_hits(struct libcouchbase_buffer_pool_st *pool);
+    libcouchbase_uint64_t libcouchbase_buffer_pool_misses(struct libcouchbase_buffer_pool_st *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
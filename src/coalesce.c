@@ -0,0 +1,190 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the coalescing of get requests. When enabled, a
+ * get for a key which already has a get in flight (for the same
+ * vbucket) isn't sent to the server. Instead the cookie is added to
+ * the command already in flight, and the response is passed to all
+ * of the cookies waiting for it.
+ */
+
+#include "internal.h"
+
+struct libcouchbase_coalesce_st {
+    /** The cookies waiting for the response */
+    const void **cookies;
+    libcouchbase_size_t ncookies;
+    libcouchbase_size_t size;
+    /** The vbucket id followed by the key (used as the hash key) */
+    char *key;
+    libcouchbase_size_t nkey;
+};
+
+static void coalesce_destroy(struct libcouchbase_coalesce_st *entry)
+{
+    free(entry->cookies);
+    free(entry);
+}
+
+static void coalesce_get_callback(libcouchbase_t instance,
+                                  const void *cookie,
+                                  libcouchbase_error_t error,
+                                  const void *key,
+                                  libcouchbase_size_t nkey,
+                                  const void *bytes,
+                                  libcouchbase_size_t nbytes,
+                                  libcouchbase_uint32_t flags,
+                                  libcouchbase_cas_t cas)
+{
+    struct libcouchbase_coalesce_st *entry = (void *)cookie;
+    libcouchbase_size_t ii;
+
+    /*
+     * Remove the entry before calling the user so that a new get for
+     * the same key from the callback is sent to the server
+     */
+    (void)hashtable_remove(instance->coalesce.inflight, entry->key,
+                           entry->nkey);
+    for (ii = 0; ii < entry->ncookies; ++ii) {
+        instance->callbacks.get(instance, entry->cookies[ii], error,
+                                key, nkey, bytes, nbytes, flags, cas);
+    }
+    coalesce_destroy(entry);
+}
+
+static int coalesce_join(struct libcouchbase_coalesce_st *entry,
+                         const void *command_cookie)
+{
+    if (entry->ncookies == entry->size) {
+        libcouchbase_size_t size = entry->size * 2;
+        const void **cookies = realloc(entry->cookies,
+                                       size * sizeof(*cookies));
+        if (cookies == NULL) {
+            return 0;
+        }
+        entry->cookies = cookies;
+        entry->size = size;
+    }
+    entry->cookies[entry->ncookies++] = command_cookie;
+    return 1;
+}
+
+static struct libcouchbase_coalesce_st *coalesce_create(int vb,
+                                                        const void *key,
+                                                        libcouchbase_size_t nkey)
+{
+    libcouchbase_uint16_t vbid = (libcouchbase_uint16_t)vb;
+    struct libcouchbase_coalesce_st *entry;
+
+    entry = calloc(1, sizeof(*entry) + sizeof(vbid) + nkey);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->size = 4;
+    entry->cookies = malloc(entry->size * sizeof(*entry->cookies));
+    if (entry->cookies == NULL) {
+        free(entry);
+        return NULL;
+    }
+    entry->key = (char *)(entry + 1);
+    memcpy(entry->key, &vbid, sizeof(vbid));
+    memcpy(entry->key + sizeof(vbid), key, nkey);
+    entry->nkey = sizeof(vbid) + nkey;
+    return entry;
+}
+
+/**
+ * Try to coalesce a get request with one already in flight.
+ *
+ * @param instance the instance
+ * @param vb the vbucket the key belongs to
+ * @param command_cookie the cookie for the get
+ * @param key the key to get
+ * @param nkey the number of bytes in the key
+ * @param ct where to store the command data to use if the get has to be
+ *           sent to the server
+ * @return non-zero if the request was attached to a get in flight (and
+ *         must not be sent), zero otherwise
+ */
+int libcouchbase_coalesce_get(libcouchbase_t instance, int vb,
+                              const void *command_cookie,
+                              const void *key, libcouchbase_size_t nkey,
+                              struct libcouchbase_command_data_st *ct)
+{
+    struct libcouchbase_coalesce_st *entry = NULL;
+    libcouchbase_uint16_t vbid = (libcouchbase_uint16_t)vb;
+    char buffer[256 + sizeof(vbid)];
+
+    ct->start = gethrtime();
+    ct->cookie = command_cookie;
+    ct->callback.get = NULL;
+    ct->retries = 0;
+
+    if (instance->coalesce.inflight == NULL) {
+        instance->coalesce.inflight = hashtable_create();
+        if (instance->coalesce.inflight == NULL) {
+            return 0;
+        }
+    }
+
+    if (nkey < sizeof(buffer) - sizeof(vbid)) {
+        memcpy(buffer, &vbid, sizeof(vbid));
+        memcpy(buffer + sizeof(vbid), key, nkey);
+        entry = hashtable_find(instance->coalesce.inflight, buffer,
+                               sizeof(vbid) + nkey);
+    }
+
+    if (entry != NULL) {
+        if (coalesce_join(entry, command_cookie)) {
+            ++instance->stats.get_coalesced;
+            return 1;
+        }
+        /* We couldn't attach to it, so just send the get */
+        return 0;
+    }
+
+    entry = coalesce_create(vb, key, nkey);
+    if (entry == NULL) {
+        return 0;
+    }
+    if (hashtable_add(instance->coalesce.inflight, entry->key, entry->nkey,
+                      entry) != 1) {
+        coalesce_destroy(entry);
+        return 0;
+    }
+
+    entry->cookies[entry->ncookies++] = command_cookie;
+    ct->cookie = entry;
+    ct->callback.get = coalesce_get_callback;
+    return 0;
+}
+
+static void release_entry(void *value, void *arg)
+{
+    (void)arg;
+    coalesce_destroy(value);
+}
+
+void libcouchbase_coalesce_destroy_all(libcouchbase_t instance)
+{
+    if (instance->coalesce.inflight != NULL) {
+        hashtable_foreach(instance->coalesce.inflight, release_entry, NULL);
+        hashtable_destroy(instance->coalesce.inflight);
+        instance->coalesce.inflight = NULL;
+    }
+}
@@ -101,7 +101,13 @@ extern "C" {
 
 #ifndef HAVE_GETHRTIME
 typedef uint64_t hrtime_t;
-extern hrtime_t gethrtime(void);
+#ifdef __cplusplus
+extern "C" {
+#endif
+    extern hrtime_t gethrtime(void);
+#ifdef __cplusplus
+}
+#endif
 #endif
 
 #endif /* LIBCOUCHBASE_CONFIG_STATIC_H */
@@ -0,0 +1,295 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the config provider shared by the instances in
+ * the process connecting to the same bucket (see
+ * libcouchbase_behavior_set_shared_config). Only one of them (the
+ * owner) opens the streaming connection to the cluster, and every
+ * config it applies is passed on to the other instances through
+ * their submission queues (see queue.c). When the owner is destroyed
+ * one of the other instances takes over the stream.
+ *
+ * The providers are looked up and modified by the threads connecting
+ * and destroying instances, and by the owners when the config change,
+ * so all of that happens with the (process wide) lock held.
+ */
+
+#include "internal.h"
+
+struct libcouchbase_config_provider_st {
+    /** The first bootstrap node and the http request (bucket and user) */
+    char *key;
+    /** The instance running the config stream */
+    libcouchbase_t owner;
+    /** All of the instances using the provider (including the owner) */
+    libcouchbase_t *subscribers;
+    libcouchbase_size_t nsubscribers;
+    libcouchbase_size_t size;
+    /** The last config applied by the owner */
+    struct libcouchbase_config_snapshot_st *current;
+    struct libcouchbase_config_provider_st *next;
+};
+
+static spinlock_t providers_lock;
+static struct libcouchbase_config_provider_st *providers;
+
+struct libcouchbase_config_snapshot_st *libcouchbase_config_snapshot_create(const char *json,
+                                                                           libcouchbase_size_t njson)
+{
+    struct libcouchbase_config_snapshot_st *snapshot;
+
+    snapshot = malloc(sizeof(*snapshot) + njson + 1);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->refcount = 1;
+    snapshot->json = (char *)(snapshot + 1);
+    memcpy(snapshot->json, json, njson);
+    snapshot->json[njson] = '\0';
+    snapshot->njson = njson;
+    return snapshot;
+}
+
+void libcouchbase_config_snapshot_ref(struct libcouchbase_config_snapshot_st *snapshot)
+{
+    atomic_incr(&snapshot->refcount);
+}
+
+void libcouchbase_config_snapshot_unref(struct libcouchbase_config_snapshot_st *snapshot)
+{
+    if (atomic_decr(&snapshot->refcount) == 0) {
+        free(snapshot);
+    }
+}
+
+static char *provider_key(libcouchbase_t instance)
+{
+    const char *node = instance->backup_nodes[0];
+    libcouchbase_size_t nnode = strlen(node);
+    libcouchbase_size_t nuri = strlen(instance->http_uri);
+    char *key = malloc(nnode + nuri + 2);
+
+    if (key != NULL) {
+        memcpy(key, node, nnode);
+        key[nnode] = '|';
+        memcpy(key + nnode + 1, instance->http_uri, nuri + 1);
+    }
+    return key;
+}
+
+static struct libcouchbase_config_provider_st *provider_create(libcouchbase_t instance)
+{
+    struct libcouchbase_config_provider_st *provider;
+
+    if ((provider = calloc(1, sizeof(*provider))) == NULL) {
+        return NULL;
+    }
+    if ((provider->key = provider_key(instance)) == NULL) {
+        free(provider);
+        return NULL;
+    }
+    provider->owner = instance;
+    return provider;
+}
+
+static void provider_destroy(struct libcouchbase_config_provider_st *provider)
+{
+    struct libcouchbase_config_provider_st **ptr = &providers;
+
+    while (*ptr != provider) {
+        ptr = &(*ptr)->next;
+    }
+    *ptr = provider->next;
+
+    if (provider->current != NULL) {
+        libcouchbase_config_snapshot_unref(provider->current);
+    }
+    free(provider->subscribers);
+    free(provider->key);
+    free(provider);
+}
+
+static int provider_add(struct libcouchbase_config_provider_st *provider,
+                        libcouchbase_t instance)
+{
+    if (provider->nsubscribers == provider->size) {
+        libcouchbase_size_t size = provider->size ? provider->size * 2 : 8;
+        libcouchbase_t *subscribers;
+
+        subscribers = realloc(provider->subscribers,
+                              size * sizeof(libcouchbase_t));
+        if (subscribers == NULL) {
+            return 0;
+        }
+        provider->subscribers = subscribers;
+        provider->size = size;
+    }
+    provider->subscribers[provider->nsubscribers++] = instance;
+    return 1;
+}
+
+/**
+ * Start using the provider for the cluster and bucket used by the
+ * instance (and create it if we're the first).
+ *
+ * @param instance the instance to subscribe
+ * @param owner set to 1 if the instance should open the config stream
+ * @return LIBCOUCHBASE_SUCCESS if the instance is subscribed
+ */
+libcouchbase_error_t libcouchbase_config_provider_subscribe(libcouchbase_t instance,
+                                                            int *owner)
+{
+    struct libcouchbase_config_provider_st *provider;
+    libcouchbase_error_t err = LIBCOUCHBASE_SUCCESS;
+    char *key;
+
+    /* The other instances reach us through the queue */
+    if (instance->queue == NULL) {
+        err = libcouchbase_enable_submission_queue(instance);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            return err;
+        }
+    }
+
+    if ((key = provider_key(instance)) == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+
+    spin_lock(&providers_lock);
+    for (provider = providers; provider != NULL; provider = provider->next) {
+        if (strcmp(provider->key, key) == 0) {
+            break;
+        }
+    }
+
+    if (provider == NULL) {
+        if ((provider = provider_create(instance)) == NULL) {
+            err = LIBCOUCHBASE_ENOMEM;
+        } else if (!provider_add(provider, instance)) {
+            free(provider->key);
+            free(provider);
+            err = LIBCOUCHBASE_ENOMEM;
+        } else {
+            provider->next = providers;
+            providers = provider;
+        }
+    } else if (!provider_add(provider, instance)) {
+        err = LIBCOUCHBASE_ENOMEM;
+    } else if (provider->current != NULL) {
+        err = libcouchbase_queue_config(instance, provider->current);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            --provider->nsubscribers;
+        }
+    }
+
+    if (err == LIBCOUCHBASE_SUCCESS) {
+        instance->config_provider = provider;
+        *owner = (provider->owner == instance);
+    }
+    spin_unlock(&providers_lock);
+    free(key);
+
+    return err;
+}
+
+/**
+ * Stop using the provider. If the instance is the owner one of the
+ * other instances is told to open the config stream.
+ */
+void libcouchbase_config_provider_unsubscribe(libcouchbase_t instance)
+{
+    struct libcouchbase_config_provider_st *provider = instance->config_provider;
+    libcouchbase_size_t ii;
+
+    if (provider == NULL) {
+        return;
+    }
+
+    spin_lock(&providers_lock);
+    for (ii = 0; ii < provider->nsubscribers; ++ii) {
+        if (provider->subscribers[ii] == instance) {
+            provider->subscribers[ii] = provider->subscribers[--provider->nsubscribers];
+            break;
+        }
+    }
+
+    if (provider->owner == instance) {
+        provider->owner = NULL;
+        for (ii = 0; ii < provider->nsubscribers; ++ii) {
+            if (libcouchbase_queue_connect(provider->subscribers[ii]) == LIBCOUCHBASE_SUCCESS) {
+                provider->owner = provider->subscribers[ii];
+                break;
+            }
+        }
+    }
+
+    if (provider->nsubscribers == 0) {
+        provider_destroy(provider);
+    }
+    spin_unlock(&providers_lock);
+    instance->config_provider = NULL;
+}
+
+/**
+ * Called by the instances every time they apply a new config. If the
+ * instance is the owner the config is passed on to all of the other
+ * instances.
+ */
+void libcouchbase_config_provider_publish(libcouchbase_t instance,
+                                          const char *json)
+{
+    struct libcouchbase_config_provider_st *provider = instance->config_provider;
+    struct libcouchbase_config_snapshot_st *snapshot;
+    libcouchbase_size_t ii;
+    libcouchbase_size_t failed = 0;
+
+    spin_lock(&providers_lock);
+    if (provider->owner != instance) {
+        /* We got it from the provider */
+        spin_unlock(&providers_lock);
+        return;
+    }
+
+    snapshot = libcouchbase_config_snapshot_create(json, strlen(json));
+    if (snapshot == NULL) {
+        spin_unlock(&providers_lock);
+        libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM,
+                                   "Failed to allocate memory for config");
+        return;
+    }
+
+    if (provider->current != NULL) {
+        libcouchbase_config_snapshot_unref(provider->current);
+    }
+    provider->current = snapshot;
+
+    for (ii = 0; ii < provider->nsubscribers; ++ii) {
+        libcouchbase_t subscriber = provider->subscribers[ii];
+        if (subscriber != instance &&
+                libcouchbase_queue_config(subscriber, snapshot) != LIBCOUCHBASE_SUCCESS) {
+            ++failed;
+        }
+    }
+    spin_unlock(&providers_lock);
+
+    /* Don't call out to the user with the lock held */
+    if (failed != 0) {
+        libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM,
+                                   "Failed to pass the config to an instance");
+    }
+}
@@ -34,7 +34,7 @@ void libcouchbase_couch_request_destroy(libcouchbase_couch_request_t req)
     if (req) {
         if (req->io) {
             if (req->event) {
-                req->io->destroy_event(req->io, req->event);
+                libcouchbase_destroy_event(req->instance, req->event);
             }
             if (req->sock != INVALID_SOCKET) {
                 req->io->close(req->io, req->sock);
@@ -241,9 +241,9 @@ static void request_event_handler(libcouchbase_socket_t sock, short which, void
     if (which & LIBCOUCHBASE_READ_EVENT) {
         rv =  request_do_read(req);
         if (rv > 0) {
-            instance->io->update_event(instance->io, req->sock,
-                                       req->event, LIBCOUCHBASE_READ_EVENT,
-                                       req, request_event_handler);
+            libcouchbase_update_event(instance, req->sock,
+                                      req->event, LIBCOUCHBASE_READ_EVENT,
+                                      req, request_event_handler);
         } else if (rv < 0) {
             req->on_complete(req, instance,
                              req->command_cookie,
@@ -265,13 +265,13 @@ static void request_event_handler(libcouchbase_socket_t sock, short which, void
             return;
         }
         if (req->output.nbytes == 0) {
-            instance->io->update_event(instance->io, req->sock,
-                                       req->event, LIBCOUCHBASE_READ_EVENT,
-                                       req, request_event_handler);
+            libcouchbase_update_event(instance, req->sock,
+                                      req->event, LIBCOUCHBASE_READ_EVENT,
+                                      req, request_event_handler);
         } else {
-            instance->io->update_event(instance->io, req->sock,
-                                       req->event, LIBCOUCHBASE_WRITE_EVENT,
-                                       req, request_event_handler);
+            libcouchbase_update_event(instance, req->sock,
+                                      req->event, LIBCOUCHBASE_WRITE_EVENT,
+                                      req, request_event_handler);
         }
     }
     if (instance->wait && hashset_num_items(server->couch_requests) == 0) {
@@ -294,9 +294,9 @@ static void request_connect_handler(libcouchbase_socket_t sock, short which, voi
 
 static void request_connected(libcouchbase_couch_request_t req)
 {
-    req->io->update_event(req->io, req->sock,
-                          req->event, LIBCOUCHBASE_WRITE_EVENT,
-                          req, request_event_handler);
+    libcouchbase_update_event(req->instance, req->sock,
+                              req->event, LIBCOUCHBASE_WRITE_EVENT,
+                              req, request_event_handler);
 }
 
 static libcouchbase_error_t request_connect(libcouchbase_couch_request_t req)
@@ -337,12 +337,12 @@ static libcouchbase_error_t request_connect(libcouchbase_couch_request_t req)
                 request_connected(req);
                 return LIBCOUCHBASE_SUCCESS;
             case LIBCOUCHBASE_CONNECT_EINPROGRESS: /*first call to connect*/
-                req->io->update_event(req->io,
-                                      req->sock,
-                                      req->event,
-                                      LIBCOUCHBASE_WRITE_EVENT,
-                                      req,
-                                      request_connect_handler);
+                libcouchbase_update_event(req->instance,
+                                          req->sock,
+                                          req->event,
+                                          LIBCOUCHBASE_WRITE_EVENT,
+                                          req,
+                                          request_connect_handler);
                 return LIBCOUCHBASE_SUCCESS;
             case LIBCOUCHBASE_CONNECT_EALREADY: /* Subsequent calls to connect */
                 return LIBCOUCHBASE_SUCCESS;
@@ -351,7 +351,7 @@ static libcouchbase_error_t request_connect(libcouchbase_couch_request_t req)
                 if (req->curr_ai->ai_next) {
                     retry = 1;
                     req->curr_ai = req->curr_ai->ai_next;
-                    req->io->delete_event(req->io, req->sock, req->event);
+                    libcouchbase_delete_event(req->instance, req->sock, req->event);
                     req->io->close(req->io, req->sock);
                     req->sock = INVALID_SOCKET;
                     break;
@@ -394,6 +394,11 @@ libcouchbase_couch_request_t libcouchbase_make_couch_request(libcouchbase_t inst
         *error = libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
         return NULL;
     }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        *error = libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+        return NULL;
+    }
     /* pick random server */
     nn = (libcouchbase_size_t)(gethrtime() >> 10) % instance->nservers;
     server = instance->servers + nn;
@@ -418,6 +423,9 @@ libcouchbase_couch_request_t libcouchbase_make_couch_request(libcouchbase_t inst
     req->on_complete = instance->callbacks.couch_complete;
     req->on_data = instance->callbacks.couch_data;
     req->chunked = chunked;
+    req->output.allocated = &instance->buffer_bytes;
+    req->input.allocated = &instance->buffer_bytes;
+    req->result.allocated = &instance->buffer_bytes;
 
 #define BUFF_APPEND(dst, src, len)                                                      \
         if (len != ringbuffer_write(dst, src, len)) {                                   \
@@ -63,6 +63,7 @@ libcouchbase_error_t libcouchbase_error_handler(libcouchbase_t instance, libcouc
     /* TODO: Should we call the callback anyway, even if it's a SUCCESS? */
     if (error != LIBCOUCHBASE_SUCCESS) {
         /* Call the user's error callback. */
+        instance->sync_retcode = error;
         instance->callbacks.error(instance, error, errinfo);
     }
 
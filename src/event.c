@@ -126,6 +126,7 @@ static int parse_single(libcouchbase_server_t *c, hrtime_t stop)
         break;
     case PROTOCOL_BINARY_RES: {
         int was_connected = c->connected;
+        libcouchbase_uint16_t status = ntohs(header.response.status);
         if (libcouchbase_server_purge_implicit_responses(c,
                                                          header.response.opaque, stop) != 0) {
             if (packet != c->input.read_head) {
@@ -140,51 +141,44 @@ static int parse_single(libcouchbase_server_t *c, hrtime_t stop)
             libcouchbase_record_metrics(c->instance, stop - ct.start,
                                         header.response.opcode);
         }
-
-        if (ntohs(header.response.status) != PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET) {
+        libcouchbase_breaker_success(c);
+        c->last_response = stop;
+
+        if ((status == PROTOCOL_BINARY_RESPONSE_ETMPFAIL ||
+                status == PROTOCOL_BINARY_RESPONSE_ENOMEM) &&
+                libcouchbase_retry_command(c, &ct, stop)) {
+            /* The command is sent again later (see retry.c) */
+            libcouchbase_window_ack(c, &ct, header.response.opaque,
+                                    status, stop);
+        } else if (status == PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET &&
+                   header.response.opcode != CMD_GET_REPLICA &&
+                   libcouchbase_retry_not_my_vbucket(c, &ct, stop)) {
+            /*
+             * The command is moved to the new master (or waits for the
+             * new configuration). The library will retry the command until
+             * its time will out and the client will get
+             * LIBCOUCHBASE_ETIMEDOUT error in command callback
+             */
+            libcouchbase_window_ack(c, &ct, header.response.opaque,
+                                    status, stop);
+        } else {
+            /*
+             * A replica read is sent to a specific node, so there is no
+             * point in moving it to the master. Let the caller handle it.
+             */
             c->instance->response_handler[header.response.opcode](c,
                                                                   ct.cookie,
                                                                   (void *)packet);
             /* keep command and cookie until we get complete STAT response */
             if (was_connected &&
                     (header.response.opcode != PROTOCOL_BINARY_CMD_STAT || header.response.keylen == 0)) {
+                libcouchbase_window_ack(c, &ct, header.response.opaque,
+                                        status, stop);
                 nr = ringbuffer_read(&c->cmd_log, req.bytes, sizeof(req));
                 assert(nr == sizeof(req));
                 ringbuffer_consumed(&c->cmd_log, ntohl(req.request.bodylen));
                 ringbuffer_consumed(&c->output_cookies, sizeof(ct));
             }
-        } else {
-            int idx;
-            char *body;
-            libcouchbase_size_t nbody;
-            libcouchbase_server_t *new_srv;
-            /* re-schedule command to new server */
-            nr = ringbuffer_read(&c->cmd_log, req.bytes, sizeof(req));
-            assert(nr == sizeof(req));
-            idx = vbucket_found_incorrect_master(c->instance->vbucket_config,
-                                                 ntohs(req.request.vbucket),
-                                                 (int)c->index);
-            assert((libcouchbase_size_t)idx < c->instance->nservers);
-            new_srv = c->instance->servers + idx;
-            req.request.opaque = ++c->instance->seqno;
-            nbody = ntohl(req.request.bodylen);
-            body = malloc(nbody);
-            if (body == NULL) {
-                libcouchbase_error_handler(c->instance, LIBCOUCHBASE_ENOMEM, NULL);
-                return -1;
-            }
-            nr = ringbuffer_read(&c->cmd_log, body, nbody);
-            assert(nr == nbody);
-            nr = ringbuffer_read(&c->output_cookies, &ct, sizeof(ct));
-            assert(nr == sizeof(ct));
-            /* Preserve the cookie and timestamp for the command. This means
-             * that the library will retry the command until its time will
-             * out and the client will get LIBCOUCHBASE_ETIMEDOUT error in
-             * command callback */
-            libcouchbase_server_retry_packet(new_srv, &ct, &req, sizeof(req));
-            libcouchbase_server_write_packet(new_srv, body, nbody);
-            libcouchbase_server_end_packet(new_srv);
-            free(body);
         }
         break;
     }
@@ -274,7 +268,7 @@ LIBCOUCHBASE_API
 void libcouchbase_flush_buffers(libcouchbase_t instance, const void *cookie)
 {
     libcouchbase_size_t ii;
-    for (ii = 0; ii < instance->nservers; ++ii) {
+    for (ii = 0; ii < instance->nconnections; ++ii) {
         libcouchbase_server_t *c = instance->servers + ii;
         if (c->connected) {
             libcouchbase_server_event_handler(c->sock,
@@ -299,6 +293,11 @@ void libcouchbase_server_event_handler(libcouchbase_socket_t sock, short which,
         }
     }
 
+    if (c->held_cookies.nbytes > 0) {
+        /* The responses may have made room in the window */
+        libcouchbase_window_release(c);
+    }
+
     if (which & LIBCOUCHBASE_WRITE_EVENT) {
         if (c->connected) {
             hrtime_t now = gethrtime();
@@ -310,6 +309,10 @@ void libcouchbase_server_event_handler(libcouchbase_socket_t sock, short which,
                                                  &c->output_cookies,
                                                  tmo, now,
                                                  LIBCOUCHBASE_ETIMEDOUT);
+                if (libcouchbase_breaker_tripped(c)) {
+                    libcouchbase_failout_server(c, LIBCOUCHBASE_ENODE_DOWN);
+                    return;
+                }
             }
         }
 
@@ -322,13 +325,31 @@ void libcouchbase_server_event_handler(libcouchbase_socket_t sock, short which,
     }
 
     if (c->output.nbytes == 0) {
-        c->instance->io->update_event(c->instance->io, c->sock,
-                                      c->event, LIBCOUCHBASE_READ_EVENT,
-                                      c, libcouchbase_server_event_handler);
+        libcouchbase_update_event(c->instance, c->sock,
+                                  c->event, LIBCOUCHBASE_READ_EVENT,
+                                  c, libcouchbase_server_event_handler);
     } else {
-        c->instance->io->update_event(c->instance->io, c->sock,
-                                      c->event, LIBCOUCHBASE_RW_EVENT,
-                                      c, libcouchbase_server_event_handler);
+        libcouchbase_update_event(c->instance, c->sock,
+                                  c->event, LIBCOUCHBASE_RW_EVENT,
+                                  c, libcouchbase_server_event_handler);
+    }
+
+    libcouchbase_server_shrink_buffers(c);
+    libcouchbase_update_memory_limit(c->instance);
+
+    if (c->instance->mget_streams != NULL) {
+        libcouchbase_mget_stream_refill(c->instance);
+    }
+
+    if (c->instance->config_refresh_pending) {
+        /* We got NOT_MY_VBUCKET (see retry.c) */
+        c->instance->config_refresh_pending = 0;
+        libcouchbase_refresh_config(c->instance);
+    }
+
+    if (c->instance->get_batches != NULL) {
+        /* Pass on the results we got in this round */
+        libcouchbase_get_batch_flush(c->instance);
     }
 
     libcouchbase_maybe_breakout(c->instance);
@@ -339,16 +360,24 @@ void libcouchbase_server_event_handler(libcouchbase_socket_t sock, short which,
 
 int libcouchbase_has_data_in_buffers(libcouchbase_t instance)
 {
-    libcouchbase_size_t ii;
-
-    for (ii = 0; ii < instance->nservers; ++ii) {
-        libcouchbase_server_t *c = instance->servers + ii;
-        if (c->cmd_log.nbytes || c->output.nbytes || c->input.nbytes ||
-                c->pending.nbytes) {
-            return 1;
-        }
+    if (instance->near_cache != NULL &&
+            libcouchbase_near_cache_has_hits(instance)) {
+        return 1;
     }
-    return 0;
+    if (instance->negative_cache != NULL &&
+            libcouchbase_negative_cache_has_hits(instance)) {
+        return 1;
+    }
+    if (instance->queue != NULL &&
+            libcouchbase_submission_queue_has_ops(instance)) {
+        return 1;
+    }
+    if (instance->retries != NULL) {
+        return 1;
+    }
+
+    /* Maintained by the server buffers (see libcouchbase_server_initialize) */
+    return instance->queued_bytes != 0;
 }
 
 void libcouchbase_maybe_breakout(libcouchbase_t instance)
@@ -36,6 +36,8 @@ libcouchbase_error_t libcouchbase_flush(libcouchbase_t instance,
     flush.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
     flush.message.header.request.opaque = ++instance->seqno;
 
+    libcouchbase_cache_invalidate_all(instance);
+
     for (ii = 0; ii < instance->nservers; ++ii) {
         server = instance->servers + ii;
         libcouchbase_server_complete_packet(server, command_cookie,
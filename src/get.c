@@ -24,7 +24,8 @@ static libcouchbase_error_t libcouchbase_single_get(libcouchbase_t instance,
                                                     const void *key,
                                                     const libcouchbase_size_t nkey,
                                                     const libcouchbase_time_t *exp,
-                                                    int lock);
+                                                    int lock,
+                                                    libcouchbase_get_callback callback);
 
 /**
  * libcouchbase_mget use the GETQ command followed by a NOOP command to avoid
@@ -46,11 +47,6 @@ libcouchbase_error_t libcouchbase_mget(libcouchbase_t instance,
                                     keys, nkey, exp);
 }
 
-struct server_info_st {
-    int vb;
-    int idx;
-};
-
 LIBCOUCHBASE_API
 libcouchbase_error_t libcouchbase_mget_by_key(libcouchbase_t instance,
                                               const void *command_cookie,
@@ -61,56 +57,48 @@ libcouchbase_error_t libcouchbase_mget_by_key(libcouchbase_t instance,
                                               const libcouchbase_size_t *nkey,
                                               const libcouchbase_time_t *exp)
 {
-    libcouchbase_server_t *server = NULL;
-    protocol_binary_request_noop noop;
-    libcouchbase_size_t ii, *affected_servers = NULL;
-    int vb, idx;
-    struct server_info_st *servers = NULL;
+    struct libcouchbase_multi_st multi;
+    libcouchbase_error_t err;
+    libcouchbase_size_t ii;
+    struct libcouchbase_get_batch_st *batch = NULL;
 
     /* we need a vbucket config before we can start getting data.. */
     if (instance->vbucket_config == NULL) {
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
     }
 
-    if (num_keys == 1) {
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    if (num_keys == 1 && instance->callbacks.get_batch == NULL) {
         return libcouchbase_single_get(instance, command_cookie, hashkey,
-                                       nhashkey, keys[0], nkey[0], exp, 0);
+                                       nhashkey, keys[0], nkey[0], exp, 0,
+                                       NULL);
     }
 
-    affected_servers = calloc(instance->nservers, sizeof(libcouchbase_size_t));
-    if (affected_servers == NULL) {
-        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ENOMEM);
+    err = libcouchbase_multi_start(&multi, instance, command_cookie,
+                                   hashkey, nhashkey, num_keys, keys, nkey);
+    if (err != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, err);
     }
-    if (nhashkey != 0) {
-        (void)vbucket_map(instance->vbucket_config, hashkey, nhashkey, &vb, &idx);
-        if (idx < 0 || idx > (int)instance->nservers) {
-            /* the config says that there is no server yet at that position (-1) */
-            return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
-        }
-        server = instance->servers + idx;
-        affected_servers[idx]++;
-    } else {
-        servers = malloc(num_keys * sizeof(struct server_info_st));
-        if (servers == NULL) {
+
+    if (instance->callbacks.get_batch != NULL && num_keys > 0) {
+        /* The results are delivered in batches (see getbatch.c) */
+        batch = libcouchbase_get_batch_create(instance, command_cookie);
+        if (batch == NULL) {
+            libcouchbase_multi_end(&multi, 0);
             return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ENOMEM);
         }
-        for (ii = 0; ii < num_keys; ++ii) {
-            (void)vbucket_map(instance->vbucket_config, keys[ii], nkey[ii], &servers[ii].vb, &servers[ii].idx);
-            if (servers[ii].idx < 0 || servers[ii].idx > (int)instance->nservers) {
-                /* the config says that there is no server yet at that position (-1) */
-                free(servers);
-                return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
-            }
-            affected_servers[servers[ii].idx]++;
-        }
     }
 
     for (ii = 0; ii < num_keys; ++ii) {
         protocol_binary_request_gat req;
-        if (nhashkey == 0) {
-            server = instance->servers + servers[ii].idx;
-            vb = servers[ii].vb;
-        }
+        struct libcouchbase_command_data_st ct;
+        libcouchbase_server_t *server;
+        libcouchbase_size_t headersize = sizeof(req.bytes);
+        int vb = libcouchbase_multi_vbucket(&multi, ii);
+        int coalesced = 0;
 
         memset(&req, 0, sizeof(req));
         req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -118,48 +106,85 @@ libcouchbase_error_t libcouchbase_mget_by_key(libcouchbase_t instance,
         req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
         req.message.header.request.vbucket = ntohs((libcouchbase_uint16_t)vb);
         req.message.header.request.bodylen = ntohl((libcouchbase_uint32_t)(nkey[ii]));
-        req.message.header.request.opaque = ++instance->seqno;
 
         if (!exp) {
-            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GETQ;
-            libcouchbase_server_start_packet(server, command_cookie, req.bytes,
-                                             sizeof(req.bytes) - 4);
+            if (instance->getk) {
+                req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GETKQ;
+            } else {
+                req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GETQ;
+            }
+            headersize -= 4;
+            if (batch == NULL) {
+                if (instance->near_cache != NULL &&
+                        libcouchbase_near_cache_get(instance, vb, command_cookie,
+                                                    keys[ii], nkey[ii])) {
+                    /* The value is passed to the callback from the cache */
+                    continue;
+                }
+                if (instance->negative_cache != NULL &&
+                        libcouchbase_negative_cache_get(instance, vb, command_cookie,
+                                                        keys[ii], nkey[ii])) {
+                    /* We know that the key doesn't exist */
+                    continue;
+                }
+                if (instance->coalesce.enabled) {
+                    if (libcouchbase_coalesce_get(instance, vb, command_cookie,
+                                                  keys[ii], nkey[ii], &ct)) {
+                        /* The response to the get in flight is used */
+                        continue;
+                    }
+                    coalesced = 1;
+                }
+            }
         } else {
             req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GATQ;
             req.message.header.request.extlen = 4;
             req.message.body.expiration = ntohl((libcouchbase_uint32_t)exp[ii]);
             req.message.header.request.bodylen = ntohl((libcouchbase_uint32_t)(nkey[ii]) + 4);
+        }
+        req.message.header.request.opaque = ++instance->seqno;
+
+        server = libcouchbase_multi_server(&multi, ii, 0);
+        if (batch != NULL) {
+            libcouchbase_get_batch_add(batch, &ct);
+            libcouchbase_server_retry_packet(server, &ct, req.bytes, headersize);
+        } else if (coalesced) {
+            libcouchbase_server_retry_packet(server, &ct, req.bytes, headersize);
+        } else {
             libcouchbase_server_start_packet(server, command_cookie, req.bytes,
-                                             sizeof(req.bytes));
+                                             headersize);
         }
         libcouchbase_server_write_packet(server, keys[ii], nkey[ii]);
         libcouchbase_server_end_packet(server);
     }
-    free(servers);
-
-    memset(&noop, 0, sizeof(noop));
-    noop.message.header.request.magic = PROTOCOL_BINARY_REQ;
-    noop.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
-    noop.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
-
-    /*
-     ** We don't know which server we sent the data to, so examine
-     ** where to send the noop
-     */
-    for (ii = 0; ii < instance->nservers; ++ii) {
-        if (affected_servers[ii]) {
-            server = instance->servers + ii;
-            noop.message.header.request.opaque = ++instance->seqno;
-            libcouchbase_server_complete_packet(server, command_cookie,
-                                                noop.bytes, sizeof(noop.bytes));
-            libcouchbase_server_send_packets(server);
-        }
-    }
-    free(affected_servers);
+    libcouchbase_multi_end(&multi, 1);
 
     return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
 }
 
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_get_with_callback(libcouchbase_t instance,
+                                                    const void *command_cookie,
+                                                    libcouchbase_get_callback callback,
+                                                    const void *hashkey,
+                                                    libcouchbase_size_t nhashkey,
+                                                    const void *key,
+                                                    libcouchbase_size_t nkey,
+                                                    const libcouchbase_time_t *exp)
+{
+    /* we need a vbucket config before we can start getting data.. */
+    if (instance->vbucket_config == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
+    }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    return libcouchbase_single_get(instance, command_cookie, hashkey,
+                                   nhashkey, key, nkey, exp, 0, callback);
+}
+
 LIBCOUCHBASE_API
 libcouchbase_error_t libcouchbase_getl_by_key(libcouchbase_t instance,
                                               const void *command_cookie,
@@ -174,8 +199,12 @@ libcouchbase_error_t libcouchbase_getl_by_key(libcouchbase_t instance,
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
     }
 
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
     return libcouchbase_single_get(instance, command_cookie, hashkey,
-                                   nhashkey, key, nkey, exp, 1);
+                                   nhashkey, key, nkey, exp, 1, NULL);
 
 }
 
@@ -213,7 +242,7 @@ libcouchbase_error_t libcouchbase_unlock_by_key(libcouchbase_t instance,
         /* the config says that there is no server yet at that position (-1) */
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
     }
-    server = instance->servers + idx;
+    server = libcouchbase_get_server(instance, idx, vb, 0);
 
     memset(&req, 0, sizeof(req));
     req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -251,7 +280,8 @@ static libcouchbase_error_t libcouchbase_single_get(libcouchbase_t instance,
                                                     const void *key,
                                                     const libcouchbase_size_t nkey,
                                                     const libcouchbase_time_t *exp,
-                                                    int lock)
+                                                    int lock,
+                                                    libcouchbase_get_callback callback)
 {
     libcouchbase_server_t *server;
     protocol_binary_request_gat req;
@@ -267,7 +297,7 @@ static libcouchbase_error_t libcouchbase_single_get(libcouchbase_t instance,
         /* the config says that there is no server yet at that position (-1) */
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
     }
-    server = instance->servers + idx;
+    server = libcouchbase_get_server(instance, idx, vb, 0);
 
     memset(&req, 0, sizeof(req));
     req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -278,7 +308,11 @@ static libcouchbase_error_t libcouchbase_single_get(libcouchbase_t instance,
     req.message.header.request.opaque = ++instance->seqno;
 
     if (!exp) {
-        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+        if (instance->getk) {
+            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GETK;
+        } else {
+            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+        }
         nbytes = sizeof(req.bytes) - 4;
     } else {
         req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GAT;
@@ -290,6 +324,44 @@ static libcouchbase_error_t libcouchbase_single_get(libcouchbase_t instance,
     if (lock) {
         /* the expiration is optional for GETL command */
         req.message.header.request.opcode = CMD_GET_LOCKED;
+    } else if (callback != NULL) {
+        /*
+         * The caches and the coalescing deliver the result through the
+         * get callback for the instance, so we have to send the command
+         */
+        struct libcouchbase_command_data_st ct;
+        ct.start = gethrtime();
+        ct.cookie = command_cookie;
+        ct.callback.get = callback;
+        ct.retries = 0;
+        /* Use the retry function so that we may pass our own command data */
+        libcouchbase_server_retry_packet(server, &ct, req.bytes, nbytes);
+        libcouchbase_server_write_packet(server, key, nkey);
+        libcouchbase_server_end_packet(server);
+        libcouchbase_server_send_packets(server);
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+    } else if (!exp && instance->near_cache != NULL &&
+               libcouchbase_near_cache_get(instance, vb, command_cookie,
+                                           key, nkey)) {
+        /* The value is passed to the callback from the cache */
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+    } else if (!exp && instance->negative_cache != NULL &&
+               libcouchbase_negative_cache_get(instance, vb, command_cookie,
+                                               key, nkey)) {
+        /* We know that the key doesn't exist */
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+    } else if (!exp && instance->coalesce.enabled) {
+        struct libcouchbase_command_data_st ct;
+        if (libcouchbase_coalesce_get(instance, vb, command_cookie,
+                                      key, nkey, &ct)) {
+            /* The response to the get in flight is used */
+            return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+        }
+        libcouchbase_server_retry_packet(server, &ct, req.bytes, nbytes);
+        libcouchbase_server_write_packet(server, key, nkey);
+        libcouchbase_server_end_packet(server);
+        libcouchbase_server_send_packets(server);
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
     }
     libcouchbase_server_start_packet(server, command_cookie, req.bytes, nbytes);
     libcouchbase_server_write_packet(server, key, nkey);
@@ -0,0 +1,189 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the batched delivery of multi-get results. Instead
+ * of calling the get callback for each key, the results are collected
+ * and passed to the get batch callback as one array. This happens when
+ * the last result for the multi-get arrives, and at the end of each
+ * iteration of the event loop for the results collected so far.
+ *
+ * The keys and values are copied into one buffer per batch. We can't
+ * point into the input buffer, because it may be reallocated (or
+ * overwritten) by the next read before the batch is delivered.
+ */
+
+#include "internal.h"
+
+struct libcouchbase_get_batch_st {
+    libcouchbase_t instance;
+    /** The cookie passed to the batch callback */
+    const void *cookie;
+    /**
+     * The batch callback when the multi-get was issued (the user may
+     * turn the batches off before all of the results arrive)
+     */
+    libcouchbase_get_batch_callback callback;
+    /** The number of results we're still waiting for */
+    libcouchbase_size_t outstanding;
+    /** The results not delivered yet (libcouchbase_get_result_t) */
+    buffer_t results;
+    /** The keys and values for the results (in the same order) */
+    buffer_t data;
+
+    struct libcouchbase_get_batch_st *prev;
+    struct libcouchbase_get_batch_st *next;
+};
+
+static void batch_destroy(struct libcouchbase_get_batch_st *batch)
+{
+    libcouchbase_t instance = batch->instance;
+
+    if (batch->prev != NULL) {
+        batch->prev->next = batch->next;
+    } else {
+        instance->get_batches = batch->next;
+    }
+    if (batch->next != NULL) {
+        batch->next->prev = batch->prev;
+    }
+
+    free(batch->results.data);
+    free(batch->data.data);
+    free(batch);
+}
+
+static void batch_deliver(struct libcouchbase_get_batch_st *batch)
+{
+    libcouchbase_get_result_t *results = (void *)batch->results.data;
+    libcouchbase_size_t nresults = batch->results.avail / sizeof(*results);
+    libcouchbase_size_t ii;
+    const char *ptr = batch->data.data;
+
+    if (nresults == 0) {
+        return;
+    }
+
+    /* The buffer may have moved while we added to it */
+    for (ii = 0; ii < nresults; ++ii) {
+        results[ii].key = ptr;
+        ptr += results[ii].nkey;
+        results[ii].bytes = results[ii].nbytes ? ptr : NULL;
+        ptr += results[ii].nbytes;
+    }
+
+    batch->results.avail = 0;
+    batch->data.avail = 0;
+    batch->callback(batch->instance, batch->cookie, results, nresults);
+}
+
+static void batch_get_callback(libcouchbase_t instance,
+                               const void *cookie,
+                               libcouchbase_error_t error,
+                               const void *key,
+                               libcouchbase_size_t nkey,
+                               const void *bytes,
+                               libcouchbase_size_t nbytes,
+                               libcouchbase_uint32_t flags,
+                               libcouchbase_cas_t cas)
+{
+    struct libcouchbase_get_batch_st *batch = (void *)cookie;
+    libcouchbase_get_result_t result;
+
+    result.error = error;
+    result.key = key;
+    result.nkey = nkey;
+    result.bytes = bytes;
+    result.nbytes = nbytes;
+    result.flags = flags;
+    result.cas = cas;
+
+    if (grow_buffer(&batch->results, sizeof(result)) &&
+            grow_buffer(&batch->data, nkey + nbytes)) {
+        memcpy(batch->results.data + batch->results.avail, &result,
+               sizeof(result));
+        batch->results.avail += sizeof(result);
+        memcpy(batch->data.data + batch->data.avail, key, nkey);
+        batch->data.avail += nkey;
+        if (nbytes > 0) {
+            memcpy(batch->data.data + batch->data.avail, bytes, nbytes);
+            batch->data.avail += nbytes;
+        }
+    } else {
+        /* We can't keep it, so pass it on with what we have so far */
+        batch_deliver(batch);
+        batch->callback(instance, batch->cookie, &result, 1);
+    }
+
+    if (--batch->outstanding == 0) {
+        batch_deliver(batch);
+        batch_destroy(batch);
+    }
+}
+
+struct libcouchbase_get_batch_st *libcouchbase_get_batch_create(libcouchbase_t instance,
+                                                                const void *command_cookie)
+{
+    struct libcouchbase_get_batch_st *batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->instance = instance;
+    batch->cookie = command_cookie;
+    batch->callback = instance->callbacks.get_batch;
+
+    batch->next = instance->get_batches;
+    if (batch->next != NULL) {
+        batch->next->prev = batch;
+    }
+    instance->get_batches = batch;
+    return batch;
+}
+
+/**
+ * Initialize the command data for a get belonging to the batch
+ */
+void libcouchbase_get_batch_add(struct libcouchbase_get_batch_st *batch,
+                                struct libcouchbase_command_data_st *ct)
+{
+    ct->start = gethrtime();
+    ct->cookie = batch;
+    ct->callback.get = batch_get_callback;
+    ct->retries = 0;
+    ++batch->outstanding;
+}
+
+/**
+ * Pass the results collected so far to the user. Called at the end of
+ * each iteration of the event loop.
+ */
+void libcouchbase_get_batch_flush(libcouchbase_t instance)
+{
+    struct libcouchbase_get_batch_st *batch = instance->get_batches;
+    while (batch != NULL) {
+        struct libcouchbase_get_batch_st *next = batch->next;
+        batch_deliver(batch);
+        batch = next;
+    }
+}
+
+void libcouchbase_get_batch_destroy_all(libcouchbase_t instance)
+{
+    while (instance->get_batches != NULL) {
+        batch_destroy(instance->get_batches);
+    }
+}
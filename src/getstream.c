@@ -0,0 +1,421 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the streaming multi-get. Instead of encoding all
+ * of the get commands up front (like libcouchbase_mget does), we keep
+ * at most "window" commands queued for each server and add a new one
+ * every time a command completes. The memory used is therefore bounded
+ * by the window size and not by the number of keys.
+ *
+ * A key for a server with a full window is set aside (one per server)
+ * and we move on to the next key, so a slow server doesn't stop the
+ * keys for the other servers. The stream only waits when a second key
+ * is waiting for the same server.
+ */
+
+#include "internal.h"
+
+struct stream_held_st {
+    const void *key;
+    libcouchbase_size_t nkey;
+    /**
+     * The copy of a key from the producer (which may release it once
+     * it's called again), reused for the next key set aside
+     */
+    char *copy;
+    libcouchbase_size_t ncopy;
+    int used;
+};
+
+struct libcouchbase_mget_stream_st {
+    libcouchbase_t instance;
+    /** The cookie passed to the get callback */
+    const void *cookie;
+    /** The max number of commands queued for a server */
+    libcouchbase_size_t window;
+
+    /** The keys to get (if the caller provided an array) */
+    const void *const *keys;
+    const libcouchbase_size_t *nkey;
+    libcouchbase_size_t num_keys;
+    libcouchbase_size_t next;
+
+    /** The callback producing the keys (if no array was provided) */
+    libcouchbase_key_producer_callback producer;
+
+    /**
+     * The keys set aside because the window for their server was full
+     * (indexed by the server, nslots of them)
+     */
+    struct stream_held_st *held;
+    libcouchbase_size_t nslots;
+    /** The number of keys set aside */
+    libcouchbase_size_t nheld;
+
+    /**
+     * A key we couldn't even set aside (its server has one already).
+     * It has to be sent before we may fetch the next key, so the
+     * pointer stays valid (the key producer may not release the key
+     * before it's called again, and the arrays outlive the stream).
+     */
+    const void *pending;
+    libcouchbase_size_t npending;
+    int has_pending;
+
+    /** The number of commands sent but not completed */
+    libcouchbase_size_t total;
+    /** Set when there is no more keys */
+    int exhausted;
+
+    struct libcouchbase_mget_stream_st *next_stream;
+};
+
+/**
+ * The number of commands queued for a server. This includes commands
+ * not belonging to the stream, and commands waiting for the connection
+ * to be established or for room in the window.
+ */
+static libcouchbase_size_t queue_depth(libcouchbase_server_t *server)
+{
+    libcouchbase_size_t nbytes = ringbuffer_get_nbytes(&server->output_cookies);
+    nbytes += ringbuffer_get_nbytes(&server->pending_cookies);
+    nbytes += ringbuffer_get_nbytes(&server->held_cookies);
+    return nbytes / sizeof(struct libcouchbase_command_data_st);
+}
+
+static int next_key(struct libcouchbase_mget_stream_st *stream,
+                    const void **key, libcouchbase_size_t *nkey)
+{
+    if (stream->has_pending) {
+        *key = stream->pending;
+        *nkey = stream->npending;
+        return 1;
+    }
+
+    if (stream->exhausted) {
+        return 0;
+    }
+
+    if (stream->producer != NULL) {
+        if (stream->producer(stream->instance, stream->cookie, key, nkey)) {
+            return 1;
+        }
+    } else if (stream->next < stream->num_keys) {
+        *key = stream->keys[stream->next];
+        *nkey = stream->nkey[stream->next];
+        ++stream->next;
+        return 1;
+    }
+
+    stream->exhausted = 1;
+    return 0;
+}
+
+/**
+ * Set the key aside until there is room in the window of its server
+ *
+ * @return non-zero if the key was set aside, 0 if there already is a
+ *         key waiting for the server (or we're out of memory)
+ */
+static int hold_key(struct libcouchbase_mget_stream_st *stream, int idx,
+                    const void *key, libcouchbase_size_t nkey)
+{
+    struct stream_held_st *slot;
+
+    if ((libcouchbase_size_t)idx >= stream->nslots) {
+        /* The cluster grew since we started */
+        libcouchbase_size_t nslots = stream->instance->nservers;
+        void *ptr = realloc(stream->held, nslots * sizeof(*slot));
+        if (ptr == NULL) {
+            return 0;
+        }
+        stream->held = ptr;
+        memset(stream->held + stream->nslots, 0,
+               (nslots - stream->nslots) * sizeof(*slot));
+        stream->nslots = nslots;
+    }
+
+    slot = stream->held + idx;
+    if (slot->used) {
+        return 0;
+    }
+
+    if (stream->producer != NULL) {
+        if (slot->ncopy < nkey) {
+            char *copy = realloc(slot->copy, nkey);
+            if (copy == NULL) {
+                return 0;
+            }
+            slot->copy = copy;
+            slot->ncopy = nkey;
+        }
+        memcpy(slot->copy, key, nkey);
+        key = slot->copy;
+    }
+    slot->key = key;
+    slot->nkey = nkey;
+    slot->used = 1;
+    ++stream->nheld;
+    return 1;
+}
+
+static void stream_get_callback(libcouchbase_t instance,
+                                const void *cookie,
+                                libcouchbase_error_t error,
+                                const void *key,
+                                libcouchbase_size_t nkey,
+                                const void *bytes,
+                                libcouchbase_size_t nbytes,
+                                libcouchbase_uint32_t flags,
+                                libcouchbase_cas_t cas)
+{
+    struct libcouchbase_mget_stream_st *stream = (void *)cookie;
+
+    /*
+     * We can't add new commands from here (we might be called while
+     * the library walks the command log), so the refill happens when
+     * we're back in the event handler.
+     */
+    --stream->total;
+    instance->callbacks.get(instance, stream->cookie, error, key, nkey,
+                            bytes, nbytes, flags, cas);
+}
+
+static void send_get(struct libcouchbase_mget_stream_st *stream,
+                     libcouchbase_server_t *server, int vb,
+                     const void *key, libcouchbase_size_t nkey)
+{
+    libcouchbase_t instance = stream->instance;
+    protocol_binary_request_get req;
+    struct libcouchbase_command_data_st ct;
+
+    memset(&req, 0, sizeof(req));
+    req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    if (instance->getk) {
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GETK;
+    } else {
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+    }
+    req.message.header.request.keylen = ntohs((libcouchbase_uint16_t)nkey);
+    req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    req.message.header.request.vbucket = ntohs((libcouchbase_uint16_t)vb);
+    req.message.header.request.bodylen = ntohl((libcouchbase_uint32_t)nkey);
+    req.message.header.request.opaque = ++instance->seqno;
+
+    ct.start = gethrtime();
+    ct.cookie = stream;
+    ct.callback.get = stream_get_callback;
+    ct.retries = 0;
+
+    /* Use the retry function so that we may pass our own command data */
+    libcouchbase_server_retry_packet(server, &ct, req.bytes, sizeof(req.bytes));
+    libcouchbase_server_write_packet(server, key, nkey);
+    libcouchbase_server_end_packet(server);
+    ++stream->total;
+    libcouchbase_server_send_packets(server);
+}
+
+/**
+ * Send a key unless the window for its server is full
+ *
+ * @param idx where to store the index of the server
+ * @return non-zero if the key was sent (or failed), 0 if it has to wait
+ */
+static int try_send(struct libcouchbase_mget_stream_st *stream,
+                    const void *key, libcouchbase_size_t nkey, int *idx)
+{
+    libcouchbase_t instance = stream->instance;
+    libcouchbase_server_t *server;
+    int vb;
+
+    (void)vbucket_map(instance->vbucket_config, key, nkey, &vb, idx);
+    if (*idx < 0 || *idx >= (int)instance->nservers) {
+        /* the config says that there is no server yet at that position (-1) */
+        instance->callbacks.get(instance, stream->cookie,
+                                LIBCOUCHBASE_NETWORK_ERROR, key, nkey,
+                                NULL, 0, 0, 0);
+        return 1;
+    }
+
+    server = libcouchbase_get_server(instance, *idx, vb, 0);
+    if (queue_depth(server) >= stream->window) {
+        return 0;
+    }
+    send_get(stream, server, vb, key, nkey);
+    return 1;
+}
+
+static void stream_refill(struct libcouchbase_mget_stream_st *stream)
+{
+    const void *key;
+    libcouchbase_size_t nkey;
+    libcouchbase_size_t ii;
+    int idx;
+
+    /* The keys set aside go first */
+    for (ii = 0; ii < stream->nslots && stream->nheld > 0; ++ii) {
+        struct stream_held_st *slot = stream->held + ii;
+        if (slot->used && try_send(stream, slot->key, slot->nkey, &idx)) {
+            slot->used = 0;
+            --stream->nheld;
+        }
+    }
+
+    while (next_key(stream, &key, &nkey)) {
+        if (try_send(stream, key, nkey, &idx) ||
+                hold_key(stream, idx, key, nkey)) {
+            stream->has_pending = 0;
+            continue;
+        }
+
+        /* Wait for some of the commands to this server to complete */
+        stream->pending = key;
+        stream->npending = nkey;
+        stream->has_pending = 1;
+        return;
+    }
+}
+
+static void stream_destroy(struct libcouchbase_mget_stream_st *stream)
+{
+    libcouchbase_size_t ii;
+
+    for (ii = 0; ii < stream->nslots; ++ii) {
+        free(stream->held[ii].copy);
+    }
+    free(stream->held);
+    free(stream);
+}
+
+/**
+ * Add more commands to all of the active streams, and release the
+ * streams where all of the commands completed.
+ */
+void libcouchbase_mget_stream_refill(libcouchbase_t instance)
+{
+    struct libcouchbase_mget_stream_st **ptr;
+
+    if (instance->mget_streams_refilling) {
+        /* Sending a command may fail out the server and get us here */
+        return;
+    }
+
+    instance->mget_streams_refilling = 1;
+    ptr = &instance->mget_streams;
+    while (*ptr != NULL) {
+        struct libcouchbase_mget_stream_st *stream = *ptr;
+
+        if (instance->vbucket_config != NULL) {
+            stream_refill(stream);
+        }
+
+        if (stream->exhausted && !stream->has_pending &&
+                stream->nheld == 0 && stream->total == 0) {
+            *ptr = stream->next_stream;
+            stream_destroy(stream);
+        } else {
+            ptr = &stream->next_stream;
+        }
+    }
+    instance->mget_streams_refilling = 0;
+}
+
+void libcouchbase_mget_stream_destroy_all(libcouchbase_t instance)
+{
+    struct libcouchbase_mget_stream_st *stream = instance->mget_streams;
+    while (stream != NULL) {
+        struct libcouchbase_mget_stream_st *next = stream->next_stream;
+        stream_destroy(stream);
+        stream = next;
+    }
+    instance->mget_streams = NULL;
+}
+
+static libcouchbase_error_t stream_start(libcouchbase_t instance,
+                                         const void *command_cookie,
+                                         libcouchbase_size_t window,
+                                         libcouchbase_size_t num_keys,
+                                         const void *const *keys,
+                                         const libcouchbase_size_t *nkey,
+                                         libcouchbase_key_producer_callback producer)
+{
+    struct libcouchbase_mget_stream_st *stream;
+
+    /* we need a vbucket config before we can start getting data.. */
+    if (instance->vbucket_config == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
+    }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    if (window == 0) {
+        return libcouchbase_synchandler_return(instance,
+                                               libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                                                          "The window must be at least one command"));
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (stream != NULL) {
+        stream->nslots = instance->nservers;
+        stream->held = calloc(stream->nslots, sizeof(*stream->held));
+        if (stream->held == NULL) {
+            free(stream);
+            stream = NULL;
+        }
+    }
+    if (stream == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ENOMEM);
+    }
+    stream->instance = instance;
+    stream->cookie = command_cookie;
+    stream->window = window;
+    stream->num_keys = num_keys;
+    stream->keys = keys;
+    stream->nkey = nkey;
+    stream->producer = producer;
+
+    stream->next_stream = instance->mget_streams;
+    instance->mget_streams = stream;
+    libcouchbase_mget_stream_refill(instance);
+
+    return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mget_stream(libcouchbase_t instance,
+                                              const void *command_cookie,
+                                              libcouchbase_size_t window,
+                                              libcouchbase_size_t num_keys,
+                                              const void *const *keys,
+                                              const libcouchbase_size_t *nkey)
+{
+    return stream_start(instance, command_cookie, window,
+                        num_keys, keys, nkey, NULL);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mget_stream_producer(libcouchbase_t instance,
+                                                       const void *command_cookie,
+                                                       libcouchbase_size_t window,
+                                                       libcouchbase_key_producer_callback producer)
+{
+    return stream_start(instance, command_cookie, window, 0, NULL, NULL,
+                        producer);
+}
@@ -152,7 +152,7 @@ int libcouchbase_lookup_server_with_command(libcouchbase_t instance,
     libcouchbase_server_t *server;
     libcouchbase_size_t nr, ii;
 
-    for (ii = 0; ii < instance->nservers; ++ii) {
+    for (ii = 0; ii < instance->nconnections; ++ii) {
         server = instance->servers + ii;
         nr = ringbuffer_peek(&server->cmd_log, cmd.bytes, sizeof(cmd));
         if (nr == sizeof(cmd) &&
@@ -175,6 +175,110 @@ static void release_key(libcouchbase_server_t *server, char *packet)
     (void)server;
 }
 
+/**
+ * Get the command data for the command we're currently processing a
+ * response for. It is still the first entry in the cookie buffer while
+ * the response handler is running.
+ *
+ * @param server the server owning the command
+ * @param ct where to store the command data
+ */
+static void get_command_data(libcouchbase_server_t *server,
+                             struct libcouchbase_command_data_st *ct)
+{
+    libcouchbase_size_t nr = ringbuffer_peek(&server->output_cookies, ct,
+                                             sizeof(*ct));
+    assert(nr == sizeof(*ct));
+    (void)nr;
+}
+
+/**
+ * Pass the result of a get command to the user. The command may carry
+ * its own callback (see libcouchbase_command_data_st), otherwise the get
+ * callback registered for the instance is used.
+ */
+void libcouchbase_get_response(libcouchbase_t instance,
+                               const struct libcouchbase_command_data_st *ct,
+                               libcouchbase_error_t error,
+                               const void *key,
+                               libcouchbase_size_t nkey,
+                               const void *bytes,
+                               libcouchbase_size_t nbytes,
+                               libcouchbase_uint32_t flags,
+                               libcouchbase_cas_t cas)
+{
+    instance->sync_retcode = error;
+    if (ct->callback.get != NULL) {
+        ct->callback.get(instance, ct->cookie, error, key, nkey,
+                         bytes, nbytes, flags, cas);
+    } else {
+        instance->callbacks.get(instance, ct->cookie, error, key, nkey,
+                                bytes, nbytes, flags, cas);
+    }
+}
+
+/**
+ * Pass the result of a storage command to the user
+ * (see libcouchbase_get_response)
+ */
+void libcouchbase_storage_response(libcouchbase_t instance,
+                                   const struct libcouchbase_command_data_st *ct,
+                                   libcouchbase_storage_t operation,
+                                   libcouchbase_error_t error,
+                                   const void *key,
+                                   libcouchbase_size_t nkey,
+                                   libcouchbase_cas_t cas)
+{
+    instance->sync_retcode = error;
+    if (ct->callback.storage != NULL) {
+        ct->callback.storage(instance, ct->cookie, operation, error,
+                             key, nkey, cas);
+    } else {
+        instance->callbacks.storage(instance, ct->cookie, operation, error,
+                                    key, nkey, cas);
+    }
+}
+
+/**
+ * Pass the result of an arithmetic command to the user
+ * (see libcouchbase_get_response)
+ */
+void libcouchbase_arithmetic_response(libcouchbase_t instance,
+                                      const struct libcouchbase_command_data_st *ct,
+                                      libcouchbase_error_t error,
+                                      const void *key,
+                                      libcouchbase_size_t nkey,
+                                      libcouchbase_uint64_t value,
+                                      libcouchbase_cas_t cas)
+{
+    instance->sync_retcode = error;
+    if (ct->callback.arithmetic != NULL) {
+        ct->callback.arithmetic(instance, ct->cookie, error, key, nkey,
+                                value, cas);
+    } else {
+        instance->callbacks.arithmetic(instance, ct->cookie, error, key, nkey,
+                                       value, cas);
+    }
+}
+
+/**
+ * Pass the result of a remove command to the user
+ * (see libcouchbase_get_response)
+ */
+void libcouchbase_remove_response(libcouchbase_t instance,
+                                  const struct libcouchbase_command_data_st *ct,
+                                  libcouchbase_error_t error,
+                                  const void *key,
+                                  libcouchbase_size_t nkey)
+{
+    instance->sync_retcode = error;
+    if (ct->callback.remove != NULL) {
+        ct->callback.remove(instance, ct->cookie, error, key, nkey);
+    } else {
+        instance->callbacks.remove(instance, ct->cookie, error, key, nkey);
+    }
+}
+
 static void getq_response_handler(libcouchbase_server_t *server,
                                   const void *command_cookie,
                                   protocol_binary_response_header *res)
@@ -186,26 +290,86 @@ static void getq_response_handler(libcouchbase_server_t *server,
     char *packet;
     libcouchbase_uint16_t nkey;
     const char *key = get_key(server, &nkey, &packet);
+    struct libcouchbase_command_data_st ct;
 
+    (void)command_cookie;
     nbytes -= res->response.extlen;
     if (key == NULL) {
         libcouchbase_error_handler(server->instance, LIBCOUCHBASE_EINTERNAL,
                                    NULL);
         return;
-    } else if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+    }
+
+    get_command_data(server, &ct);
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
         const char *bytes = (const char *)res;
         bytes += sizeof(getq->bytes);
-        root->callbacks.get(root, command_cookie, LIBCOUCHBASE_SUCCESS,
-                            key, nkey, bytes, nbytes,
-                            ntohl(getq->message.body.flags),
-                            res->response.cas);
+        if (root->near_cache != NULL) {
+            libcouchbase_near_cache_store(server, key, nkey, bytes, nbytes,
+                                          ntohl(getq->message.body.flags),
+                                          res->response.cas);
+        }
+        libcouchbase_get_response(root, &ct, LIBCOUCHBASE_SUCCESS,
+                                  key, nkey, bytes, nbytes,
+                                  ntohl(getq->message.body.flags),
+                                  res->response.cas);
     } else {
-        root->callbacks.get(root, command_cookie, map_error(status), key, nkey,
-                            NULL, 0, 0, 0);
+        if (status == PROTOCOL_BINARY_RESPONSE_KEY_ENOENT &&
+                root->negative_cache != NULL) {
+            libcouchbase_negative_cache_store(server, key, nkey);
+        }
+        libcouchbase_get_response(root, &ct, map_error(status), key, nkey,
+                                  NULL, 0, 0, 0);
     }
     release_key(server, packet);
 }
 
+/**
+ * The GETK/GETKQ responses carries the key, so we may use the key
+ * directly from the packet instead of looking it up in the command log.
+ * Some servers don't return the key for a miss, so we'll fall back to
+ * the command log for them.
+ */
+static void getk_response_handler(libcouchbase_server_t *server,
+                                  const void *command_cookie,
+                                  protocol_binary_response_header *res)
+{
+    libcouchbase_t root = server->instance;
+    protocol_binary_response_getq *getq = (void *)res;
+    libcouchbase_uint16_t status = ntohs(res->response.status);
+    libcouchbase_uint16_t nkey = ntohs(res->response.keylen);
+    libcouchbase_size_t nbytes = ntohl(res->response.bodylen);
+    const char *key = (const char *)res;
+    struct libcouchbase_command_data_st ct;
+
+    if (nkey == 0) {
+        getq_response_handler(server, command_cookie, res);
+        return;
+    }
+
+    get_command_data(server, &ct);
+    key += sizeof(res->bytes) + res->response.extlen;
+    nbytes -= res->response.extlen + nkey;
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        if (root->near_cache != NULL) {
+            libcouchbase_near_cache_store(server, key, nkey, key + nkey, nbytes,
+                                          ntohl(getq->message.body.flags),
+                                          res->response.cas);
+        }
+        libcouchbase_get_response(root, &ct, LIBCOUCHBASE_SUCCESS,
+                                  key, nkey, key + nkey, nbytes,
+                                  ntohl(getq->message.body.flags),
+                                  res->response.cas);
+    } else {
+        if (status == PROTOCOL_BINARY_RESPONSE_KEY_ENOENT &&
+                root->negative_cache != NULL) {
+            libcouchbase_negative_cache_store(server, key, nkey);
+        }
+        libcouchbase_get_response(root, &ct, map_error(status), key, nkey,
+                                  NULL, 0, 0, 0);
+    }
+}
+
 static void delete_response_handler(libcouchbase_server_t *server,
                                     const void *command_cookie,
                                     protocol_binary_response_header *res)
@@ -216,12 +380,15 @@ static void delete_response_handler(libcouchbase_server_t *server,
     libcouchbase_uint16_t nkey;
     const char *key = get_key(server, &nkey, &packet);
 
+    struct libcouchbase_command_data_st ct;
+
+    (void)command_cookie;
     if (key == NULL) {
         libcouchbase_error_handler(server->instance, LIBCOUCHBASE_EINTERNAL,
                                    NULL);
     } else {
-        root->callbacks.remove(root, command_cookie, map_error(status),
-                               key, nkey);
+        get_command_data(server, &ct);
+        libcouchbase_remove_response(root, &ct, map_error(status), key, nkey);
         release_key(server, packet);
     }
 }
@@ -236,24 +403,31 @@ static void storage_response_handler(libcouchbase_server_t *server,
     char *packet;
     libcouchbase_uint16_t nkey;
     const char *key = get_key(server, &nkey, &packet);
-
+    struct libcouchbase_command_data_st ct;
 
     libcouchbase_uint16_t status = ntohs(res->response.status);
 
+    (void)command_cookie;
+
     switch (res->response.opcode) {
     case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
         op = LIBCOUCHBASE_ADD;
         break;
     case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
         op = LIBCOUCHBASE_REPLACE;
         break;
     case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
         op = LIBCOUCHBASE_SET;
         break;
     case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
         op = LIBCOUCHBASE_APPEND;
         break;
     case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
         op = LIBCOUCHBASE_PREPEND;
         break;
     default:
@@ -272,8 +446,9 @@ static void storage_response_handler(libcouchbase_server_t *server,
         libcouchbase_error_handler(server->instance, LIBCOUCHBASE_EINTERNAL,
                                    NULL);
     } else {
-        root->callbacks.storage(root, command_cookie, op, map_error(status),
-                                key, nkey, res->response.cas);
+        get_command_data(server, &ct);
+        libcouchbase_storage_response(root, &ct, op, map_error(status),
+                                      key, nkey, res->response.cas);
         release_key(server, packet);
     }
 }
@@ -287,20 +462,25 @@ static void arithmetic_response_handler(libcouchbase_server_t *server,
     char *packet;
     libcouchbase_uint16_t nkey;
     const char *key = get_key(server, &nkey, &packet);
+    struct libcouchbase_command_data_st ct;
 
+    (void)command_cookie;
     if (key == NULL) {
         libcouchbase_error_handler(server->instance, LIBCOUCHBASE_EINTERNAL,
                                    NULL);
         return ;
-    } else if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+    }
+
+    get_command_data(server, &ct);
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
         libcouchbase_uint64_t value;
         memcpy(&value, res + 1, sizeof(value));
         value = ntohll(value);
-        root->callbacks.arithmetic(root, command_cookie, LIBCOUCHBASE_SUCCESS,
-                                   key, nkey, value, res->response.cas);
+        libcouchbase_arithmetic_response(root, &ct, LIBCOUCHBASE_SUCCESS,
+                                         key, nkey, value, res->response.cas);
     } else {
-        root->callbacks.arithmetic(root, command_cookie, map_error(status),
-                                   key, nkey, 0, 0);
+        libcouchbase_arithmetic_response(root, &ct, map_error(status),
+                                         key, nkey, 0, 0);
     }
     release_key(server, packet);
 }
@@ -315,6 +495,7 @@ static void stat_response_handler(libcouchbase_server_t *server,
     libcouchbase_uint32_t nvalue;
     const char *key, *value;
 
+    root->sync_retcode = map_error(status);
     if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
         nkey = ntohs(res->response.keylen);
         if (nkey == 0) {
@@ -359,6 +540,7 @@ static void version_response_handler(libcouchbase_server_t *server,
         vstring = NULL;
     }
 
+    root->sync_retcode = map_error(status);
     root->callbacks.version(root, command_cookie, server->authority, map_error(status),
                             vstring, nvstring);
 
@@ -393,6 +575,10 @@ static void tap_mutation_handler(libcouchbase_server_t *server,
         flags = ntohl(flags);
     }
 
+    if (root->near_cache_owner != NULL) {
+        libcouchbase_near_cache_tap_invalidate(root, ntohs(req->request.vbucket),
+                                               key, nkey);
+    }
     root->callbacks.tap_mutation(root, command_cookie, key, nkey, data,
                                  nbytes, flags, exp, req->request.cas,
                                  ntohs(req->request.vbucket),
@@ -411,6 +597,10 @@ static void tap_deletion_handler(libcouchbase_server_t *server,
     libcouchbase_uint16_t nes = ntohs(deletion->message.body.tap.enginespecific_length);
     char *key = es + nes;
     libcouchbase_t root = server->instance;
+    if (root->near_cache_owner != NULL) {
+        libcouchbase_near_cache_tap_invalidate(root, ntohs(req->request.vbucket),
+                                               key, nkey);
+    }
     root->callbacks.tap_deletion(root, command_cookie, key, nkey,
                                  req->request.cas,
                                  ntohs(req->request.vbucket), es, nes);
@@ -426,6 +616,9 @@ static void tap_flush_handler(libcouchbase_server_t *server,
     char *es = packet + sizeof(flush->bytes);
     libcouchbase_uint16_t nes = ntohs(flush->message.body.tap.enginespecific_length);
     libcouchbase_t root = server->instance;
+    if (root->near_cache_owner != NULL) {
+        libcouchbase_near_cache_tap_invalidate(root, 0, NULL, 0);
+    }
     root->callbacks.tap_flush(root, command_cookie, es, nes);
 }
 
@@ -571,6 +764,7 @@ static void touch_response_handler(libcouchbase_server_t *server,
         libcouchbase_error_handler(server->instance, LIBCOUCHBASE_EINTERNAL,
                                    NULL);
     } else {
+        root->sync_retcode = map_error(status);
         root->callbacks.touch(root, command_cookie, map_error(status),
                               key, nkey);
         release_key(server, packet);
@@ -583,6 +777,7 @@ static void flush_response_handler(libcouchbase_server_t *server,
 {
     libcouchbase_t root = server->instance;
     libcouchbase_uint16_t status = ntohs(res->response.status);
+    root->sync_retcode = map_error(status);
     root->callbacks.flush(root, command_cookie, server->authority,
                           map_error(status));
     if (libcouchbase_lookup_server_with_command(root, PROTOCOL_BINARY_CMD_FLUSH,
@@ -606,6 +801,7 @@ static void unlock_response_handler(libcouchbase_server_t *server,
         libcouchbase_error_handler(server->instance, LIBCOUCHBASE_EINTERNAL,
                                    NULL);
     } else {
+        root->sync_retcode = map_error(status);
         root->callbacks.unlock(root, command_cookie, map_error(status),
                                key, nkey);
         release_key(server, packet);
@@ -869,14 +1065,88 @@ static void dummy_unlock_callback(libcouchbase_t instance,
     (void)nkey;
 }
 
-void libcouchbase_initialize_packet_handlers(libcouchbase_t instance)
+static void dummy_memory_limit_callback(libcouchbase_t instance,
+                                        int exceeded)
+{
+    (void)instance;
+    (void)exceeded;
+}
+
+/**
+ * The packet handlers never change, so all of the instances share the
+ * same tables. They're filled in when the first instance is created.
+ */
+static RESPONSE_HANDLER response_handlers[0x100];
+static REQUEST_HANDLER request_handlers[0x100];
+static int handlers_initialized;
+static spinlock_t handlers_lock;
+
+static void initialize_handler_tables(void)
 {
     int ii;
+
+    spin_lock(&handlers_lock);
+    if (handlers_initialized) {
+        spin_unlock(&handlers_lock);
+        return;
+    }
+
     for (ii = 0; ii < 0x100; ++ii) {
-        instance->request_handler[ii] = dummy_request_handler;
-        instance->response_handler[ii] = dummy_response_handler;
+        request_handlers[ii] = dummy_request_handler;
+        response_handlers[ii] = dummy_response_handler;
     }
 
+    request_handlers[PROTOCOL_BINARY_CMD_TAP_MUTATION] = tap_mutation_handler;
+    request_handlers[PROTOCOL_BINARY_CMD_TAP_DELETE] = tap_deletion_handler;
+    request_handlers[PROTOCOL_BINARY_CMD_TAP_FLUSH] = tap_flush_handler;
+    request_handlers[PROTOCOL_BINARY_CMD_TAP_OPAQUE] = tap_opaque_handler;
+    request_handlers[PROTOCOL_BINARY_CMD_TAP_VBUCKET_SET] = tap_vbucket_set_handler;
+
+    response_handlers[PROTOCOL_BINARY_CMD_FLUSH] = flush_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_GETQ] = getq_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_GATQ] = getq_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_GET] = getq_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_GAT] = getq_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_GETK] = getk_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_GETKQ] = getk_response_handler;
+    response_handlers[CMD_GET_LOCKED] = getq_response_handler;
+    response_handlers[CMD_GET_REPLICA] = getq_response_handler;
+    response_handlers[CMD_UNLOCK_KEY] = unlock_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_ADD] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_DELETE] = delete_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_DELETEQ] = delete_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_REPLACE] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_SET] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_APPEND] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_PREPEND] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_ADDQ] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_REPLACEQ] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_SETQ] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_APPENDQ] = storage_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_PREPENDQ] = storage_response_handler;
+
+    response_handlers[PROTOCOL_BINARY_CMD_INCREMENT] = arithmetic_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_DECREMENT] = arithmetic_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_INCREMENTQ] = arithmetic_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_DECREMENTQ] = arithmetic_response_handler;
+
+    response_handlers[PROTOCOL_BINARY_CMD_SASL_LIST_MECHS] = sasl_list_mech_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_SASL_AUTH] = sasl_auth_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_SASL_STEP] = sasl_step_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_TOUCH] = touch_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_STAT] = stat_response_handler;
+    response_handlers[PROTOCOL_BINARY_CMD_VERSION] = version_response_handler;
+
+    handlers_initialized = 1;
+    spin_unlock(&handlers_lock);
+}
+
+void libcouchbase_initialize_packet_handlers(libcouchbase_t instance)
+{
+    initialize_handler_tables();
+    instance->request_handler = request_handlers;
+    instance->response_handler = response_handlers;
+
     instance->callbacks.tap_mutation = dummy_tap_mutation_callback;
     instance->callbacks.tap_deletion = dummy_tap_deletion_callback;
     instance->callbacks.tap_flush = dummy_tap_flush_callback;
@@ -894,36 +1164,7 @@ void libcouchbase_initialize_packet_handlers(libcouchbase_t instance)
     instance->callbacks.couch_data = dummy_couch_data_callback;
     instance->callbacks.flush = dummy_flush_callback;
     instance->callbacks.unlock = dummy_unlock_callback;
-
-    instance->request_handler[PROTOCOL_BINARY_CMD_TAP_MUTATION] = tap_mutation_handler;
-    instance->request_handler[PROTOCOL_BINARY_CMD_TAP_DELETE] = tap_deletion_handler;
-    instance->request_handler[PROTOCOL_BINARY_CMD_TAP_FLUSH] = tap_flush_handler;
-    instance->request_handler[PROTOCOL_BINARY_CMD_TAP_OPAQUE] = tap_opaque_handler;
-    instance->request_handler[PROTOCOL_BINARY_CMD_TAP_VBUCKET_SET] = tap_vbucket_set_handler;
-
-    instance->response_handler[PROTOCOL_BINARY_CMD_FLUSH] = flush_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_GETQ] = getq_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_GATQ] = getq_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_GET] = getq_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_GAT] = getq_response_handler;
-    instance->response_handler[CMD_GET_LOCKED] = getq_response_handler;
-    instance->response_handler[CMD_UNLOCK_KEY] = unlock_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_ADD] = storage_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_DELETE] = delete_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_REPLACE] = storage_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_SET] = storage_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_APPEND] = storage_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_PREPEND] = storage_response_handler;
-
-    instance->response_handler[PROTOCOL_BINARY_CMD_INCREMENT] = arithmetic_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_DECREMENT] = arithmetic_response_handler;
-
-    instance->response_handler[PROTOCOL_BINARY_CMD_SASL_LIST_MECHS] = sasl_list_mech_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_SASL_AUTH] = sasl_auth_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_SASL_STEP] = sasl_step_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_TOUCH] = touch_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_STAT] = stat_response_handler;
-    instance->response_handler[PROTOCOL_BINARY_CMD_VERSION] = version_response_handler;
+    instance->callbacks.memory_limit = dummy_memory_limit_callback;
 }
 
 LIBCOUCHBASE_API
@@ -1112,3 +1353,24 @@ libcouchbase_unlock_callback libcouchbase_set_unlock_callback(libcouchbase_t ins
     }
     return ret;
 }
+
+LIBCOUCHBASE_API
+libcouchbase_memory_limit_callback libcouchbase_set_memory_limit_callback(libcouchbase_t instance,
+                                                                          libcouchbase_memory_limit_callback cb)
+{
+    libcouchbase_memory_limit_callback ret = instance->callbacks.memory_limit;
+    if (cb != NULL) {
+        instance->callbacks.memory_limit = cb;
+    }
+    return ret;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_get_batch_callback libcouchbase_set_get_batch_callback(libcouchbase_t instance,
+                                                                    libcouchbase_get_batch_callback cb)
+{
+    /* Unlike the other callbacks this one is optional */
+    libcouchbase_get_batch_callback ret = instance->callbacks.get_batch;
+    instance->callbacks.get_batch = cb;
+    return ret;
+}
@@ -0,0 +1,194 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+
+/* FNV-1a */
+static size_t hash_key(const void *key, size_t nkey)
+{
+    const unsigned char *ptr = key;
+    libcouchbase_uint32_t hash = 2166136261U;
+    size_t ii;
+
+    for (ii = 0; ii < nkey; ++ii) {
+        hash ^= ptr[ii];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+hashtable_t hashtable_create(void)
+{
+    hashtable_t table = calloc(1, sizeof(struct hashtable_st));
+
+    if (table == NULL) {
+        return NULL;
+    }
+    table->nbits = 3;
+    table->capacity = 1 << table->nbits;
+    table->mask = table->capacity - 1;
+    table->buckets = calloc(table->capacity, sizeof(struct hashtable_item_st *));
+    if (table->buckets == NULL) {
+        hashtable_destroy(table);
+        return NULL;
+    }
+    table->nitems = 0;
+    return table;
+}
+
+void hashtable_destroy(hashtable_t table)
+{
+    size_t ii;
+
+    if (table == NULL) {
+        return;
+    }
+
+    if (table->buckets != NULL) {
+        for (ii = 0; ii < table->capacity; ++ii) {
+            struct hashtable_item_st *item = table->buckets[ii];
+            while (item != NULL) {
+                struct hashtable_item_st *next = item->next;
+                free(item);
+                item = next;
+            }
+        }
+        free(table->buckets);
+    }
+    free(table);
+}
+
+size_t hashtable_num_items(hashtable_t table)
+{
+    return table->nitems;
+}
+
+static struct hashtable_item_st **find_item(hashtable_t table,
+                                            const void *key, size_t nkey,
+                                            size_t hash)
+{
+    struct hashtable_item_st **ptr = table->buckets + (hash & table->mask);
+
+    while (*ptr != NULL) {
+        struct hashtable_item_st *item = *ptr;
+        if (item->hash == hash && item->nkey == nkey &&
+                memcmp(item->key, key, nkey) == 0) {
+            break;
+        }
+        ptr = &item->next;
+    }
+    return ptr;
+}
+
+static void maybe_rehash(hashtable_t table)
+{
+    struct hashtable_item_st **buckets;
+    size_t capacity, ii;
+
+    if (table->nitems < table->capacity) {
+        return;
+    }
+
+    capacity = table->capacity << 1;
+    buckets = calloc(capacity, sizeof(struct hashtable_item_st *));
+    if (buckets == NULL) {
+        /* Keep the old (and slower) table */
+        return;
+    }
+
+    for (ii = 0; ii < table->capacity; ++ii) {
+        struct hashtable_item_st *item = table->buckets[ii];
+        while (item != NULL) {
+            struct hashtable_item_st *next = item->next;
+            size_t idx = item->hash & (capacity - 1);
+            item->next = buckets[idx];
+            buckets[idx] = item;
+            item = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->capacity = capacity;
+    table->mask = capacity - 1;
+    table->nbits++;
+}
+
+int hashtable_add(hashtable_t table, const void *key, size_t nkey,
+                  void *value)
+{
+    size_t hash = hash_key(key, nkey);
+    struct hashtable_item_st **ptr = find_item(table, key, nkey, hash);
+    struct hashtable_item_st *item;
+
+    if (*ptr != NULL) {
+        return 0;
+    }
+
+    item = malloc(sizeof(*item));
+    if (item == NULL) {
+        return -1;
+    }
+    item->key = key;
+    item->nkey = nkey;
+    item->hash = hash;
+    item->value = value;
+    item->next = NULL;
+    *ptr = item;
+    table->nitems++;
+    maybe_rehash(table);
+    return 1;
+}
+
+void *hashtable_find(hashtable_t table, const void *key, size_t nkey)
+{
+    struct hashtable_item_st **ptr;
+
+    ptr = find_item(table, key, nkey, hash_key(key, nkey));
+    return *ptr ? (*ptr)->value : NULL;
+}
+
+void *hashtable_remove(hashtable_t table, const void *key, size_t nkey)
+{
+    struct hashtable_item_st **ptr;
+    struct hashtable_item_st *item;
+    void *value;
+
+    ptr = find_item(table, key, nkey, hash_key(key, nkey));
+    item = *ptr;
+    if (item == NULL) {
+        return NULL;
+    }
+
+    *ptr = item->next;
+    value = item->value;
+    free(item);
+    table->nitems--;
+    return value;
+}
+
+void hashtable_foreach(hashtable_t table, hashtable_iterator_t iterator,
+                       void *arg)
+{
+    size_t ii;
+
+    for (ii = 0; ii < table->capacity; ++ii) {
+        struct hashtable_item_st *item;
+        for (item = table->buckets[ii]; item != NULL; item = item->next) {
+            iterator(item->value, arg);
+        }
+    }
+}
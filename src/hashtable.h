@@ -0,0 +1,97 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#ifndef LIBCOUCHBASE_HASHTABLE_H
+#define LIBCOUCHBASE_HASHTABLE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * A chained hash table mapping a key (a byte string) to a pointer.
+     * Unlike the hashset it doesn't leave tombstones behind when items
+     * are removed, so it may be used for sets with a lot of churn.
+     *
+     * The table does not copy the key, so the memory the key points to
+     * must remain valid until the item is removed (the easiest is to
+     * keep the key in the object stored as the value).
+     */
+    struct hashtable_item_st {
+        const void *key;
+        size_t nkey;
+        size_t hash;
+        void *value;
+        struct hashtable_item_st *next;
+    };
+
+    struct hashtable_st {
+        size_t nbits;
+        size_t mask;
+
+        size_t capacity;
+        struct hashtable_item_st **buckets;
+        size_t nitems;
+    };
+
+    typedef struct hashtable_st *hashtable_t;
+
+    typedef void (*hashtable_iterator_t)(void *value, void *arg);
+
+    /* create hashtable instance */
+    hashtable_t hashtable_create(void);
+
+    /* destroy hashtable instance (the values are not released) */
+    void hashtable_destroy(hashtable_t table);
+
+    size_t hashtable_num_items(hashtable_t table);
+
+    /* add item into the hashtable.
+     *
+     * returns zero if the key already is in the table (the table is not
+     * modified), -1 if we failed to allocate memory and 1 otherwise
+     */
+    int hashtable_add(hashtable_t table, const void *key, size_t nkey,
+                      void *value);
+
+    /* find an item in the hashtable
+     *
+     * returns the value stored for the key or NULL if the key wasn't
+     * found
+     */
+    void *hashtable_find(hashtable_t table, const void *key, size_t nkey);
+
+    /* remove item from the hashtable
+     *
+     * returns the value stored for the key or NULL if the key wasn't
+     * found
+     */
+    void *hashtable_remove(hashtable_t table, const void *key, size_t nkey);
+
+    /* call the iterator for all of the values in the table. The
+     * iterator may not modify the table.
+     */
+    void hashtable_foreach(hashtable_t table, hashtable_iterator_t iterator,
+                           void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the hedged get. The get is sent to the master of
+ * the vbucket, and if we don't have the response within the hedge
+ * delay (or the master fails) the same key is read from the first
+ * replica. The first successful response is passed to the get callback
+ * and the other one is ignored.
+ */
+
+#include "internal.h"
+
+struct libcouchbase_hedge_st;
+
+/**
+ * The command cookie for the get to the master (or the replica)
+ */
+struct hedge_leg_st {
+    struct libcouchbase_hedge_st *hedge;
+    int replica;
+};
+
+struct libcouchbase_hedge_st {
+    libcouchbase_t instance;
+    const void *cookie;
+    struct hedge_leg_st master;
+    struct hedge_leg_st replica;
+    /** The number of commands in flight */
+    int outstanding;
+    /** Set when the result is passed to the user */
+    int done;
+    /** Set when the get is sent to the replica */
+    int replica_sent;
+    /** Set while the hedge timer is running */
+    int timer_pending;
+    void *event;
+    int vb;
+    char *key;
+    libcouchbase_size_t nkey;
+
+    struct libcouchbase_hedge_st *prev;
+    struct libcouchbase_hedge_st *next;
+};
+
+static void hedge_destroy(struct libcouchbase_hedge_st *hedge)
+{
+    libcouchbase_t instance = hedge->instance;
+
+    if (hedge->prev != NULL) {
+        hedge->prev->next = hedge->next;
+    } else {
+        instance->hedges = hedge->next;
+    }
+    if (hedge->next != NULL) {
+        hedge->next->prev = hedge->prev;
+    }
+
+    if (hedge->timer_pending) {
+        instance->io->delete_timer(instance->io, hedge->event);
+    }
+    instance->io->destroy_timer(instance->io, hedge->event);
+    free(hedge);
+}
+
+static void maybe_destroy(struct libcouchbase_hedge_st *hedge)
+{
+    if (hedge->outstanding == 0 && (hedge->done || !hedge->timer_pending)) {
+        hedge_destroy(hedge);
+    }
+}
+
+static void hedge_get_callback(libcouchbase_t instance,
+                               const void *cookie,
+                               libcouchbase_error_t error,
+                               const void *key,
+                               libcouchbase_size_t nkey,
+                               const void *bytes,
+                               libcouchbase_size_t nbytes,
+                               libcouchbase_uint32_t flags,
+                               libcouchbase_cas_t cas);
+
+static void send_get(struct libcouchbase_hedge_st *hedge,
+                     libcouchbase_server_t *server,
+                     struct hedge_leg_st *leg)
+{
+    libcouchbase_t instance = hedge->instance;
+    protocol_binary_request_get req;
+    struct libcouchbase_command_data_st ct;
+
+    memset(&req, 0, sizeof(req));
+    req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    if (leg->replica) {
+        req.message.header.request.opcode = CMD_GET_REPLICA;
+    } else {
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+    }
+    req.message.header.request.keylen = ntohs((libcouchbase_uint16_t)hedge->nkey);
+    req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    req.message.header.request.vbucket = ntohs((libcouchbase_uint16_t)hedge->vb);
+    req.message.header.request.bodylen = ntohl((libcouchbase_uint32_t)hedge->nkey);
+    req.message.header.request.opaque = ++instance->seqno;
+
+    ct.start = gethrtime();
+    ct.cookie = leg;
+    ct.callback.get = hedge_get_callback;
+    ct.retries = 0;
+
+    ++hedge->outstanding;
+    libcouchbase_server_retry_packet(server, &ct, req.bytes, sizeof(req.bytes));
+    libcouchbase_server_write_packet(server, hedge->key, hedge->nkey);
+    libcouchbase_server_end_packet(server);
+    libcouchbase_server_send_packets(server);
+}
+
+/**
+ * Send the get to the first replica of the vbucket
+ *
+ * @return non-zero if the get was sent
+ */
+static int send_replica(struct libcouchbase_hedge_st *hedge)
+{
+    libcouchbase_t instance = hedge->instance;
+    int idx;
+
+    hedge->replica_sent = 1;
+    if (hedge->timer_pending) {
+        instance->io->delete_timer(instance->io, hedge->event);
+        hedge->timer_pending = 0;
+    }
+
+    if (instance->vbucket_config == NULL) {
+        return 0;
+    }
+    idx = vbucket_get_replica(instance->vbucket_config, hedge->vb, 0);
+    if (idx < 0 || idx >= (int)instance->nservers) {
+        return 0;
+    }
+
+    ++instance->stats.get_hedged;
+    send_get(hedge, libcouchbase_get_server(instance, idx, hedge->vb, 0),
+             &hedge->replica);
+    return 1;
+}
+
+static void hedge_get_callback(libcouchbase_t instance,
+                               const void *cookie,
+                               libcouchbase_error_t error,
+                               const void *key,
+                               libcouchbase_size_t nkey,
+                               const void *bytes,
+                               libcouchbase_size_t nbytes,
+                               libcouchbase_uint32_t flags,
+                               libcouchbase_cas_t cas)
+{
+    const struct hedge_leg_st *leg = cookie;
+    struct libcouchbase_hedge_st *hedge = leg->hedge;
+    int deliver = 0;
+
+    --hedge->outstanding;
+    if (!hedge->done) {
+        if (error == LIBCOUCHBASE_SUCCESS) {
+            deliver = 1;
+        } else if (!leg->replica && error == LIBCOUCHBASE_KEY_ENOENT) {
+            /* The master knows that the key doesn't exist */
+            deliver = 1;
+        } else if (!leg->replica && !hedge->replica_sent) {
+            /* The master failed, so try the replica right away */
+            deliver = !send_replica(hedge);
+        } else if (hedge->outstanding == 0) {
+            /* This is the last response */
+            deliver = 1;
+        }
+    }
+
+    if (deliver) {
+        hedge->done = 1;
+        if (leg->replica && error == LIBCOUCHBASE_SUCCESS) {
+            ++instance->stats.get_hedged_replica_won;
+        }
+        instance->callbacks.get(instance, hedge->cookie, error, key, nkey,
+                                bytes, nbytes, flags, cas);
+    }
+    maybe_destroy(hedge);
+}
+
+static void hedge_timeout_handler(libcouchbase_socket_t sock,
+                                  short which,
+                                  void *arg)
+{
+    struct libcouchbase_hedge_st *hedge = arg;
+
+    hedge->instance->io->delete_timer(hedge->instance->io, hedge->event);
+    hedge->timer_pending = 0;
+    if (!hedge->done && !hedge->replica_sent) {
+        (void)send_replica(hedge);
+    }
+    maybe_destroy(hedge);
+
+    (void)sock;
+    (void)which;
+}
+
+void libcouchbase_hedge_destroy_all(libcouchbase_t instance)
+{
+    while (instance->hedges != NULL) {
+        hedge_destroy(instance->hedges);
+    }
+}
+
+static libcouchbase_error_t hedged_get(libcouchbase_t instance,
+                                       const void *command_cookie,
+                                       const void *key,
+                                       libcouchbase_size_t nkey,
+                                       libcouchbase_uint32_t delay)
+{
+    struct libcouchbase_hedge_st *hedge;
+    int vb, idx;
+
+    (void)vbucket_map(instance->vbucket_config, key, nkey, &vb, &idx);
+    if (idx < 0 || idx >= (int)instance->nservers) {
+        /* the config says that there is no server yet at that position (-1) */
+        return LIBCOUCHBASE_NETWORK_ERROR;
+    }
+
+    hedge = calloc(1, sizeof(*hedge) + nkey);
+    if (hedge == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    hedge->event = instance->io->create_timer(instance->io);
+    if (hedge->event == NULL) {
+        free(hedge);
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    hedge->instance = instance;
+    hedge->cookie = command_cookie;
+    hedge->master.hedge = hedge;
+    hedge->replica.hedge = hedge;
+    hedge->replica.replica = 1;
+    hedge->vb = vb;
+    hedge->key = (char *)(hedge + 1);
+    memcpy(hedge->key, key, nkey);
+    hedge->nkey = nkey;
+
+    hedge->next = instance->hedges;
+    if (hedge->next != NULL) {
+        hedge->next->prev = hedge;
+    }
+    instance->hedges = hedge;
+
+    if (delay != 0) {
+        instance->io->update_timer(instance->io, hedge->event, delay,
+                                   hedge, hedge_timeout_handler);
+        hedge->timer_pending = 1;
+    }
+
+    send_get(hedge, libcouchbase_get_server(instance, idx, vb, 0),
+             &hedge->master);
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mget_hedged(libcouchbase_t instance,
+                                              const void *command_cookie,
+                                              libcouchbase_size_t num_keys,
+                                              const void *const *keys,
+                                              const libcouchbase_size_t *nkey,
+                                              libcouchbase_uint32_t delay)
+{
+    libcouchbase_size_t ii;
+
+    /* we need a vbucket config before we can start getting data.. */
+    if (instance->vbucket_config == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
+    }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    for (ii = 0; ii < num_keys; ++ii) {
+        libcouchbase_error_t err = hedged_get(instance, command_cookie,
+                                              keys[ii], nkey[ii], delay);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            return libcouchbase_synchandler_return(instance, err);
+        }
+    }
+
+    return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+}
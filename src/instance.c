@@ -55,16 +55,28 @@ const char *libcouchbase_get_port(libcouchbase_t instance)
     return instance->port;
 }
 
-static void setup_current_host(libcouchbase_t instance, const char *host)
+/**
+ * Set the host (and port) we're getting the config from. The port
+ * points into the same allocation as the host (or to the default).
+ *
+ * @return 0 on success, -1 if we failed to allocate memory
+ */
+static int setup_current_host(libcouchbase_t instance, const char *host)
 {
     char *ptr;
-    snprintf(instance->host, sizeof(instance->host), "%s", host);
+
+    free(instance->host);
+    instance->port = NULL;
+    if ((instance->host = strdup(host)) == NULL) {
+        return -1;
+    }
     if ((ptr = strchr(instance->host, ':')) == NULL) {
-        strcpy(instance->port, "8091");
+        instance->port = "8091";
     } else {
         *ptr = '\0';
-        snprintf(instance->port, sizeof(instance->port), "%s", ptr + 1);
+        instance->port = ptr + 1;
     }
+    return 0;
 }
 
 static int setup_boostrap_hosts(libcouchbase_t ret, const char *host)
@@ -114,9 +126,7 @@ static int setup_boostrap_hosts(libcouchbase_t ret, const char *host)
     } while (ptr != NULL);
 
     ret->backup_idx = 0;
-    setup_current_host(ret, ret->backup_nodes[0]);
-
-    return 0;
+    return setup_current_host(ret, ret->backup_nodes[0]);
 }
 
 LIBCOUCHBASE_API
@@ -155,9 +165,17 @@ libcouchbase_t libcouchbase_create(const char *host,
         return NULL;
     }
     libcouchbase_initialize_packet_handlers(ret);
+    ret->buffer_pool = libcouchbase_buffer_pool_create(LIBCOUCHBASE_DEFAULT_BUFFER_POOL_SIZE);
+    if (ret->buffer_pool == NULL) {
+        free(ret);
+        return NULL;
+    }
     libcouchbase_behavior_set_syncmode(ret, LIBCOUCHBASE_ASYNCHRONOUS);
+    libcouchbase_behavior_set_connections_per_node(ret, 1);
+    ret->breaker_reset = LIBCOUCHBASE_DEFAULT_BREAKER_RESET;
 
     if (setup_boostrap_hosts(ret, host) == -1) {
+        libcouchbase_buffer_pool_destroy(ret->buffer_pool);
         free(ret);
         return NULL;
     }
@@ -205,12 +223,16 @@ LIBCOUCHBASE_API
 void libcouchbase_destroy(libcouchbase_t instance)
 {
     libcouchbase_size_t ii;
+
+    /* Let someone else take over the config stream */
+    libcouchbase_config_provider_unsubscribe(instance);
     free(instance->http_uri);
+    free(instance->host);
 
     if (instance->sock != INVALID_SOCKET) {
-        instance->io->delete_event(instance->io, instance->sock,
-                                   instance->event);
-        instance->io->destroy_event(instance->io, instance->event);
+        libcouchbase_delete_event(instance, instance->sock,
+                                  instance->event);
+        libcouchbase_destroy_event(instance, instance->event);
         instance->io->close(instance->io, instance->sock);
     }
 
@@ -228,11 +250,23 @@ void libcouchbase_destroy(libcouchbase_t instance)
         vbucket_config_destroy(instance->vbucket_config);
     }
 
-    for (ii = 0; ii < instance->nservers; ++ii) {
+    for (ii = 0; ii < instance->nconnections; ++ii) {
         libcouchbase_server_destroy(instance->servers + ii);
     }
     free(instance->servers);
     free(instance->backup_nodes);
+    libcouchbase_mget_stream_destroy_all(instance);
+    libcouchbase_coalesce_destroy_all(instance);
+    libcouchbase_hedge_destroy_all(instance);
+    libcouchbase_get_batch_destroy_all(instance);
+    free(instance->op_values.data);
+    libcouchbase_retry_destroy_all(instance);
+    libcouchbase_keepalive_destroy(instance);
+    libcouchbase_submission_queue_destroy(instance, 0);
+    libcouchbase_near_cache_destroy(instance);
+    libcouchbase_negative_cache_destroy(instance);
+    libcouchbase_buffer_pool_destroy(instance->buffer_pool);
+    libcouchbase_tick_destroy(instance);
 
     if (instance->io && instance->io->destructor) {
         instance->io->destructor(instance->io);
@@ -248,6 +282,22 @@ void libcouchbase_destroy(libcouchbase_t instance)
     free(instance);
 }
 
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_release_idle_buffers(libcouchbase_t instance)
+{
+    libcouchbase_size_t ii;
+    libcouchbase_size_t nbytes;
+
+    nbytes = libcouchbase_buffer_pool_purge(instance->buffer_pool);
+    for (ii = 0; ii < instance->nconnections; ++ii) {
+        nbytes += libcouchbase_server_release_buffers(instance->servers + ii);
+    }
+    /* Don't keep the ones we just released in our pool either */
+    libcouchbase_buffer_pool_purge(instance->buffer_pool);
+    libcouchbase_update_memory_limit(instance);
+    return nbytes;
+}
+
 /**
  * Callback functions called from libsasl to get the username to use for
  * authentication.
@@ -298,7 +348,7 @@ static int sasl_get_password(sasl_conn_t *conn, void *context, int id,
 void libcouchbase_apply_vbucket_config(libcouchbase_t instance, VBUCKET_CONFIG_HANDLE config)
 {
     libcouchbase_uint16_t ii, max;
-    libcouchbase_size_t num;
+    libcouchbase_size_t num, conn;
     const char *passwd;
     char curnode[NI_MAXHOST + NI_MAXSERV + 2];
     sasl_callback_t sasl_callbacks[4] = {
@@ -310,7 +360,9 @@ void libcouchbase_apply_vbucket_config(libcouchbase_t instance, VBUCKET_CONFIG_H
 
     num = (libcouchbase_size_t)vbucket_config_get_num_servers(config);
     instance->nservers = num;
-    instance->servers = calloc(num, sizeof(libcouchbase_server_t));
+    instance->nconnections = num * instance->connections_per_node;
+    instance->servers = calloc(instance->nconnections,
+                               sizeof(libcouchbase_server_t));
     instance->vbucket_config = config;
     if (instance->backup_nodes) {
         free(instance->backup_nodes);
@@ -333,6 +385,12 @@ void libcouchbase_apply_vbucket_config(libcouchbase_t instance, VBUCKET_CONFIG_H
             instance->backup_nodes[nn] = pp;
         }
     }
+    /* The other connections to the servers */
+    for (conn = num; conn < instance->nconnections; ++conn) {
+        instance->servers[conn].instance = instance;
+        libcouchbase_server_initialize(instance->servers + conn,
+                                       (int)(conn % num));
+    }
     instance->sasl.name = vbucket_config_get_user(instance->vbucket_config);
     memset(instance->sasl.password.buffer, 0,
            sizeof(instance->sasl.password.buffer));
@@ -380,7 +438,9 @@ static void relocate_packets(libcouchbase_server_t *src,
         assert(ringbuffer_read(&src->cmd_log, body, nbody) == nbody);
         vb = ntohs(cmd.request.vbucket);
         idx = (libcouchbase_size_t)vbucket_get_master(dst_instance->vbucket_config, vb);
-        dst = dst_instance->servers + idx;
+        dst = libcouchbase_get_server(dst_instance, (int)idx, vb,
+                                      nbody - cmd.request.extlen -
+                                      ntohs(cmd.request.keylen));
         if (src->connected) {
             assert(ringbuffer_read(&src->output_cookies, &ct, sizeof(ct)) == sizeof(ct));
         } else {
@@ -416,8 +476,9 @@ static void libcouchbase_update_serverlist(libcouchbase_t instance)
     libcouchbase_size_t ii;
     VBUCKET_CONFIG_HANDLE next_config, curr_config;
     VBUCKET_CONFIG_DIFF *diff = NULL;
-    libcouchbase_size_t nservers;
+    libcouchbase_size_t nconnections;
     libcouchbase_server_t *servers, *ss;
+    int applied = 0;
 
     curr_config = instance->vbucket_config;
     next_config = vbucket_config_create();
@@ -438,10 +499,11 @@ static void libcouchbase_update_serverlist(libcouchbase_t instance)
         diff = vbucket_compare(curr_config, next_config);
         if (diff && (diff->sequence_changed || diff->n_vb_changes > 0)) {
             VBUCKET_DISTRIBUTION_TYPE dist_t = vbucket_config_get_distribution_type(next_config);
-            nservers = instance->nservers;
+            nconnections = instance->nconnections;
             servers = instance->servers;
             libcouchbase_apply_vbucket_config(instance, next_config);
-            for (ii = 0; ii < nservers; ++ii) {
+            applied = 1;
+            for (ii = 0; ii < nconnections; ++ii) {
                 ss = servers + ii;
                 if (dist_t == VBUCKET_DISTRIBUTION_VBUCKET) {
                     relocate_packets(ss, instance);
@@ -458,9 +520,10 @@ static void libcouchbase_update_serverlist(libcouchbase_t instance)
             vbucket_config_destroy(curr_config);
 
             /* Send data and notify listeners */
-            for (ii = 0; ii < instance->nservers; ++ii) {
+            for (ii = 0; ii < instance->nconnections; ++ii) {
                 ss = instance->servers + ii;
-                if (instance->vbucket_state_listener != NULL) {
+                if (instance->vbucket_state_listener != NULL &&
+                        ii < instance->nservers) {
                     instance->vbucket_state_listener(ss);
                 }
                 if (ss->cmd_log.nbytes != 0) {
@@ -474,6 +537,7 @@ static void libcouchbase_update_serverlist(libcouchbase_t instance)
         assert(instance->servers == NULL);
         assert(instance->nservers == 0);
         libcouchbase_apply_vbucket_config(instance, next_config);
+        applied = 1;
 
         /* Notify anyone interested in this event... */
         if (instance->vbucket_state_listener != NULL) {
@@ -482,6 +546,43 @@ static void libcouchbase_update_serverlist(libcouchbase_t instance)
             }
         }
     }
+
+    if (applied) {
+        /* Send the commands waiting for the new config */
+        libcouchbase_retry_config_changed(instance);
+    }
+    if (applied && instance->sharded != NULL) {
+        /* Pass the new config on to the other shards */
+        libcouchbase_sharded_config_changed(instance->sharded,
+                                            instance->vbucket_stream.input.data);
+    }
+    if (applied && instance->config_provider != NULL) {
+        libcouchbase_config_provider_publish(instance,
+                                             instance->vbucket_stream.input.data);
+    }
+}
+
+/**
+ * Apply a configuration received by another instance (see sharded.c
+ * and configprovider.c)
+ * @param instance the instance to update
+ * @param json the configuration
+ * @param njson the number of bytes in the configuration
+ */
+void libcouchbase_update_config(libcouchbase_t instance,
+                                const char *json,
+                                libcouchbase_size_t njson)
+{
+    instance->vbucket_stream.input.avail = 0;
+    if (!grow_buffer(&instance->vbucket_stream.input, njson + 1)) {
+        libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM,
+                                   "Failed to allocate memory for config");
+        return;
+    }
+    memcpy(instance->vbucket_stream.input.data, json, njson);
+    instance->vbucket_stream.input.data[njson] = '\0';
+    instance->vbucket_stream.input.avail = njson;
+    libcouchbase_update_serverlist(instance);
 }
 
 /**
@@ -655,7 +756,7 @@ static int libcouchbase_switch_to_backup_node(libcouchbase_t instance,
 
     while (!connected) {
         /* Keep on trying the nodes until all of them failed ;-) */
-        libcouchbase_error_t rc = libcouchbase_connect(instance);
+        libcouchbase_error_t rc = libcouchbase_connect_config_stream(instance);
         connected = (rc == LIBCOUCHBASE_SUCCESS);
         if (!connected && instance->backup_nodes[instance->backup_idx] == NULL) {
             libcouchbase_error_handler(instance, LIBCOUCHBASE_NETWORK_ERROR,
@@ -671,7 +772,7 @@ static void libcouchbase_instance_connerr(libcouchbase_t instance,
                                           const char *errinfo)
 {
     if (instance->sock != INVALID_SOCKET) {
-        instance->io->delete_event(instance->io, instance->sock, instance->event);
+        libcouchbase_delete_event(instance, instance->sock, instance->event);
         instance->io->close(instance->io, instance->sock);
         instance->sock = INVALID_SOCKET;
     }
@@ -695,7 +796,7 @@ static void libcouchbase_instance_connerr(libcouchbase_t instance,
         instance->io->delete_timer(instance->io, instance->timeout.event);
     } else {
         libcouchbase_size_t ii;
-        for (ii = 0; ii < instance->nservers; ++ii) {
+        for (ii = 0; ii < instance->nconnections; ++ii) {
             libcouchbase_failout_server(instance->servers + ii, err);
         }
     }
@@ -730,17 +831,17 @@ static void vbucket_stream_handler(libcouchbase_socket_t sock, short which, void
         if (nw == -1) {
             libcouchbase_error_handler(instance, LIBCOUCHBASE_NETWORK_ERROR,
                                        "Failed to send data to REST server");
-            instance->io->delete_event(instance->io, instance->sock,
-                                       instance->event);
+            libcouchbase_delete_event(instance, instance->sock,
+                                      instance->event);
             return;
 
         }
 
         instance->n_http_uri_sent += nw;
         if (instance->n_http_uri_sent == strlen(instance->http_uri)) {
-            instance->io->update_event(instance->io, instance->sock,
-                                       instance->event, LIBCOUCHBASE_READ_EVENT,
-                                       instance, vbucket_stream_handler);
+            libcouchbase_update_event(instance, instance->sock,
+                                      instance->event, LIBCOUCHBASE_READ_EVENT,
+                                      instance, vbucket_stream_handler);
         }
     }
 
@@ -835,9 +936,9 @@ static void vbucket_stream_handler(libcouchbase_socket_t sock, short which, void
 static void libcouchbase_instance_connected(libcouchbase_t instance)
 {
     instance->backup_idx = 0;
-    instance->io->update_event(instance->io, instance->sock,
-                               instance->event, LIBCOUCHBASE_RW_EVENT,
-                               instance, vbucket_stream_handler);
+    libcouchbase_update_event(instance, instance->sock,
+                              instance->event, LIBCOUCHBASE_RW_EVENT,
+                              instance, vbucket_stream_handler);
 }
 
 static void libcouchbase_instance_connect_handler(libcouchbase_socket_t sock,
@@ -901,12 +1002,12 @@ static void libcouchbase_instance_connect_handler(libcouchbase_socket_t sock,
                 libcouchbase_instance_connected(instance);
                 return ;
             case LIBCOUCHBASE_CONNECT_EINPROGRESS:
-                instance->io->update_event(instance->io,
-                                           instance->sock,
-                                           instance->event,
-                                           LIBCOUCHBASE_WRITE_EVENT,
-                                           instance,
-                                           libcouchbase_instance_connect_handler);
+                libcouchbase_update_event(instance,
+                                          instance->sock,
+                                          instance->event,
+                                          LIBCOUCHBASE_WRITE_EVENT,
+                                          instance,
+                                          libcouchbase_instance_connect_handler);
                 return ;
             case LIBCOUCHBASE_CONNECT_EALREADY: /* Subsequent calls to connect */
                 return ;
@@ -916,9 +1017,9 @@ static void libcouchbase_instance_connect_handler(libcouchbase_socket_t sock,
                 if (instance->sock != INVALID_SOCKET) {
                     if (!first_try) {
                         /* Event updated */
-                        instance->io->delete_event(instance->io,
-                                                   instance->sock,
-                                                   instance->event);
+                        libcouchbase_delete_event(instance,
+                                                  instance->sock,
+                                                  instance->event);
                     }
                     instance->io->close(instance->io, instance->sock);
                     instance->sock = INVALID_SOCKET;
@@ -951,17 +1052,40 @@ static void libcouchbase_instance_connect_handler(libcouchbase_socket_t sock,
 }
 
 /**
+ * Ask for the cluster configuration again by reconnecting the
+ * streaming connection (the server sends the current config first).
+ * Instances getting the config from another instance, or already
+ * connecting, don't have to do anything.
+ *
+ * @param instance the instance to refresh
+ */
+void libcouchbase_refresh_config(libcouchbase_t instance)
+{
+    if (instance->sock == INVALID_SOCKET || instance->ai == NULL) {
+        return;
+    }
+
+    libcouchbase_delete_event(instance, instance->sock, instance->event);
+    instance->io->close(instance->io, instance->sock);
+    instance->sock = INVALID_SOCKET;
+    instance->curr_ai = instance->ai;
+    ++instance->stats.config_refreshes;
+    libcouchbase_instance_connect_handler(INVALID_SOCKET, 0, instance);
+}
+
+/**
+ * Open the streaming connection to get the cluster configuration
+ *
  * @todo use async connects etc
  */
-LIBCOUCHBASE_API
-libcouchbase_error_t libcouchbase_connect(libcouchbase_t instance)
+libcouchbase_error_t libcouchbase_connect_config_stream(libcouchbase_t instance)
 {
     struct addrinfo hints;
     int error;
 
     if (instance->sock != INVALID_SOCKET) {
-        instance->io->delete_event(instance->io, instance->sock, instance->event);
-        instance->io->destroy_event(instance->io, instance->event);
+        libcouchbase_delete_event(instance, instance->sock, instance->event);
+        libcouchbase_destroy_event(instance, instance->event);
         instance->io->close(instance->io, instance->sock);
         instance->sock = INVALID_SOCKET;
     }
@@ -975,8 +1099,11 @@ libcouchbase_error_t libcouchbase_connect(libcouchbase_t instance)
     hints.ai_family = AF_UNSPEC;
 
     do {
-        setup_current_host(instance,
-                           instance->backup_nodes[instance->backup_idx]);
+        if (setup_current_host(instance,
+                               instance->backup_nodes[instance->backup_idx]) == -1) {
+            return libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM,
+                                              "Failed to allocate memory for the host");
+        }
         error = getaddrinfo(instance->host, instance->port,
                             &hints, &instance->ai);
         if (error != 0) {
@@ -993,8 +1120,6 @@ libcouchbase_error_t libcouchbase_connect(libcouchbase_t instance)
                                                   LIBCOUCHBASE_UNKNOWN_HOST,
                                                   errinfo);
             }
-            setup_current_host(instance,
-                               instance->backup_nodes[instance->backup_idx]);
         }
     } while (error != 0);
 
@@ -1005,3 +1130,24 @@ libcouchbase_error_t libcouchbase_connect(libcouchbase_t instance)
 
     return instance->last_error;
 }
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_connect(libcouchbase_t instance)
+{
+    if (instance->shared_config && instance->config_provider == NULL) {
+        int owner = 0;
+        libcouchbase_error_t err;
+
+        err = libcouchbase_config_provider_subscribe(instance, &owner);
+        if (err == LIBCOUCHBASE_SUCCESS && !owner) {
+            /* The config arrives through the submission queue */
+            return LIBCOUCHBASE_SUCCESS;
+        }
+        if (err != LIBCOUCHBASE_SUCCESS && err != LIBCOUCHBASE_NOT_SUPPORTED) {
+            return libcouchbase_error_handler(instance, err,
+                                              "Failed to subscribe to the shared config");
+        }
+        /* The owner (or the platform can't share it) */
+    }
+    return libcouchbase_connect_config_stream(instance);
+}
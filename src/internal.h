@@ -38,7 +38,10 @@
 
 #include "http_parser/http_parser.h"
 #include "ringbuffer.h"
+#include "bufpool.h"
 #include "hashset.h"
+#include "hashtable.h"
+#include "atomics.h"
 #include "debug.h"
 
 /*
@@ -50,6 +53,32 @@
 #endif
 
 #define LIBCOUCHBASE_DEFAULT_TIMEOUT 2500000
+/**
+ * The default number of bytes kept in the free buffers of an instance.
+ * It's small so that a process with many idle instances doesn't hold
+ * on to their buffers (the bigger ones are freed when released).
+ */
+#define LIBCOUCHBASE_DEFAULT_BUFFER_POOL_SIZE (8 * 1024)
+/** The empty server buffers bigger than this are given back to the pool */
+#define LIBCOUCHBASE_BUFFER_SHRINK_SIZE (32 * 1024)
+/** A response slower than this many times the fastest one is congestion */
+#define LIBCOUCHBASE_WINDOW_RTT_FACTOR 8
+/** ..unless it's faster than this (in nanoseconds) */
+#define LIBCOUCHBASE_WINDOW_MIN_CONGESTED_RTT 1000000
+/** The longest we wait before a command is retried (in usec) */
+#define LIBCOUCHBASE_MAX_RETRY_BACKOFF 500000
+/** We don't ask for a new config more often than this (in usec) */
+#define LIBCOUCHBASE_CONFIG_REFRESH_INTERVAL 1000000
+/** A vbucket is moving this long after NOT_MY_VBUCKET (in usec) */
+#define LIBCOUCHBASE_VBUCKET_MOVE_TIMEOUT 1000000
+/** The first delay for a command waiting for a vbucket to move (in usec) */
+#define LIBCOUCHBASE_VBUCKET_MOVE_BACKOFF 10000
+/** How long the circuit breaker stays open the first time (in usec) */
+#define LIBCOUCHBASE_DEFAULT_BREAKER_RESET 1000000
+/** The longest the circuit breaker stays open (in usec) */
+#define LIBCOUCHBASE_MAX_BREAKER_BACKOFF 30000000
+/** The number of slots used to remember the last mutation of the keys */
+#define LIBCOUCHBASE_MUTATION_SLOTS 256
 #define LIBCOUCHBASE_TAP_CONNECTION 1
 
 #ifdef __cplusplus
@@ -80,6 +109,15 @@ extern "C" {
         LIBCOUCHBASE_CONNECT_EUNHANDLED
     } libcouchbase_connect_status_t;
 
+    /**
+     * The states of the circuit breaker for a connection (see breaker.c)
+     */
+    typedef enum {
+        LIBCOUCHBASE_BREAKER_CLOSED = 0,
+        LIBCOUCHBASE_BREAKER_OPEN,
+        LIBCOUCHBASE_BREAKER_HALF_OPEN
+    } libcouchbase_breaker_state_t;
+
     typedef struct {
         char *data;
         libcouchbase_size_t size;
@@ -92,7 +130,149 @@ extern "C" {
      */
     struct libcouchbase_command_data_st {
         hrtime_t start;
+        /** When the command was given to the connection (0 if unknown) */
+        hrtime_t sent;
         const void *cookie;
+        /**
+         * The result of the command is passed to this function instead
+         * of the callback registered for the instance if it is set. The
+         * member to use depends on the command.
+         */
+        union {
+            libcouchbase_get_callback get;
+            libcouchbase_storage_callback storage;
+            libcouchbase_arithmetic_callback arithmetic;
+            libcouchbase_remove_callback remove;
+        } callback;
+        /** The number of times the command was retried (see retry.c) */
+        libcouchbase_uint32_t retries;
+    };
+
+    /**
+     * A cluster configuration passed to other instances (see
+     * configprovider.c). It is never modified once it's created, and
+     * it's released when the last reference is dropped.
+     */
+    struct libcouchbase_config_snapshot_st {
+        atomic_counter_t refcount;
+        char *json;
+        libcouchbase_size_t njson;
+    };
+
+    struct libcouchbase_multi_key_st;
+
+    /**
+     * A command operating on multiple keys (see multi.c)
+     */
+    struct libcouchbase_multi_st {
+        libcouchbase_t instance;
+        const void *command_cookie;
+        /** The vbucket and server for each key (NULL with a hashkey) */
+        struct libcouchbase_multi_key_st *keys;
+        /** The vbucket and server for all of the keys with a hashkey */
+        int vb;
+        int idx;
+        /** The number of commands sent to each connection */
+        libcouchbase_size_t *affected;
+    };
+
+    /**
+     * An entry in one of the client side caches (see utilities.c). The
+     * caches put their own members after it.
+     */
+    struct libcouchbase_cache_entry_st {
+        struct libcouchbase_cache_entry_st *prev;
+        struct libcouchbase_cache_entry_st *next;
+        /** The entry may not be used after this time */
+        hrtime_t expires;
+        /** The number of hits queued for delivery referencing the entry */
+        libcouchbase_size_t refcount;
+        /** Set while the entry is in the cache */
+        int linked;
+        /** The vbucket id followed by the key (used as the hash key) */
+        char *key;
+        libcouchbase_size_t nkey;
+        /** The number of bytes allocated for the entry */
+        libcouchbase_size_t size;
+    };
+
+    struct libcouchbase_cache_st;
+
+    /** The cache enabled for an instance (NULL if it's disabled) */
+    typedef struct libcouchbase_cache_st *(*libcouchbase_cache_lookup_fn)(libcouchbase_t instance);
+    /** Report a hit found in the cache to the get callback */
+    typedef void (*libcouchbase_cache_deliver_fn)(libcouchbase_t instance,
+                                                  const void *cookie,
+                                                  struct libcouchbase_cache_entry_st *entry);
+
+    /**
+     * The part shared by the near cache and the negative cache: the
+     * entries keyed by the vbucket and the key, ordered from the most
+     * recently stored (or used) one at the head, and the hits waiting
+     * to be delivered from a timer callback.
+     */
+    struct libcouchbase_cache_st {
+        libcouchbase_t instance;
+        hashtable_t items;
+        struct libcouchbase_cache_entry_st *head;
+        struct libcouchbase_cache_entry_st *tail;
+        /** The number of bytes used by the entries */
+        libcouchbase_size_t nbytes;
+        /** The hits waiting to be delivered */
+        ringbuffer_t hits;
+        void *event;
+        libcouchbase_cache_lookup_fn lookup;
+        libcouchbase_cache_deliver_fn deliver;
+    };
+
+    struct libcouchbase_mget_stream_st;
+    struct libcouchbase_near_cache_st;
+    struct libcouchbase_negative_cache_st;
+    struct libcouchbase_hedge_st;
+    struct libcouchbase_get_batch_st;
+    struct libcouchbase_op_batch_st;
+    struct libcouchbase_queue_st;
+
+    /**
+     * Counters reported through libcouchbase_get_client_stats()
+     */
+    struct libcouchbase_client_stats_st {
+        /** The number of gets attached to a get already in flight */
+        libcouchbase_uint64_t get_coalesced;
+        /** The number of gets answered by the near cache */
+        libcouchbase_uint64_t near_cache_hits;
+        /** The number of gets not found in the near cache */
+        libcouchbase_uint64_t near_cache_misses;
+        /** The number of near cache entries removed by a modification */
+        libcouchbase_uint64_t near_cache_invalidations;
+        /** The number of near cache entries removed to free memory */
+        libcouchbase_uint64_t near_cache_evictions;
+        /** The number of gets answered by the negative cache */
+        libcouchbase_uint64_t negative_cache_hits;
+        /** The number of negative cache entries removed by a modification */
+        libcouchbase_uint64_t negative_cache_invalidations;
+        /** The number of hedged gets sent to a replica */
+        libcouchbase_uint64_t get_hedged;
+        /** The number of hedged gets answered by the replica */
+        libcouchbase_uint64_t get_hedged_replica_won;
+        /** The number of operations run from the submission queue */
+        libcouchbase_uint64_t submission_queue_ops;
+        /** The number of times the submission queue woke us up */
+        libcouchbase_uint64_t submission_queue_wakeups;
+        /** The number of operations refused by the memory limit */
+        libcouchbase_uint64_t memory_limit_rejected;
+        /** The number of TMPFAIL/ENOMEM responses retried */
+        libcouchbase_uint64_t retried;
+        /** The number of NOT_MY_VBUCKET responses */
+        libcouchbase_uint64_t not_my_vbucket;
+        /** The number of them waiting for the new config */
+        libcouchbase_uint64_t not_my_vbucket_parked;
+        /** The number of times we asked for the config again */
+        libcouchbase_uint64_t config_refreshes;
+        /** The number of NOOPs sent to idle connections */
+        libcouchbase_uint64_t keepalive_probes;
+        /** The number of idle connections found dead */
+        libcouchbase_uint64_t keepalive_failures;
     };
 
     struct libcouchbase_histogram_st;
@@ -117,13 +297,16 @@ extern "C" {
         libcouchbase_couch_complete_callback couch_complete;
         libcouchbase_couch_data_callback couch_data;
         libcouchbase_unlock_callback unlock;
+        libcouchbase_memory_limit_callback memory_limit;
+        /** Not set unless the user wants batched mget results */
+        libcouchbase_get_batch_callback get_batch;
     };
 
     struct libcouchbase_st {
         /** The couchbase host */
-        char host[NI_MAXHOST + 1];
-        /** The port of the couchbase server */
-        char port[NI_MAXSERV + 1];
+        char *host;
+        /** The port of the couchbase server (see setup_current_host) */
+        const char *port;
 
         /** The URL request to send to the server */
         char *http_uri;
@@ -147,6 +330,15 @@ extern "C" {
 
         /* The current synchronous mode */
         libcouchbase_syncmode_t syncmode;
+        /* Use GETK/GETKQ so that the responses carries the key */
+        int getk;
+
+        /** Coalescing of gets for the same key (see coalesce.c) */
+        struct {
+            int enabled;
+            /** The gets in flight others may attach to */
+            hashtable_t inflight;
+        } coalesce;
 
         evutil_socket_t sock;
         struct addrinfo *ai;
@@ -154,8 +346,22 @@ extern "C" {
 
         /** The number of couchbase server in the configuration */
         size_t nservers;
-        /** The array of the couchbase servers */
+        /**
+         * The array of the connections to the couchbase servers. The
+         * first nservers entries are the first connection to each of
+         * the servers, the next nservers entries the second connection
+         * and so on (see libcouchbase_get_server()).
+         */
         libcouchbase_server_t *servers;
+        /** The number of entries in servers */
+        libcouchbase_size_t nconnections;
+        /** The number of connections to open to each server */
+        libcouchbase_size_t connections_per_node;
+        /**
+         * Values of at least this size are sent over a connection of
+         * their own (0 disables it)
+         */
+        libcouchbase_size_t large_value_threshold;
 
         /** The array of last known nodes as hostname:port */
         char **backup_nodes;
@@ -173,8 +379,9 @@ extern "C" {
          * see breakout_vbucket_state_listener in wait.c*/
         vbucket_state_listener_t vbucket_state_listener_last;
 
-        RESPONSE_HANDLER response_handler[0x100];
-        REQUEST_HANDLER request_handler[0x100];
+        /** The packet handlers (shared by all instances, see handler.c) */
+        const RESPONSE_HANDLER *response_handler;
+        const REQUEST_HANDLER *request_handler;
 
         struct {
             const char *name;
@@ -194,9 +401,98 @@ extern "C" {
         struct libcouchbase_callback_st callbacks;
         struct libcouchbase_histogram_st *histogram;
 
+        /** The list of active streaming multi-gets */
+        struct libcouchbase_mget_stream_st *mget_streams;
+        /** Set while we're adding more commands to the streams */
+        int mget_streams_refilling;
+
+        struct libcouchbase_client_stats_st stats;
+
+        /** The near cache (see nearcache.c) */
+        struct libcouchbase_near_cache_st *near_cache;
+        /** The instance whose near cache we're invalidating with TAP */
+        libcouchbase_t near_cache_owner;
+        /** The recently missing keys (see negcache.c) */
+        struct libcouchbase_negative_cache_st *negative_cache;
+        /**
+         * The seqno when the keys hashing to each slot were last
+         * modified (LIBCOUCHBASE_MUTATION_SLOTS of them, only while a
+         * cache is enabled). A get sent before that may not fill the
+         * caches (see libcouchbase_cache_may_fill)
+         */
+        libcouchbase_uint32_t *mutations;
+        /** The hedged gets in progress (see hedge.c) */
+        struct libcouchbase_hedge_st *hedges;
+        /** The batched multi-gets in progress (see getbatch.c) */
+        struct libcouchbase_get_batch_st *get_batches;
+        /** The operations submitted by other threads (see queue.c) */
+        struct libcouchbase_queue_st *queue;
+        /** The sharded client this instance receives the config for */
+        libcouchbase_sharded_t sharded;
+        /** Set if the config stream should be shared with other instances */
+        int shared_config;
+        /** The provider we get the config from (see configprovider.c) */
+        struct libcouchbase_config_provider_st *config_provider;
+        /** Where the server buffers come from (see bufpool.c) */
+        struct libcouchbase_buffer_pool_st *buffer_pool;
+        /** The bytes allocated for the server and view buffers */
+        libcouchbase_size_t buffer_bytes;
+        /**
+         * The bytes in the server buffers (the commands to send, the
+         * commands waiting for a response and the input). It's only zero
+         * when all of the servers are idle (see libcouchbase_maybe_breakout)
+         */
+        libcouchbase_size_t queued_bytes;
+        /** The bytes in the command-cookie buffers for all servers */
+        libcouchbase_size_t queued_cookie_bytes;
+        /** The max value for buffer_bytes (0 for no limit) */
+        libcouchbase_size_t memory_limit;
+        /** Set while we're refusing operations because of the limit */
+        int memory_limit_exceeded;
+        /** The max in-flight window for a connection (0 for no window) */
+        libcouchbase_size_t max_window;
+        /** The delay before the first retry in usec (0 to not retry) */
+        libcouchbase_uint32_t retry_backoff;
+        /** The commands waiting to be retried (see retry.c) */
+        struct libcouchbase_retry_st *retries;
+        /** The number of commands in the list */
+        libcouchbase_size_t nretries;
+        /** The timer for the first command in the list */
+        void *retry_timer;
+        /** When the retry timer fires (0 when it isn't running) */
+        hrtime_t retry_timer_next;
+        /** When we got NOT_MY_VBUCKET for each vbucket (see retry.c) */
+        hrtime_t *vb_moves;
+        /** We don't ask for a new config before this time */
+        hrtime_t config_refresh_next;
+        /** Set when we should ask for a new config */
+        int config_refresh_pending;
+        /** The failures in a row that open the breaker (0 for no breaker) */
+        libcouchbase_size_t breaker_threshold;
+        /** How long the breaker stays open the first time (in usec) */
+        libcouchbase_uint32_t breaker_reset;
+        /** Probe connections idle this long (in usec, 0 for never) */
+        libcouchbase_uint32_t keepalive_interval;
+        /** The timer for the probes (see keepalive.c) */
+        void *keepalive_timer;
+        /** Set while the timer is running */
+        int keepalive_timer_running;
+
         libcouchbase_uint32_t seqno;
         int wait;
         const void *cookie;
+        /** The error passed to the last callback (see synchandler.c) */
+        libcouchbase_error_t sync_retcode;
+        /** The libcouchbase_execute_ops calls in progress */
+        struct libcouchbase_op_batch_st *op_batches;
+        /** The values we got for libcouchbase_execute_ops */
+        buffer_t op_values;
+        /** The events registered with the io plugin (see tick.c) */
+        hashtable_t interest;
+        /** The timer stopping the event loop in libcouchbase_tick */
+        void *tick_timer;
+        /** Set while libcouchbase_tick runs the event loop */
+        int ticking;
 
         libcouchbase_error_t last_error;
 
@@ -214,7 +510,7 @@ extern "C" {
      * The structure representing each couchbase server
      */
     struct libcouchbase_server_st {
-        /** The server index in the list */
+        /** The server index in the list (the same for all connections) */
         int index;
         /** The name of the server */
         char *hostname;
@@ -249,6 +545,40 @@ extern "C" {
         /** The input buffer for this server */
         ringbuffer_t input;
 
+        /** The commands waiting for room in the window (see window.c) */
+        ringbuffer_t held;
+        ringbuffer_t held_cookies;
+        /** Set while the packet we're writing goes to the held buffer */
+        int holding;
+        /** The max number of commands we may have sent and not completed */
+        libcouchbase_size_t window;
+        /** The number of responses since the window last grew */
+        libcouchbase_size_t window_acked;
+        /** Don't shrink the window for responses to commands up to this one */
+        libcouchbase_uint32_t window_recover_seqno;
+        /** The fastest response seen on this connection */
+        hrtime_t min_rtt;
+        /** The number of held commands that timed out before they were sent */
+        libcouchbase_uint64_t window_shed;
+        /** The number of TMPFAIL/ENOMEM responses from it we retried */
+        libcouchbase_uint64_t retried;
+        /** The state of the circuit breaker (see breaker.c) */
+        libcouchbase_breaker_state_t breaker;
+        /** The number of failures in a row */
+        libcouchbase_size_t breaker_failures;
+        /** When the breaker was opened */
+        hrtime_t breaker_opened;
+        /** How long the breaker stays open (in usec) */
+        libcouchbase_uint32_t breaker_backoff;
+        /** The number of times the breaker was opened */
+        libcouchbase_uint64_t breaker_trips;
+        /** The number of commands failed because the breaker was open */
+        libcouchbase_uint64_t breaker_rejected;
+        /** When we last got a response from the server */
+        hrtime_t last_response;
+        /** When we sent the keepalive probe (0 if none is in flight) */
+        hrtime_t probe_sent;
+
         /** The set of the pointers to Couchbase View requests */
         hashset_t couch_requests;
 
@@ -324,14 +654,178 @@ extern "C" {
                                                     libcouchbase_error_t error,
                                                     const char *errinfo);
 
+    void libcouchbase_get_response(libcouchbase_t instance,
+                                   const struct libcouchbase_command_data_st *ct,
+                                   libcouchbase_error_t error,
+                                   const void *key,
+                                   libcouchbase_size_t nkey,
+                                   const void *bytes,
+                                   libcouchbase_size_t nbytes,
+                                   libcouchbase_uint32_t flags,
+                                   libcouchbase_cas_t cas);
+    void libcouchbase_storage_response(libcouchbase_t instance,
+                                       const struct libcouchbase_command_data_st *ct,
+                                       libcouchbase_storage_t operation,
+                                       libcouchbase_error_t error,
+                                       const void *key,
+                                       libcouchbase_size_t nkey,
+                                       libcouchbase_cas_t cas);
+    void libcouchbase_arithmetic_response(libcouchbase_t instance,
+                                          const struct libcouchbase_command_data_st *ct,
+                                          libcouchbase_error_t error,
+                                          const void *key,
+                                          libcouchbase_size_t nkey,
+                                          libcouchbase_uint64_t value,
+                                          libcouchbase_cas_t cas);
+    void libcouchbase_remove_response(libcouchbase_t instance,
+                                      const struct libcouchbase_command_data_st *ct,
+                                      libcouchbase_error_t error,
+                                      const void *key,
+                                      libcouchbase_size_t nkey);
+
+    void libcouchbase_mget_stream_refill(libcouchbase_t instance);
+    void libcouchbase_mget_stream_destroy_all(libcouchbase_t instance);
+
+    int libcouchbase_coalesce_get(libcouchbase_t instance, int vb,
+                                  const void *command_cookie,
+                                  const void *key, libcouchbase_size_t nkey,
+                                  struct libcouchbase_command_data_st *ct);
+    void libcouchbase_coalesce_destroy_all(libcouchbase_t instance);
+
+    void libcouchbase_hedge_destroy_all(libcouchbase_t instance);
+
+    struct libcouchbase_get_batch_st *libcouchbase_get_batch_create(libcouchbase_t instance,
+                                                                    const void *command_cookie);
+    void libcouchbase_get_batch_add(struct libcouchbase_get_batch_st *batch,
+                                    struct libcouchbase_command_data_st *ct);
+    void libcouchbase_get_batch_flush(libcouchbase_t instance);
+    void libcouchbase_get_batch_destroy_all(libcouchbase_t instance);
+
+    int libcouchbase_submission_queue_has_ops(libcouchbase_t instance);
+    void libcouchbase_submission_queue_destroy(libcouchbase_t instance,
+                                               int drain);
+    libcouchbase_error_t libcouchbase_queue_config(libcouchbase_t instance,
+                                                   struct libcouchbase_config_snapshot_st *snapshot);
+    libcouchbase_error_t libcouchbase_queue_connect(libcouchbase_t instance);
+
+    void libcouchbase_update_config(libcouchbase_t instance,
+                                    const char *json,
+                                    libcouchbase_size_t njson);
+    void libcouchbase_sharded_config_changed(libcouchbase_sharded_t sharded,
+                                             const char *json);
+
+    struct libcouchbase_config_snapshot_st *libcouchbase_config_snapshot_create(const char *json,
+                                                                               libcouchbase_size_t njson);
+    void libcouchbase_config_snapshot_ref(struct libcouchbase_config_snapshot_st *snapshot);
+    void libcouchbase_config_snapshot_unref(struct libcouchbase_config_snapshot_st *snapshot);
+    libcouchbase_error_t libcouchbase_config_provider_subscribe(libcouchbase_t instance,
+                                                                int *owner);
+    void libcouchbase_config_provider_unsubscribe(libcouchbase_t instance);
+    void libcouchbase_config_provider_publish(libcouchbase_t instance,
+                                              const char *json);
+    libcouchbase_error_t libcouchbase_connect_config_stream(libcouchbase_t instance);
+
+    int libcouchbase_near_cache_get(libcouchbase_t instance, int vb,
+                                    const void *command_cookie,
+                                    const void *key, libcouchbase_size_t nkey);
+    void libcouchbase_near_cache_store(libcouchbase_server_t *server,
+                                       const void *key,
+                                       libcouchbase_size_t nkey,
+                                       const void *bytes,
+                                       libcouchbase_size_t nbytes,
+                                       libcouchbase_uint32_t flags,
+                                       libcouchbase_cas_t cas);
+    void libcouchbase_near_cache_invalidate(libcouchbase_t instance, int vb,
+                                            const void *key,
+                                            libcouchbase_size_t nkey);
+    void libcouchbase_near_cache_invalidate_all(libcouchbase_t instance);
+    void libcouchbase_near_cache_tap_invalidate(libcouchbase_t tap, int vb,
+                                                const void *key,
+                                                libcouchbase_size_t nkey);
+    int libcouchbase_near_cache_has_hits(libcouchbase_t instance);
+    libcouchbase_size_t libcouchbase_near_cache_nbytes(libcouchbase_t instance);
+    libcouchbase_size_t libcouchbase_near_cache_nitems(libcouchbase_t instance);
+    void libcouchbase_near_cache_destroy(libcouchbase_t instance);
+
+    int libcouchbase_negative_cache_get(libcouchbase_t instance, int vb,
+                                        const void *command_cookie,
+                                        const void *key, libcouchbase_size_t nkey);
+    void libcouchbase_negative_cache_store(libcouchbase_server_t *server,
+                                           const void *key,
+                                           libcouchbase_size_t nkey);
+    void libcouchbase_negative_cache_invalidate(libcouchbase_t instance, int vb,
+                                                const void *key,
+                                                libcouchbase_size_t nkey);
+    void libcouchbase_negative_cache_invalidate_all(libcouchbase_t instance);
+    int libcouchbase_negative_cache_has_hits(libcouchbase_t instance);
+    libcouchbase_size_t libcouchbase_negative_cache_nitems(libcouchbase_t instance);
+    void libcouchbase_negative_cache_destroy(libcouchbase_t instance);
+
+    void libcouchbase_cache_invalidate(libcouchbase_t instance, int vb,
+                                       const void *key, libcouchbase_size_t nkey);
+    void libcouchbase_cache_invalidate_all(libcouchbase_t instance);
+    void libcouchbase_cache_mutated(libcouchbase_t instance, int vb,
+                                    const void *key, libcouchbase_size_t nkey);
+    libcouchbase_error_t libcouchbase_cache_mutations_create(libcouchbase_t instance);
+    void libcouchbase_cache_mutations_release(libcouchbase_t instance);
+    libcouchbase_error_t libcouchbase_cache_create(struct libcouchbase_cache_st *cache,
+                                                   libcouchbase_t instance,
+                                                   libcouchbase_cache_lookup_fn lookup,
+                                                   libcouchbase_cache_deliver_fn deliver);
+    void libcouchbase_cache_destroy(struct libcouchbase_cache_st *cache,
+                                    int deliver);
+    struct libcouchbase_cache_entry_st *libcouchbase_cache_entry_create(libcouchbase_size_t size,
+                                                                        int vb,
+                                                                        const void *key,
+                                                                        libcouchbase_size_t nkey,
+                                                                        libcouchbase_size_t nextra);
+    struct libcouchbase_cache_entry_st *libcouchbase_cache_find(struct libcouchbase_cache_st *cache,
+                                                                int vb,
+                                                                const void *key,
+                                                                libcouchbase_size_t nkey);
+    int libcouchbase_cache_add(struct libcouchbase_cache_st *cache,
+                               struct libcouchbase_cache_entry_st *entry);
+    void libcouchbase_cache_remove(struct libcouchbase_cache_st *cache,
+                                   struct libcouchbase_cache_entry_st *entry);
+    void libcouchbase_cache_touch(struct libcouchbase_cache_st *cache,
+                                  struct libcouchbase_cache_entry_st *entry);
+    void libcouchbase_cache_clear(struct libcouchbase_cache_st *cache);
+    int libcouchbase_cache_add_hit(struct libcouchbase_cache_st *cache,
+                                   const void *cookie,
+                                   struct libcouchbase_cache_entry_st *entry);
+    int libcouchbase_cache_may_fill(libcouchbase_t instance, int vb,
+                                    const void *key, libcouchbase_size_t nkey,
+                                    libcouchbase_uint32_t opaque);
+
     int libcouchbase_server_purge_implicit_responses(libcouchbase_server_t *c,
                                                      libcouchbase_uint32_t seqno,
                                                      hrtime_t delta);
     void libcouchbase_server_destroy(libcouchbase_server_t *server);
+    libcouchbase_size_t libcouchbase_server_release_buffers(libcouchbase_server_t *server);
+    void libcouchbase_server_shrink_buffers(libcouchbase_server_t *server);
+    libcouchbase_size_t libcouchbase_server_buffer_bytes(libcouchbase_server_t *server);
     void libcouchbase_server_connected(libcouchbase_server_t *server);
 
     void libcouchbase_server_initialize(libcouchbase_server_t *server,
                                         int servernum);
+    libcouchbase_server_t *libcouchbase_get_server(libcouchbase_t instance,
+                                                   int idx, int vb,
+                                                   libcouchbase_size_t nbytes);
+
+    libcouchbase_error_t libcouchbase_multi_start(struct libcouchbase_multi_st *multi,
+                                                  libcouchbase_t instance,
+                                                  const void *command_cookie,
+                                                  const void *hashkey,
+                                                  libcouchbase_size_t nhashkey,
+                                                  libcouchbase_size_t num_keys,
+                                                  const void *const *keys,
+                                                  const libcouchbase_size_t *nkey);
+    int libcouchbase_multi_vbucket(struct libcouchbase_multi_st *multi,
+                                   libcouchbase_size_t ii);
+    libcouchbase_server_t *libcouchbase_multi_server(struct libcouchbase_multi_st *multi,
+                                                     libcouchbase_size_t ii,
+                                                     libcouchbase_size_t nbytes);
+    void libcouchbase_multi_end(struct libcouchbase_multi_st *multi, int terminate);
 
 
 
@@ -343,7 +837,7 @@ extern "C" {
                                                  libcouchbase_size_t size);
 
     void libcouchbase_server_buffer_retry_packet(libcouchbase_server_t *c,
-                                                 struct libcouchbase_command_data_st *ct,
+                                                 const struct libcouchbase_command_data_st *ct,
                                                  ringbuffer_t *buff,
                                                  ringbuffer_t *buff_cookie,
                                                  const void *data,
@@ -377,7 +871,7 @@ extern "C" {
                                           libcouchbase_size_t size);
 
     void libcouchbase_server_retry_packet(libcouchbase_server_t *c,
-                                          struct libcouchbase_command_data_st *ct,
+                                          const struct libcouchbase_command_data_st *ct,
                                           const void *data,
                                           libcouchbase_size_t size);
     /**
@@ -389,6 +883,18 @@ extern "C" {
     void libcouchbase_server_write_packet(libcouchbase_server_t *c,
                                           const void *data,
                                           libcouchbase_size_t size);
+    /**
+     * Write data from a ringbuffer to the current packet without
+     * copying it to a temporary buffer first. The data isn't consumed
+     * from the ringbuffer.
+     * @param c the server connection to send it to
+     * @param src the ringbuffer to read the data from (it may not be
+     *            one of the buffers of c)
+     * @param size the number of bytes to include
+     */
+    void libcouchbase_server_write_packet_ringbuffer(libcouchbase_server_t *c,
+                                                     ringbuffer_t *src,
+                                                     libcouchbase_size_t size);
     /**
      * Mark this packet complete
      */
@@ -421,10 +927,62 @@ extern "C" {
     void libcouchbase_record_metrics(libcouchbase_t instance,
                                      hrtime_t delta,
                                      libcouchbase_uint8_t opcode);
+    libcouchbase_size_t libcouchbase_timings_nbytes(libcouchbase_t instance);
+
+    libcouchbase_error_t libcouchbase_check_memory_limit(libcouchbase_t instance);
+    void libcouchbase_update_memory_limit(libcouchbase_t instance);
+
+    int libcouchbase_window_is_full(libcouchbase_server_t *server,
+                                    const void *packet);
+    void libcouchbase_window_ack(libcouchbase_server_t *server,
+                                 const struct libcouchbase_command_data_st *ct,
+                                 libcouchbase_uint32_t opaque,
+                                 libcouchbase_uint16_t status,
+                                 hrtime_t now);
+    void libcouchbase_window_congested(libcouchbase_server_t *server);
+    void libcouchbase_window_reset(libcouchbase_server_t *server);
+    int libcouchbase_window_release(libcouchbase_server_t *server);
+    libcouchbase_size_t libcouchbase_window_inflight(libcouchbase_server_t *server);
+    libcouchbase_size_t libcouchbase_window_nheld(libcouchbase_server_t *server);
+
+    void libcouchbase_breaker_success(libcouchbase_server_t *server);
+    void libcouchbase_breaker_failure(libcouchbase_server_t *server, hrtime_t now);
+    int libcouchbase_breaker_allow(libcouchbase_server_t *server);
+    int libcouchbase_breaker_tripped(libcouchbase_server_t *server);
+    void libcouchbase_breaker_reject(libcouchbase_server_t *server);
+
+    void libcouchbase_keepalive_update(libcouchbase_t instance);
+    void libcouchbase_keepalive_destroy(libcouchbase_t instance);
+    void libcouchbase_server_reset_timeout(libcouchbase_server_t *server);
+    void libcouchbase_server_reconnect(libcouchbase_server_t *server);
+
+    int libcouchbase_retry_command(libcouchbase_server_t *server,
+                                   const struct libcouchbase_command_data_st *ct,
+                                   hrtime_t now);
+    int libcouchbase_retry_not_my_vbucket(libcouchbase_server_t *server,
+                                          const struct libcouchbase_command_data_st *ct,
+                                          hrtime_t now);
+    void libcouchbase_retry_config_changed(libcouchbase_t instance);
+    void libcouchbase_retry_destroy_all(libcouchbase_t instance);
+    void libcouchbase_refresh_config(libcouchbase_t instance);
 
     void libcouchbase_update_timer(libcouchbase_t instance);
     void libcouchbase_purge_timedout(libcouchbase_t instance);
 
+    int libcouchbase_update_event(libcouchbase_t instance,
+                                  libcouchbase_socket_t sock,
+                                  void *event,
+                                  short flags,
+                                  void *cb_data,
+                                  void (*handler)(libcouchbase_socket_t sock,
+                                                  short which,
+                                                  void *cb_data));
+    void libcouchbase_delete_event(libcouchbase_t instance,
+                                   libcouchbase_socket_t sock,
+                                   void *event);
+    void libcouchbase_destroy_event(libcouchbase_t instance, void *event);
+    void libcouchbase_tick_destroy(libcouchbase_t instance);
+
 
     int libcouchbase_lookup_server_with_command(libcouchbase_t instance,
                                                 libcouchbase_uint8_t opcode,
@@ -0,0 +1,151 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the keepalive probes for idle connections. A
+ * connection that died while it was idle (the node went away, or a
+ * firewall dropped the connection) is otherwise not detected until the
+ * next commands for it time out.
+ *
+ * Every instance->keepalive_interval usec we send a NOOP to all of the
+ * connections without any commands in flight that haven't got a
+ * response within the interval. The NOOP has no cookie, so it's handled
+ * like the NOOP after a multi-command (nothing is reported to the user).
+ * If there is still no response when the timer fires the next time,
+ * the connection is failed out and we connect to the server again.
+ */
+
+#include "internal.h"
+
+static void keepalive_timeout_handler(libcouchbase_socket_t sock,
+                                      short which,
+                                      void *arg);
+
+static int is_idle(libcouchbase_server_t *server)
+{
+    return server->output.nbytes == 0 && server->output_cookies.nbytes == 0 &&
+           server->held_cookies.nbytes == 0;
+}
+
+static void send_probe(libcouchbase_server_t *server, hrtime_t now)
+{
+    protocol_binary_request_noop noop;
+
+    memset(&noop, 0, sizeof(noop));
+    noop.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    noop.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
+    noop.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    noop.message.header.request.opaque = ++server->instance->seqno;
+
+    server->probe_sent = now;
+    ++server->instance->stats.keepalive_probes;
+    libcouchbase_server_complete_packet(server, NULL, noop.bytes,
+                                        sizeof(noop.bytes));
+    libcouchbase_server_send_packets(server);
+}
+
+static void check_server(libcouchbase_server_t *server, hrtime_t now,
+                         hrtime_t interval)
+{
+    if (!server->connected) {
+        server->probe_sent = 0;
+        return;
+    }
+
+    if (server->probe_sent != 0) {
+        if (server->last_response >= server->probe_sent) {
+            server->probe_sent = 0;
+        } else if (now - server->probe_sent >= interval) {
+            /* The connection is dead, connect again right away */
+            ++server->instance->stats.keepalive_failures;
+            server->probe_sent = 0;
+            libcouchbase_failout_server(server, LIBCOUCHBASE_NETWORK_ERROR);
+            libcouchbase_server_reconnect(server);
+            return;
+        } else {
+            return;
+        }
+    }
+
+    if (is_idle(server) && now - server->last_response >= interval) {
+        send_probe(server, now);
+    }
+}
+
+static void keepalive_timeout_handler(libcouchbase_socket_t sock,
+                                      short which,
+                                      void *arg)
+{
+    libcouchbase_t instance = arg;
+    hrtime_t now = gethrtime();
+    hrtime_t interval = instance->keepalive_interval;
+    libcouchbase_size_t ii;
+
+    interval *= 1000;
+    instance->io->delete_timer(instance->io, instance->keepalive_timer);
+    instance->keepalive_timer_running = 0;
+
+    if (instance->tap.is_tap_instance != LIBCOUCHBASE_TAP_CONNECTION) {
+        for (ii = 0; ii < instance->nconnections; ++ii) {
+            check_server(instance->servers + ii, now, interval);
+        }
+    }
+
+    libcouchbase_keepalive_update(instance);
+    libcouchbase_maybe_breakout(instance);
+
+    (void)sock;
+    (void)which;
+}
+
+/**
+ * Start (or stop) the keepalive timer after the interval is changed
+ */
+void libcouchbase_keepalive_update(libcouchbase_t instance)
+{
+    if (instance->keepalive_timer_running) {
+        instance->io->delete_timer(instance->io, instance->keepalive_timer);
+        instance->keepalive_timer_running = 0;
+    }
+
+    if (instance->keepalive_interval == 0) {
+        return;
+    }
+
+    if (instance->keepalive_timer == NULL) {
+        instance->keepalive_timer = instance->io->create_timer(instance->io);
+        if (instance->keepalive_timer == NULL) {
+            libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM, NULL);
+            return;
+        }
+    }
+    instance->io->update_timer(instance->io, instance->keepalive_timer,
+                               instance->keepalive_interval, instance,
+                               keepalive_timeout_handler);
+    instance->keepalive_timer_running = 1;
+}
+
+void libcouchbase_keepalive_destroy(libcouchbase_t instance)
+{
+    if (instance->keepalive_timer != NULL) {
+        if (instance->keepalive_timer_running) {
+            instance->io->delete_timer(instance->io, instance->keepalive_timer);
+        }
+        instance->io->destroy_timer(instance->io, instance->keepalive_timer);
+        instance->keepalive_timer = NULL;
+    }
+}
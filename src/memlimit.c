@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the limit for the memory used by the buffers of
+ * an instance. The buffers of the servers and the view requests add
+ * their size to instance->buffer_bytes (see ringbuffer_t), so we know
+ * the total without walking the servers. New operations are refused
+ * while the total is above the limit, so that a stalled server can't
+ * make the buffers grow until the process runs out of memory.
+ */
+
+#include "internal.h"
+
+/**
+ * Check if we may encode another operation
+ *
+ * @return LIBCOUCHBASE_SUCCESS or LIBCOUCHBASE_EMEMLIMIT
+ */
+libcouchbase_error_t libcouchbase_check_memory_limit(libcouchbase_t instance)
+{
+    if (instance->memory_limit == 0 ||
+            instance->buffer_bytes < instance->memory_limit) {
+        return LIBCOUCHBASE_SUCCESS;
+    }
+
+    ++instance->stats.memory_limit_rejected;
+    if (!instance->memory_limit_exceeded) {
+        instance->memory_limit_exceeded = 1;
+        instance->callbacks.memory_limit(instance, 1);
+    }
+    return LIBCOUCHBASE_EMEMLIMIT;
+}
+
+/**
+ * Called when the buffers may have shrunk to tell the user that we're
+ * accepting operations again.
+ */
+void libcouchbase_update_memory_limit(libcouchbase_t instance)
+{
+    if (instance->memory_limit_exceeded &&
+            (instance->memory_limit == 0 ||
+             instance->buffer_bytes < instance->memory_limit)) {
+        instance->memory_limit_exceeded = 0;
+        instance->callbacks.memory_limit(instance, 0);
+    }
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_get_buffered_bytes(libcouchbase_t instance)
+{
+    return instance->buffer_bytes;
+}
@@ -0,0 +1,142 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the code shared by the commands operating on
+ * multiple keys (mget, mstore, ...). We look up the server for all of
+ * the keys before we send anything, and count the commands sent to
+ * each connection so that the batch of quiet commands may be
+ * terminated with a NOOP on each of them.
+ */
+
+#include "internal.h"
+
+struct libcouchbase_multi_key_st {
+    int vb;
+    int idx;
+};
+
+libcouchbase_error_t libcouchbase_multi_start(struct libcouchbase_multi_st *multi,
+                                              libcouchbase_t instance,
+                                              const void *command_cookie,
+                                              const void *hashkey,
+                                              libcouchbase_size_t nhashkey,
+                                              libcouchbase_size_t num_keys,
+                                              const void *const *keys,
+                                              const libcouchbase_size_t *nkey)
+{
+    libcouchbase_size_t ii;
+
+    memset(multi, 0, sizeof(*multi));
+    multi->instance = instance;
+    multi->command_cookie = command_cookie;
+    multi->affected = calloc(instance->nconnections, sizeof(libcouchbase_size_t));
+    if (multi->affected == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+
+    if (nhashkey != 0) {
+        (void)vbucket_map(instance->vbucket_config, hashkey, nhashkey,
+                          &multi->vb, &multi->idx);
+        if (multi->idx < 0 || multi->idx >= (int)instance->nservers) {
+            /* the config says that there is no server yet at that position (-1) */
+            free(multi->affected);
+            return LIBCOUCHBASE_NETWORK_ERROR;
+        }
+        return LIBCOUCHBASE_SUCCESS;
+    }
+
+    if (num_keys == 0) {
+        return LIBCOUCHBASE_SUCCESS;
+    }
+
+    multi->keys = malloc(num_keys * sizeof(struct libcouchbase_multi_key_st));
+    if (multi->keys == NULL) {
+        free(multi->affected);
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    for (ii = 0; ii < num_keys; ++ii) {
+        struct libcouchbase_multi_key_st *key = multi->keys + ii;
+        (void)vbucket_map(instance->vbucket_config, keys[ii], nkey[ii],
+                          &key->vb, &key->idx);
+        if (key->idx < 0 || key->idx >= (int)instance->nservers) {
+            /* the config says that there is no server yet at that position (-1) */
+            free(multi->keys);
+            free(multi->affected);
+            return LIBCOUCHBASE_NETWORK_ERROR;
+        }
+    }
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+int libcouchbase_multi_vbucket(struct libcouchbase_multi_st *multi,
+                               libcouchbase_size_t ii)
+{
+    return multi->keys != NULL ? multi->keys[ii].vb : multi->vb;
+}
+
+libcouchbase_server_t *libcouchbase_multi_server(struct libcouchbase_multi_st *multi,
+                                                 libcouchbase_size_t ii,
+                                                 libcouchbase_size_t nbytes)
+{
+    libcouchbase_t instance = multi->instance;
+    libcouchbase_server_t *server;
+
+    if (multi->keys != NULL) {
+        server = libcouchbase_get_server(instance, multi->keys[ii].idx,
+                                         multi->keys[ii].vb, nbytes);
+    } else {
+        server = libcouchbase_get_server(instance, multi->idx, multi->vb,
+                                         nbytes);
+    }
+    ++multi->affected[server - instance->servers];
+    return server;
+}
+
+void libcouchbase_multi_end(struct libcouchbase_multi_st *multi, int terminate)
+{
+    libcouchbase_t instance = multi->instance;
+    protocol_binary_request_noop noop;
+    libcouchbase_size_t ii;
+
+    memset(&noop, 0, sizeof(noop));
+    noop.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    noop.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
+    noop.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+
+    for (ii = 0; ii < instance->nconnections; ++ii) {
+        if (multi->affected[ii]) {
+            libcouchbase_server_t *server = instance->servers + ii;
+            if (terminate) {
+                /*
+                 * The quiet commands don't send a response for a
+                 * successful operation, so the NOOP tells us that
+                 * all of them completed
+                 */
+                noop.message.header.request.opaque = ++instance->seqno;
+                libcouchbase_server_complete_packet(server, multi->command_cookie,
+                                                    noop.bytes, sizeof(noop.bytes));
+            }
+            libcouchbase_server_send_packets(server);
+        }
+    }
+
+    free(multi->keys);
+    free(multi->affected);
+    multi->keys = NULL;
+    multi->affected = NULL;
+}
@@ -0,0 +1,367 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the near cache: a bounded in-process cache of the
+ * values returned by get operations. The entries are kept in a LRU
+ * list and the least recently used entries are evicted when the cache
+ * exceeds its memory budget. An entry is never returned after its
+ * time-to-live (or the item's expiration time if we know it) passed.
+ *
+ * The cache is invalidated by the store/remove/arithmetic/touch
+ * operations performed through the same instance, and by the TAP
+ * stream of the instance connected with libcouchbase_near_cache_tap().
+ *
+ * Hits are not reported from within the get call, but from a timer
+ * callback (just like a response from the network would be).
+ */
+
+#include "internal.h"
+
+/* memcached treats expiration times above 30 days as absolute */
+#define REALTIME_MAXDELTA (60*60*24*30)
+
+struct near_cache_entry_st {
+    /** Must be first (the entries are allocated by utilities.c) */
+    struct libcouchbase_cache_entry_st base;
+    libcouchbase_uint32_t flags;
+    libcouchbase_cas_t cas;
+    char *bytes;
+    libcouchbase_size_t nbytes;
+};
+
+struct libcouchbase_near_cache_st {
+    struct libcouchbase_cache_st base;
+    libcouchbase_size_t max_bytes;
+    /** The max lifetime of an entry (in usec) */
+    libcouchbase_uint32_t ttl;
+    /** The instance receiving the TAP stream used to invalidate */
+    libcouchbase_t tap;
+};
+
+static struct libcouchbase_cache_st *lookup_cache(libcouchbase_t instance)
+{
+    if (instance->near_cache == NULL) {
+        return NULL;
+    }
+    return &instance->near_cache->base;
+}
+
+static void deliver_hit(libcouchbase_t instance, const void *cookie,
+                        struct libcouchbase_cache_entry_st *base)
+{
+    struct near_cache_entry_st *entry = (struct near_cache_entry_st *)base;
+
+    instance->sync_retcode = LIBCOUCHBASE_SUCCESS;
+    instance->callbacks.get(instance, cookie, LIBCOUCHBASE_SUCCESS,
+                            base->key + sizeof(libcouchbase_uint16_t),
+                            base->nkey - sizeof(libcouchbase_uint16_t),
+                            entry->bytes, entry->nbytes,
+                            entry->flags, entry->cas);
+}
+
+/**
+ * Look up a key in the near cache. If found, a call to the get
+ * callback with the value is scheduled.
+ *
+ * @return non-zero if the key was found (and no get should be sent)
+ */
+int libcouchbase_near_cache_get(libcouchbase_t instance, int vb,
+                                const void *command_cookie,
+                                const void *key, libcouchbase_size_t nkey)
+{
+    struct libcouchbase_cache_st *cache = &instance->near_cache->base;
+    struct libcouchbase_cache_entry_st *entry;
+
+    entry = libcouchbase_cache_find(cache, vb, key, nkey);
+    if (entry != NULL && entry->expires < gethrtime()) {
+        libcouchbase_cache_remove(cache, entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL ||
+            !libcouchbase_cache_add_hit(cache, command_cookie, entry)) {
+        /* Just ask the server */
+        ++instance->stats.near_cache_misses;
+        return 0;
+    }
+
+    libcouchbase_cache_touch(cache, entry);
+    ++instance->stats.near_cache_hits;
+    return 1;
+}
+
+/**
+ * Store the value returned from the server for the get request at the
+ * head of the command log.
+ */
+void libcouchbase_near_cache_store(libcouchbase_server_t *server,
+                                   const void *key,
+                                   libcouchbase_size_t nkey,
+                                   const void *bytes,
+                                   libcouchbase_size_t nbytes,
+                                   libcouchbase_uint32_t flags,
+                                   libcouchbase_cas_t cas)
+{
+    struct libcouchbase_near_cache_st *cache = server->instance->near_cache;
+    struct near_cache_entry_st *entry;
+    struct libcouchbase_cache_entry_st *old;
+    protocol_binary_request_gat req;
+    libcouchbase_uint16_t vbid;
+    hrtime_t now = gethrtime();
+    hrtime_t expires;
+
+    memset(&req, 0, sizeof(req));
+    (void)ringbuffer_peek(&server->cmd_log, req.bytes, sizeof(req.bytes));
+
+    expires = now + (hrtime_t)cache->ttl * 1000;
+    switch (req.message.header.request.opcode) {
+    case PROTOCOL_BINARY_CMD_GAT:
+    case PROTOCOL_BINARY_CMD_GATQ: {
+        /* We know when the item expires */
+        libcouchbase_uint32_t exp = ntohl(req.message.body.expiration);
+        hrtime_t delta;
+
+        if (exp > REALTIME_MAXDELTA) {
+            time_t tm = time(NULL);
+            if ((time_t)exp <= tm) {
+                return;
+            }
+            exp -= (libcouchbase_uint32_t)tm;
+        }
+        delta = (hrtime_t)exp * 1000000000;
+        if (exp != 0 && now + delta < expires) {
+            expires = now + delta;
+        }
+        break;
+    }
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        break;
+    default:
+        /* Locked items etc. */
+        return;
+    }
+
+    if (sizeof(*entry) + sizeof(vbid) + nkey + nbytes > cache->max_bytes) {
+        return;
+    }
+
+    vbid = ntohs(req.message.header.request.vbucket);
+    if (!libcouchbase_cache_may_fill(server->instance, vbid, key, nkey,
+                                     req.message.header.request.opaque)) {
+        /* The key was modified after we sent the get */
+        return;
+    }
+
+    old = libcouchbase_cache_find(&cache->base, vbid, key, nkey);
+    if (old != NULL) {
+        libcouchbase_cache_remove(&cache->base, old);
+    }
+
+    entry = (struct near_cache_entry_st *)libcouchbase_cache_entry_create(sizeof(*entry),
+                                                                          vbid, key, nkey,
+                                                                          nbytes);
+    if (entry == NULL) {
+        return;
+    }
+    entry->base.expires = expires;
+    entry->flags = flags;
+    entry->cas = cas;
+    entry->bytes = entry->base.key + entry->base.nkey;
+    memcpy(entry->bytes, bytes, nbytes);
+    entry->nbytes = nbytes;
+
+    if (!libcouchbase_cache_add(&cache->base, &entry->base)) {
+        return;
+    }
+
+    while (cache->base.nbytes > cache->max_bytes) {
+        libcouchbase_cache_remove(&cache->base, cache->base.tail);
+        ++server->instance->stats.near_cache_evictions;
+    }
+}
+
+/**
+ * Remove a key from the near cache (if present)
+ */
+void libcouchbase_near_cache_invalidate(libcouchbase_t instance, int vb,
+                                        const void *key,
+                                        libcouchbase_size_t nkey)
+{
+    struct libcouchbase_cache_entry_st *entry;
+
+    if (instance->near_cache == NULL) {
+        return;
+    }
+
+    entry = libcouchbase_cache_find(&instance->near_cache->base, vb, key, nkey);
+    if (entry != NULL) {
+        libcouchbase_cache_remove(&instance->near_cache->base, entry);
+        ++instance->stats.near_cache_invalidations;
+    }
+}
+
+/**
+ * Remove all of the entries from the near cache (the bucket is flushed)
+ */
+void libcouchbase_near_cache_invalidate_all(libcouchbase_t instance)
+{
+    if (instance->near_cache == NULL) {
+        return;
+    }
+
+    instance->stats.near_cache_invalidations += hashtable_num_items(instance->near_cache->base.items);
+    libcouchbase_cache_clear(&instance->near_cache->base);
+}
+
+/**
+ * Called by the TAP handlers of an instance connected to a near cache
+ * with libcouchbase_near_cache_tap(). A NULL key means that the bucket
+ * was flushed.
+ */
+void libcouchbase_near_cache_tap_invalidate(libcouchbase_t tap, int vb,
+                                            const void *key,
+                                            libcouchbase_size_t nkey)
+{
+    libcouchbase_t owner = tap->near_cache_owner;
+    if (key == NULL) {
+        libcouchbase_cache_invalidate_all(owner);
+    } else {
+        libcouchbase_cache_mutated(owner, vb, key, nkey);
+        libcouchbase_near_cache_invalidate(owner, vb, key, nkey);
+    }
+}
+
+int libcouchbase_near_cache_has_hits(libcouchbase_t instance)
+{
+    return ringbuffer_get_nbytes(&instance->near_cache->base.hits) != 0;
+}
+
+libcouchbase_size_t libcouchbase_near_cache_nbytes(libcouchbase_t instance)
+{
+    return instance->near_cache->base.nbytes;
+}
+
+libcouchbase_size_t libcouchbase_near_cache_nitems(libcouchbase_t instance)
+{
+    return hashtable_num_items(instance->near_cache->base.items);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_enable_near_cache(libcouchbase_t instance,
+                                                    libcouchbase_size_t max_bytes,
+                                                    libcouchbase_uint32_t ttl)
+{
+    struct libcouchbase_near_cache_st *cache;
+
+    if (instance->near_cache != NULL) {
+        return LIBCOUCHBASE_KEY_EEXISTS;
+    }
+
+    if (max_bytes == 0 || ttl == 0) {
+        return libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                          "The near cache needs a size and a time-to-live");
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    if (libcouchbase_cache_create(&cache->base, instance, lookup_cache,
+                                  deliver_hit) != LIBCOUCHBASE_SUCCESS) {
+        free(cache);
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    cache->max_bytes = max_bytes;
+    cache->ttl = ttl;
+
+    instance->near_cache = cache;
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+static void near_cache_destroy(libcouchbase_t instance, int deliver)
+{
+    struct libcouchbase_near_cache_st *cache = instance->near_cache;
+
+    instance->near_cache = NULL;
+    if (cache->tap != NULL) {
+        cache->tap->near_cache_owner = NULL;
+    }
+
+    libcouchbase_cache_destroy(&cache->base, deliver);
+    free(cache);
+}
+
+/**
+ * Release the near cache of an instance being destroyed (the pending
+ * hits are dropped just like the commands in flight), and break the
+ * link between an instance and the near cache it feeds with TAP.
+ */
+void libcouchbase_near_cache_destroy(libcouchbase_t instance)
+{
+    if (instance->near_cache != NULL) {
+        near_cache_destroy(instance, 0);
+    }
+    if (instance->near_cache_owner != NULL) {
+        instance->near_cache_owner->near_cache->tap = NULL;
+        instance->near_cache_owner = NULL;
+    }
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_disable_near_cache(libcouchbase_t instance)
+{
+    if (instance->near_cache == NULL) {
+        return LIBCOUCHBASE_KEY_ENOENT;
+    }
+
+    /* The hits already found are delivered before we return */
+    near_cache_destroy(instance, 1);
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_near_cache_tap(libcouchbase_t instance,
+                                                 libcouchbase_t tap,
+                                                 libcouchbase_tap_filter_t filter)
+{
+    libcouchbase_error_t err;
+
+    if (instance->near_cache == NULL) {
+        return LIBCOUCHBASE_KEY_ENOENT;
+    }
+
+    if (tap == instance || tap->near_cache_owner != NULL) {
+        return libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                          "The TAP instance is already in use");
+    }
+
+    err = libcouchbase_tap_cluster(tap, NULL, filter, 0);
+    if (err != LIBCOUCHBASE_SUCCESS) {
+        return err;
+    }
+
+    if (instance->near_cache->tap != NULL) {
+        instance->near_cache->tap->near_cache_owner = NULL;
+    }
+    instance->near_cache->tap = tap;
+    tap->near_cache_owner = instance;
+    return LIBCOUCHBASE_SUCCESS;
+}
@@ -0,0 +1,236 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the negative cache: a set of the keys recently
+ * reported as missing by the server. A get for one of those keys is
+ * answered with LIBCOUCHBASE_KEY_ENOENT without asking the server, until
+ * the entry expires (after a short time-to-live) or the key is modified
+ * through the same instance.
+ *
+ * Since all of the entries have the same time-to-live, the list of the
+ * entries is ordered by the expiration time and we may expire them
+ * from the tail of the list.
+ */
+
+#include "internal.h"
+
+struct libcouchbase_negative_cache_st {
+    struct libcouchbase_cache_st base;
+    libcouchbase_size_t max_items;
+    /** The lifetime of an entry (in usec) */
+    libcouchbase_uint32_t ttl;
+};
+
+static void expire_entries(struct libcouchbase_negative_cache_st *cache,
+                           hrtime_t now)
+{
+    while (cache->base.tail != NULL && cache->base.tail->expires < now) {
+        libcouchbase_cache_remove(&cache->base, cache->base.tail);
+    }
+}
+
+static struct libcouchbase_cache_st *lookup_cache(libcouchbase_t instance)
+{
+    if (instance->negative_cache == NULL) {
+        return NULL;
+    }
+    return &instance->negative_cache->base;
+}
+
+static void deliver_hit(libcouchbase_t instance, const void *cookie,
+                        struct libcouchbase_cache_entry_st *entry)
+{
+    instance->sync_retcode = LIBCOUCHBASE_KEY_ENOENT;
+    instance->callbacks.get(instance, cookie, LIBCOUCHBASE_KEY_ENOENT,
+                            entry->key + sizeof(libcouchbase_uint16_t),
+                            entry->nkey - sizeof(libcouchbase_uint16_t),
+                            NULL, 0, 0, 0);
+}
+
+/**
+ * Look up a key in the negative cache. If found, a call to the get
+ * callback with LIBCOUCHBASE_KEY_ENOENT is scheduled.
+ *
+ * @return non-zero if the key was found (and no get should be sent)
+ */
+int libcouchbase_negative_cache_get(libcouchbase_t instance, int vb,
+                                    const void *command_cookie,
+                                    const void *key, libcouchbase_size_t nkey)
+{
+    struct libcouchbase_negative_cache_st *cache = instance->negative_cache;
+    struct libcouchbase_cache_entry_st *entry;
+
+    expire_entries(cache, gethrtime());
+    entry = libcouchbase_cache_find(&cache->base, vb, key, nkey);
+    if (entry == NULL ||
+            !libcouchbase_cache_add_hit(&cache->base, command_cookie, entry)) {
+        /* Just ask the server */
+        return 0;
+    }
+
+    ++instance->stats.negative_cache_hits;
+    return 1;
+}
+
+/**
+ * Remember that the key for the get request at the head of the command
+ * log doesn't exist.
+ */
+void libcouchbase_negative_cache_store(libcouchbase_server_t *server,
+                                       const void *key,
+                                       libcouchbase_size_t nkey)
+{
+    struct libcouchbase_negative_cache_st *cache = server->instance->negative_cache;
+    struct libcouchbase_cache_entry_st *entry;
+    protocol_binary_request_header req;
+    libcouchbase_uint16_t vbid;
+    hrtime_t now = gethrtime();
+
+    if (ringbuffer_peek(&server->cmd_log, req.bytes, sizeof(req.bytes)) != sizeof(req.bytes)) {
+        return;
+    }
+
+    switch (req.request.opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        break;
+    default:
+        return;
+    }
+
+    expire_entries(cache, now);
+
+    vbid = ntohs(req.request.vbucket);
+    if (!libcouchbase_cache_may_fill(server->instance, vbid, key, nkey,
+                                     req.request.opaque)) {
+        /* The key was modified after we sent the get */
+        return;
+    }
+
+    entry = libcouchbase_cache_find(&cache->base, vbid, key, nkey);
+    if (entry != NULL) {
+        libcouchbase_cache_remove(&cache->base, entry);
+    } else if (hashtable_num_items(cache->base.items) >= cache->max_items) {
+        libcouchbase_cache_remove(&cache->base, cache->base.tail);
+    }
+
+    entry = libcouchbase_cache_entry_create(sizeof(*entry), vbid, key, nkey, 0);
+    if (entry == NULL) {
+        return;
+    }
+    entry->expires = now + (hrtime_t)cache->ttl * 1000;
+    (void)libcouchbase_cache_add(&cache->base, entry);
+}
+
+void libcouchbase_negative_cache_invalidate(libcouchbase_t instance, int vb,
+                                            const void *key,
+                                            libcouchbase_size_t nkey)
+{
+    struct libcouchbase_cache_st *cache = &instance->negative_cache->base;
+    struct libcouchbase_cache_entry_st *entry;
+
+    entry = libcouchbase_cache_find(cache, vb, key, nkey);
+    if (entry != NULL) {
+        libcouchbase_cache_remove(cache, entry);
+        ++instance->stats.negative_cache_invalidations;
+    }
+}
+
+void libcouchbase_negative_cache_invalidate_all(libcouchbase_t instance)
+{
+    struct libcouchbase_cache_st *cache = &instance->negative_cache->base;
+
+    instance->stats.negative_cache_invalidations += hashtable_num_items(cache->items);
+    libcouchbase_cache_clear(cache);
+}
+
+int libcouchbase_negative_cache_has_hits(libcouchbase_t instance)
+{
+    return ringbuffer_get_nbytes(&instance->negative_cache->base.hits) != 0;
+}
+
+libcouchbase_size_t libcouchbase_negative_cache_nitems(libcouchbase_t instance)
+{
+    return hashtable_num_items(instance->negative_cache->base.items);
+}
+
+static void negative_cache_destroy(libcouchbase_t instance, int deliver)
+{
+    struct libcouchbase_negative_cache_st *cache = instance->negative_cache;
+
+    instance->negative_cache = NULL;
+    libcouchbase_cache_destroy(&cache->base, deliver);
+    free(cache);
+}
+
+/**
+ * Release the negative cache of an instance being destroyed (the
+ * pending misses are dropped just like the commands in flight)
+ */
+void libcouchbase_negative_cache_destroy(libcouchbase_t instance)
+{
+    if (instance->negative_cache != NULL) {
+        negative_cache_destroy(instance, 0);
+    }
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_enable_negative_cache(libcouchbase_t instance,
+                                                        libcouchbase_size_t max_keys,
+                                                        libcouchbase_uint32_t ttl)
+{
+    struct libcouchbase_negative_cache_st *cache;
+
+    if (instance->negative_cache != NULL) {
+        return LIBCOUCHBASE_KEY_EEXISTS;
+    }
+
+    if (max_keys == 0 || ttl == 0) {
+        return libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                          "The negative cache needs a size and a time-to-live");
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    if (libcouchbase_cache_create(&cache->base, instance, lookup_cache,
+                                  deliver_hit) != LIBCOUCHBASE_SUCCESS) {
+        free(cache);
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    cache->max_items = max_keys;
+    cache->ttl = ttl;
+
+    instance->negative_cache = cache;
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_disable_negative_cache(libcouchbase_t instance)
+{
+    if (instance->negative_cache == NULL) {
+        return LIBCOUCHBASE_KEY_ENOENT;
+    }
+
+    /* The misses already found are delivered before we return */
+    negative_cache_destroy(instance, 1);
+    return LIBCOUCHBASE_SUCCESS;
+}
@@ -36,7 +36,21 @@ void libcouchbase_server_buffer_start_packet(libcouchbase_server_t *c,
     /* so I need to pass it down the chain so that a large */
     /* multiget can reuse the same timer... */
     ct.start = gethrtime();
+    ct.sent = (buff == &c->output) ? ct.start : 0;
     ct.cookie = command_cookie;
+    ct.callback.get = NULL;
+    ct.retries = 0;
+
+    if (buff == &c->held) {
+        /* Held commands go into the command log when they're sent */
+        if (!ringbuffer_ensure_capacity(buff, size) ||
+                !ringbuffer_ensure_capacity(buff_cookie, sizeof(ct)) ||
+                ringbuffer_write(buff, data, size) != size ||
+                ringbuffer_write(buff_cookie, &ct, sizeof(ct)) != sizeof(ct)) {
+            abort();
+        }
+        return;
+    }
 
     if (ringbuffer_get_nbytes(buff_cookie) == 0) {
         c->next_timeout = ct.start;
@@ -54,13 +68,27 @@ void libcouchbase_server_buffer_start_packet(libcouchbase_server_t *c,
 }
 
 void libcouchbase_server_buffer_retry_packet(libcouchbase_server_t *c,
-                                             struct libcouchbase_command_data_st *ct,
+                                             const struct libcouchbase_command_data_st *ct,
                                              ringbuffer_t *buff,
                                              ringbuffer_t *buff_cookie,
                                              const void *data,
                                              libcouchbase_size_t size)
 {
     libcouchbase_size_t ct_size = sizeof(struct libcouchbase_command_data_st);
+    struct libcouchbase_command_data_st copy = *ct;
+
+    copy.sent = (buff == &c->output) ? gethrtime() : 0;
+    if (buff == &c->held) {
+        /* Held commands go into the command log when they're sent */
+        if (!ringbuffer_ensure_capacity(buff, size) ||
+                !ringbuffer_ensure_capacity(buff_cookie, ct_size) ||
+                ringbuffer_write(buff, data, size) != size ||
+                ringbuffer_write(buff_cookie, &copy, ct_size) != ct_size) {
+            abort();
+        }
+        return;
+    }
+
     if (ringbuffer_get_nbytes(buff_cookie) == 0) {
         c->next_timeout = ct->start;
         libcouchbase_update_timer(c->instance);
@@ -71,7 +99,7 @@ void libcouchbase_server_buffer_retry_packet(libcouchbase_server_t *c,
             !ringbuffer_ensure_capacity(buff_cookie, ct_size) ||
             ringbuffer_write(buff, data, size) != size ||
             ringbuffer_write(&c->cmd_log, data, size) != size ||
-            ringbuffer_write(buff_cookie, ct, ct_size) != ct_size) {
+            ringbuffer_write(buff_cookie, &copy, ct_size) != ct_size) {
         abort();
     }
 }
@@ -81,7 +109,14 @@ void libcouchbase_server_buffer_write_packet(libcouchbase_server_t *c,
                                              const void *data,
                                              libcouchbase_size_t size)
 {
-    (void)c;
+    if (buff == &c->held) {
+        if (!ringbuffer_ensure_capacity(buff, size) ||
+                ringbuffer_write(buff, data, size) != size) {
+            abort();
+        }
+        return;
+    }
+
     if (!ringbuffer_ensure_capacity(buff, size) ||
             !ringbuffer_ensure_capacity(&c->cmd_log, size) ||
             ringbuffer_write(buff, data, size) != size ||
@@ -111,11 +146,17 @@ void libcouchbase_server_buffer_complete_packet(libcouchbase_server_t *c,
 }
 
 void libcouchbase_server_retry_packet(libcouchbase_server_t *c,
-                                      struct libcouchbase_command_data_st *command_data,
+                                      const struct libcouchbase_command_data_st *command_data,
                                       const void *data,
                                       libcouchbase_size_t size)
 {
-    if (c->connected) {
+    c->holding = c->connected && libcouchbase_window_is_full(c, data);
+    if (c->holding) {
+        libcouchbase_server_buffer_retry_packet(c, command_data,
+                                                &c->held,
+                                                &c->held_cookies,
+                                                data, size);
+    } else if (c->connected) {
         libcouchbase_server_buffer_retry_packet(c, command_data,
                                                 &c->output,
                                                 &c->output_cookies,
@@ -133,7 +174,13 @@ void libcouchbase_server_start_packet(libcouchbase_server_t *c,
                                       const void *data,
                                       libcouchbase_size_t size)
 {
-    if (c->connected) {
+    c->holding = c->connected && libcouchbase_window_is_full(c, data);
+    if (c->holding) {
+        libcouchbase_server_buffer_start_packet(c, command_cookie,
+                                                &c->held,
+                                                &c->held_cookies,
+                                                data, size);
+    } else if (c->connected) {
         libcouchbase_server_buffer_start_packet(c, command_cookie,
                                                 &c->output,
                                                 &c->output_cookies,
@@ -150,13 +197,35 @@ void libcouchbase_server_write_packet(libcouchbase_server_t *c,
                                       const void *data,
                                       libcouchbase_size_t size)
 {
-    if (c->connected) {
+    if (c->holding) {
+        libcouchbase_server_buffer_write_packet(c, &c->held, data, size);
+    } else if (c->connected) {
         libcouchbase_server_buffer_write_packet(c, &c->output, data, size);
     } else {
         libcouchbase_server_buffer_write_packet(c, &c->pending, data, size);
     }
 }
 
+void libcouchbase_server_write_packet_ringbuffer(libcouchbase_server_t *c,
+                                                 ringbuffer_t *src,
+                                                 libcouchbase_size_t size)
+{
+    ringbuffer_t *buff;
+
+    if (c->holding) {
+        buff = &c->held;
+    } else if (c->connected) {
+        buff = &c->output;
+    } else {
+        buff = &c->pending;
+    }
+
+    if (ringbuffer_memcpy(buff, src, size) != 0 ||
+            (buff != &c->held && ringbuffer_memcpy(&c->cmd_log, src, size) != 0)) {
+        abort();
+    }
+}
+
 void libcouchbase_server_end_packet(libcouchbase_server_t *c)
 {
     (void)c;
@@ -167,7 +236,13 @@ void libcouchbase_server_complete_packet(libcouchbase_server_t *c,
                                          const void *data,
                                          libcouchbase_size_t size)
 {
-    if (c->connected) {
+    c->holding = c->connected && libcouchbase_window_is_full(c, data);
+    if (c->holding) {
+        libcouchbase_server_buffer_complete_packet(c, command_cookie,
+                                                   &c->held,
+                                                   &c->held_cookies,
+                                                   data, size);
+    } else if (c->connected) {
         libcouchbase_server_buffer_complete_packet(c, command_cookie,
                                                    &c->output,
                                                    &c->output_cookies,
@@ -0,0 +1,538 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the submission queue used to pass operations to
+ * an instance from other threads. The producers push the operations on
+ * a lock free stack (with compare-and-swap), and the thread running
+ * the event loop grabs the entire stack at once and runs the operations
+ * in the order they were pushed. Since the consumer never pops single
+ * entries there is no ABA problem.
+ */
+
+#include "internal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+typedef enum {
+    QUEUE_GET,
+    QUEUE_STORE,
+    QUEUE_ARITHMETIC,
+    QUEUE_REMOVE,
+    /** A new cluster configuration (see sharded.c and configprovider.c) */
+    QUEUE_CONFIG,
+    /** Open the config stream (see configprovider.c) */
+    QUEUE_CONNECT
+} queue_op_type_t;
+
+struct queue_op_st {
+    struct queue_op_st *next;
+    queue_op_type_t type;
+    const void *cookie;
+    libcouchbase_storage_t operation;
+    libcouchbase_uint32_t flags;
+    libcouchbase_time_t exp;
+    libcouchbase_cas_t cas;
+    libcouchbase_int64_t delta;
+    libcouchbase_uint64_t initial;
+    int create;
+    /** The key followed by the value */
+    char *key;
+    libcouchbase_size_t nkey;
+    libcouchbase_size_t nbytes;
+    /** The configuration (we hold a reference to it) */
+    struct libcouchbase_config_snapshot_st *snapshot;
+};
+
+struct libcouchbase_queue_st {
+    /** The operations submitted, the last one first */
+    struct queue_op_st *volatile head;
+    /** The descriptor we read (and write to if it's an eventfd) */
+    int rfd;
+    /** The descriptor we write to */
+    int wfd;
+    void *event;
+};
+
+static void queue_op_destroy(struct queue_op_st *op)
+{
+    if (op->snapshot != NULL) {
+        libcouchbase_config_snapshot_unref(op->snapshot);
+    }
+    free(op);
+}
+
+#ifndef _WIN32
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int wakeup_create(struct libcouchbase_queue_st *queue)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    queue->rfd = eventfd(0, EFD_NONBLOCK);
+    if (queue->rfd != -1) {
+        queue->wfd = queue->rfd;
+        return 0;
+    }
+#endif
+    {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            return -1;
+        }
+        if (set_nonblocking(fds[0]) == -1 || set_nonblocking(fds[1]) == -1) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        queue->rfd = fds[0];
+        queue->wfd = fds[1];
+    }
+    return 0;
+}
+
+static void wakeup_destroy(struct libcouchbase_queue_st *queue)
+{
+    close(queue->rfd);
+    if (queue->wfd != queue->rfd) {
+        close(queue->wfd);
+    }
+}
+
+static void wakeup_signal(struct libcouchbase_queue_st *queue)
+{
+    /*
+     * If the write fails the descriptor is already readable (the pipe
+     * is full or the eventfd counter is huge), so there is nothing to
+     * do about it.
+     */
+    libcouchbase_uint64_t val = 1;
+    libcouchbase_size_t nbytes = sizeof(val);
+
+    if (queue->wfd != queue->rfd) {
+        /* a single byte is enough for a pipe */
+        nbytes = 1;
+    }
+    if (write(queue->wfd, &val, nbytes) == -1) {
+        return;
+    }
+}
+
+static void wakeup_clear(struct libcouchbase_queue_st *queue)
+{
+    char buffer[64];
+
+    if (queue->wfd == queue->rfd) {
+        /* Reading an eventfd resets the counter */
+        if (read(queue->rfd, buffer, sizeof(libcouchbase_uint64_t)) == -1) {
+            return;
+        }
+    } else {
+        while (read(queue->rfd, buffer, sizeof(buffer)) > 0) {
+            /* empty the pipe */
+        }
+    }
+}
+
+/**
+ * Run the operations in the queue
+ */
+static void queue_drain(libcouchbase_t instance,
+                        struct libcouchbase_queue_st *queue)
+{
+    struct queue_op_st *head, *op;
+    struct queue_op_st *list = NULL;
+
+    do {
+        head = queue->head;
+    } while (head != NULL && !atomic_cas_ptr(&queue->head, head, NULL));
+
+    /* Put them back in the order they were submitted */
+    while (head != NULL) {
+        op = head;
+        head = head->next;
+        op->next = list;
+        list = op;
+    }
+
+    while (list != NULL) {
+        libcouchbase_error_t err = LIBCOUCHBASE_SUCCESS;
+
+        op = list;
+        list = list->next;
+        ++instance->stats.submission_queue_ops;
+
+        switch (op->type) {
+        case QUEUE_GET:
+            err = libcouchbase_mget(instance, op->cookie, 1,
+                                    (const void * const *)&op->key,
+                                    &op->nkey, NULL);
+            if (err != LIBCOUCHBASE_SUCCESS) {
+                instance->callbacks.get(instance, op->cookie, err,
+                                        op->key, op->nkey, NULL, 0, 0, 0);
+            }
+            break;
+        case QUEUE_STORE:
+            err = libcouchbase_store(instance, op->cookie, op->operation,
+                                     op->key, op->nkey,
+                                     op->key + op->nkey, op->nbytes,
+                                     op->flags, op->exp, op->cas);
+            if (err != LIBCOUCHBASE_SUCCESS) {
+                instance->callbacks.storage(instance, op->cookie,
+                                            op->operation, err,
+                                            op->key, op->nkey, 0);
+            }
+            break;
+        case QUEUE_ARITHMETIC:
+            err = libcouchbase_arithmetic(instance, op->cookie,
+                                          op->key, op->nkey, op->delta,
+                                          op->exp, op->create, op->initial);
+            if (err != LIBCOUCHBASE_SUCCESS) {
+                instance->callbacks.arithmetic(instance, op->cookie, err,
+                                               op->key, op->nkey, 0, 0);
+            }
+            break;
+        case QUEUE_REMOVE:
+            err = libcouchbase_remove(instance, op->cookie,
+                                      op->key, op->nkey, op->cas);
+            if (err != LIBCOUCHBASE_SUCCESS) {
+                instance->callbacks.remove(instance, op->cookie, err,
+                                           op->key, op->nkey);
+            }
+            break;
+        case QUEUE_CONFIG:
+            libcouchbase_update_config(instance, op->snapshot->json,
+                                       op->snapshot->njson);
+            break;
+        case QUEUE_CONNECT:
+            libcouchbase_connect_config_stream(instance);
+            break;
+        }
+        queue_op_destroy(op);
+    }
+}
+
+static void queue_event_handler(libcouchbase_socket_t sock,
+                                short which,
+                                void *arg)
+{
+    libcouchbase_t instance = arg;
+
+    ++instance->stats.submission_queue_wakeups;
+    wakeup_clear(instance->queue);
+    queue_drain(instance, instance->queue);
+    libcouchbase_maybe_breakout(instance);
+
+    (void)sock;
+    (void)which;
+}
+
+static libcouchbase_error_t queue_push(libcouchbase_t instance,
+                                       struct queue_op_st *op)
+{
+    struct libcouchbase_queue_st *queue = instance->queue;
+    struct queue_op_st *head;
+
+    do {
+        head = queue->head;
+        op->next = head;
+    } while (!atomic_cas_ptr(&queue->head, head, op));
+
+    if (head == NULL) {
+        /* The queue was empty, so the consumer may be sleeping */
+        wakeup_signal(queue);
+    }
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_enable_submission_queue(libcouchbase_t instance)
+{
+    struct libcouchbase_queue_st *queue;
+
+    if (instance->queue != NULL) {
+        return LIBCOUCHBASE_KEY_EEXISTS;
+    }
+
+    if (instance->syncmode == LIBCOUCHBASE_SYNCHRONOUS) {
+        return libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                          "The submission queue requires asynchronous mode");
+    }
+
+    queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+
+    if (wakeup_create(queue) == -1) {
+        free(queue);
+        return libcouchbase_error_handler(instance, LIBCOUCHBASE_NETWORK_ERROR,
+                                          "Failed to create the wakeup descriptor");
+    }
+
+    queue->event = instance->io->create_event(instance->io);
+    if (queue->event == NULL) {
+        wakeup_destroy(queue);
+        free(queue);
+        return LIBCOUCHBASE_ENOMEM;
+    }
+
+    instance->queue = queue;
+    libcouchbase_update_event(instance, queue->rfd, queue->event,
+                              LIBCOUCHBASE_READ_EVENT, instance,
+                              queue_event_handler);
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+int libcouchbase_submission_queue_has_ops(libcouchbase_t instance)
+{
+    return instance->queue->head != NULL;
+}
+
+void libcouchbase_submission_queue_destroy(libcouchbase_t instance, int drain)
+{
+    struct libcouchbase_queue_st *queue = instance->queue;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    if (drain) {
+        queue_drain(instance, queue);
+    } else {
+        while (queue->head != NULL) {
+            struct queue_op_st *op = queue->head;
+            queue->head = op->next;
+            queue_op_destroy(op);
+        }
+    }
+
+    libcouchbase_delete_event(instance, queue->rfd, queue->event);
+    libcouchbase_destroy_event(instance, queue->event);
+    wakeup_destroy(queue);
+    free(queue);
+    instance->queue = NULL;
+}
+
+#else
+
+/* The event loop on windows can only wait for sockets */
+
+static libcouchbase_error_t queue_push(libcouchbase_t instance,
+                                       struct queue_op_st *op)
+{
+    (void)instance;
+    queue_op_destroy(op);
+    return LIBCOUCHBASE_NOT_SUPPORTED;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_enable_submission_queue(libcouchbase_t instance)
+{
+    (void)instance;
+    return LIBCOUCHBASE_NOT_SUPPORTED;
+}
+
+int libcouchbase_submission_queue_has_ops(libcouchbase_t instance)
+{
+    (void)instance;
+    return 0;
+}
+
+void libcouchbase_submission_queue_destroy(libcouchbase_t instance, int drain)
+{
+    (void)instance;
+    (void)drain;
+}
+
+#endif
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_disable_submission_queue(libcouchbase_t instance)
+{
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_KEY_ENOENT;
+    }
+    libcouchbase_submission_queue_destroy(instance, 1);
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+/**
+ * Allocate an operation with room for the key and the value. This is
+ * called by the producers, so it must not touch the instance.
+ */
+static struct queue_op_st *queue_op_create(queue_op_type_t type,
+                                           const void *cookie,
+                                           const void *key,
+                                           libcouchbase_size_t nkey,
+                                           const void *bytes,
+                                           libcouchbase_size_t nbytes)
+{
+    struct queue_op_st *op = calloc(1, sizeof(*op) + nkey + nbytes);
+    if (op == NULL) {
+        return NULL;
+    }
+    op->type = type;
+    op->cookie = cookie;
+    op->key = (char *)(op + 1);
+    if (nkey != 0) {
+        memcpy(op->key, key, nkey);
+    }
+    op->nkey = nkey;
+    if (nbytes != 0) {
+        memcpy(op->key + nkey, bytes, nbytes);
+    }
+    op->nbytes = nbytes;
+    return op;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_queue_get(libcouchbase_t instance,
+                                            const void *command_cookie,
+                                            const void *key,
+                                            libcouchbase_size_t nkey)
+{
+    struct queue_op_st *op;
+
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_EINVAL;
+    }
+    op = queue_op_create(QUEUE_GET, command_cookie, key, nkey, NULL, 0);
+    if (op == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    return queue_push(instance, op);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_queue_store(libcouchbase_t instance,
+                                              const void *command_cookie,
+                                              libcouchbase_storage_t operation,
+                                              const void *key,
+                                              libcouchbase_size_t nkey,
+                                              const void *bytes,
+                                              libcouchbase_size_t nbytes,
+                                              libcouchbase_uint32_t flags,
+                                              libcouchbase_time_t exp,
+                                              libcouchbase_cas_t cas)
+{
+    struct queue_op_st *op;
+
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_EINVAL;
+    }
+    op = queue_op_create(QUEUE_STORE, command_cookie, key, nkey,
+                         bytes, nbytes);
+    if (op == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    op->operation = operation;
+    op->flags = flags;
+    op->exp = exp;
+    op->cas = cas;
+    return queue_push(instance, op);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_queue_arithmetic(libcouchbase_t instance,
+                                                   const void *command_cookie,
+                                                   const void *key,
+                                                   libcouchbase_size_t nkey,
+                                                   libcouchbase_int64_t delta,
+                                                   libcouchbase_time_t exp,
+                                                   int create,
+                                                   libcouchbase_uint64_t initial)
+{
+    struct queue_op_st *op;
+
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_EINVAL;
+    }
+    op = queue_op_create(QUEUE_ARITHMETIC, command_cookie, key, nkey,
+                         NULL, 0);
+    if (op == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    op->delta = delta;
+    op->exp = exp;
+    op->create = create;
+    op->initial = initial;
+    return queue_push(instance, op);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_queue_remove(libcouchbase_t instance,
+                                               const void *command_cookie,
+                                               const void *key,
+                                               libcouchbase_size_t nkey,
+                                               libcouchbase_cas_t cas)
+{
+    struct queue_op_st *op;
+
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_EINVAL;
+    }
+    op = queue_op_create(QUEUE_REMOVE, command_cookie, key, nkey, NULL, 0);
+    if (op == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    op->cas = cas;
+    return queue_push(instance, op);
+}
+
+libcouchbase_error_t libcouchbase_queue_config(libcouchbase_t instance,
+                                               struct libcouchbase_config_snapshot_st *snapshot)
+{
+    struct queue_op_st *op;
+
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_EINVAL;
+    }
+    op = queue_op_create(QUEUE_CONFIG, NULL, NULL, 0, NULL, 0);
+    if (op == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    libcouchbase_config_snapshot_ref(snapshot);
+    op->snapshot = snapshot;
+    return queue_push(instance, op);
+}
+
+libcouchbase_error_t libcouchbase_queue_connect(libcouchbase_t instance)
+{
+    struct queue_op_st *op;
+
+    if (instance->queue == NULL) {
+        return LIBCOUCHBASE_EINVAL;
+    }
+    op = queue_op_create(QUEUE_CONNECT, NULL, NULL, 0, NULL, 0);
+    if (op == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    return queue_push(instance, op);
+}
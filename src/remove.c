@@ -40,6 +40,19 @@ libcouchbase_error_t libcouchbase_remove_by_key(libcouchbase_t instance,
                                                 libcouchbase_size_t nhashkey,
                                                 const void *key, libcouchbase_size_t nkey,
                                                 libcouchbase_cas_t cas)
+{
+    return libcouchbase_remove_with_callback(instance, command_cookie, NULL,
+                                             hashkey, nhashkey, key, nkey, cas);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_remove_with_callback(libcouchbase_t instance,
+                                                       const void *command_cookie,
+                                                       libcouchbase_remove_callback callback,
+                                                       const void *hashkey,
+                                                       libcouchbase_size_t nhashkey,
+                                                       const void *key, libcouchbase_size_t nkey,
+                                                       libcouchbase_cas_t cas)
 {
     libcouchbase_server_t *server;
     protocol_binary_request_delete req;
@@ -50,6 +63,10 @@ libcouchbase_error_t libcouchbase_remove_by_key(libcouchbase_t instance,
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
     }
 
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
     if (nhashkey == 0) {
         nhashkey = nkey;
         hashkey = key;
@@ -59,7 +76,7 @@ libcouchbase_error_t libcouchbase_remove_by_key(libcouchbase_t instance,
         /* the config says that there is no server yet at that position (-1) */
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
     }
-    server = instance->servers + idx;
+    server = libcouchbase_get_server(instance, idx, vb, 0);
 
     memset(&req, 0, sizeof(req));
     req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -72,11 +89,103 @@ libcouchbase_error_t libcouchbase_remove_by_key(libcouchbase_t instance,
     req.message.header.request.opaque = ++instance->seqno;
     req.message.header.request.cas = cas;
 
-    libcouchbase_server_start_packet(server, command_cookie,
-                                     req.bytes, sizeof(req.bytes));
+    libcouchbase_cache_invalidate(instance, vb, key, nkey);
+    if (callback != NULL) {
+        struct libcouchbase_command_data_st ct;
+        ct.start = gethrtime();
+        ct.cookie = command_cookie;
+        ct.callback.remove = callback;
+        ct.retries = 0;
+        /* Use the retry function so that we may pass our own command data */
+        libcouchbase_server_retry_packet(server, &ct, req.bytes, sizeof(req.bytes));
+    } else {
+        libcouchbase_server_start_packet(server, command_cookie,
+                                         req.bytes, sizeof(req.bytes));
+    }
     libcouchbase_server_write_packet(server, key, nkey);
     libcouchbase_server_end_packet(server);
     libcouchbase_server_send_packets(server);
 
     return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
 }
+
+/**
+ * libcouchbase_mremove use the DELETEQ command followed by a NOOP command
+ * to avoid transferring the responses for the successful operations.
+ * All of the success callbacks are generated implicit by receiving a
+ * later response or the NOOP.
+ */
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mremove(libcouchbase_t instance,
+                                          const void *command_cookie,
+                                          libcouchbase_size_t num_keys,
+                                          const void *const *keys,
+                                          const libcouchbase_size_t *nkey,
+                                          const libcouchbase_cas_t *cas)
+{
+    return libcouchbase_mremove_by_key(instance, command_cookie, NULL, 0,
+                                       num_keys, keys, nkey, cas);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mremove_by_key(libcouchbase_t instance,
+                                                 const void *command_cookie,
+                                                 const void *hashkey,
+                                                 libcouchbase_size_t nhashkey,
+                                                 libcouchbase_size_t num_keys,
+                                                 const void *const *keys,
+                                                 const libcouchbase_size_t *nkey,
+                                                 const libcouchbase_cas_t *cas)
+{
+    struct libcouchbase_multi_st multi;
+    libcouchbase_error_t err;
+    libcouchbase_size_t ii;
+
+    /* we need a vbucket config before we can start removing the items.. */
+    if (instance->vbucket_config == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
+    }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    if (num_keys == 1) {
+        return libcouchbase_remove_by_key(instance, command_cookie, hashkey,
+                                          nhashkey, keys[0], nkey[0],
+                                          cas ? cas[0] : 0);
+    }
+
+    err = libcouchbase_multi_start(&multi, instance, command_cookie,
+                                   hashkey, nhashkey, num_keys, keys, nkey);
+    if (err != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, err);
+    }
+
+    for (ii = 0; ii < num_keys; ++ii) {
+        protocol_binary_request_delete req;
+        int vb = libcouchbase_multi_vbucket(&multi, ii);
+        libcouchbase_server_t *server = libcouchbase_multi_server(&multi, ii, 0);
+
+        memset(&req, 0, sizeof(req));
+        req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_DELETEQ;
+        req.message.header.request.keylen = ntohs((libcouchbase_uint16_t)nkey[ii]);
+        req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        req.message.header.request.vbucket = ntohs((libcouchbase_uint16_t)vb);
+        req.message.header.request.bodylen = ntohl((libcouchbase_uint32_t)nkey[ii]);
+        req.message.header.request.opaque = ++instance->seqno;
+        if (cas) {
+            req.message.header.request.cas = cas[ii];
+        }
+
+        libcouchbase_cache_invalidate(instance, vb, keys[ii], nkey[ii]);
+        libcouchbase_server_start_packet(server, command_cookie,
+                                         req.bytes, sizeof(req.bytes));
+        libcouchbase_server_write_packet(server, keys[ii], nkey[ii]);
+        libcouchbase_server_end_packet(server);
+    }
+    libcouchbase_multi_end(&multi, 1);
+
+    return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+}
@@ -0,0 +1,507 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the retry of commands the server failed with a
+ * temporary failure (TMPFAIL or ENOMEM, while it's warming up or low
+ * on memory). The packet is moved from the command log to a list of
+ * commands to retry, and it's sent again once the backoff delay has
+ * passed. The delay is doubled for every retry of the command (with
+ * a random part so that the retries from many clients don't arrive
+ * at the same time). If the command would time out before the next
+ * retry the error is passed to the user instead.
+ *
+ * A command that gets NOT_MY_VBUCKET is moved from the command log
+ * straight into the connection to the next guess for the master of
+ * the vbucket, and we ask for a new cluster configuration (at most
+ * once per LIBCOUCHBASE_CONFIG_REFRESH_INTERVAL). If the vbucket is
+ * already moving the guess was wrong, so the command waits in the list
+ * for the new configuration instead of bouncing between the servers.
+ *
+ * A quiet command is sent again as its normal form. It was part of a
+ * batch terminated by a NOOP, and it goes out alone now, so the server
+ * has to respond to it even if it succeeds.
+ *
+ * A get sent while a mutation waits for its retry may be executed
+ * before it, so a mutation that is sent again invalidates the key in
+ * the client side caches once more (with the new opaque).
+ */
+
+#include "internal.h"
+
+struct libcouchbase_retry_st {
+    /** When to send the command again */
+    hrtime_t due;
+    struct libcouchbase_command_data_st ct;
+    /** The server that failed the command */
+    int index;
+    /** Set if we're waiting for the vbucket to move */
+    int moved;
+    libcouchbase_size_t npacket;
+    struct libcouchbase_retry_st *next;
+    /** The packet from the command log (npacket bytes) */
+    char packet[1];
+};
+
+static void retry_timeout_handler(libcouchbase_socket_t sock,
+                                  short which,
+                                  void *arg);
+static void send_retry(libcouchbase_t instance,
+                       struct libcouchbase_retry_st *retry);
+
+static int is_retriable(libcouchbase_uint8_t opcode)
+{
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+    case PROTOCOL_BINARY_CMD_GAT:
+    case PROTOCOL_BINARY_CMD_GATQ:
+    case PROTOCOL_BINARY_CMD_TOUCH:
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+    case PROTOCOL_BINARY_CMD_DELETE:
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Get the opcode to use when a command is sent on its own
+ */
+static libcouchbase_uint8_t unquiet_opcode(libcouchbase_uint8_t opcode)
+{
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_GETQ:
+        return PROTOCOL_BINARY_CMD_GET;
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        return PROTOCOL_BINARY_CMD_GETK;
+    case PROTOCOL_BINARY_CMD_GATQ:
+        return PROTOCOL_BINARY_CMD_GAT;
+    case PROTOCOL_BINARY_CMD_SETQ:
+        return PROTOCOL_BINARY_CMD_SET;
+    case PROTOCOL_BINARY_CMD_ADDQ:
+        return PROTOCOL_BINARY_CMD_ADD;
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+        return PROTOCOL_BINARY_CMD_REPLACE;
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+        return PROTOCOL_BINARY_CMD_APPEND;
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+        return PROTOCOL_BINARY_CMD_PREPEND;
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+        return PROTOCOL_BINARY_CMD_DELETE;
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+        return PROTOCOL_BINARY_CMD_INCREMENT;
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+        return PROTOCOL_BINARY_CMD_DECREMENT;
+    default:
+        return opcode;
+    }
+}
+
+/**
+ * Check if the command modifies the key (and the caches must forget it)
+ */
+static int is_mutation(libcouchbase_uint8_t opcode)
+{
+    switch (unquiet_opcode(opcode)) {
+    case PROTOCOL_BINARY_CMD_TOUCH:
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_DELETE:
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Make sure the timer fires for the first command in the list
+ */
+static void update_retry_timer(libcouchbase_t instance)
+{
+    hrtime_t now;
+    libcouchbase_uint32_t usec = 0;
+
+    if (instance->retries == NULL) {
+        if (instance->retry_timer_next != 0) {
+            instance->io->delete_timer(instance->io, instance->retry_timer);
+            instance->retry_timer_next = 0;
+        }
+        return;
+    }
+
+    if (instance->retry_timer_next == instance->retries->due) {
+        return;
+    }
+
+    now = gethrtime();
+    if (instance->retries->due > now) {
+        usec = (libcouchbase_uint32_t)((instance->retries->due - now) / 1000);
+    }
+    instance->io->update_timer(instance->io, instance->retry_timer, usec,
+                               instance, retry_timeout_handler);
+    instance->retry_timer_next = instance->retries->due;
+}
+
+/**
+ * Move the command at the head of the command log of the server to the
+ * list of commands to retry, unless it would time out before the delay
+ * has passed. The delay is doubled for each retry of the command.
+ *
+ * @param server the server that failed the command
+ * @param ct the command data for the command
+ * @param now the time we read the response
+ * @param backoff the delay before the first retry (in usec)
+ * @param moved set if the command waits for the vbucket to move
+ * @return non-zero if the command is going to be retried
+ */
+static int queue_retry(libcouchbase_server_t *server,
+                       const struct libcouchbase_command_data_st *ct,
+                       hrtime_t now,
+                       libcouchbase_uint32_t backoff,
+                       int moved)
+{
+    libcouchbase_t instance = server->instance;
+    protocol_binary_request_header req;
+    struct libcouchbase_retry_st *retry;
+    struct libcouchbase_retry_st **ptr;
+    hrtime_t delay;
+    hrtime_t tmo;
+    libcouchbase_size_t npacket;
+
+    if (ringbuffer_peek(&server->cmd_log, req.bytes, sizeof(req)) != sizeof(req) ||
+            !is_retriable(req.request.opcode)) {
+        return 0;
+    }
+
+    /* Double the delay for each retry, and pick a random part of it */
+    delay = backoff;
+    delay <<= (ct->retries < 16) ? ct->retries : 16;
+    if (delay > LIBCOUCHBASE_MAX_RETRY_BACKOFF) {
+        delay = LIBCOUCHBASE_MAX_RETRY_BACKOFF;
+    }
+    delay *= 1000;
+    delay = delay / 2 + (hrtime_t)(gethrtime() >> 10) % (delay / 2 + 1);
+
+    tmo = instance->timeout.usec;
+    tmo *= 1000;
+    if (now + delay >= ct->start + tmo) {
+        /* It would time out before we get to retry it */
+        return 0;
+    }
+
+    npacket = ntohl(req.request.bodylen) + sizeof(req);
+    retry = malloc(sizeof(*retry) + npacket);
+    if (retry == NULL) {
+        return 0;
+    }
+    if (ringbuffer_read(&server->cmd_log, retry->packet, npacket) != npacket) {
+        abort();
+    }
+    req.request.opcode = unquiet_opcode(req.request.opcode);
+    memcpy(retry->packet, req.bytes, sizeof(req.bytes));
+    ringbuffer_consumed(&server->output_cookies, sizeof(*ct));
+
+    retry->due = now + delay;
+    retry->ct = *ct;
+    ++retry->ct.retries;
+    retry->index = server->index;
+    retry->moved = moved;
+    retry->npacket = npacket;
+
+    /* Keep the list sorted by the time to retry */
+    ptr = &instance->retries;
+    while (*ptr != NULL && (*ptr)->due <= retry->due) {
+        ptr = &(*ptr)->next;
+    }
+    retry->next = *ptr;
+    *ptr = retry;
+    ++instance->nretries;
+
+    if (instance->retry_timer == NULL) {
+        instance->retry_timer = instance->io->create_timer(instance->io);
+    }
+    update_retry_timer(instance);
+    return 1;
+}
+
+/**
+ * Retry a command the server failed with TMPFAIL or ENOMEM (if the
+ * retries are enabled)
+ *
+ * @param server the server that failed the command
+ * @param ct the command data for the command
+ * @param now the time we read the response
+ * @return non-zero if the command is going to be retried
+ */
+int libcouchbase_retry_command(libcouchbase_server_t *server,
+                               const struct libcouchbase_command_data_st *ct,
+                               hrtime_t now)
+{
+    if (server->instance->retry_backoff == 0 || !server->connected ||
+            !queue_retry(server, ct, now, server->instance->retry_backoff, 0)) {
+        return 0;
+    }
+
+    ++server->retried;
+    ++server->instance->stats.retried;
+    return 1;
+}
+
+/**
+ * Ask for the cluster configuration again unless we just did
+ */
+static void refresh_config(libcouchbase_t instance, hrtime_t now)
+{
+    hrtime_t interval = LIBCOUCHBASE_CONFIG_REFRESH_INTERVAL;
+
+    if (now < instance->config_refresh_next) {
+        return;
+    }
+    interval *= 1000;
+    instance->config_refresh_next = now + interval;
+    /* The event handler does it when it's done with the responses */
+    instance->config_refresh_pending = 1;
+}
+
+/**
+ * Send a command the server failed with NOT_MY_VBUCKET to the right
+ * server.
+ *
+ * @param server the server that failed the command
+ * @param ct the command data for the command
+ * @param now the time we read the response
+ * @return non-zero if the command is going to be sent again, zero if
+ *         the error should be passed to the user
+ */
+int libcouchbase_retry_not_my_vbucket(libcouchbase_server_t *server,
+                                      const struct libcouchbase_command_data_st *ct,
+                                      hrtime_t now)
+{
+    libcouchbase_t instance = server->instance;
+    protocol_binary_request_header req;
+    libcouchbase_server_t *new_srv;
+    libcouchbase_size_t nbody;
+    hrtime_t moving;
+    int vb, idx;
+
+    if (ringbuffer_peek(&server->cmd_log, req.bytes, sizeof(req)) != sizeof(req)) {
+        return 0;
+    }
+    vb = ntohs(req.request.vbucket);
+    if (vb >= instance->nvbuckets) {
+        return 0;
+    }
+
+    ++instance->stats.not_my_vbucket;
+    refresh_config(instance, now);
+
+    if (instance->vb_moves == NULL) {
+        instance->vb_moves = calloc(instance->nvbuckets, sizeof(hrtime_t));
+        if (instance->vb_moves == NULL) {
+            libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM, NULL);
+            return 0;
+        }
+    }
+
+    moving = LIBCOUCHBASE_VBUCKET_MOVE_TIMEOUT;
+    moving *= 1000;
+    if (instance->vb_moves[vb] != 0 && instance->vb_moves[vb] + moving > now) {
+        /* We guessed wrong, wait for the new configuration */
+        if (queue_retry(server, ct, now, LIBCOUCHBASE_VBUCKET_MOVE_BACKOFF, 1)) {
+            ++instance->stats.not_my_vbucket_parked;
+            return 1;
+        }
+    } else {
+        instance->vb_moves[vb] = now;
+    }
+
+    idx = vbucket_found_incorrect_master(instance->vbucket_config, vb,
+                                         server->index);
+    if (idx < 0 || idx >= (int)instance->nservers) {
+        return 0;
+    }
+    nbody = ntohl(req.request.bodylen);
+    new_srv = libcouchbase_get_server(instance, idx, vb,
+                                      nbody - req.request.extlen -
+                                      ntohs(req.request.keylen));
+    if (new_srv == server) {
+        /* We can't copy the packet within the same buffer */
+        return queue_retry(server, ct, now, LIBCOUCHBASE_VBUCKET_MOVE_BACKOFF, 1);
+    }
+
+    /* Copy the packet straight from the command log */
+    ringbuffer_consumed(&server->cmd_log, sizeof(req));
+    req.request.opcode = unquiet_opcode(req.request.opcode);
+    req.request.opaque = ++instance->seqno;
+    if (is_mutation(req.request.opcode)) {
+        /* The body starts with the extras and the key (at most 250 bytes) */
+        char buffer[256 + 256];
+        libcouchbase_size_t nkey = ntohs(req.request.keylen);
+        libcouchbase_size_t nhead = req.request.extlen + nkey;
+        if (nhead <= sizeof(buffer) &&
+                ringbuffer_peek(&server->cmd_log, buffer, nhead) == nhead) {
+            libcouchbase_cache_invalidate(instance, vb,
+                                          buffer + req.request.extlen, nkey);
+        }
+    }
+    libcouchbase_server_retry_packet(new_srv, ct, req.bytes, sizeof(req));
+    libcouchbase_server_write_packet_ringbuffer(new_srv, &server->cmd_log, nbody);
+    libcouchbase_server_end_packet(new_srv);
+    ringbuffer_consumed(&server->cmd_log, nbody);
+    ringbuffer_consumed(&server->output_cookies, sizeof(*ct));
+    libcouchbase_server_send_packets(new_srv);
+    return 1;
+}
+
+/**
+ * Called when a new cluster configuration is applied. We don't know
+ * of any moving vbuckets anymore, and the commands waiting for them
+ * are sent to the new masters right away.
+ */
+void libcouchbase_retry_config_changed(libcouchbase_t instance)
+{
+    struct libcouchbase_retry_st **ptr = &instance->retries;
+    struct libcouchbase_retry_st *moved = NULL;
+    struct libcouchbase_retry_st **tail = &moved;
+
+    free(instance->vb_moves);
+    instance->vb_moves = NULL;
+
+    while (*ptr != NULL) {
+        struct libcouchbase_retry_st *retry = *ptr;
+        if (retry->moved) {
+            *ptr = retry->next;
+            --instance->nretries;
+            retry->next = NULL;
+            *tail = retry;
+            tail = &retry->next;
+        } else {
+            ptr = &retry->next;
+        }
+    }
+
+    while (moved != NULL) {
+        struct libcouchbase_retry_st *retry = moved;
+        moved = retry->next;
+        send_retry(instance, retry);
+        free(retry);
+    }
+    update_retry_timer(instance);
+}
+
+/**
+ * Send the command to the current master of the vbucket
+ */
+static void send_retry(libcouchbase_t instance,
+                       struct libcouchbase_retry_st *retry)
+{
+    protocol_binary_request_header *req = (void *)retry->packet;
+    libcouchbase_server_t *server;
+    int vb = ntohs(req->request.vbucket);
+    int idx = -1;
+
+    if (instance->vbucket_config != NULL) {
+        idx = vbucket_get_master(instance->vbucket_config, vb);
+    }
+    if (idx < 0 || idx >= (int)instance->nservers) {
+        /* Try the same server again (it'll tell us if it moved) */
+        idx = retry->index;
+    }
+
+    req->request.opaque = ++instance->seqno;
+    if (is_mutation(req->request.opcode)) {
+        libcouchbase_cache_invalidate(instance, vb,
+                                      retry->packet + sizeof(*req) +
+                                      req->request.extlen,
+                                      ntohs(req->request.keylen));
+    }
+    server = libcouchbase_get_server(instance, idx, vb,
+                                     ntohl(req->request.bodylen) -
+                                     req->request.extlen -
+                                     ntohs(req->request.keylen));
+    libcouchbase_server_retry_packet(server, &retry->ct,
+                                     retry->packet, retry->npacket);
+    libcouchbase_server_end_packet(server);
+    libcouchbase_server_send_packets(server);
+}
+
+static void retry_timeout_handler(libcouchbase_socket_t sock,
+                                  short which,
+                                  void *arg)
+{
+    libcouchbase_t instance = arg;
+    hrtime_t now = gethrtime();
+
+    instance->io->delete_timer(instance->io, instance->retry_timer);
+    instance->retry_timer_next = 0;
+
+    while (instance->retries != NULL && instance->retries->due <= now) {
+        struct libcouchbase_retry_st *retry = instance->retries;
+        instance->retries = retry->next;
+        --instance->nretries;
+        send_retry(instance, retry);
+        free(retry);
+    }
+
+    update_retry_timer(instance);
+    libcouchbase_maybe_breakout(instance);
+
+    (void)sock;
+    (void)which;
+}
+
+void libcouchbase_retry_destroy_all(libcouchbase_t instance)
+{
+    while (instance->retries != NULL) {
+        struct libcouchbase_retry_st *retry = instance->retries;
+        instance->retries = retry->next;
+        free(retry);
+    }
+    instance->nretries = 0;
+    free(instance->vb_moves);
+    instance->vb_moves = NULL;
+
+    if (instance->retry_timer != NULL) {
+        if (instance->retry_timer_next != 0) {
+            instance->io->delete_timer(instance->io, instance->retry_timer);
+        }
+        instance->io->destroy_timer(instance->io, instance->retry_timer);
+        instance->retry_timer = NULL;
+    }
+}
@@ -41,9 +41,25 @@ void ringbuffer_reset(ringbuffer_t *buffer)
                         ringbuffer_get_nbytes(buffer));
 }
 
+static void release_root(ringbuffer_t *buffer, char *root,
+                         libcouchbase_size_t size)
+{
+    if (buffer->pool != NULL) {
+        libcouchbase_buffer_pool_release(buffer->pool, root, size);
+    } else {
+        free(root);
+    }
+}
+
 void ringbuffer_destruct(ringbuffer_t *buffer)
 {
-    free(buffer->root);
+    if (buffer->allocated != NULL) {
+        *buffer->allocated -= buffer->size;
+    }
+    if (buffer->queued != NULL) {
+        *buffer->queued -= buffer->nbytes;
+    }
+    release_root(buffer, buffer->root, buffer->size);
     buffer->root = buffer->read_head = buffer->write_head = NULL;
     buffer->size = buffer->nbytes = 0;
 }
@@ -67,12 +83,18 @@ int ringbuffer_ensure_capacity(ringbuffer_t *buffer, libcouchbase_size_t size)
     }
 
     /* go ahead and allocate a bigger block */
-    if ((new_root = malloc(new_size)) == NULL) {
+    if (buffer->pool != NULL) {
+        new_root = libcouchbase_buffer_pool_alloc(buffer->pool, new_size);
+    } else {
+        new_root = malloc(new_size);
+    }
+    if (new_root == NULL) {
         /* Allocation failed! */
         return 0;
     } else {
         /* copy the data over :) */
         char *old;
+        libcouchbase_size_t old_size = buffer->size;
         libcouchbase_size_t nbytes = buffer->nbytes;
         libcouchbase_size_t nr = ringbuffer_read(buffer, new_root, nbytes);
         if (nr != nbytes) {
@@ -84,7 +106,14 @@ int ringbuffer_ensure_capacity(ringbuffer_t *buffer, libcouchbase_size_t size)
         buffer->nbytes = nbytes;
         buffer->read_head = buffer->root;
         buffer->write_head = buffer->root + nbytes;
-        free(old);
+        if (buffer->allocated != NULL) {
+            *buffer->allocated += new_size - old_size;
+        }
+        if (buffer->queued != NULL) {
+            /* The bytes are still in the buffer (undo the read) */
+            *buffer->queued += nbytes;
+        }
+        release_root(buffer, old, old_size);
         return 1;
     }
 }
@@ -136,6 +165,9 @@ libcouchbase_size_t ringbuffer_write(ringbuffer_t *buffer,
 
         if (nw == nb) {
             /* everything is written to the buffer.. */
+            if (buffer->queued != NULL) {
+                *buffer->queued += nw;
+            }
             return nw;
         }
 
@@ -157,6 +189,9 @@ libcouchbase_size_t ringbuffer_write(ringbuffer_t *buffer,
         buffer->write_head = buffer->root;
     }
 
+    if (buffer->queued != NULL) {
+        *buffer->queued += nw;
+    }
     return nw;
 }
 
@@ -197,6 +232,9 @@ libcouchbase_size_t ringbuffer_read(ringbuffer_t *buffer, void *dest, libcouchba
 
         if (nr == nb) {
             maybe_reset(buffer);
+            if (buffer->queued != NULL) {
+                *buffer->queued -= nr;
+            }
             return nr;
         }
 
@@ -219,12 +257,16 @@ libcouchbase_size_t ringbuffer_read(ringbuffer_t *buffer, void *dest, libcouchba
     }
 
     maybe_reset(buffer);
+    if (buffer->queued != NULL) {
+        *buffer->queued -= nr;
+    }
     return nr;
 }
 
 libcouchbase_size_t ringbuffer_peek(ringbuffer_t *buffer, void *dest, libcouchbase_size_t nb)
 {
     ringbuffer_t copy = *buffer;
+    copy.queued = NULL;
     return ringbuffer_read(&copy, dest, nb);
 }
 
@@ -338,6 +380,8 @@ int ringbuffer_memcpy(ringbuffer_t *dst, ringbuffer_t *src,
     int ii = 0;
     libcouchbase_size_t towrite = nbytes;
 
+    copy.queued = NULL;
+
     if (nbytes > ringbuffer_get_nbytes(src)) {
         /* EINVAL */
         return -1;
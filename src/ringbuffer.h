@@ -27,6 +27,12 @@ extern "C" {
         char *write_head;
         libcouchbase_size_t size;
         libcouchbase_size_t nbytes;
+        /** Where to get the memory from (malloc if it's NULL) */
+        struct libcouchbase_buffer_pool_st *pool;
+        /** A counter to add the size of the buffer to (may be NULL) */
+        libcouchbase_size_t *allocated;
+        /** A counter to add the bytes in the buffer to (may be NULL) */
+        libcouchbase_size_t *queued;
     } ringbuffer_t;
 
     typedef enum {
@@ -42,6 +42,7 @@ void libcouchbase_purge_single_server(libcouchbase_server_t *server,
     ringbuffer_t rest;
     libcouchbase_size_t send_size = ringbuffer_get_nbytes(&server->output);
     libcouchbase_size_t stream_size = ringbuffer_get_nbytes(stream);
+    libcouchbase_size_t ncookies = ringbuffer_get_nbytes(cookies);
 
     assert(ringbuffer_initialize(&rest, 1024));
 
@@ -102,6 +103,7 @@ void libcouchbase_purge_single_server(libcouchbase_server_t *server,
         }
 
         keyptr = packet + sizeof(req) + req.request.extlen;
+        root->sync_retcode = error;
         /* It would have been awesome if we could have a generic error */
         /* handler we could call */
         switch (req.request.opcode) {
@@ -111,10 +113,12 @@ void libcouchbase_purge_single_server(libcouchbase_server_t *server,
         case PROTOCOL_BINARY_CMD_GATQ:
         case PROTOCOL_BINARY_CMD_GET:
         case PROTOCOL_BINARY_CMD_GETQ:
-            root->callbacks.get(root, ct.cookie,
-                                error,
-                                keyptr, ntohs(req.request.keylen),
-                                NULL, 0, 0, 0);
+        case PROTOCOL_BINARY_CMD_GETK:
+        case PROTOCOL_BINARY_CMD_GETKQ:
+        case CMD_GET_REPLICA:
+            libcouchbase_get_response(root, &ct, error,
+                                      keyptr, ntohs(req.request.keylen),
+                                      NULL, 0, 0, 0);
             break;
         case PROTOCOL_BINARY_CMD_FLUSH:
             root->callbacks.flush(root,
@@ -132,51 +136,48 @@ void libcouchbase_purge_single_server(libcouchbase_server_t *server,
             }
             break;
         case PROTOCOL_BINARY_CMD_ADD:
-            root->callbacks.storage(root, ct.cookie,
-                                    LIBCOUCHBASE_ADD,
-                                    error,
-                                    keyptr, ntohs(req.request.keylen),
-                                    req.request.cas);
+        case PROTOCOL_BINARY_CMD_ADDQ:
+            libcouchbase_storage_response(root, &ct, LIBCOUCHBASE_ADD, error,
+                                          keyptr, ntohs(req.request.keylen),
+                                          req.request.cas);
             break;
         case PROTOCOL_BINARY_CMD_REPLACE:
-            root->callbacks.storage(root, ct.cookie,
-                                    LIBCOUCHBASE_REPLACE,
-                                    error,
-                                    keyptr, ntohs(req.request.keylen),
-                                    req.request.cas);
+        case PROTOCOL_BINARY_CMD_REPLACEQ:
+            libcouchbase_storage_response(root, &ct, LIBCOUCHBASE_REPLACE, error,
+                                          keyptr, ntohs(req.request.keylen),
+                                          req.request.cas);
             break;
         case PROTOCOL_BINARY_CMD_SET:
-            root->callbacks.storage(root, ct.cookie,
-                                    LIBCOUCHBASE_SET,
-                                    error,
-                                    keyptr, ntohs(req.request.keylen),
-                                    req.request.cas);
+        case PROTOCOL_BINARY_CMD_SETQ:
+            libcouchbase_storage_response(root, &ct, LIBCOUCHBASE_SET, error,
+                                          keyptr, ntohs(req.request.keylen),
+                                          req.request.cas);
             break;
         case PROTOCOL_BINARY_CMD_APPEND:
-            root->callbacks.storage(root, ct.cookie,
-                                    LIBCOUCHBASE_APPEND,
-                                    error,
-                                    keyptr, ntohs(req.request.keylen),
-                                    req.request.cas);
+        case PROTOCOL_BINARY_CMD_APPENDQ:
+            libcouchbase_storage_response(root, &ct, LIBCOUCHBASE_APPEND, error,
+                                          keyptr, ntohs(req.request.keylen),
+                                          req.request.cas);
             break;
         case PROTOCOL_BINARY_CMD_PREPEND:
-            root->callbacks.storage(root, ct.cookie,
-                                    LIBCOUCHBASE_PREPEND,
-                                    error,
-                                    keyptr, ntohs(req.request.keylen),
-                                    req.request.cas);
+        case PROTOCOL_BINARY_CMD_PREPENDQ:
+            libcouchbase_storage_response(root, &ct, LIBCOUCHBASE_PREPEND, error,
+                                          keyptr, ntohs(req.request.keylen),
+                                          req.request.cas);
             break;
         case PROTOCOL_BINARY_CMD_DELETE:
-            root->callbacks.remove(root, ct.cookie,
-                                   error,
-                                   keyptr, ntohs(req.request.keylen));
+        case PROTOCOL_BINARY_CMD_DELETEQ:
+            libcouchbase_remove_response(root, &ct, error,
+                                         keyptr, ntohs(req.request.keylen));
             break;
 
         case PROTOCOL_BINARY_CMD_INCREMENT:
         case PROTOCOL_BINARY_CMD_DECREMENT:
-            root->callbacks.arithmetic(root, ct.cookie,
-                                       error,
-                                       keyptr, ntohs(req.request.keylen), 0, 0);
+        case PROTOCOL_BINARY_CMD_INCREMENTQ:
+        case PROTOCOL_BINARY_CMD_DECREMENTQ:
+            libcouchbase_arithmetic_response(root, &ct, error,
+                                             keyptr, ntohs(req.request.keylen),
+                                             0, 0);
             break;
         case PROTOCOL_BINARY_CMD_SASL_LIST_MECHS:
             abort();
@@ -247,12 +248,43 @@ void libcouchbase_purge_single_server(libcouchbase_server_t *server,
         ringbuffer_append(&rest, &server->output);
     }
 
+    if (writing && error == LIBCOUCHBASE_ETIMEDOUT &&
+            ringbuffer_get_nbytes(cookies) < ncookies) {
+        libcouchbase_window_congested(server);
+    }
+
+    if (stream != &server->held && error == LIBCOUCHBASE_ETIMEDOUT &&
+            ringbuffer_get_nbytes(cookies) < ncookies) {
+        libcouchbase_breaker_failure(server, now);
+    }
+
     server->next_timeout = 0;
     if (ringbuffer_peek(cookies, &ct, sizeof(ct)) == sizeof(ct)) {
         server->next_timeout = ct.start;
     }
 }
 
+/**
+ * Set the time the timeout for the server counts from to the start of
+ * the oldest command given to the connection, or the oldest held
+ * command if there is none.
+ *
+ * @param server the server to update
+ */
+void libcouchbase_server_reset_timeout(libcouchbase_server_t *server)
+{
+    struct libcouchbase_command_data_st ct;
+    ringbuffer_t *cookies;
+
+    cookies = server->connected ? &server->output_cookies : &server->pending_cookies;
+    server->next_timeout = 0;
+    if (ringbuffer_peek(cookies, &ct, sizeof(ct)) == sizeof(ct) ||
+            ringbuffer_peek(&server->held_cookies, &ct, sizeof(ct)) == sizeof(ct)) {
+        server->next_timeout = ct.start;
+    }
+    libcouchbase_update_timer(server->instance);
+}
+
 libcouchbase_error_t libcouchbase_failout_server(libcouchbase_server_t *server,
                                                  libcouchbase_error_t error)
 {
@@ -265,6 +297,9 @@ libcouchbase_error_t libcouchbase_failout_server(libcouchbase_server_t *server,
                                          &server->pending_cookies,
                                          0, gethrtime() + 1, error);
     }
+    libcouchbase_purge_single_server(server, &server->held,
+                                     &server->held_cookies,
+                                     0, gethrtime() + 1, error);
 
     ringbuffer_reset(&server->output);
     ringbuffer_reset(&server->input);
@@ -272,21 +307,103 @@ libcouchbase_error_t libcouchbase_failout_server(libcouchbase_server_t *server,
     ringbuffer_reset(&server->output_cookies);
     ringbuffer_reset(&server->pending);
     ringbuffer_reset(&server->pending_cookies);
+    ringbuffer_reset(&server->held);
+    ringbuffer_reset(&server->held_cookies);
+    /* They're empty now, and may have grown while the server was stalled */
+    (void)libcouchbase_server_release_buffers(server);
 
     server->connected = 0;
+    libcouchbase_window_reset(server);
 
     if (server->sock != INVALID_SOCKET) {
-        server->instance->io->delete_event(server->instance->io, server->sock,
-                                           server->event);
+        libcouchbase_delete_event(server->instance, server->sock,
+                                  server->event);
         server->instance->io->close(server->instance->io, server->sock);
         server->sock = INVALID_SOCKET;
     }
     /* reset address info for future attempts */
     server->curr_ai = server->root_ai;
 
+    if (error == LIBCOUCHBASE_NETWORK_ERROR ||
+            error == LIBCOUCHBASE_CONNECT_ERROR) {
+        libcouchbase_breaker_failure(server, gethrtime());
+    }
+
+    /* The streams may have got room for more commands */
+    if (server->instance->mget_streams != NULL) {
+        libcouchbase_mget_stream_refill(server->instance);
+    }
+
+    libcouchbase_update_memory_limit(server->instance);
+    libcouchbase_maybe_breakout(server->instance);
     return error;
 }
 
+/**
+ * Release the buffers of the server if there is nothing in them. They
+ * are allocated again by the next command (ringbuffer_ensure_capacity)
+ *
+ * @param server the server to release the buffers for
+ * @return the number of bytes released
+ */
+libcouchbase_size_t libcouchbase_server_release_buffers(libcouchbase_server_t *server)
+{
+    libcouchbase_size_t nbytes = libcouchbase_server_buffer_bytes(server);
+
+    if (server->output.nbytes || server->output_cookies.nbytes ||
+            server->cmd_log.nbytes || server->pending.nbytes ||
+            server->pending_cookies.nbytes || server->input.nbytes ||
+            server->held.nbytes || server->held_cookies.nbytes) {
+        return 0;
+    }
+
+    ringbuffer_destruct(&server->output);
+    ringbuffer_destruct(&server->output_cookies);
+    ringbuffer_destruct(&server->cmd_log);
+    ringbuffer_destruct(&server->pending);
+    ringbuffer_destruct(&server->pending_cookies);
+    ringbuffer_destruct(&server->input);
+    ringbuffer_destruct(&server->held);
+    ringbuffer_destruct(&server->held_cookies);
+    return nbytes;
+}
+
+static void shrink_buffer(ringbuffer_t *buffer)
+{
+    if (buffer->nbytes == 0 && buffer->size > LIBCOUCHBASE_BUFFER_SHRINK_SIZE) {
+        ringbuffer_destruct(buffer);
+    }
+}
+
+/**
+ * Give the big buffers back to the pool when they're empty, so that a
+ * burst (or a single large value) doesn't leave them allocated.
+ *
+ * @param server the server to shrink the buffers for
+ */
+void libcouchbase_server_shrink_buffers(libcouchbase_server_t *server)
+{
+    shrink_buffer(&server->output);
+    shrink_buffer(&server->output_cookies);
+    shrink_buffer(&server->cmd_log);
+    shrink_buffer(&server->pending);
+    shrink_buffer(&server->pending_cookies);
+    shrink_buffer(&server->input);
+    shrink_buffer(&server->held);
+    shrink_buffer(&server->held_cookies);
+}
+
+/**
+ * Get the number of bytes allocated for the buffers of the server
+ */
+libcouchbase_size_t libcouchbase_server_buffer_bytes(libcouchbase_server_t *server)
+{
+    return server->output.size + server->output_cookies.size +
+           server->cmd_log.size + server->pending.size +
+           server->pending_cookies.size + server->input.size +
+           server->held.size + server->held_cookies.size;
+}
+
 /**
  * Release all allocated resources for this server instance
  * @param server the server to destroy
@@ -308,8 +425,7 @@ void libcouchbase_server_destroy(libcouchbase_server_t *server)
     }
 
     /* Delete the event structure itself */
-    server->instance->io->destroy_event(server->instance->io,
-                                        server->event);
+    libcouchbase_destroy_event(server->instance, server->event);
 
     if (server->sock != INVALID_SOCKET) {
         server->instance->io->close(server->instance->io, server->sock);
@@ -329,6 +445,8 @@ void libcouchbase_server_destroy(libcouchbase_server_t *server)
     ringbuffer_destruct(&server->pending);
     ringbuffer_destruct(&server->pending_cookies);
     ringbuffer_destruct(&server->input);
+    ringbuffer_destruct(&server->held);
+    ringbuffer_destruct(&server->held_cookies);
     for (ii = 0; ii < server->couch_requests->capacity; ++ii) {
         if (server->couch_requests->items[ii] > 1) {
             libcouchbase_couch_request_destroy((libcouchbase_couch_request_t)server->couch_requests->items[ii]);
@@ -424,6 +542,8 @@ void libcouchbase_server_connected(libcouchbase_server_t *server)
         **       much data..
         */
         ringbuffer_t copy = server->pending;
+        /* The bytes are counted for the pending buffer */
+        copy.queued = NULL;
         ringbuffer_reset(&server->cmd_log);
         ringbuffer_reset(&server->output_cookies);
         ringbuffer_reset(&server->output);
@@ -444,9 +564,9 @@ void libcouchbase_server_connected(libcouchbase_server_t *server)
 
     } else {
         /* Set the correct event handler */
-        server->instance->io->update_event(server->instance->io, server->sock,
-                                           server->event, LIBCOUCHBASE_READ_EVENT,
-                                           server, libcouchbase_server_event_handler);
+        libcouchbase_update_event(server->instance, server->sock,
+                                  server->event, LIBCOUCHBASE_READ_EVENT,
+                                  server, libcouchbase_server_event_handler);
     }
 }
 
@@ -527,12 +647,12 @@ static void server_connect(libcouchbase_server_t *server)
                 socket_connected(server);
                 return ;
             case LIBCOUCHBASE_CONNECT_EINPROGRESS: /*first call to connect*/
-                server->instance->io->update_event(server->instance->io,
-                                                   server->sock,
-                                                   server->event,
-                                                   LIBCOUCHBASE_WRITE_EVENT,
-                                                   server,
-                                                   server_connect_handler);
+                libcouchbase_update_event(server->instance,
+                                          server->sock,
+                                          server->event,
+                                          LIBCOUCHBASE_WRITE_EVENT,
+                                          server,
+                                          server_connect_handler);
                 return ;
             case LIBCOUCHBASE_CONNECT_EALREADY: /* Subsequent calls to connect */
                 return ;
@@ -541,9 +661,9 @@ static void server_connect(libcouchbase_server_t *server)
                 if (server->curr_ai->ai_next) {
                     retry = 1;
                     server->curr_ai = server->curr_ai->ai_next;
-                    server->instance->io->delete_event(server->instance->io,
-                                                       server->sock,
-                                                       server->event);
+                    libcouchbase_delete_event(server->instance,
+                                              server->sock,
+                                              server->event);
                     server->instance->io->close(server->instance->io, server->sock);
                     server->sock = INVALID_SOCKET;
                     break;
@@ -596,24 +716,70 @@ void libcouchbase_server_initialize(libcouchbase_server_t *server, int servernum
     }
 
     server->sasl_conn = NULL;
+
+    server->output.pool = server->instance->buffer_pool;
+    server->output_cookies.pool = server->instance->buffer_pool;
+    server->cmd_log.pool = server->instance->buffer_pool;
+    server->pending.pool = server->instance->buffer_pool;
+    server->pending_cookies.pool = server->instance->buffer_pool;
+    server->input.pool = server->instance->buffer_pool;
+    server->held.pool = server->instance->buffer_pool;
+    server->held_cookies.pool = server->instance->buffer_pool;
+
+    server->output.allocated = &server->instance->buffer_bytes;
+    server->output_cookies.allocated = &server->instance->buffer_bytes;
+    server->cmd_log.allocated = &server->instance->buffer_bytes;
+    server->pending.allocated = &server->instance->buffer_bytes;
+    server->pending_cookies.allocated = &server->instance->buffer_bytes;
+    server->input.allocated = &server->instance->buffer_bytes;
+    server->held.allocated = &server->instance->buffer_bytes;
+    server->held_cookies.allocated = &server->instance->buffer_bytes;
+
+    server->output.queued = &server->instance->queued_bytes;
+    server->cmd_log.queued = &server->instance->queued_bytes;
+    server->pending.queued = &server->instance->queued_bytes;
+    server->input.queued = &server->instance->queued_bytes;
+    server->held.queued = &server->instance->queued_bytes;
+    server->output_cookies.queued = &server->instance->queued_cookie_bytes;
+    server->pending_cookies.queued = &server->instance->queued_cookie_bytes;
+    server->held_cookies.queued = &server->instance->queued_cookie_bytes;
+
+    libcouchbase_window_reset(server);
 }
 
 void libcouchbase_server_send_packets(libcouchbase_server_t *server)
 {
     if (server->pending.nbytes > 0 || server->output.nbytes > 0) {
         if (server->connected) {
-            server->instance->io->update_event(server->instance->io,
-                                               server->sock,
-                                               server->event,
-                                               LIBCOUCHBASE_RW_EVENT,
-                                               server,
-                                               libcouchbase_server_event_handler);
+            libcouchbase_update_event(server->instance,
+                                      server->sock,
+                                      server->event,
+                                      LIBCOUCHBASE_RW_EVENT,
+                                      server,
+                                      libcouchbase_server_event_handler);
+        } else if (server->sock == INVALID_SOCKET &&
+                   !libcouchbase_breaker_allow(server)) {
+            /* Don't wait for the timeout, the server is down */
+            libcouchbase_breaker_reject(server);
         } else {
             server_connect(server);
         }
     }
 }
 
+/**
+ * Connect to the server again after the connection was failed out,
+ * even if there are no commands for it yet
+ *
+ * @param server the server to connect to
+ */
+void libcouchbase_server_reconnect(libcouchbase_server_t *server)
+{
+    if (server->sock == INVALID_SOCKET && libcouchbase_breaker_allow(server)) {
+        server_connect(server);
+    }
+}
+
 int libcouchbase_server_purge_implicit_responses(libcouchbase_server_t *c,
                                                  libcouchbase_uint32_t seqno,
                                                  hrtime_t end)
@@ -626,7 +792,12 @@ int libcouchbase_server_purge_implicit_responses(libcouchbase_server_t *c,
     while (req.request.opaque < seqno) {
         struct libcouchbase_command_data_st ct;
         char *packet = c->cmd_log.read_head;
+        char *allocated = NULL;
+        char buffer[512];
         libcouchbase_size_t packetsize = ntohl(req.request.bodylen) + (libcouchbase_uint32_t)sizeof(req);
+        libcouchbase_uint16_t nkey = ntohs(req.request.keylen);
+        /* We only need the key, so we don't copy the value */
+        libcouchbase_size_t headsize = sizeof(req) + req.request.extlen + nkey;
         char *keyptr;
 
         nr = ringbuffer_read(&c->output_cookies, &ct, sizeof(ct));
@@ -637,40 +808,92 @@ int libcouchbase_server_purge_implicit_responses(libcouchbase_server_t *c,
                                         req.request.opcode);
         }
 
-        switch (req.request.opcode) {
-        case PROTOCOL_BINARY_CMD_GATQ:
-        case PROTOCOL_BINARY_CMD_GETQ:
-            if (!ringbuffer_is_continous(&c->cmd_log,
-                                         RINGBUFFER_READ,
-                                         packetsize)) {
-                packet = malloc(packetsize);
+        if (!ringbuffer_is_continous(&c->cmd_log,
+                                     RINGBUFFER_READ,
+                                     headsize)) {
+            if (headsize <= sizeof(buffer)) {
+                packet = buffer;
+            } else {
+                packet = allocated = malloc(headsize);
                 if (packet == NULL) {
                     libcouchbase_error_handler(c->instance, LIBCOUCHBASE_ENOMEM, NULL);
                     return -1;
                 }
+            }
 
-                nr = ringbuffer_peek(&c->cmd_log, packet, packetsize);
-                if (nr != packetsize) {
-                    libcouchbase_error_handler(c->instance, LIBCOUCHBASE_EINTERNAL,
-                                               NULL);
-                    free(packet);
-                    return -1;
-                }
+            nr = ringbuffer_peek(&c->cmd_log, packet, headsize);
+            if (nr != headsize) {
+                libcouchbase_error_handler(c->instance, LIBCOUCHBASE_EINTERNAL,
+                                           NULL);
+                free(allocated);
+                return -1;
             }
+        }
 
-            keyptr = packet + sizeof(req) + req.request.extlen;
-            c->instance->callbacks.get(c->instance, ct.cookie,
-                                       LIBCOUCHBASE_KEY_ENOENT,
-                                       keyptr, ntohs(req.request.keylen),
-                                       NULL, 0, 0, 0);
-            if (packet != c->cmd_log.read_head) {
-                free(packet);
+        keyptr = packet + sizeof(req) + req.request.extlen;
+
+        switch (req.request.opcode) {
+        case PROTOCOL_BINARY_CMD_GATQ:
+        case PROTOCOL_BINARY_CMD_GETQ:
+        case PROTOCOL_BINARY_CMD_GETKQ:
+            if (c->instance->negative_cache != NULL) {
+                libcouchbase_negative_cache_store(c, keyptr, nkey);
             }
+            libcouchbase_get_response(c->instance, &ct,
+                                      LIBCOUCHBASE_KEY_ENOENT,
+                                      keyptr, nkey, NULL, 0, 0, 0);
+            break;
+        /*
+         * The quiet storage commands only send a response if they
+         * fail, so if we got here the operation succeeded. We don't
+         * know the new cas value for the item though..
+         */
+        case PROTOCOL_BINARY_CMD_ADDQ:
+            libcouchbase_storage_response(c->instance, &ct,
+                                          LIBCOUCHBASE_ADD,
+                                          LIBCOUCHBASE_SUCCESS,
+                                          keyptr, nkey, 0);
+            break;
+        case PROTOCOL_BINARY_CMD_REPLACEQ:
+            libcouchbase_storage_response(c->instance, &ct,
+                                          LIBCOUCHBASE_REPLACE,
+                                          LIBCOUCHBASE_SUCCESS,
+                                          keyptr, nkey, 0);
+            break;
+        case PROTOCOL_BINARY_CMD_SETQ:
+            libcouchbase_storage_response(c->instance, &ct,
+                                          LIBCOUCHBASE_SET,
+                                          LIBCOUCHBASE_SUCCESS,
+                                          keyptr, nkey, 0);
+            break;
+        case PROTOCOL_BINARY_CMD_APPENDQ:
+            libcouchbase_storage_response(c->instance, &ct,
+                                          LIBCOUCHBASE_APPEND,
+                                          LIBCOUCHBASE_SUCCESS,
+                                          keyptr, nkey, 0);
+            break;
+        case PROTOCOL_BINARY_CMD_PREPENDQ:
+            libcouchbase_storage_response(c->instance, &ct,
+                                          LIBCOUCHBASE_PREPEND,
+                                          LIBCOUCHBASE_SUCCESS,
+                                          keyptr, nkey, 0);
+            break;
+        case PROTOCOL_BINARY_CMD_DELETEQ:
+            libcouchbase_remove_response(c->instance, &ct,
+                                         LIBCOUCHBASE_SUCCESS, keyptr, nkey);
+            break;
+        /*
+         * The same goes for the quiet arithmetic commands, but here we
+         * don't know the new value either..
+         */
+        case PROTOCOL_BINARY_CMD_INCREMENTQ:
+        case PROTOCOL_BINARY_CMD_DECREMENTQ:
+            libcouchbase_arithmetic_response(c->instance, &ct,
+                                             LIBCOUCHBASE_SUCCESS,
+                                             keyptr, nkey, 0, 0);
             break;
         case PROTOCOL_BINARY_CMD_NOOP:
-            if (packet != c->cmd_log.read_head) {
-                free(packet);
-            }
+            free(allocated);
             return -1;
 
         default: {
@@ -679,11 +902,13 @@ int libcouchbase_server_purge_implicit_responses(libcouchbase_server_t *c,
             libcouchbase_error_handler(c->instance,
                                        LIBCOUCHBASE_EINTERNAL,
                                        errinfo);
+            free(allocated);
             return -1;
 
         }
         }
 
+        free(allocated);
         ringbuffer_consumed(&c->cmd_log, packetsize);
         nr =  ringbuffer_peek(&c->cmd_log, req.bytes,
                               sizeof(req));
@@ -693,3 +918,41 @@ int libcouchbase_server_purge_implicit_responses(libcouchbase_server_t *c,
 
     return 0;
 }
+
+/**
+ * Get the connection to use for a command to a server. The commands for
+ * a vbucket always use the same connection so that the commands for a
+ * key are executed in the order they were sent. If there is a threshold
+ * for large values, the last connection is used for the commands with
+ * a body of at least that size.
+ *
+ * @param instance the instance
+ * @param idx the index of the server (from vbucket_map)
+ * @param vb the vbucket the command is for
+ * @param nbytes the size of the value in the command (0 if none)
+ */
+libcouchbase_server_t *libcouchbase_get_server(libcouchbase_t instance,
+                                               int idx, int vb,
+                                               libcouchbase_size_t nbytes)
+{
+    /*
+     * connections_per_node may have been changed after the connections
+     * were created, so use the number we actually have
+     */
+    libcouchbase_size_t nconn = instance->nconnections / instance->nservers;
+    libcouchbase_size_t conn = 0;
+
+    if (nconn > 1) {
+        if (instance->large_value_threshold != 0) {
+            --nconn;
+            if (nbytes >= instance->large_value_threshold) {
+                conn = nconn;
+            }
+        }
+        if (conn == 0 && vb > 0) {
+            conn = (libcouchbase_size_t)vb % nconn;
+        }
+    }
+
+    return instance->servers + conn * instance->nservers + (libcouchbase_size_t)idx;
+}
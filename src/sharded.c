@@ -0,0 +1,330 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the sharded client. Each shard is a normal
+ * instance with its own event loop (to be run by a thread of its own),
+ * and the operations are passed to the shards through their submission
+ * queues (see queue.c). The first shard owns the configuration stream
+ * and passes every new configuration on to the other shards.
+ */
+
+#include "internal.h"
+
+/**
+ * The configuration used to pick the shard for a key. It's read by
+ * the threads submitting operations, so it is never modified once it's
+ * published. A configuration replaced by a new one is kept in the list
+ * of retired configurations until no submitter is in get_shard().
+ */
+struct dispatch_config_st {
+    VBUCKET_CONFIG_HANDLE config;
+    struct dispatch_config_st *next;
+};
+
+struct libcouchbase_sharded_st {
+    libcouchbase_size_t nshards;
+    libcouchbase_t *shards;
+    struct dispatch_config_st *volatile dispatch;
+    /** The configurations a submitter may still be using */
+    struct dispatch_config_st *retired;
+    /** The number of submitters reading the configuration */
+    atomic_counter_t readers;
+};
+
+static void dispatch_destroy(struct dispatch_config_st *dispatch)
+{
+    while (dispatch != NULL) {
+        struct dispatch_config_st *next = dispatch->next;
+        vbucket_config_destroy(dispatch->config);
+        free(dispatch);
+        dispatch = next;
+    }
+}
+
+/**
+ * Called by the first shard (from the thread running its event loop)
+ * every time it applies a new configuration.
+ */
+void libcouchbase_sharded_config_changed(libcouchbase_sharded_t sharded,
+                                         const char *json)
+{
+    struct dispatch_config_st *dispatch;
+    struct libcouchbase_config_snapshot_st *snapshot;
+    libcouchbase_size_t ii;
+
+    dispatch = calloc(1, sizeof(*dispatch));
+    if (dispatch == NULL) {
+        libcouchbase_error_handler(sharded->shards[0], LIBCOUCHBASE_ENOMEM,
+                                   "Failed to allocate memory for config");
+        return;
+    }
+    dispatch->config = vbucket_config_create();
+    if (dispatch->config == NULL) {
+        free(dispatch);
+        libcouchbase_error_handler(sharded->shards[0], LIBCOUCHBASE_ENOMEM,
+                                   "Failed to allocate memory for config");
+        return;
+    }
+    if (vbucket_config_parse(dispatch->config, LIBVBUCKET_SOURCE_MEMORY,
+                             json) != 0) {
+        /* The first shard just parsed the same config.. */
+        libcouchbase_error_handler(sharded->shards[0],
+                                   LIBCOUCHBASE_PROTOCOL_ERROR,
+                                   vbucket_get_error_message(dispatch->config));
+        vbucket_config_destroy(dispatch->config);
+        free(dispatch);
+        return;
+    }
+
+    snapshot = libcouchbase_config_snapshot_create(json, strlen(json));
+    if (snapshot == NULL) {
+        vbucket_config_destroy(dispatch->config);
+        free(dispatch);
+        libcouchbase_error_handler(sharded->shards[0], LIBCOUCHBASE_ENOMEM,
+                                   "Failed to allocate memory for config");
+        return;
+    }
+
+    /*
+     * Queue the config to the shards before we publish it, so that the
+     * operations dispatched with the new config end up behind it.
+     */
+    for (ii = 1; ii < sharded->nshards; ++ii) {
+        libcouchbase_error_t err = libcouchbase_queue_config(sharded->shards[ii],
+                                                             snapshot);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            libcouchbase_error_handler(sharded->shards[0], err,
+                                       "Failed to pass the config to a shard");
+        }
+    }
+    libcouchbase_config_snapshot_unref(snapshot);
+
+    memory_barrier();
+    if (sharded->dispatch != NULL) {
+        sharded->dispatch->next = sharded->retired;
+        sharded->retired = sharded->dispatch;
+    }
+    sharded->dispatch = dispatch;
+
+    /*
+     * A submitter entering get_shard() from now on sees the new config,
+     * so the old ones may be released if nobody is in there right now.
+     * Otherwise we'll try again with the next config.
+     */
+    memory_barrier();
+    if (sharded->readers == 0) {
+        dispatch_destroy(sharded->retired);
+        sharded->retired = NULL;
+    }
+}
+
+/**
+ * Get the shard owning the server the key maps to
+ *
+ * @return the shard or NULL if we haven't got a config yet
+ */
+static libcouchbase_t get_shard(libcouchbase_sharded_t sharded,
+                                const void *key, libcouchbase_size_t nkey)
+{
+    struct dispatch_config_st *dispatch;
+    int vb, idx;
+
+    /* Keep the config from being released while we use it */
+    (void)atomic_incr(&sharded->readers);
+    dispatch = sharded->dispatch;
+    if (dispatch == NULL) {
+        (void)atomic_decr(&sharded->readers);
+        return NULL;
+    }
+
+    (void)vbucket_map(dispatch->config, key, nkey, &vb, &idx);
+    (void)atomic_decr(&sharded->readers);
+    if (idx < 0) {
+        /* no server owns the vbucket right now, spread them anyway */
+        idx = vb;
+    }
+    return sharded->shards[(libcouchbase_size_t)idx % sharded->nshards];
+}
+
+LIBCOUCHBASE_API
+libcouchbase_sharded_t libcouchbase_sharded_create(const char *host,
+                                                   const char *user,
+                                                   const char *passwd,
+                                                   const char *bucket,
+                                                   libcouchbase_size_t nshards)
+{
+    libcouchbase_sharded_t ret;
+    libcouchbase_size_t ii;
+
+    if (nshards == 0) {
+        return NULL;
+    }
+
+    if ((ret = calloc(1, sizeof(*ret))) == NULL) {
+        return NULL;
+    }
+    ret->shards = calloc(nshards, sizeof(libcouchbase_t));
+    if (ret->shards == NULL) {
+        free(ret);
+        return NULL;
+    }
+    ret->nshards = nshards;
+
+    for (ii = 0; ii < nshards; ++ii) {
+        /* Each shard gets an event loop of its own */
+        ret->shards[ii] = libcouchbase_create(host, user, passwd, bucket, NULL);
+        if (ret->shards[ii] == NULL) {
+            libcouchbase_sharded_destroy(ret);
+            return NULL;
+        }
+    }
+    ret->shards[0]->sharded = ret;
+
+    return ret;
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_sharded_destroy(libcouchbase_sharded_t sharded)
+{
+    libcouchbase_size_t ii;
+
+    for (ii = 0; ii < sharded->nshards; ++ii) {
+        if (sharded->shards[ii] != NULL) {
+            libcouchbase_destroy(sharded->shards[ii]);
+        }
+    }
+    free(sharded->shards);
+
+    dispatch_destroy(sharded->dispatch);
+    dispatch_destroy(sharded->retired);
+    free(sharded);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_sharded_connect(libcouchbase_sharded_t sharded)
+{
+    libcouchbase_size_t ii;
+
+    for (ii = 0; ii < sharded->nshards; ++ii) {
+        libcouchbase_error_t err;
+        err = libcouchbase_enable_submission_queue(sharded->shards[ii]);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            return err;
+        }
+    }
+
+    return libcouchbase_connect(sharded->shards[0]);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_sharded_get_num_shards(libcouchbase_sharded_t sharded)
+{
+    return sharded->nshards;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_t libcouchbase_sharded_get_shard(libcouchbase_sharded_t sharded,
+                                              libcouchbase_size_t idx)
+{
+    if (idx >= sharded->nshards) {
+        return NULL;
+    }
+    return sharded->shards[idx];
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_sharded_run(libcouchbase_sharded_t sharded,
+                              libcouchbase_size_t idx)
+{
+    libcouchbase_t instance = sharded->shards[idx];
+    instance->io->run_event_loop(instance->io);
+}
+
+LIBCOUCHBASE_API
+void libcouchbase_sharded_stop(libcouchbase_sharded_t sharded,
+                               libcouchbase_size_t idx)
+{
+    libcouchbase_t instance = sharded->shards[idx];
+    instance->io->stop_event_loop(instance->io);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_sharded_get(libcouchbase_sharded_t sharded,
+                                              const void *command_cookie,
+                                              const void *key,
+                                              libcouchbase_size_t nkey)
+{
+    libcouchbase_t shard = get_shard(sharded, key, nkey);
+    if (shard == NULL) {
+        return LIBCOUCHBASE_ETMPFAIL;
+    }
+    return libcouchbase_queue_get(shard, command_cookie, key, nkey);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_sharded_store(libcouchbase_sharded_t sharded,
+                                                const void *command_cookie,
+                                                libcouchbase_storage_t operation,
+                                                const void *key,
+                                                libcouchbase_size_t nkey,
+                                                const void *bytes,
+                                                libcouchbase_size_t nbytes,
+                                                libcouchbase_uint32_t flags,
+                                                libcouchbase_time_t exp,
+                                                libcouchbase_cas_t cas)
+{
+    libcouchbase_t shard = get_shard(sharded, key, nkey);
+    if (shard == NULL) {
+        return LIBCOUCHBASE_ETMPFAIL;
+    }
+    return libcouchbase_queue_store(shard, command_cookie, operation,
+                                    key, nkey, bytes, nbytes,
+                                    flags, exp, cas);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_sharded_arithmetic(libcouchbase_sharded_t sharded,
+                                                     const void *command_cookie,
+                                                     const void *key,
+                                                     libcouchbase_size_t nkey,
+                                                     libcouchbase_int64_t delta,
+                                                     libcouchbase_time_t exp,
+                                                     int create,
+                                                     libcouchbase_uint64_t initial)
+{
+    libcouchbase_t shard = get_shard(sharded, key, nkey);
+    if (shard == NULL) {
+        return LIBCOUCHBASE_ETMPFAIL;
+    }
+    return libcouchbase_queue_arithmetic(shard, command_cookie, key, nkey,
+                                         delta, exp, create, initial);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_sharded_remove(libcouchbase_sharded_t sharded,
+                                                 const void *command_cookie,
+                                                 const void *key,
+                                                 libcouchbase_size_t nkey,
+                                                 libcouchbase_cas_t cas)
+{
+    libcouchbase_t shard = get_shard(sharded, key, nkey);
+    if (shard == NULL) {
+        return LIBCOUCHBASE_ETMPFAIL;
+    }
+    return libcouchbase_queue_remove(shard, command_cookie, key, nkey, cas);
+}
@@ -88,3 +88,147 @@ libcouchbase_error_t libcouchbase_server_versions(libcouchbase_t instance,
 
     return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
 }
+
+/**
+ * Report the counters collected by the library
+ */
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_get_client_stats(libcouchbase_t instance,
+                                                   const void *cookie,
+                                                   libcouchbase_client_stat_callback callback)
+{
+    libcouchbase_uint64_t inflight = 0;
+    libcouchbase_size_t ii;
+
+    if (instance->coalesce.inflight != NULL) {
+        inflight = hashtable_num_items(instance->coalesce.inflight);
+    }
+
+    callback(instance, cookie, NULL, "get_coalesced",
+             instance->stats.get_coalesced);
+    callback(instance, cookie, NULL, "get_coalesce_inflight", inflight);
+    callback(instance, cookie, NULL, "resident_bytes",
+             libcouchbase_get_resident_bytes(instance));
+    callback(instance, cookie, NULL, "buffer_pool_bytes",
+             libcouchbase_buffer_pool_nbytes(instance->buffer_pool));
+    callback(instance, cookie, NULL, "buffer_pool_hits",
+             libcouchbase_buffer_pool_hits(instance->buffer_pool));
+    callback(instance, cookie, NULL, "buffer_pool_misses",
+             libcouchbase_buffer_pool_misses(instance->buffer_pool));
+    callback(instance, cookie, NULL, "buffered_bytes", instance->buffer_bytes);
+    callback(instance, cookie, NULL, "queued_bytes", instance->queued_bytes);
+    callback(instance, cookie, NULL, "outstanding_ops",
+             instance->queued_cookie_bytes /
+             sizeof(struct libcouchbase_command_data_st));
+    callback(instance, cookie, NULL, "memory_limit_rejected",
+             instance->stats.memory_limit_rejected);
+    callback(instance, cookie, NULL, "retried", instance->stats.retried);
+    callback(instance, cookie, NULL, "retry_queued", instance->nretries);
+    callback(instance, cookie, NULL, "not_my_vbucket",
+             instance->stats.not_my_vbucket);
+    callback(instance, cookie, NULL, "not_my_vbucket_parked",
+             instance->stats.not_my_vbucket_parked);
+    callback(instance, cookie, NULL, "config_refreshes",
+             instance->stats.config_refreshes);
+    callback(instance, cookie, NULL, "keepalive_probes",
+             instance->stats.keepalive_probes);
+    callback(instance, cookie, NULL, "keepalive_failures",
+             instance->stats.keepalive_failures);
+    callback(instance, cookie, NULL, "get_hedged", instance->stats.get_hedged);
+    callback(instance, cookie, NULL, "get_hedged_replica_won",
+             instance->stats.get_hedged_replica_won);
+
+    if (instance->queue != NULL) {
+        callback(instance, cookie, NULL, "submission_queue_ops",
+                 instance->stats.submission_queue_ops);
+        callback(instance, cookie, NULL, "submission_queue_wakeups",
+                 instance->stats.submission_queue_wakeups);
+    }
+
+    if (instance->near_cache != NULL) {
+        callback(instance, cookie, NULL, "near_cache_hits",
+                 instance->stats.near_cache_hits);
+        callback(instance, cookie, NULL, "near_cache_misses",
+                 instance->stats.near_cache_misses);
+        callback(instance, cookie, NULL, "near_cache_invalidations",
+                 instance->stats.near_cache_invalidations);
+        callback(instance, cookie, NULL, "near_cache_evictions",
+                 instance->stats.near_cache_evictions);
+        callback(instance, cookie, NULL, "near_cache_items",
+                 libcouchbase_near_cache_nitems(instance));
+        callback(instance, cookie, NULL, "near_cache_bytes",
+                 libcouchbase_near_cache_nbytes(instance));
+    }
+
+    if (instance->negative_cache != NULL) {
+        callback(instance, cookie, NULL, "negative_cache_hits",
+                 instance->stats.negative_cache_hits);
+        callback(instance, cookie, NULL, "negative_cache_invalidations",
+                 instance->stats.negative_cache_invalidations);
+        callback(instance, cookie, NULL, "negative_cache_items",
+                 libcouchbase_negative_cache_nitems(instance));
+    }
+
+    for (ii = 0; ii < instance->nconnections; ++ii) {
+        libcouchbase_server_t *server = instance->servers + ii;
+        callback(instance, cookie, server->authority, "buffer_bytes",
+                 libcouchbase_server_buffer_bytes(server));
+        callback(instance, cookie, server->authority, "retried",
+                 server->retried);
+        if (instance->max_window != 0) {
+            callback(instance, cookie, server->authority, "inflight_window",
+                     server->window);
+            callback(instance, cookie, server->authority, "inflight_ops",
+                     libcouchbase_window_inflight(server));
+            callback(instance, cookie, server->authority, "held_ops",
+                     libcouchbase_window_nheld(server));
+            callback(instance, cookie, server->authority, "held_ops_shed",
+                     server->window_shed);
+        }
+        if (instance->breaker_threshold != 0) {
+            callback(instance, cookie, server->authority, "breaker_state",
+                     server->breaker);
+            callback(instance, cookie, server->authority, "breaker_trips",
+                     server->breaker_trips);
+            callback(instance, cookie, server->authority, "breaker_rejected",
+                     server->breaker_rejected);
+        }
+    }
+
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+/**
+ * Sum up the memory allocated for the instance. The memory used by
+ * the io plugin and the parsed cluster config isn't included.
+ */
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_get_resident_bytes(libcouchbase_t instance)
+{
+    libcouchbase_size_t nbytes = sizeof(*instance);
+    libcouchbase_size_t ii;
+
+    nbytes += strlen(instance->http_uri) + 1;
+    nbytes += strlen(instance->host) + 1;
+    nbytes += instance->vbucket_stream.input.size;
+    nbytes += instance->vbucket_stream.chunk.size;
+    nbytes += instance->nvbuckets * sizeof(libcouchbase_vbucket_t);
+    nbytes += libcouchbase_timings_nbytes(instance);
+
+    nbytes += instance->nconnections * sizeof(libcouchbase_server_t);
+    for (ii = 0; ii < instance->nconnections; ++ii) {
+        nbytes += libcouchbase_server_buffer_bytes(instance->servers + ii);
+    }
+
+    if (instance->buffer_pool != libcouchbase_buffer_pool_get_shared()) {
+        nbytes += libcouchbase_buffer_pool_nbytes(instance->buffer_pool);
+    }
+
+    if (instance->near_cache != NULL) {
+        nbytes += libcouchbase_near_cache_nbytes(instance);
+    }
+    if (instance->mutations != NULL) {
+        nbytes += LIBCOUCHBASE_MUTATION_SLOTS * sizeof(*instance->mutations);
+    }
+    return nbytes;
+}
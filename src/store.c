@@ -47,6 +47,24 @@ libcouchbase_error_t libcouchbase_store_by_key(libcouchbase_t instance,
                                                const void *bytes, libcouchbase_size_t nbytes,
                                                libcouchbase_uint32_t flags, libcouchbase_time_t exp,
                                                libcouchbase_cas_t cas)
+{
+    return libcouchbase_store_with_callback(instance, command_cookie, NULL,
+                                            operation, hashkey, nhashkey,
+                                            key, nkey, bytes, nbytes,
+                                            flags, exp, cas);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_store_with_callback(libcouchbase_t instance,
+                                                      const void *command_cookie,
+                                                      libcouchbase_storage_callback callback,
+                                                      libcouchbase_storage_t operation,
+                                                      const void *hashkey,
+                                                      libcouchbase_size_t nhashkey,
+                                                      const void *key, libcouchbase_size_t nkey,
+                                                      const void *bytes, libcouchbase_size_t nbytes,
+                                                      libcouchbase_uint32_t flags, libcouchbase_time_t exp,
+                                                      libcouchbase_cas_t cas)
 {
     libcouchbase_server_t *server;
     protocol_binary_request_set req;
@@ -59,6 +77,10 @@ libcouchbase_error_t libcouchbase_store_by_key(libcouchbase_t instance,
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
     }
 
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
     if (nhashkey == 0) {
         nhashkey = nkey;
         hashkey = key;
@@ -68,7 +90,7 @@ libcouchbase_error_t libcouchbase_store_by_key(libcouchbase_t instance,
         /* the config says that there is no server yet at that position (-1) */
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
     }
-    server = instance->servers + idx;
+    server = libcouchbase_get_server(instance, idx, vb, nbytes);
 
     memset(&req, 0, sizeof(req));
     req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -115,7 +137,18 @@ libcouchbase_error_t libcouchbase_store_by_key(libcouchbase_t instance,
     bodylen = nkey + nbytes + req.message.header.request.extlen;
     req.message.header.request.bodylen = htonl((libcouchbase_uint32_t)bodylen);
 
-    libcouchbase_server_start_packet(server, command_cookie, &req, headersize);
+    libcouchbase_cache_invalidate(instance, vb, key, nkey);
+    if (callback != NULL) {
+        struct libcouchbase_command_data_st ct;
+        ct.start = gethrtime();
+        ct.cookie = command_cookie;
+        ct.callback.storage = callback;
+        ct.retries = 0;
+        /* Use the retry function so that we may pass our own command data */
+        libcouchbase_server_retry_packet(server, &ct, &req, headersize);
+    } else {
+        libcouchbase_server_start_packet(server, command_cookie, &req, headersize);
+    }
     libcouchbase_server_write_packet(server, key, nkey);
     libcouchbase_server_write_packet(server, bytes, nbytes);
     libcouchbase_server_end_packet(server);
@@ -123,3 +156,144 @@ libcouchbase_error_t libcouchbase_store_by_key(libcouchbase_t instance,
 
     return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
 }
+
+/**
+ * libcouchbase_mstore use the quiet versions of the storage commands
+ * followed by a NOOP command to avoid transferring the responses for
+ * the successful operations. All of the success callbacks are generated
+ * implicit by receiving a later response or the NOOP.
+ *
+ * The storage callback is called once per key: a failure is reported
+ * with the error from the server response for that key, and a success
+ * is reported by the implicit purge with a cas of 0 (the server doesn't
+ * send us the new cas for a quiet command).
+ */
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mstore(libcouchbase_t instance,
+                                         const void *command_cookie,
+                                         libcouchbase_storage_t operation,
+                                         libcouchbase_size_t num_keys,
+                                         const void *const *keys,
+                                         const libcouchbase_size_t *nkey,
+                                         const void *const *bytes,
+                                         const libcouchbase_size_t *nbytes,
+                                         const libcouchbase_uint32_t *flags,
+                                         const libcouchbase_time_t *exp,
+                                         const libcouchbase_cas_t *cas)
+{
+    return libcouchbase_mstore_by_key(instance, command_cookie, operation,
+                                      NULL, 0, num_keys, keys, nkey,
+                                      bytes, nbytes, flags, exp, cas);
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_mstore_by_key(libcouchbase_t instance,
+                                                const void *command_cookie,
+                                                libcouchbase_storage_t operation,
+                                                const void *hashkey,
+                                                libcouchbase_size_t nhashkey,
+                                                libcouchbase_size_t num_keys,
+                                                const void *const *keys,
+                                                const libcouchbase_size_t *nkey,
+                                                const void *const *bytes,
+                                                const libcouchbase_size_t *nbytes,
+                                                const libcouchbase_uint32_t *flags,
+                                                const libcouchbase_time_t *exp,
+                                                const libcouchbase_cas_t *cas)
+{
+    struct libcouchbase_multi_st multi;
+    libcouchbase_error_t err;
+    libcouchbase_size_t ii;
+    libcouchbase_uint8_t opcode;
+
+    /* we need a vbucket config before we can start getting data.. */
+    if (instance->vbucket_config == NULL) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
+    }
+
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    switch (operation) {
+    case LIBCOUCHBASE_ADD:
+        opcode = PROTOCOL_BINARY_CMD_ADDQ;
+        break;
+    case LIBCOUCHBASE_REPLACE:
+        opcode = PROTOCOL_BINARY_CMD_REPLACEQ;
+        break;
+    case LIBCOUCHBASE_SET:
+        opcode = PROTOCOL_BINARY_CMD_SETQ;
+        break;
+    case LIBCOUCHBASE_APPEND:
+        opcode = PROTOCOL_BINARY_CMD_APPENDQ;
+        break;
+    case LIBCOUCHBASE_PREPEND:
+        opcode = PROTOCOL_BINARY_CMD_PREPENDQ;
+        break;
+    default:
+        /* We were given an unknown storage operation. */
+        return libcouchbase_synchandler_return(instance,
+                                               libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                                                          "Invalid value passed as storage operation"));
+    }
+
+    if (num_keys == 1) {
+        return libcouchbase_store_by_key(instance, command_cookie, operation,
+                                         hashkey, nhashkey, keys[0], nkey[0],
+                                         bytes[0], nbytes[0],
+                                         flags ? flags[0] : 0,
+                                         exp ? exp[0] : 0,
+                                         cas ? cas[0] : 0);
+    }
+
+    err = libcouchbase_multi_start(&multi, instance, command_cookie,
+                                   hashkey, nhashkey, num_keys, keys, nkey);
+    if (err != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, err);
+    }
+
+    for (ii = 0; ii < num_keys; ++ii) {
+        protocol_binary_request_set req;
+        libcouchbase_size_t headersize = sizeof(req.bytes);
+        int vb = libcouchbase_multi_vbucket(&multi, ii);
+        libcouchbase_server_t *server = libcouchbase_multi_server(&multi, ii,
+                                                                  nbytes[ii]);
+
+        memset(&req, 0, sizeof(req));
+        req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        req.message.header.request.opcode = opcode;
+        req.message.header.request.keylen = ntohs((libcouchbase_uint16_t)nkey[ii]);
+        req.message.header.request.extlen = 8;
+        req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        req.message.header.request.vbucket = ntohs((libcouchbase_uint16_t)vb);
+        req.message.header.request.opaque = ++instance->seqno;
+        if (cas) {
+            req.message.header.request.cas = cas[ii];
+        }
+        if (flags) {
+            req.message.body.flags = htonl(flags[ii]);
+        }
+        if (exp) {
+            req.message.body.expiration = htonl((libcouchbase_uint32_t)exp[ii]);
+        }
+        if (opcode == PROTOCOL_BINARY_CMD_APPENDQ ||
+                opcode == PROTOCOL_BINARY_CMD_PREPENDQ) {
+            req.message.header.request.extlen = 0;
+            headersize -= 8;
+        }
+        req.message.header.request.bodylen = htonl((libcouchbase_uint32_t)(nkey[ii] + nbytes[ii] + req.message.header.request.extlen));
+
+        libcouchbase_cache_invalidate(instance, vb, keys[ii], nkey[ii]);
+        libcouchbase_server_start_packet(server, command_cookie, &req, headersize);
+        libcouchbase_server_write_packet(server, keys[ii], nkey[ii]);
+        libcouchbase_server_write_packet(server, bytes[ii], nbytes[ii]);
+        libcouchbase_server_end_packet(server);
+    }
+
+    /* Make it known that this was a success. */
+    libcouchbase_error_handler(instance, LIBCOUCHBASE_SUCCESS, NULL);
+    libcouchbase_multi_end(&multi, 1);
+
+    return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
+}
@@ -81,6 +81,10 @@ const char *libcouchbase_strerror(libcouchbase_t instance,
         return "Connection failure";
     case LIBCOUCHBASE_BUCKET_ENOENT:
         return "No such bucket";
+    case LIBCOUCHBASE_EMEMLIMIT:
+        return "The memory limit for the instance is reached";
+    case LIBCOUCHBASE_ENODE_DOWN:
+        return "The server is down (the circuit breaker is open)";
     default:
         return "Unknown error.. are you sure libcouchbase gave you that?";
     }
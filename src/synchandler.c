@@ -16,306 +16,211 @@
  */
 #include "internal.h"
 
-/* @todo add static prototypes */
-
-struct user_cookie {
-    void *cookie;
-    struct libcouchbase_callback_st callbacks;
-    libcouchbase_error_t retcode;
-};
-
-static void restore_user_env(libcouchbase_t instance);
-static void restore_wrapping_env(libcouchbase_t instance,
-                                 struct user_cookie *user,
-                                 libcouchbase_error_t error);
-
-static void tap_mutation_callback(libcouchbase_t instance,
-                                  const void *cookie,
-                                  const void *key,
-                                  libcouchbase_size_t nkey,
-                                  const void *data,
-                                  libcouchbase_size_t nbytes,
-                                  libcouchbase_uint32_t flags,
-                                  libcouchbase_time_t exp,
-                                  libcouchbase_cas_t cas,
-                                  libcouchbase_vbucket_t vbucket,
-                                  const void *es,
-                                  libcouchbase_size_t nes)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.tap_mutation(instance, cookie, key, nkey, data,
-                              nbytes, flags, exp, cas, vbucket,
-                              es, nes);
-    restore_wrapping_env(instance, c, LIBCOUCHBASE_SUCCESS);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void tap_deletion_callback(libcouchbase_t instance,
-                                  const void *cookie,
-                                  const void *key,
-                                  libcouchbase_size_t nkey,
-                                  libcouchbase_cas_t cas,
-                                  libcouchbase_vbucket_t vbucket,
-                                  const void *es,
-                                  libcouchbase_size_t nes)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.tap_deletion(instance, cookie, key, nkey,
-                              cas, vbucket, es, nes);
-    restore_wrapping_env(instance, c, LIBCOUCHBASE_SUCCESS);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void tap_flush_callback(libcouchbase_t instance,
-                               const void *cookie,
-                               const void *es,
-                               libcouchbase_size_t nes)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.tap_flush(instance, cookie, es, nes);
-    restore_wrapping_env(instance, c, LIBCOUCHBASE_SUCCESS);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void tap_opaque_callback(libcouchbase_t instance,
-                                const void *cookie,
-                                const void *es,
-                                libcouchbase_size_t nes)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.tap_opaque(instance, cookie, es, nes);
-    restore_wrapping_env(instance, c, LIBCOUCHBASE_SUCCESS);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void tap_vbucket_set_callback(libcouchbase_t instance,
-                                     const void *cookie,
-                                     libcouchbase_vbucket_t vbid,
-                                     libcouchbase_vbucket_state_t state,
-                                     const void *es,
-                                     libcouchbase_size_t nes)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.tap_vbucket_set(instance, cookie, vbid, state, es, nes);
-    restore_wrapping_env(instance, c, LIBCOUCHBASE_SUCCESS);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void error_callback(libcouchbase_t instance,
-                           libcouchbase_error_t error,
-                           const char *errinfo)
+/**
+ * In synchronous mode we run the event loop until all of the commands
+ * completed, and return the error code passed to the last callback.
+ * The callbacks record their error code in instance->sync_retcode (we
+ * save and restore it so that a synchronous call from within a callback
+ * doesn't clobber the result of the outer call).
+ */
+libcouchbase_error_t libcouchbase_synchandler_return(libcouchbase_t instance,
+                                                     libcouchbase_error_t retcode)
 {
-    struct user_cookie *c = (void *)instance->cookie;
+    libcouchbase_error_t saved;
 
-    restore_user_env(instance);
-    c->callbacks.error(instance, error, errinfo);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void stat_callback(libcouchbase_t instance,
-                          const void *command_cookie,
-                          const char *server_endpoint,
-                          libcouchbase_error_t error,
-                          const void *key,
-                          libcouchbase_size_t nkey,
-                          const void *value,
-                          libcouchbase_size_t nvalue)
-{
-    struct user_cookie *c = (void *)instance->cookie;
+    if (instance->syncmode == LIBCOUCHBASE_ASYNCHRONOUS ||
+            retcode != LIBCOUCHBASE_SUCCESS) {
+        return retcode;
+    }
 
-    restore_user_env(instance);
-    c->callbacks.stat(instance, command_cookie, server_endpoint,
-                      error, key, nkey, value, nvalue);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
+    saved = instance->sync_retcode;
+    instance->sync_retcode = LIBCOUCHBASE_SUCCESS;
+    libcouchbase_wait(instance);
+    retcode = instance->sync_retcode;
+    instance->sync_retcode = saved;
+    return retcode;
 }
 
-static void get_callback(libcouchbase_t instance,
-                         const void *cookie,
-                         libcouchbase_error_t error,
-                         const void *key, libcouchbase_size_t nkey,
-                         const void *bytes, libcouchbase_size_t nbytes,
-                         libcouchbase_uint32_t flags, libcouchbase_cas_t cas)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.get(instance, cookie, error, key, nkey, bytes, nbytes,
-                     flags, cas);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
-}
+/**
+ * A libcouchbase_execute_ops call in progress. The calls may be nested
+ * (from a callback), so they're kept in a list on the instance.
+ */
+struct libcouchbase_op_batch_st {
+    libcouchbase_op_t *ops;
+    libcouchbase_size_t nops;
+    /** The number of operations not completed */
+    libcouchbase_size_t outstanding;
+    /** Set while we're running the event loop */
+    int running;
+    struct libcouchbase_op_batch_st *next;
+};
 
-static void storage_callback(libcouchbase_t instance,
-                             const void *cookie,
-                             libcouchbase_storage_t operation,
-                             libcouchbase_error_t error,
-                             const void *key, libcouchbase_size_t nkey,
-                             libcouchbase_cas_t cas)
+/**
+ * Store the result of an operation, and stop the event loop if it was
+ * the last one we waited for.
+ */
+static void op_completed(libcouchbase_t instance, const void *cookie,
+                         libcouchbase_error_t error, libcouchbase_cas_t cas)
 {
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.storage(instance, cookie, operation, error, key,
-                         nkey, cas);
-    restore_wrapping_env(instance, c, error);
+    libcouchbase_op_t *op = (void *)cookie;
+    struct libcouchbase_op_batch_st *batch = instance->op_batches;
 
-    libcouchbase_maybe_breakout(instance);
-}
+    op->error = error;
+    op->cas = cas;
 
-static void arithmetic_callback(libcouchbase_t instance,
-                                const void *cookie,
-                                libcouchbase_error_t error,
-                                const void *key, libcouchbase_size_t nkey,
-                                libcouchbase_uint64_t value,
-                                libcouchbase_cas_t cas)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.arithmetic(instance, cookie, error, key, nkey,
-                            value, cas);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
+    while (batch != NULL && (op < batch->ops || op >= batch->ops + batch->nops)) {
+        batch = batch->next;
+    }
+    assert(batch != NULL);
+    if (--batch->outstanding == 0 && batch->running) {
+        instance->io->stop_event_loop(instance->io);
+    }
 }
 
-static void remove_callback(libcouchbase_t instance,
+static void op_get_callback(libcouchbase_t instance,
                             const void *cookie,
                             libcouchbase_error_t error,
-                            const void *key, libcouchbase_size_t nkey)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.remove(instance, cookie, error, key, nkey);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void touch_callback(libcouchbase_t instance,
-                           const void *cookie,
-                           libcouchbase_error_t error,
-                           const void *key, libcouchbase_size_t nkey)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.touch(instance, cookie, error, key, nkey);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
-}
-
-static void couch_complete_callback(libcouchbase_couch_request_t request,
-                                    libcouchbase_t instance,
-                                    const void *cookie,
-                                    libcouchbase_error_t error,
-                                    libcouchbase_http_status_t status,
-                                    const char *path,
-                                    libcouchbase_size_t npath,
-                                    const void *bytes,
-                                    libcouchbase_size_t nbytes)
-{
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.couch_complete(request, instance, cookie, error,
-                                status, path, npath, bytes, nbytes);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
+                            const void *key, libcouchbase_size_t nkey,
+                            const void *bytes, libcouchbase_size_t nbytes,
+                            libcouchbase_uint32_t flags, libcouchbase_cas_t cas)
+{
+    libcouchbase_op_t *op = (void *)cookie;
+    buffer_t *values = &instance->op_values;
+
+    op->bytes = NULL;
+    op->nbytes = 0;
+    op->flags = flags;
+    if (error == LIBCOUCHBASE_SUCCESS) {
+        if (grow_buffer(values, nbytes)) {
+            /* The buffer may move, so we fix up the pointer later */
+            memcpy(values->data + values->avail, bytes, nbytes);
+            op->value = values->avail;
+            op->nbytes = nbytes;
+            values->avail += nbytes;
+        } else {
+            error = LIBCOUCHBASE_ENOMEM;
+        }
+    }
+    op_completed(instance, cookie, error, cas);
+    (void)key; (void)nkey;
 }
 
-static void couch_data_callback(libcouchbase_couch_request_t request,
-                                libcouchbase_t instance,
+static void op_storage_callback(libcouchbase_t instance,
                                 const void *cookie,
+                                libcouchbase_storage_t operation,
                                 libcouchbase_error_t error,
-                                libcouchbase_http_status_t status,
-                                const char *path,
-                                libcouchbase_size_t npath,
-                                const void *bytes,
-                                libcouchbase_size_t nbytes)
+                                const void *key, libcouchbase_size_t nkey,
+                                libcouchbase_cas_t cas)
 {
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.couch_data(request, instance, cookie, error,
-                            status, path, npath, bytes, nbytes);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
+    op_completed(instance, cookie, error, cas);
+    (void)operation; (void)key; (void)nkey;
 }
 
-static void flush_callback(libcouchbase_t instance,
-                           const void *cookie,
-                           const char *server_endpoint,
-                           libcouchbase_error_t error)
+static void op_arithmetic_callback(libcouchbase_t instance,
+                                   const void *cookie,
+                                   libcouchbase_error_t error,
+                                   const void *key, libcouchbase_size_t nkey,
+                                   libcouchbase_uint64_t value,
+                                   libcouchbase_cas_t cas)
 {
-    struct user_cookie *c = (void *)instance->cookie;
-
-    restore_user_env(instance);
-    c->callbacks.flush(instance, cookie, server_endpoint, error);
-    restore_wrapping_env(instance, c, error);
-    libcouchbase_maybe_breakout(instance);
+    libcouchbase_op_t *op = (void *)cookie;
+    op->value = value;
+    op_completed(instance, cookie, error, cas);
+    (void)key; (void)nkey;
 }
 
-
-static void restore_user_env(libcouchbase_t instance)
-{
-    struct user_cookie *cookie = (void *)instance->cookie;
-    /* Restore the users environment */
-    instance->cookie = cookie->cookie;
-    instance->callbacks = cookie->callbacks;
+static void op_remove_callback(libcouchbase_t instance,
+                               const void *cookie,
+                               libcouchbase_error_t error,
+                               const void *key, libcouchbase_size_t nkey)
+{
+    op_completed(instance, cookie, error, 0);
+    (void)key; (void)nkey;
+}
+
+static libcouchbase_error_t op_send(libcouchbase_t instance,
+                                    libcouchbase_op_t *op)
+{
+    switch (op->type) {
+    case LIBCOUCHBASE_OP_GET:
+        return libcouchbase_get_with_callback(instance, op, op_get_callback,
+                                              NULL, 0, op->key, op->nkey,
+                                              op->exp ? &op->exp : NULL);
+    case LIBCOUCHBASE_OP_STORE:
+        return libcouchbase_store_with_callback(instance, op, op_storage_callback,
+                                                op->operation, NULL, 0,
+                                                op->key, op->nkey,
+                                                op->bytes, op->nbytes,
+                                                op->flags, op->exp, op->cas);
+    case LIBCOUCHBASE_OP_ARITHMETIC:
+        return libcouchbase_arithmetic_with_callback(instance, op,
+                                                     op_arithmetic_callback,
+                                                     NULL, 0, op->key, op->nkey,
+                                                     op->delta, op->exp,
+                                                     op->create, op->initial);
+    case LIBCOUCHBASE_OP_REMOVE:
+        return libcouchbase_remove_with_callback(instance, op, op_remove_callback,
+                                                 NULL, 0, op->key, op->nkey,
+                                                 op->cas);
+    default:
+        return LIBCOUCHBASE_EINVAL;
+    }
 }
 
-static void restore_wrapping_env(libcouchbase_t instance,
-                                 struct user_cookie *user,
-                                 libcouchbase_error_t error)
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_execute_ops(libcouchbase_t instance,
+                                              libcouchbase_op_t *ops,
+                                              libcouchbase_size_t nops)
 {
-    user->callbacks = instance->callbacks;
-    /* Install new callbacks */
-    instance->callbacks.get = get_callback;
-    instance->callbacks.storage = storage_callback;
-    instance->callbacks.arithmetic = arithmetic_callback;
-    instance->callbacks.remove = remove_callback;
-    instance->callbacks.stat = stat_callback;
-    instance->callbacks.touch = touch_callback;
-    instance->callbacks.flush = flush_callback;
-    instance->callbacks.tap_mutation = tap_mutation_callback;
-    instance->callbacks.tap_deletion = tap_deletion_callback;
-    instance->callbacks.tap_flush = tap_flush_callback;
-    instance->callbacks.tap_opaque = tap_opaque_callback;
-    instance->callbacks.tap_vbucket_set = tap_vbucket_set_callback;
-    instance->callbacks.error = error_callback;
-    instance->callbacks.couch_complete = couch_complete_callback;
-    instance->callbacks.couch_data = couch_data_callback;
+    struct libcouchbase_op_batch_st batch;
+    libcouchbase_syncmode_t syncmode;
+    libcouchbase_size_t ii;
 
-    user->cookie = (void *)instance->cookie;
-    user->retcode = error;
-    instance->cookie = user;
-}
+    /* we need a vbucket config before we can start getting data.. */
+    if (instance->vbucket_config == NULL) {
+        return LIBCOUCHBASE_ETMPFAIL;
+    }
 
+    memset(&batch, 0, sizeof(batch));
+    batch.ops = ops;
+    batch.nops = nops;
+    batch.next = instance->op_batches;
+    instance->op_batches = &batch;
+    if (batch.next == NULL) {
+        instance->op_values.avail = 0;
+    }
 
-libcouchbase_error_t libcouchbase_synchandler_return(libcouchbase_t instance,
-                                                     libcouchbase_error_t retcode)
-{
-    struct user_cookie cookie;
+    /* Send all of them before we start waiting */
+    syncmode = instance->syncmode;
+    instance->syncmode = LIBCOUCHBASE_ASYNCHRONOUS;
+    for (ii = 0; ii < nops; ++ii) {
+        libcouchbase_error_t err;
+        ++batch.outstanding;
+        /* The operation may complete (and fail) before we return */
+        err = op_send(instance, ops + ii);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            ops[ii].error = err;
+            --batch.outstanding;
+        }
+    }
+    instance->syncmode = syncmode;
+
+    /*
+     * Other commands may keep the event loop running (or stop it), so
+     * we run it until our own operations completed.
+     */
+    batch.running = 1;
+    while (batch.outstanding > 0) {
+        instance->io->run_event_loop(instance->io);
+    }
+    instance->op_batches = batch.next;
 
-    if (instance->syncmode == LIBCOUCHBASE_ASYNCHRONOUS ||
-            retcode != LIBCOUCHBASE_SUCCESS) {
-        return retcode;
+    for (ii = 0; ii < nops; ++ii) {
+        if (ops[ii].type == LIBCOUCHBASE_OP_GET && ops[ii].nbytes > 0) {
+            ops[ii].bytes = instance->op_values.data + ops[ii].value;
+            ops[ii].value = 0;
+        }
     }
 
-    restore_wrapping_env(instance, &cookie, LIBCOUCHBASE_SUCCESS);
-    libcouchbase_wait(instance);
-    restore_user_env(instance);
-    return cookie.retcode;
+    return LIBCOUCHBASE_SUCCESS;
 }
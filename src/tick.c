@@ -0,0 +1,226 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the API used to drive the library from an event
+ * loop the application owns. The library keeps a table of the events it
+ * has registered with the io plugin (the socket and the flags it is
+ * waiting for), so that the application may add the sockets to its own
+ * poll set, and libcouchbase_tick runs the io plugin for a bounded time.
+ *
+ * The table is updated every time we change the flags for a socket, so
+ * it's a hash table keyed by the event pointer.
+ */
+
+#include "internal.h"
+
+/**
+ * An event registered with the io plugin
+ */
+struct libcouchbase_io_interest_st {
+    /** The event (the hash key is the pointer itself) */
+    void *event;
+    libcouchbase_socket_t sock;
+    short flags;
+};
+
+/**
+ * Find the entry for an event in the table (or NULL if the event isn't
+ * registered)
+ */
+static struct libcouchbase_io_interest_st *find_interest(libcouchbase_t instance,
+                                                         void *event)
+{
+    if (instance->interest == NULL) {
+        return NULL;
+    }
+    return hashtable_find(instance->interest, &event, sizeof(event));
+}
+
+/**
+ * Add an entry for the event to the table
+ *
+ * @return the new entry or NULL if we failed to allocate memory
+ */
+static struct libcouchbase_io_interest_st *add_interest(libcouchbase_t instance,
+                                                        void *event)
+{
+    struct libcouchbase_io_interest_st *entry;
+
+    if (instance->interest == NULL) {
+        instance->interest = hashtable_create();
+        if (instance->interest == NULL) {
+            return NULL;
+        }
+    }
+
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->event = event;
+    if (hashtable_add(instance->interest, &entry->event,
+                      sizeof(entry->event), entry) != 1) {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+static void remove_interest(libcouchbase_t instance, void *event)
+{
+    if (instance->interest != NULL) {
+        free(hashtable_remove(instance->interest, &event, sizeof(event)));
+    }
+}
+
+int libcouchbase_update_event(libcouchbase_t instance,
+                              libcouchbase_socket_t sock,
+                              void *event,
+                              short flags,
+                              void *cb_data,
+                              void (*handler)(libcouchbase_socket_t sock,
+                                              short which,
+                                              void *cb_data))
+{
+    struct libcouchbase_io_interest_st *entry = find_interest(instance, event);
+
+    if (entry == NULL) {
+        entry = add_interest(instance, event);
+        if (entry == NULL) {
+            libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM,
+                                       "Failed to track the socket");
+            return instance->io->update_event(instance->io, sock, event,
+                                              flags, cb_data, handler);
+        }
+    }
+    entry->sock = sock;
+    entry->flags = flags;
+
+    return instance->io->update_event(instance->io, sock, event,
+                                      flags, cb_data, handler);
+}
+
+void libcouchbase_delete_event(libcouchbase_t instance,
+                               libcouchbase_socket_t sock,
+                               void *event)
+{
+    remove_interest(instance, event);
+    instance->io->delete_event(instance->io, sock, event);
+}
+
+void libcouchbase_destroy_event(libcouchbase_t instance, void *event)
+{
+    remove_interest(instance, event);
+    instance->io->destroy_event(instance->io, event);
+}
+
+static void free_interest(void *value, void *arg)
+{
+    free(value);
+    (void)arg;
+}
+
+void libcouchbase_tick_destroy(libcouchbase_t instance)
+{
+    if (instance->tick_timer != NULL) {
+        instance->io->destroy_timer(instance->io, instance->tick_timer);
+        instance->tick_timer = NULL;
+    }
+    if (instance->interest != NULL) {
+        hashtable_foreach(instance->interest, free_interest, NULL);
+        hashtable_destroy(instance->interest);
+        instance->interest = NULL;
+    }
+}
+
+struct pollfds_st {
+    libcouchbase_pollfd_t *fds;
+    libcouchbase_size_t nfds;
+    libcouchbase_size_t nused;
+};
+
+static void add_pollfd(void *value, void *arg)
+{
+    struct libcouchbase_io_interest_st *entry = value;
+    struct pollfds_st *pollfds = arg;
+
+    if (pollfds->nused < pollfds->nfds) {
+        pollfds->fds[pollfds->nused].sock = entry->sock;
+        pollfds->fds[pollfds->nused].events = entry->flags;
+        ++pollfds->nused;
+    }
+}
+
+LIBCOUCHBASE_API
+libcouchbase_size_t libcouchbase_get_pollfds(libcouchbase_t instance,
+                                             libcouchbase_pollfd_t *fds,
+                                             libcouchbase_size_t nfds)
+{
+    struct pollfds_st pollfds;
+
+    if (instance->interest == NULL) {
+        return 0;
+    }
+
+    pollfds.fds = fds;
+    pollfds.nfds = nfds;
+    pollfds.nused = 0;
+    hashtable_foreach(instance->interest, add_pollfd, &pollfds);
+    return hashtable_num_items(instance->interest);
+}
+
+static void tick_handler(libcouchbase_socket_t sock, short which, void *arg)
+{
+    libcouchbase_t instance = arg;
+    instance->io->stop_event_loop(instance->io);
+    (void)sock;
+    (void)which;
+}
+
+LIBCOUCHBASE_API
+libcouchbase_error_t libcouchbase_tick(libcouchbase_t instance,
+                                       libcouchbase_uint32_t max_usec)
+{
+    if (instance->ticking) {
+        return libcouchbase_error_handler(instance, LIBCOUCHBASE_EINVAL,
+                                          "libcouchbase_tick called from a callback");
+    }
+
+    if (instance->tick_timer == NULL) {
+        instance->tick_timer = instance->io->create_timer(instance->io);
+        if (instance->tick_timer == NULL) {
+            return libcouchbase_error_handler(instance, LIBCOUCHBASE_ENOMEM,
+                                              "Failed to create the tick timer");
+        }
+    }
+
+    /*
+     * The timer stops the event loop once the plugin has handled the
+     * sockets that are ready and the timers that have expired. Events
+     * that became ready when the loop was stopped are handled by the
+     * next tick.
+     */
+    instance->ticking = 1;
+    instance->io->update_timer(instance->io, instance->tick_timer, max_usec,
+                               instance, tick_handler);
+    instance->io->run_event_loop(instance->io);
+    instance->io->delete_timer(instance->io, instance->tick_timer);
+    instance->ticking = 0;
+
+    return LIBCOUCHBASE_SUCCESS;
+}
@@ -41,7 +41,7 @@ static void libcouchbase_timeout_handler(libcouchbase_socket_t sock,
         /*Reset the timer */
         instance->timeout.next = gethrtime();
         libcouchbase_size_t idx;
-        for (idx = 0; idx < instance->nservers; ++idx) {
+        for (idx = 0; idx < instance->nconnections; ++idx) {
             libcouchbase_server_t *server = instance->servers + (libcouchbase_size_t)idx;
             server->next_timeout = instance->timeout.next;
         }
@@ -52,6 +52,12 @@ static void libcouchbase_timeout_handler(libcouchbase_socket_t sock,
     instance->io->delete_timer(instance->io, instance->timeout.event);
     instance->timeout.next = 0;
     libcouchbase_purge_timedout(instance);
+    if (instance->mget_streams != NULL) {
+        libcouchbase_mget_stream_refill(instance);
+    }
+    if (instance->get_batches != NULL) {
+        libcouchbase_get_batch_flush(instance);
+    }
     libcouchbase_update_timer(instance);
 
     libcouchbase_maybe_breakout(instance);
@@ -67,7 +73,7 @@ void libcouchbase_update_timer(libcouchbase_t instance)
     hrtime_t next = 0;
     libcouchbase_size_t idx;
 
-    for (idx = 0; idx < instance->nservers; ++idx) {
+    for (idx = 0; idx < instance->nconnections; ++idx) {
         libcouchbase_server_t *server = instance->servers + (libcouchbase_size_t)idx;
 
         if (next == 0) {
@@ -100,7 +106,7 @@ void libcouchbase_purge_timedout(libcouchbase_t instance)
     hrtime_t tmo = instance->timeout.usec;
     tmo *= 1000;
 
-    for (idx = 0; idx < instance->nservers; ++idx) {
+    for (idx = 0; idx < instance->nconnections; ++idx) {
         libcouchbase_server_t *server = instance->servers + (libcouchbase_size_t)idx;
         if (server->next_timeout != 0 && (now > (tmo + server->next_timeout))) {
             if (server->connected) {
@@ -109,6 +115,9 @@ void libcouchbase_purge_timedout(libcouchbase_t instance)
                                                  &server->output_cookies,
                                                  tmo, now,
                                                  LIBCOUCHBASE_ETIMEDOUT);
+                if (libcouchbase_window_release(server) > 0) {
+                    libcouchbase_server_send_packets(server);
+                }
             } else {
                 libcouchbase_purge_single_server(server,
                                                  &server->pending,
@@ -116,6 +125,13 @@ void libcouchbase_purge_timedout(libcouchbase_t instance)
                                                  tmo, now,
                                                  LIBCOUCHBASE_ETIMEDOUT);
             }
+            if (libcouchbase_breaker_tripped(server)) {
+                /* Fail the rest of the commands right away */
+                libcouchbase_failout_server(server, LIBCOUCHBASE_ENODE_DOWN);
+            } else {
+                libcouchbase_server_shrink_buffers(server);
+            }
         }
     }
+    libcouchbase_update_memory_limit(instance);
 }
@@ -130,6 +130,11 @@ libcouchbase_error_t libcouchbase_get_timings(libcouchbase_t instance,
     return LIBCOUCHBASE_SUCCESS;
 }
 
+libcouchbase_size_t libcouchbase_timings_nbytes(libcouchbase_t instance)
+{
+    return instance->histogram != NULL ? sizeof(*instance->histogram) : 0;
+}
+
 void libcouchbase_record_metrics(libcouchbase_t instance,
                                  hrtime_t delta,
                                  uint8_t opcode)
@@ -37,11 +37,6 @@ libcouchbase_error_t libcouchbase_mtouch(libcouchbase_t instance,
                                       keys, nkey, exp);
 }
 
-struct server_info_st {
-    int vb;
-    int idx;
-};
-
 LIBCOUCHBASE_API
 libcouchbase_error_t libcouchbase_mtouch_by_key(libcouchbase_t instance,
                                                 const void *command_cookie,
@@ -52,44 +47,29 @@ libcouchbase_error_t libcouchbase_mtouch_by_key(libcouchbase_t instance,
                                                 const libcouchbase_size_t *nkey,
                                                 const libcouchbase_time_t *exp)
 {
-    libcouchbase_server_t *server = NULL;
+    struct libcouchbase_multi_st multi;
+    libcouchbase_error_t err;
     libcouchbase_size_t ii;
-    int vb, idx;
-    struct server_info_st *servers = NULL;
 
     /* we need a vbucket config before we can start getting data.. */
     if (instance->vbucket_config == NULL) {
         return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ETMPFAIL);
     }
 
-    if (nhashkey != 0) {
-        (void)vbucket_map(instance->vbucket_config, hashkey, nhashkey, &vb, &idx);
-        if (idx < 0 || idx > (int)instance->nservers) {
-            /* the config says that there is no server yet at that position (-1) */
-            return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
-        }
-        server = instance->servers + idx;
-    } else {
-        servers = malloc(num_keys * sizeof(struct server_info_st));
-        if (servers == NULL) {
-            return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_ENOMEM);
-        }
-        for (ii = 0; ii < num_keys; ++ii) {
-            (void)vbucket_map(instance->vbucket_config, keys[ii], nkey[ii], &servers[ii].vb, &servers[ii].idx);
-            if (servers[ii].idx < 0 || servers[ii].idx > (int)instance->nservers) {
-                /* the config says that there is no server yet at that position (-1) */
-                free(servers);
-                return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_NETWORK_ERROR);
-            }
-        }
+    if (libcouchbase_check_memory_limit(instance) != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_EMEMLIMIT);
+    }
+
+    err = libcouchbase_multi_start(&multi, instance, command_cookie,
+                                   hashkey, nhashkey, num_keys, keys, nkey);
+    if (err != LIBCOUCHBASE_SUCCESS) {
+        return libcouchbase_synchandler_return(instance, err);
     }
 
     for (ii = 0; ii < num_keys; ++ii) {
         protocol_binary_request_touch req;
-        if (nhashkey == 0) {
-            server = instance->servers + servers[ii].idx;
-            vb = servers[ii].vb;
-        }
+        int vb = libcouchbase_multi_vbucket(&multi, ii);
+        libcouchbase_server_t *server = libcouchbase_multi_server(&multi, ii, 0);
 
         memset(&req, 0, sizeof(req));
         req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -102,13 +82,14 @@ libcouchbase_error_t libcouchbase_mtouch_by_key(libcouchbase_t instance,
         req.message.header.request.opaque = ++instance->seqno;
         /* @todo fix the relative time! */
         req.message.body.expiration = htonl((libcouchbase_uint32_t)exp[ii]);
+        libcouchbase_cache_invalidate(instance, vb, keys[ii], nkey[ii]);
         libcouchbase_server_start_packet(server, command_cookie,
                                          req.bytes, sizeof(req.bytes));
         libcouchbase_server_write_packet(server, keys[ii], nkey[ii]);
         libcouchbase_server_end_packet(server);
-        libcouchbase_server_send_packets(server);
     }
-    free(servers);
+    /* TOUCH isn't quiet, so we don't need to terminate the batch */
+    libcouchbase_multi_end(&multi, 0);
 
     return libcouchbase_synchandler_return(instance, LIBCOUCHBASE_SUCCESS);
 }
@@ -167,3 +167,402 @@ evutil_socket_t libcouchbase_gai2sock(libcouchbase_t instance,
 
     return ret;
 }
+
+/**
+ * The slot in instance->mutations for a key. Keys sharing a slot only
+ * make us skip filling the caches more often than we have to.
+ */
+static libcouchbase_size_t mutation_slot(int vb, const void *key,
+                                         libcouchbase_size_t nkey)
+{
+    const unsigned char *ptr = key;
+    libcouchbase_uint32_t hash = 2166136261U ^ (libcouchbase_uint32_t)vb;
+    libcouchbase_size_t ii;
+
+    for (ii = 0; ii < nkey; ++ii) {
+        hash ^= ptr[ii];
+        hash *= 16777619U;
+    }
+    return hash % LIBCOUCHBASE_MUTATION_SLOTS;
+}
+
+/**
+ * Allocate the mutation slots when the first cache is enabled. The gets
+ * already sent may not fill the caches, since we don't know what was
+ * modified before.
+ *
+ * @return LIBCOUCHBASE_SUCCESS or LIBCOUCHBASE_ENOMEM
+ */
+libcouchbase_error_t libcouchbase_cache_mutations_create(libcouchbase_t instance)
+{
+    libcouchbase_size_t ii;
+
+    if (instance->mutations != NULL) {
+        return LIBCOUCHBASE_SUCCESS;
+    }
+    instance->mutations = malloc(LIBCOUCHBASE_MUTATION_SLOTS *
+                                 sizeof(*instance->mutations));
+    if (instance->mutations == NULL) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    for (ii = 0; ii < LIBCOUCHBASE_MUTATION_SLOTS; ++ii) {
+        instance->mutations[ii] = instance->seqno;
+    }
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+/**
+ * Release the mutation slots when the last cache is disabled
+ */
+void libcouchbase_cache_mutations_release(libcouchbase_t instance)
+{
+    if (instance->near_cache == NULL && instance->negative_cache == NULL) {
+        free(instance->mutations);
+        instance->mutations = NULL;
+    }
+}
+
+/**
+ * Remember that a key was modified. The response to a get sent before
+ * this may carry the old value (or the miss), so it may not be put in
+ * the caches.
+ */
+void libcouchbase_cache_mutated(libcouchbase_t instance, int vb,
+                                const void *key, libcouchbase_size_t nkey)
+{
+    if (instance->mutations != NULL) {
+        instance->mutations[mutation_slot(vb, key, nkey)] = instance->seqno;
+    }
+}
+
+/**
+ * Check if the response to the get with the given opaque may be put in
+ * the caches (the key wasn't modified after the get was sent). The
+ * seqno wraps, so the opaque is compared like a serial number: it's
+ * newer if it's less than half of the range ahead of the mutation.
+ */
+int libcouchbase_cache_may_fill(libcouchbase_t instance, int vb,
+                                const void *key, libcouchbase_size_t nkey,
+                                libcouchbase_uint32_t opaque)
+{
+    libcouchbase_uint32_t distance;
+
+    if (instance->mutations == NULL) {
+        return 1;
+    }
+    distance = opaque - instance->mutations[mutation_slot(vb, key, nkey)];
+    return distance != 0 && distance < 0x80000000U;
+}
+
+/**
+ * Remove a key from the client side caches. Called for all of the
+ * operations modifying a key.
+ */
+void libcouchbase_cache_invalidate(libcouchbase_t instance, int vb,
+                                   const void *key, libcouchbase_size_t nkey)
+{
+    if (instance->near_cache == NULL && instance->negative_cache == NULL) {
+        return;
+    }
+
+    libcouchbase_cache_mutated(instance, vb, key, nkey);
+    if (instance->near_cache != NULL) {
+        libcouchbase_near_cache_invalidate(instance, vb, key, nkey);
+    }
+    if (instance->negative_cache != NULL) {
+        libcouchbase_negative_cache_invalidate(instance, vb, key, nkey);
+    }
+}
+
+/**
+ * Remove all of the keys from the client side caches (the bucket is
+ * flushed)
+ */
+void libcouchbase_cache_invalidate_all(libcouchbase_t instance)
+{
+    libcouchbase_size_t ii;
+
+    if (instance->near_cache == NULL && instance->negative_cache == NULL) {
+        return;
+    }
+
+    for (ii = 0; instance->mutations != NULL &&
+                 ii < LIBCOUCHBASE_MUTATION_SLOTS; ++ii) {
+        instance->mutations[ii] = instance->seqno;
+    }
+    if (instance->near_cache != NULL) {
+        libcouchbase_near_cache_invalidate_all(instance);
+    }
+    if (instance->negative_cache != NULL) {
+        libcouchbase_negative_cache_invalidate_all(instance);
+    }
+}
+
+/**
+ * A hit waiting to be delivered to the get callback
+ */
+struct cache_hit_st {
+    const void *cookie;
+    struct libcouchbase_cache_entry_st *entry;
+};
+
+static void cache_entry_release(struct libcouchbase_cache_entry_st *entry)
+{
+    if (entry->refcount == 0 && !entry->linked) {
+        free(entry);
+    }
+}
+
+static void cache_unlink(struct libcouchbase_cache_st *cache,
+                         struct libcouchbase_cache_entry_st *entry)
+{
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void cache_push(struct libcouchbase_cache_st *cache,
+                       struct libcouchbase_cache_entry_st *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+static void cache_deliver_hits(libcouchbase_socket_t sock, short which,
+                               void *arg)
+{
+    struct libcouchbase_cache_st *cache = arg;
+    libcouchbase_t instance = cache->instance;
+    libcouchbase_size_t nhits;
+
+    instance->io->delete_timer(instance->io, cache->event);
+
+    /*
+     * Only deliver the hits we've got now. The callbacks may issue
+     * new gets, and they'll be delivered the next time we're called.
+     */
+    nhits = ringbuffer_get_nbytes(&cache->hits) / sizeof(struct cache_hit_st);
+    while (nhits-- > 0) {
+        struct cache_hit_st hit;
+        libcouchbase_size_t nr = ringbuffer_read(&cache->hits, &hit, sizeof(hit));
+        assert(nr == sizeof(hit));
+        (void)nr;
+
+        cache->deliver(instance, hit.cookie, hit.entry);
+        --hit.entry->refcount;
+        cache_entry_release(hit.entry);
+        if (cache->lookup(instance) != cache) {
+            /* The cache was disabled from the callback */
+            return;
+        }
+    }
+
+    if (ringbuffer_get_nbytes(&cache->hits) != 0) {
+        instance->io->update_timer(instance->io, cache->event, 0,
+                                   cache, cache_deliver_hits);
+    }
+    libcouchbase_maybe_breakout(instance);
+
+    (void)sock;
+    (void)which;
+}
+
+/**
+ * Initialize the part shared by the caches (and the mutation slots)
+ *
+ * @param lookup returns the cache of the instance, so we can tell if it
+ *               was disabled from a get callback
+ * @param deliver reports a hit to the get callback
+ * @return LIBCOUCHBASE_SUCCESS or LIBCOUCHBASE_ENOMEM
+ */
+libcouchbase_error_t libcouchbase_cache_create(struct libcouchbase_cache_st *cache,
+                                               libcouchbase_t instance,
+                                               libcouchbase_cache_lookup_fn lookup,
+                                               libcouchbase_cache_deliver_fn deliver)
+{
+    memset(cache, 0, sizeof(*cache));
+    if (libcouchbase_cache_mutations_create(instance) != LIBCOUCHBASE_SUCCESS) {
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    cache->instance = instance;
+    cache->lookup = lookup;
+    cache->deliver = deliver;
+    cache->items = hashtable_create();
+    cache->event = instance->io->create_timer(instance->io);
+    if (cache->items == NULL || cache->event == NULL ||
+            !ringbuffer_initialize(&cache->hits, 64 * sizeof(struct cache_hit_st))) {
+        if (cache->event != NULL) {
+            instance->io->destroy_timer(instance->io, cache->event);
+        }
+        hashtable_destroy(cache->items);
+        libcouchbase_cache_mutations_release(instance);
+        return LIBCOUCHBASE_ENOMEM;
+    }
+    return LIBCOUCHBASE_SUCCESS;
+}
+
+/**
+ * Release the part shared by the caches. The cache must already be
+ * removed from the instance (so the mutation slots may be released).
+ *
+ * @param deliver if the pending hits should be delivered (or dropped
+ *                just like the commands in flight)
+ */
+void libcouchbase_cache_destroy(struct libcouchbase_cache_st *cache,
+                                int deliver)
+{
+    libcouchbase_t instance = cache->instance;
+
+    while (ringbuffer_get_nbytes(&cache->hits) != 0) {
+        struct cache_hit_st hit;
+        libcouchbase_size_t nr = ringbuffer_read(&cache->hits, &hit, sizeof(hit));
+        assert(nr == sizeof(hit));
+        (void)nr;
+        if (deliver) {
+            cache->deliver(instance, hit.cookie, hit.entry);
+        }
+        --hit.entry->refcount;
+        cache_entry_release(hit.entry);
+    }
+
+    libcouchbase_cache_clear(cache);
+    instance->io->delete_timer(instance->io, cache->event);
+    instance->io->destroy_timer(instance->io, cache->event);
+    ringbuffer_destruct(&cache->hits);
+    hashtable_destroy(cache->items);
+    libcouchbase_cache_mutations_release(instance);
+}
+
+/**
+ * Allocate an entry with the vbucket id and the key copied in
+ *
+ * @param size the size of the struct the entry is the first member of
+ * @param nextra the number of bytes to allocate after the key
+ */
+struct libcouchbase_cache_entry_st *libcouchbase_cache_entry_create(libcouchbase_size_t size,
+                                                                    int vb,
+                                                                    const void *key,
+                                                                    libcouchbase_size_t nkey,
+                                                                    libcouchbase_size_t nextra)
+{
+    libcouchbase_uint16_t vbid = (libcouchbase_uint16_t)vb;
+    struct libcouchbase_cache_entry_st *entry;
+
+    entry = malloc(size + sizeof(vbid) + nkey + nextra);
+    if (entry == NULL) {
+        return NULL;
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->key = (char *)entry + size;
+    memcpy(entry->key, &vbid, sizeof(vbid));
+    memcpy(entry->key + sizeof(vbid), key, nkey);
+    entry->nkey = sizeof(vbid) + nkey;
+    entry->size = size + sizeof(vbid) + nkey + nextra;
+    return entry;
+}
+
+struct libcouchbase_cache_entry_st *libcouchbase_cache_find(struct libcouchbase_cache_st *cache,
+                                                            int vb,
+                                                            const void *key,
+                                                            libcouchbase_size_t nkey)
+{
+    libcouchbase_uint16_t vbid = (libcouchbase_uint16_t)vb;
+    char buffer[256 + sizeof(vbid)];
+
+    if (nkey > sizeof(buffer) - sizeof(vbid)) {
+        return NULL;
+    }
+    memcpy(buffer, &vbid, sizeof(vbid));
+    memcpy(buffer + sizeof(vbid), key, nkey);
+    return hashtable_find(cache->items, buffer, sizeof(vbid) + nkey);
+}
+
+/**
+ * Insert an entry at the head of the cache
+ *
+ * @return non-zero on success, 0 if the entry was released
+ */
+int libcouchbase_cache_add(struct libcouchbase_cache_st *cache,
+                           struct libcouchbase_cache_entry_st *entry)
+{
+    if (hashtable_add(cache->items, entry->key, entry->nkey, entry) != 1) {
+        free(entry);
+        return 0;
+    }
+    entry->linked = 1;
+    cache_push(cache, entry);
+    cache->nbytes += entry->size;
+    return 1;
+}
+
+/**
+ * Remove an entry from the cache. It's released once the hits queued
+ * for it are delivered.
+ */
+void libcouchbase_cache_remove(struct libcouchbase_cache_st *cache,
+                               struct libcouchbase_cache_entry_st *entry)
+{
+    (void)hashtable_remove(cache->items, entry->key, entry->nkey);
+    cache_unlink(cache, entry);
+    cache->nbytes -= entry->size;
+    entry->linked = 0;
+    cache_entry_release(entry);
+}
+
+/**
+ * Move an entry to the head of the cache (it was just used)
+ */
+void libcouchbase_cache_touch(struct libcouchbase_cache_st *cache,
+                              struct libcouchbase_cache_entry_st *entry)
+{
+    cache_unlink(cache, entry);
+    cache_push(cache, entry);
+}
+
+void libcouchbase_cache_clear(struct libcouchbase_cache_st *cache)
+{
+    while (cache->head != NULL) {
+        libcouchbase_cache_remove(cache, cache->head);
+    }
+}
+
+/**
+ * Schedule the delivery of a hit from the timer of the cache
+ *
+ * @return non-zero on success, 0 if we're out of memory (and the get
+ *         should be sent to the server)
+ */
+int libcouchbase_cache_add_hit(struct libcouchbase_cache_st *cache,
+                               const void *cookie,
+                               struct libcouchbase_cache_entry_st *entry)
+{
+    struct cache_hit_st hit;
+
+    hit.cookie = cookie;
+    hit.entry = entry;
+    if (!ringbuffer_ensure_capacity(&cache->hits, sizeof(hit)) ||
+            ringbuffer_write(&cache->hits, &hit, sizeof(hit)) != sizeof(hit)) {
+        return 0;
+    }
+
+    if (ringbuffer_get_nbytes(&cache->hits) == sizeof(hit)) {
+        cache->instance->io->update_timer(cache->instance->io, cache->event,
+                                          0, cache, cache_deliver_hits);
+    }
+    ++entry->refcount;
+    return 1;
+}
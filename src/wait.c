@@ -38,9 +38,9 @@ static void initial_connect_timeout_handler(libcouchbase_socket_t sock,
 
     if (instance->sock != INVALID_SOCKET) {
         /* Do we need to delete the event? */
-        instance->io->delete_event(instance->io,
-                                   instance->sock,
-                                   instance->event);
+        libcouchbase_delete_event(instance,
+                                  instance->sock,
+                                  instance->event);
         instance->io->close(instance->io, instance->sock);
         instance->sock = INVALID_SOCKET;
     }
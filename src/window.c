@@ -0,0 +1,240 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This file contains the in-flight window for the connections to the
+ * servers. When it's enabled, at most server->window commands may be
+ * sent to a connection and not completed yet. The rest of them wait
+ * in the held buffer (in the order they were issued), and they don't
+ * go into the command log until they are moved into the window.
+ *
+ * The window is adjusted like TCP does it (AIMD). It grows by one for
+ * every window of responses, and it's cut in half when a command times
+ * out, the server tells us to back off (TMPFAIL/ENOMEM) or a response
+ * takes a lot longer than the fastest one we've seen. A held command
+ * that times out before there is room for it is never sent.
+ *
+ * The quiet commands and the NOOP terminating them don't wait for room
+ * in the window (unless there are commands held before them). The
+ * server doesn't respond to a quiet command that succeeds, so it only
+ * completes when the NOOP does, and holding either of them would stall
+ * the batch until it times out.
+ */
+
+#include "internal.h"
+
+/**
+ * Check if the command may pass the window
+ */
+static int window_exempt(const void *packet)
+{
+    const protocol_binary_request_header *req = packet;
+
+    switch (req->request.opcode) {
+    case PROTOCOL_BINARY_CMD_NOOP:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+    case PROTOCOL_BINARY_CMD_GATQ:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Get the number of commands given to the connection and not completed
+ */
+libcouchbase_size_t libcouchbase_window_inflight(libcouchbase_server_t *server)
+{
+    return ringbuffer_get_nbytes(&server->output_cookies) /
+           sizeof(struct libcouchbase_command_data_st);
+}
+
+/**
+ * Get the number of commands waiting for room in the window
+ */
+libcouchbase_size_t libcouchbase_window_nheld(libcouchbase_server_t *server)
+{
+    return ringbuffer_get_nbytes(&server->held_cookies) /
+           sizeof(struct libcouchbase_command_data_st);
+}
+
+/**
+ * Check if a new command for the server has to be held back
+ *
+ * @param server the connection the command is for
+ * @param packet the start of the command (the request header)
+ */
+int libcouchbase_window_is_full(libcouchbase_server_t *server,
+                                const void *packet)
+{
+    if (server->instance->max_window == 0) {
+        return 0;
+    }
+
+    if (server->held_cookies.nbytes > 0) {
+        /* Don't let the new command pass the ones already waiting */
+        return 1;
+    }
+
+    return !window_exempt(packet) &&
+           libcouchbase_window_inflight(server) >= server->window;
+}
+
+/**
+ * Start over with the biggest window (for a new connection, or when
+ * the max size of the window changes)
+ */
+void libcouchbase_window_reset(libcouchbase_server_t *server)
+{
+    server->window = server->instance->max_window;
+    server->window_acked = 0;
+    server->window_recover_seqno = 0;
+    server->min_rtt = 0;
+}
+
+/**
+ * Cut the window in half. The responses to the commands already sent
+ * won't shrink it again.
+ */
+void libcouchbase_window_congested(libcouchbase_server_t *server)
+{
+    if (server->instance->max_window == 0) {
+        return;
+    }
+
+    server->window /= 2;
+    if (server->window == 0) {
+        server->window = 1;
+    }
+    server->window_acked = 0;
+    server->window_recover_seqno = server->instance->seqno;
+}
+
+/**
+ * Adjust the window for a response from the server
+ *
+ * @param server the connection the response came from
+ * @param ct the command data for the command
+ * @param opaque the opaque field from the response
+ * @param status the status from the response
+ * @param now the time we read the response
+ */
+void libcouchbase_window_ack(libcouchbase_server_t *server,
+                             const struct libcouchbase_command_data_st *ct,
+                             libcouchbase_uint32_t opaque,
+                             libcouchbase_uint16_t status,
+                             hrtime_t now)
+{
+    int congested = 0;
+
+    if (server->instance->max_window == 0) {
+        return;
+    }
+
+    if (status == PROTOCOL_BINARY_RESPONSE_ETMPFAIL ||
+            status == PROTOCOL_BINARY_RESPONSE_ENOMEM) {
+        congested = 1;
+    } else if (ct->sent != 0 && now > ct->sent) {
+        hrtime_t rtt = now - ct->sent;
+        if (server->min_rtt == 0 || rtt < server->min_rtt) {
+            server->min_rtt = rtt;
+        }
+        if (rtt > LIBCOUCHBASE_WINDOW_MIN_CONGESTED_RTT &&
+                rtt > server->min_rtt * LIBCOUCHBASE_WINDOW_RTT_FACTOR) {
+            congested = 1;
+        }
+    }
+
+    if (congested) {
+        if (opaque > server->window_recover_seqno) {
+            libcouchbase_window_congested(server);
+        }
+    } else if (++server->window_acked >= server->window) {
+        server->window_acked = 0;
+        if (server->window < server->instance->max_window) {
+            ++server->window;
+        }
+    }
+}
+
+/**
+ * Move the held commands into the window as long as there is room
+ * for them. The ones that timed out while they were waiting are
+ * failed with LIBCOUCHBASE_ETIMEDOUT instead.
+ *
+ * @param server the connection to move the commands for
+ * @return the number of commands moved to the output buffer
+ */
+int libcouchbase_window_release(libcouchbase_server_t *server)
+{
+    struct libcouchbase_command_data_st ct;
+    protocol_binary_request_header req;
+    libcouchbase_size_t packetsize;
+    libcouchbase_size_t nheld;
+    hrtime_t now;
+    hrtime_t tmo;
+    int nmoved = 0;
+
+    if (server->held_cookies.nbytes == 0 || !server->connected) {
+        return 0;
+    }
+
+    now = gethrtime();
+    tmo = server->instance->timeout.usec;
+    tmo *= 1000;
+    nheld = libcouchbase_window_nheld(server);
+    libcouchbase_purge_single_server(server, &server->held,
+                                     &server->held_cookies,
+                                     tmo, now, LIBCOUCHBASE_ETIMEDOUT);
+    server->window_shed += nheld - libcouchbase_window_nheld(server);
+
+    while (server->held_cookies.nbytes > 0) {
+        if (ringbuffer_peek(&server->held, req.bytes, sizeof(req)) != sizeof(req)) {
+            abort();
+        }
+        if (server->instance->max_window != 0 && !window_exempt(req.bytes) &&
+                libcouchbase_window_inflight(server) >= server->window) {
+            break;
+        }
+        if (ringbuffer_read(&server->held_cookies, &ct, sizeof(ct)) != sizeof(ct)) {
+            abort();
+        }
+        packetsize = ntohl(req.request.bodylen) + (libcouchbase_uint32_t)sizeof(req);
+        ct.sent = now;
+
+        if (ringbuffer_memcpy(&server->output, &server->held, packetsize) != 0 ||
+                ringbuffer_memcpy(&server->cmd_log, &server->held, packetsize) != 0 ||
+                !ringbuffer_ensure_capacity(&server->output_cookies, sizeof(ct)) ||
+                ringbuffer_write(&server->output_cookies, &ct, sizeof(ct)) != sizeof(ct)) {
+            abort();
+        }
+        ringbuffer_consumed(&server->held, packetsize);
+        ++nmoved;
+    }
+
+    libcouchbase_server_reset_timeout(server);
+    return nmoved;
+}
@@ -0,0 +1,178 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+#include <gtest/gtest.h>
+#include "internal.h"
+
+/*
+ * The tests only exercise the state machine, so catch the failout
+ * instead of linking the connection handling.
+ */
+static libcouchbase_error_t failout_error;
+
+extern "C" {
+    libcouchbase_error_t libcouchbase_failout_server(libcouchbase_server_t *server,
+                                                     libcouchbase_error_t error)
+    {
+        ringbuffer_reset(&server->pending_cookies);
+        ringbuffer_reset(&server->held_cookies);
+        failout_error = error;
+        return error;
+    }
+}
+
+class Breaker : public ::testing::Test
+{
+public:
+    virtual void SetUp(void) {
+        memset(&instance, 0, sizeof(instance));
+        memset(&server, 0, sizeof(server));
+        instance.breaker_threshold = 3;
+        instance.breaker_reset = 1000;
+        server.instance = &instance;
+        server.sock = INVALID_SOCKET;
+        failout_error = LIBCOUCHBASE_SUCCESS;
+    }
+
+    virtual void TearDown(void) {
+        ringbuffer_destruct(&server.pending_cookies);
+        ringbuffer_destruct(&server.held_cookies);
+    }
+
+protected:
+    /* Pretend the breaker was opened long enough ago to be half open */
+    void expire(void) {
+        hrtime_t backoff = server.breaker_backoff;
+        server.breaker_opened = gethrtime() - backoff * 1000 - 1;
+    }
+
+    struct libcouchbase_st instance;
+    libcouchbase_server_t server;
+};
+
+TEST_F(Breaker, disabled)
+{
+    instance.breaker_threshold = 0;
+    for (int ii = 0; ii < 10; ++ii) {
+        libcouchbase_breaker_failure(&server, gethrtime());
+    }
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_CLOSED, server.breaker);
+    EXPECT_NE(0, libcouchbase_breaker_allow(&server));
+}
+
+TEST_F(Breaker, opensAtThreshold)
+{
+    libcouchbase_breaker_failure(&server, gethrtime());
+    libcouchbase_breaker_failure(&server, gethrtime());
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_CLOSED, server.breaker);
+    EXPECT_NE(0, libcouchbase_breaker_allow(&server));
+
+    libcouchbase_breaker_failure(&server, gethrtime());
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_OPEN, server.breaker);
+    EXPECT_EQ(instance.breaker_reset, server.breaker_backoff);
+    EXPECT_EQ(1, server.breaker_trips);
+    EXPECT_EQ(0, libcouchbase_breaker_allow(&server));
+}
+
+TEST_F(Breaker, successResetsFailures)
+{
+    libcouchbase_breaker_failure(&server, gethrtime());
+    libcouchbase_breaker_failure(&server, gethrtime());
+    libcouchbase_breaker_success(&server);
+    libcouchbase_breaker_failure(&server, gethrtime());
+    libcouchbase_breaker_failure(&server, gethrtime());
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_CLOSED, server.breaker);
+    EXPECT_EQ(0, server.breaker_trips);
+}
+
+TEST_F(Breaker, halfOpenAfterBackoff)
+{
+    for (int ii = 0; ii < 3; ++ii) {
+        libcouchbase_breaker_failure(&server, gethrtime());
+    }
+    ASSERT_EQ(LIBCOUCHBASE_BREAKER_OPEN, server.breaker);
+
+    expire();
+    EXPECT_NE(0, libcouchbase_breaker_allow(&server));
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_HALF_OPEN, server.breaker);
+
+    /* The first response closes it */
+    libcouchbase_breaker_success(&server);
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_CLOSED, server.breaker);
+    EXPECT_EQ(0, server.breaker_backoff);
+}
+
+TEST_F(Breaker, backoffDoubles)
+{
+    for (int ii = 0; ii < 3; ++ii) {
+        libcouchbase_breaker_failure(&server, gethrtime());
+    }
+
+    /* A single failure while half open opens it for twice as long */
+    expire();
+    ASSERT_NE(0, libcouchbase_breaker_allow(&server));
+    libcouchbase_breaker_failure(&server, gethrtime());
+    EXPECT_EQ(LIBCOUCHBASE_BREAKER_OPEN, server.breaker);
+    EXPECT_EQ(2 * instance.breaker_reset, server.breaker_backoff);
+    EXPECT_EQ(2, server.breaker_trips);
+    EXPECT_EQ(0, libcouchbase_breaker_allow(&server));
+
+    expire();
+    ASSERT_NE(0, libcouchbase_breaker_allow(&server));
+    libcouchbase_breaker_failure(&server, gethrtime());
+    EXPECT_EQ(4 * instance.breaker_reset, server.breaker_backoff);
+}
+
+TEST_F(Breaker, backoffIsCapped)
+{
+    instance.breaker_reset = LIBCOUCHBASE_MAX_BREAKER_BACKOFF - 1;
+    for (int ii = 0; ii < 3; ++ii) {
+        libcouchbase_breaker_failure(&server, gethrtime());
+    }
+    expire();
+    ASSERT_NE(0, libcouchbase_breaker_allow(&server));
+    libcouchbase_breaker_failure(&server, gethrtime());
+    EXPECT_EQ((libcouchbase_uint32_t)LIBCOUCHBASE_MAX_BREAKER_BACKOFF,
+              server.breaker_backoff);
+}
+
+TEST_F(Breaker, trippedOnlyWithSocket)
+{
+    for (int ii = 0; ii < 3; ++ii) {
+        libcouchbase_breaker_failure(&server, gethrtime());
+    }
+    EXPECT_EQ(0, libcouchbase_breaker_tripped(&server));
+    server.sock = 0;
+    EXPECT_NE(0, libcouchbase_breaker_tripped(&server));
+}
+
+TEST_F(Breaker, rejectFailsQueuedCommands)
+{
+    struct libcouchbase_command_data_st ct;
+
+    memset(&ct, 0, sizeof(ct));
+    ASSERT_NE(0, ringbuffer_ensure_capacity(&server.pending_cookies, 2 * sizeof(ct)));
+    ASSERT_EQ(sizeof(ct), ringbuffer_write(&server.pending_cookies, &ct, sizeof(ct)));
+    ASSERT_EQ(sizeof(ct), ringbuffer_write(&server.pending_cookies, &ct, sizeof(ct)));
+    ASSERT_NE(0, ringbuffer_ensure_capacity(&server.held_cookies, sizeof(ct)));
+    ASSERT_EQ(sizeof(ct), ringbuffer_write(&server.held_cookies, &ct, sizeof(ct)));
+
+    libcouchbase_breaker_reject(&server);
+    EXPECT_EQ(3, server.breaker_rejected);
+    EXPECT_EQ(LIBCOUCHBASE_ENODE_DOWN, failout_error);
+}
@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+#include <gtest/gtest.h>
+#include <libcouchbase/couchbase.h>
+#include "ringbuffer.h"
+#include "bufpool.h"
+
+class Bufpool : public ::testing::Test
+{
+public:
+    virtual void SetUp(void) {
+        pool = libcouchbase_buffer_pool_create(4096);
+        ASSERT_NE((struct libcouchbase_buffer_pool_st *)NULL, pool);
+    }
+
+    virtual void TearDown(void) {
+        libcouchbase_buffer_pool_destroy(pool);
+    }
+
+protected:
+    struct libcouchbase_buffer_pool_st *pool;
+};
+
+TEST_F(Bufpool, reuseBuffers)
+{
+    void *ptr = libcouchbase_buffer_pool_alloc(pool, 1024);
+    ASSERT_NE((void *)NULL, ptr);
+    EXPECT_EQ(0, libcouchbase_buffer_pool_hits(pool));
+    EXPECT_EQ(1, libcouchbase_buffer_pool_misses(pool));
+
+    libcouchbase_buffer_pool_release(pool, ptr, 1024);
+    EXPECT_EQ(1024, libcouchbase_buffer_pool_nbytes(pool));
+
+    /* Only a buffer of the same size may be reused */
+    void *other = libcouchbase_buffer_pool_alloc(pool, 2048);
+    EXPECT_EQ(1024, libcouchbase_buffer_pool_nbytes(pool));
+    EXPECT_EQ(ptr, libcouchbase_buffer_pool_alloc(pool, 1024));
+    EXPECT_EQ(1, libcouchbase_buffer_pool_hits(pool));
+    EXPECT_EQ(0, libcouchbase_buffer_pool_nbytes(pool));
+
+    libcouchbase_buffer_pool_release(pool, ptr, 1024);
+    libcouchbase_buffer_pool_release(pool, other, 2048);
+    EXPECT_EQ(3072, libcouchbase_buffer_pool_nbytes(pool));
+}
+
+TEST_F(Bufpool, limits)
+{
+    /* The pool keeps at most 4096 bytes */
+    libcouchbase_buffer_pool_release(pool, malloc(4096), 4096);
+    libcouchbase_buffer_pool_release(pool, malloc(128), 128);
+    EXPECT_EQ(4096, libcouchbase_buffer_pool_nbytes(pool));
+
+    /* Sizes that aren't a size class are never kept */
+    libcouchbase_buffer_pool_set_max_bytes(pool, 1 << 30);
+    libcouchbase_buffer_pool_release(pool, malloc(1000), 1000);
+    libcouchbase_buffer_pool_release(pool, malloc(4 << 20), 4 << 20);
+    EXPECT_EQ(4096, libcouchbase_buffer_pool_nbytes(pool));
+
+    /* Shrinking the limit releases the buffers */
+    libcouchbase_buffer_pool_set_max_bytes(pool, 0);
+    EXPECT_EQ(0, libcouchbase_buffer_pool_nbytes(pool));
+}
+
+TEST_F(Bufpool, ringbuffer)
+{
+    ringbuffer_t ring;
+    char buffer[512];
+
+    memset(&ring, 0, sizeof(ring));
+    ring.pool = pool;
+
+    memset(buffer, 'a', sizeof(buffer));
+    ASSERT_NE(0, ringbuffer_ensure_capacity(&ring, sizeof(buffer)));
+    EXPECT_EQ(sizeof(buffer), ringbuffer_write(&ring, buffer, sizeof(buffer)));
+    /* Growing it puts the old buffer in the pool */
+    ASSERT_NE(0, ringbuffer_ensure_capacity(&ring, 2048));
+    EXPECT_EQ(512, libcouchbase_buffer_pool_nbytes(pool));
+    EXPECT_EQ(4096, ringbuffer_get_size(&ring));
+    EXPECT_EQ(sizeof(buffer), ringbuffer_read(&ring, buffer, sizeof(buffer)));
+    EXPECT_EQ('a', buffer[sizeof(buffer) - 1]);
+
+    libcouchbase_buffer_pool_set_max_bytes(pool, 8192);
+    ringbuffer_destruct(&ring);
+    EXPECT_EQ(512 + 4096, libcouchbase_buffer_pool_nbytes(pool));
+
+    /* The next one gets it from the pool */
+    ASSERT_NE(0, ringbuffer_ensure_capacity(&ring, 4000));
+    EXPECT_EQ(1, libcouchbase_buffer_pool_hits(pool));
+    ringbuffer_destruct(&ring);
+}
@@ -0,0 +1,109 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+#include "hashtable.h"
+#include <gtest/gtest.h>
+#include <cstring>
+
+class Hashtable : public ::testing::Test
+{
+public:
+    virtual void SetUp(void) {
+        table = hashtable_create();
+        ASSERT_NE((hashtable_t)NULL, table);
+    }
+
+    virtual void TearDown(void) {
+        hashtable_destroy(table);
+    }
+
+protected:
+    hashtable_t table;
+};
+
+static void count_values(void *value, void *arg)
+{
+    (void)value;
+    ++*(size_t *)arg;
+}
+
+TEST_F(Hashtable, trivial)
+{
+    const char *items[] = {"zero", "one", "two", "three"};
+    int values[] = {0, 1, 2, 3};
+    size_t ii, nitems = 4;
+
+    for (ii = 0; ii < nitems; ++ii) {
+        EXPECT_EQ(1, hashtable_add(table, items[ii], strlen(items[ii]),
+                                   values + ii));
+    }
+    EXPECT_EQ(nitems, hashtable_num_items(table));
+
+    for (ii = 0; ii < nitems; ++ii) {
+        EXPECT_EQ(values + ii, hashtable_find(table, items[ii],
+                                              strlen(items[ii])));
+    }
+
+    EXPECT_EQ(NULL, hashtable_find(table, "missing", 7));
+    /* The key is compared by value, not by the pointer */
+    EXPECT_EQ(values + 1, hashtable_find(table, "one", 3));
+    /* A prefix of a key is a different key */
+    EXPECT_EQ(NULL, hashtable_find(table, "thr", 3));
+
+    EXPECT_EQ(0, hashtable_add(table, "two", 3, values));
+    EXPECT_EQ(values + 2, hashtable_find(table, "two", 3));
+
+    EXPECT_EQ(values + 1, hashtable_remove(table, "one", 3));
+    EXPECT_EQ(3, hashtable_num_items(table));
+    EXPECT_EQ(NULL, hashtable_remove(table, "one", 3));
+    EXPECT_EQ(NULL, hashtable_find(table, "one", 3));
+}
+
+TEST_F(Hashtable, testChurn)
+{
+    char keys[1000][32];
+    size_t ii, nitems = 1000;
+    size_t counter = 0;
+
+    for (ii = 0; ii < nitems; ++ii) {
+        snprintf(keys[ii], sizeof(keys[ii]), "key-%lu", (unsigned long)ii);
+        EXPECT_EQ(1, hashtable_add(table, keys[ii], strlen(keys[ii]),
+                                   keys[ii]));
+    }
+    EXPECT_EQ(nitems, hashtable_num_items(table));
+    hashtable_foreach(table, count_values, &counter);
+    EXPECT_EQ(nitems, counter);
+
+    /* Removing and adding items must not fill up the table */
+    for (int round = 0; round < 10; ++round) {
+        for (ii = 0; ii < nitems; ii += 2) {
+            EXPECT_EQ(keys[ii], hashtable_remove(table, keys[ii],
+                                                 strlen(keys[ii])));
+        }
+        for (ii = 0; ii < nitems; ii += 2) {
+            EXPECT_EQ(1, hashtable_add(table, keys[ii], strlen(keys[ii]),
+                                       keys[ii]));
+        }
+    }
+
+    for (ii = 0; ii < nitems; ++ii) {
+        EXPECT_EQ(keys[ii], hashtable_find(table, keys[ii],
+                                           strlen(keys[ii])));
+    }
+    EXPECT_EQ(nitems, hashtable_num_items(table));
+}
@@ -30,6 +30,7 @@ const void *mock = NULL;
 struct libcouchbase_io_opt_st *io = NULL;
 libcouchbase_error_t global_error = -1;
 int total_node_count = -1;
+libcouchbase_size_t connections_per_node = 1;
 
 
 static void error_callback(libcouchbase_t instance,
@@ -74,11 +75,18 @@ static void setup(char **argv, const char *username, const char *password,
     }
 
     (void)libcouchbase_set_error_callback(session, error_callback);
+    libcouchbase_behavior_set_connections_per_node(session,
+                                                   connections_per_node);
+    if (connections_per_node > 1) {
+        /* Send the values used by the tests on their own connection */
+        libcouchbase_behavior_set_large_value_threshold(session, 3);
+    }
 
     if (libcouchbase_connect(session) != LIBCOUCHBASE_SUCCESS) {
         err_exit("Failed to connect to server");
     }
     libcouchbase_wait(session);
+    assert(session->nconnections == session->nservers * connections_per_node);
 }
 
 static void teardown(void)
@@ -318,198 +326,1423 @@ static void test_get2(void)
     free(nkeys);
 }
 
-static void test_touch1(void)
+static void marithmetic_callback(libcouchbase_t instance,
+                                 const void *cookie,
+                                 libcouchbase_error_t error,
+                                 const void *key, libcouchbase_size_t nkey,
+                                 libcouchbase_uint64_t value,
+                                 libcouchbase_cas_t cas)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    rv->errors |= error;
+    rv->key = key;
+    rv->nkey = nkey;
+    rv->cas = cas;
+    rv->counter--;
+    if (rv->counter <= 0) {
+        assert(io);
+        io->stop_event_loop(io);
+    }
+    (void)instance;
+    (void)value;
+}
+
+static void mremove_callback(libcouchbase_t instance,
+                             const void *cookie,
+                             libcouchbase_error_t error,
+                             const void *key, libcouchbase_size_t nkey)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    rv->errors |= error;
+    rv->key = key;
+    rv->nkey = nkey;
+    rv->counter--;
+    if (rv->counter <= 0) {
+        assert(io);
+        io->stop_event_loop(io);
+    }
+    (void)instance;
+}
+
+static void getk_callback(libcouchbase_t instance,
+                          const void *cookie,
+                          libcouchbase_error_t error,
+                          const void *key, libcouchbase_size_t nkey,
+                          const void *bytes, libcouchbase_size_t nbytes,
+                          libcouchbase_uint32_t flags, libcouchbase_cas_t cas)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    rv->errors |= error;
+    assert(nkey == 5 && memcmp(key, "getk", 4) == 0);
+    if (error == LIBCOUCHBASE_SUCCESS) {
+        /* The key is the one in the response (in front of the value) */
+        assert((const char *)key + nkey == (const char *)bytes);
+        assert(nbytes == 3 && memcmp(bytes, "bar", 3) == 0);
+    }
+    rv->counter--;
+    if (rv->counter <= 0) {
+        assert(io);
+        io->stop_event_loop(io);
+    }
+    (void)instance;
+    (void)flags;
+    (void)cas;
+}
+
+static void test_mstore1(void)
 {
     libcouchbase_error_t err;
     struct rvbuf rv;
-    char *key = "fooX", *val = "bar";
+    char *key = "mstoreX", *val = "bar";
     libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
     char **keys;
-    libcouchbase_size_t *nkeys, ii;
-    libcouchbase_time_t *ttls;
+    const void **vals;
+    libcouchbase_size_t *nkeys, *nvals, ii;
 
-    (void)libcouchbase_set_storage_callback(session, store_callback);
-    (void)libcouchbase_set_touch_callback(session, touch_callback);
+    (void)libcouchbase_set_storage_callback(session, mstore_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
 
     keys = malloc(26 * sizeof(char *));
     nkeys = malloc(26 * sizeof(libcouchbase_size_t));
-    ttls = malloc(26 * sizeof(libcouchbase_time_t));
-    if (keys == NULL || nkeys == NULL || ttls == NULL) {
+    vals = malloc(26 * sizeof(void *));
+    nvals = malloc(26 * sizeof(libcouchbase_size_t));
+    if (keys == NULL || nkeys == NULL || vals == NULL || nvals == NULL) {
         err_exit("Failed to allocate memory for keys");
     }
     for (ii = 0; ii < 26; ii++) {
         nkeys[ii] = nkey;
         keys[ii] = strdup(key);
-        ttls[ii] = 1;
         if (keys[ii] == NULL) {
             err_exit("Failed to allocate memory for key");
         }
-        keys[ii][3] = (char)ii + 'a';
-        err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, keys[ii], nkeys[ii], val, nval, 0, 0, 0);
-        assert(err == LIBCOUCHBASE_SUCCESS);
-        io->run_event_loop(io);
-        assert(rv.error == LIBCOUCHBASE_SUCCESS);
-        memset(&rv, 0, sizeof(rv));
+        keys[ii][6] = (char)ii + 'a';
+        vals[ii] = val;
+        nvals[ii] = nval;
     }
 
+    memset(&rv, 0, sizeof(rv));
     rv.counter = 26;
-    err = libcouchbase_mtouch(session, &rv, 26, (const void * const *)keys, nkeys, ttls);
+    err = libcouchbase_mstore(session, &rv, LIBCOUCHBASE_SET, 26,
+                              (const void * const *)keys, nkeys,
+                              vals, nvals, NULL, NULL, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
+
+    /* ADD should fail for all of the keys */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 26;
+    err = libcouchbase_mstore(session, &rv, LIBCOUCHBASE_ADD, 26,
+                              (const void * const *)keys, nkeys,
+                              vals, nvals, NULL, NULL, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_KEY_EEXISTS);
+    assert(rv.counter == 0);
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 26;
+    err = libcouchbase_mget(session, &rv, 26, (const void * const *)keys, nkeys, NULL);
     assert(err == LIBCOUCHBASE_SUCCESS);
     io->run_event_loop(io);
     assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == nval);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+
     for (ii = 0; ii < 26; ii++) {
         free(keys[ii]);
     }
     free(keys);
-    free(ttls);
     free(nkeys);
+    free(vals);
+    free(nvals);
 }
 
-static libcouchbase_error_t test_connect(char **argv, const char *username,
-                                         const char *password,
-                                         const char *bucket)
+static void test_mget_stream1(void)
 {
-    const char *endpoint;
-    libcouchbase_error_t rc;
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    char keys[26][8];
+    const void *kptrs[26];
+    const void *vals[26];
+    libcouchbase_size_t nkeys[26], nvals[26], ii;
 
-    assert(session == NULL);
-    assert(mock == NULL);
-    assert(io == NULL);
+    (void)libcouchbase_set_storage_callback(session, mstore_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
 
-    io = get_test_io_opts();
-    if (io == NULL) {
-        err_exit("Failed to create IO session");
+    for (ii = 0; ii < 26; ii++) {
+        snprintf(keys[ii], sizeof(keys[ii]), "streamX");
+        keys[ii][6] = (char)ii + 'a';
+        kptrs[ii] = keys[ii];
+        nkeys[ii] = 7;
+        vals[ii] = "bar";
+        nvals[ii] = 3;
     }
 
-    mock = start_mock_server(argv);
-    if (mock == NULL) {
-        err_exit("Failed to start mock server");
-    }
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 26;
+    err = libcouchbase_mstore(session, &rv, LIBCOUCHBASE_SET, 26, kptrs, nkeys,
+                              vals, nvals, NULL, NULL, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
 
-    endpoint = get_mock_http_server(mock);
-    session = libcouchbase_create(endpoint, username, password, bucket, io);
-    if (session == NULL) {
-        err_exit("Failed to create libcouchbase session");
-    }
+    /* Fetch them with at most one command queued per server */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 26;
+    err = libcouchbase_mget_stream(session, &rv, 1, 26, kptrs, nkeys);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
 
-    (void)libcouchbase_set_error_callback(session, error_callback2);
+    /* ..and with a window larger than the number of keys */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 26;
+    err = libcouchbase_mget_stream(session, &rv, 64, 26, kptrs, nkeys);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+}
 
-    if (libcouchbase_connect(session) != LIBCOUCHBASE_SUCCESS) {
-        err_exit("Failed to connect to server");
-    }
-    libcouchbase_wait(session);
-    rc = global_error;
+static void test_getk1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    const char *keys[] = { "getkA", "getkB", "getkC" };
+    const void *vals[] = { "bar", "bar", "bar" };
+    libcouchbase_size_t nkeys[] = { 5, 5, 5 };
+    libcouchbase_size_t nvals[] = { 3, 3, 3 };
 
-    libcouchbase_destroy(session);
-    session = NULL;
-    io = NULL;
-    shutdown_mock_server(mock);
-    mock = NULL;
+    (void)libcouchbase_set_storage_callback(session, mstore_callback);
+    (void)libcouchbase_set_get_callback(session, getk_callback);
 
-    return rc;
-}
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    err = libcouchbase_mstore(session, &rv, LIBCOUCHBASE_SET, 3,
+                              (const void * const *)keys, nkeys,
+                              vals, nvals, NULL, NULL, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
 
-RESPONSE_HANDLER old_sasl_auth_response_handler;
-libcouchbase_error_t sasl_auth_rc;
+    libcouchbase_behavior_set_getk(session, 1);
+    assert(libcouchbase_behavior_get_getk(session) == 1);
 
-static void sasl_auth_response_handler(libcouchbase_server_t *server,
-                                       const void *command_cookie,
-                                       protocol_binary_response_header *res)
-{
-    sasl_auth_rc = ntohs(res->response.status);
-    old_sasl_auth_response_handler(server, command_cookie, res);
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    err = libcouchbase_mget(session, &rv, 3, (const void * const *)keys,
+                            nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
+
+    /* The misses are implicit, so we still know the key */
+    keys[1] = "getkX";
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    err = libcouchbase_mget(session, &rv, 3, (const void * const *)keys,
+                            nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_KEY_ENOENT);
+    assert(rv.counter == 0);
+
+    libcouchbase_behavior_set_getk(session, 0);
+    (void)libcouchbase_set_get_callback(session, get_callback);
 }
 
-static void test_set3(void)
+static void test_mremove1(void)
 {
     libcouchbase_error_t err;
     struct rvbuf rv;
-    const char *key = "foo", *val = "bar";
-    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+    const char *keys[] = { "mremoveA", "mremoveB", "mremoveC" };
+    const void *vals[] = { "bar", "bar", "bar" };
+    libcouchbase_size_t nkeys[] = { 8, 8, 8 };
+    libcouchbase_size_t nvals[] = { 3, 3, 3 };
 
-    old_sasl_auth_response_handler = session->response_handler[PROTOCOL_BINARY_CMD_SASL_AUTH];
-    session->response_handler[PROTOCOL_BINARY_CMD_SASL_AUTH] = sasl_auth_response_handler;
-    sasl_auth_rc = -1;
+    (void)libcouchbase_set_storage_callback(session, mstore_callback);
+    (void)libcouchbase_set_remove_callback(session, mremove_callback);
 
-    (void)libcouchbase_set_storage_callback(session, store_callback);
-    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey, val, nval, 0, 0, 0);
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    err = libcouchbase_mstore(session, &rv, LIBCOUCHBASE_SET, 3,
+                              (const void * const *)keys, nkeys,
+                              vals, nvals, NULL, NULL, NULL);
     assert(err == LIBCOUCHBASE_SUCCESS);
     io->run_event_loop(io);
-    assert(rv.error == LIBCOUCHBASE_SUCCESS);
-    assert(rv.operation == LIBCOUCHBASE_SET);
-    assert(memcmp(rv.key, "foo", 3) == 0);
-    assert(sasl_auth_rc == LIBCOUCHBASE_SUCCESS);
-    session->response_handler[PROTOCOL_BINARY_CMD_SASL_AUTH] = old_sasl_auth_response_handler;
+    assert(rv.errors == 0);
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    err = libcouchbase_mremove(session, &rv, 3, (const void * const *)keys,
+                               nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
+
+    /* Removing them again fails for all of the keys */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    err = libcouchbase_mremove(session, &rv, 3, (const void * const *)keys,
+                               nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_KEY_ENOENT);
+    assert(rv.counter == 0);
 }
 
-static void test_version1(void)
+static void test_marithmetic1(void)
 {
     libcouchbase_error_t err;
     struct rvbuf rv;
+    const char *keys[] = { "marithA", "marithB", "marithC", "marithD" };
+    libcouchbase_size_t nkeys[] = { 7, 7, 7, 7 };
+    libcouchbase_int64_t delta[] = { 1, 2, -1, 5 };
 
-    (void)libcouchbase_set_version_callback(session, version_callback);
-    err = libcouchbase_server_versions(session, &rv);
+    (void)libcouchbase_set_arithmetic_callback(session, marithmetic_callback);
+    (void)libcouchbase_set_remove_callback(session, mremove_callback);
 
+    /* Create the counters */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 4;
+    err = libcouchbase_marithmetic(session, &rv, 4, (const void * const *)keys,
+                                   nkeys, delta, 0, 1, 10);
     assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
 
-    rv.counter = total_node_count;
+    /* And update them */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 4;
+    err = libcouchbase_marithmetic(session, &rv, 4, (const void * const *)keys,
+                                   nkeys, delta, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
 
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 4;
+    err = libcouchbase_mremove(session, &rv, 4, (const void * const *)keys,
+                               nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
     io->run_event_loop(io);
+    assert(rv.errors == 0);
+    assert(rv.counter == 0);
 
-    /* Ensure all version responses have been received */
+    /* The counters are gone, so we get the failures */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 4;
+    err = libcouchbase_marithmetic(session, &rv, 4, (const void * const *)keys,
+                                   nkeys, delta, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_KEY_ENOENT);
     assert(rv.counter == 0);
 }
 
-static void test_spurious_saslerr(void)
+static void client_stat_callback(libcouchbase_t instance,
+                                 const void *cookie,
+                                 const char *server_endpoint,
+                                 const char *name,
+                                 libcouchbase_uint64_t value)
 {
-    const char *key = "KEY";
-    int iterations = 50;
-    struct rvbuf rvs[50];
-    int i;
-    libcouchbase_error_t err;
-    libcouchbase_set_storage_callback(session, mstore_callback);
-
-    memset(rvs, 0, sizeof(rvs));
-
-    for (i = 0; i < iterations; i++) {
-        rvs[i].counter = 999; /*don't trigger a stop_event_loop*/
-        err = libcouchbase_store(session, rvs + i, LIBCOUCHBASE_SET, key, 3, key, 3, 0, 0, 0);
-        if (err != LIBCOUCHBASE_SUCCESS) {
-            err_exit("Store operation failed");
-        }
-    }
-    libcouchbase_wait(session);
-
-    for (i = 0; i < iterations; i++) {
-        char *errinfo = NULL;
-        if (rvs[i].errors != LIBCOUCHBASE_SUCCESS) {
-            errinfo = "Did not get success response";
-        } else if (rvs[i].nkey != 3) {
-            errinfo = "Did not get expected key length";
-        } else if (memcmp(rvs[i].key, key, 3) != 0) {
-            errinfo = "Weird key size";
-        }
-        if (errinfo) {
-            err_exit("%s", errinfo);
-        }
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    if (server_endpoint == NULL && strcmp(name, rv->key) == 0) {
+        rv->cas = value;
     }
+    (void)instance;
 }
 
-/* libcouchbase_wait() blocks forever if there is nothing queued */
-static void test_issue_59(void)
+static libcouchbase_uint64_t get_client_stat(const char *name)
 {
-    libcouchbase_wait(session);
-    libcouchbase_wait(session);
-    libcouchbase_wait(session);
-    libcouchbase_wait(session);
-    libcouchbase_wait(session);
+    struct rvbuf rv;
+    memset(&rv, 0, sizeof(rv));
+    rv.key = name;
+    assert(libcouchbase_get_client_stats(session, &rv,
+                                         client_stat_callback) == LIBCOUCHBASE_SUCCESS);
+    return rv.cas;
 }
 
-int main(int argc, char **argv)
+static void test_coalesce1(void)
 {
-    char str_node_count[16];
-    const char *args[] = {"--nodes", "",
-                           "--buckets=default::memcache", NULL};
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    const char *key = "foo", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+    libcouchbase_uint64_t coalesced;
+    int ii;
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey, val, nval, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+
+    libcouchbase_behavior_set_coalesce_gets(session, 1);
+    coalesced = get_client_stat("get_coalesced");
+
+    /* Only the first get should be sent to the server */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 3;
+    for (ii = 0; ii < 3; ++ii) {
+        err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+        assert(err == LIBCOUCHBASE_SUCCESS);
+    }
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == nval);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+    assert(get_client_stat("get_coalesced") == coalesced + 2);
+    assert(get_client_stat("get_coalesce_inflight") == 0);
+
+    libcouchbase_behavior_set_coalesce_gets(session, 0);
+}
+
+static void test_submission_queue1(void)
+{
+    struct rvbuf rv;
+    const char *key = "foo", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+
+    assert(libcouchbase_queue_get(session, &rv, key, nkey) == LIBCOUCHBASE_EINVAL);
+    assert(libcouchbase_enable_submission_queue(session) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_enable_submission_queue(session) == LIBCOUCHBASE_KEY_EEXISTS);
+
+    memset(&rv, 0, sizeof(rv));
+    assert(libcouchbase_queue_store(session, &rv, LIBCOUCHBASE_SET, key, nkey,
+                                    val, nval, 0, 0, 0) == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.operation == LIBCOUCHBASE_SET);
+
+    /* Both gets are run after a single wakeup */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 2;
+    assert(libcouchbase_queue_get(session, &rv, key, nkey) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_queue_get(session, &rv, key, nkey) == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == nval);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+    assert(get_client_stat("submission_queue_ops") == 3);
+
+    assert(libcouchbase_disable_submission_queue(session) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_disable_submission_queue(session) == LIBCOUCHBASE_KEY_ENOENT);
+}
+
+static void sharded_store_callback(libcouchbase_t instance,
+                                   const void *cookie,
+                                   libcouchbase_storage_t operation,
+                                   libcouchbase_error_t error,
+                                   const void *key, libcouchbase_size_t nkey,
+                                   libcouchbase_cas_t cas)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    rv->error = error;
+    rv->operation = operation;
+    rv->counter--;
+    (void)instance; (void)key; (void)nkey; (void)cas;
+}
+
+static void sharded_get_callback(libcouchbase_t instance,
+                                 const void *cookie,
+                                 libcouchbase_error_t error,
+                                 const void *key, libcouchbase_size_t nkey,
+                                 const void *bytes, libcouchbase_size_t nbytes,
+                                 libcouchbase_uint32_t flags, libcouchbase_cas_t cas)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    rv->error = error;
+    rv->nbytes = nbytes;
+    if (nbytes != 3 || memcmp(bytes, "bar", 3) != 0) {
+        rv->errors++;
+    }
+    rv->counter--;
+    (void)instance; (void)key; (void)nkey; (void)flags; (void)cas;
+}
+
+static void wait_shards(libcouchbase_sharded_t sharded)
+{
+    libcouchbase_size_t ii;
+    for (ii = 0; ii < libcouchbase_sharded_get_num_shards(sharded); ++ii) {
+        libcouchbase_wait(libcouchbase_sharded_get_shard(sharded, ii));
+    }
+}
+
+static void test_sharded1(void)
+{
+    libcouchbase_sharded_t sharded;
+    struct rvbuf rv;
+    const char *key = "foo", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+    libcouchbase_size_t ii;
+
+    sharded = libcouchbase_sharded_create(get_mock_http_server(mock),
+                                          "Administrator", "password",
+                                          "default", 2);
+    assert(sharded != NULL);
+    for (ii = 0; ii < 2; ++ii) {
+        libcouchbase_t shard = libcouchbase_sharded_get_shard(sharded, ii);
+        (void)libcouchbase_set_error_callback(shard, error_callback);
+        (void)libcouchbase_set_storage_callback(shard, sharded_store_callback);
+        (void)libcouchbase_set_get_callback(shard, sharded_get_callback);
+    }
+
+    assert(libcouchbase_sharded_connect(sharded) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_sharded_get(sharded, &rv, key, nkey) == LIBCOUCHBASE_ETMPFAIL);
+    /* The first shard receives the config and passes it on */
+    wait_shards(sharded);
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 1;
+    assert(libcouchbase_sharded_store(sharded, &rv, LIBCOUCHBASE_SET,
+                                      key, nkey, val, nval,
+                                      0, 0, 0) == LIBCOUCHBASE_SUCCESS);
+    wait_shards(sharded);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 1;
+    assert(libcouchbase_sharded_get(sharded, &rv, key, nkey) == LIBCOUCHBASE_SUCCESS);
+    wait_shards(sharded);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.errors == 0);
+
+    libcouchbase_sharded_destroy(sharded);
+}
+
+static void test_shared_config1(void)
+{
+    libcouchbase_t owner, other;
+    struct rvbuf rv;
+    const char *key = "foo", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+
+    owner = libcouchbase_create(get_mock_http_server(mock), "Administrator",
+                                "password", "default", NULL);
+    other = libcouchbase_create(get_mock_http_server(mock), "Administrator",
+                                "password", "default", NULL);
+    assert(owner != NULL && other != NULL);
+    libcouchbase_behavior_set_shared_config(owner, 1);
+    libcouchbase_behavior_set_shared_config(other, 1);
+    assert(libcouchbase_behavior_get_shared_config(other) == 1);
+    libcouchbase_behavior_set_shared_buffer_pool(other, 1);
+    assert(libcouchbase_behavior_get_shared_buffer_pool(other) == 1);
+    (void)libcouchbase_set_error_callback(owner, error_callback);
+    (void)libcouchbase_set_error_callback(other, error_callback);
+    (void)libcouchbase_set_storage_callback(other, sharded_store_callback);
+
+    assert(libcouchbase_connect(owner) == LIBCOUCHBASE_SUCCESS);
+    libcouchbase_wait(owner);
+    assert(owner->vbucket_config != NULL);
+
+    /* The second instance gets the config without a stream of its own */
+    assert(libcouchbase_connect(other) == LIBCOUCHBASE_SUCCESS);
+    assert(other->sock == INVALID_SOCKET);
+    libcouchbase_wait(other);
+    assert(other->vbucket_config != NULL);
+    assert(other->nservers == owner->nservers);
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 1;
+    assert(libcouchbase_store(other, &rv, LIBCOUCHBASE_SET, key, nkey,
+                              val, nval, 0, 0, 0) == LIBCOUCHBASE_SUCCESS);
+    libcouchbase_wait(other);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+
+    /* The other instance takes over the stream */
+    libcouchbase_destroy(owner);
+    libcouchbase_wait(other);
+    assert(other->sock != INVALID_SOCKET);
+    libcouchbase_destroy(other);
+}
+
+static void test_resident_bytes1(void)
+{
+    libcouchbase_size_t before, released;
+
+    /* The previous tests left the buffers allocated */
+    before = libcouchbase_get_resident_bytes(session);
+    assert(before > sizeof(*session));
+    released = libcouchbase_release_idle_buffers(session);
+    assert(released > 0);
+    assert(libcouchbase_get_resident_bytes(session) == before - released);
+    assert(libcouchbase_release_idle_buffers(session) == 0);
+
+    /* They're allocated again by the next command */
+    test_set1();
+    assert(libcouchbase_get_resident_bytes(session) > before - released);
+}
+
+static void server_stat_callback(libcouchbase_t instance,
+                                 const void *cookie,
+                                 const char *server_endpoint,
+                                 const char *name,
+                                 libcouchbase_uint64_t value)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    if (server_endpoint != NULL && strcmp(name, rv->key) == 0) {
+        rv->cas += value;
+    }
+    (void)instance;
+}
+
+/* Sum up a client stat reported for each of the connections */
+static libcouchbase_uint64_t get_server_stat(const char *name)
+{
+    struct rvbuf rv;
+    memset(&rv, 0, sizeof(rv));
+    rv.key = name;
+    assert(libcouchbase_get_client_stats(session, &rv,
+                                         server_stat_callback) == LIBCOUCHBASE_SUCCESS);
+    return rv.cas;
+}
+
+static void test_inflight_window1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    char key[] = "windowX";
+    const char *keys[26];
+    libcouchbase_size_t nkeys[26], nvals[26];
+    const void *vals[26];
+    libcouchbase_size_t ii;
+
+    (void)libcouchbase_set_storage_callback(session, mstore_callback);
+    libcouchbase_behavior_set_inflight_window(session, 1);
+    assert(libcouchbase_behavior_get_inflight_window(session) == 1);
+
+    for (ii = 0; ii < 26; ii++) {
+        key[6] = (char)ii + 'a';
+        keys[ii] = strdup(key);
+        assert(keys[ii] != NULL);
+        nkeys[ii] = strlen(key);
+        vals[ii] = "bar";
+        nvals[ii] = 3;
+    }
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 2 * 26;
+    for (ii = 0; ii < 26; ii++) {
+        err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET,
+                                 keys[ii], nkeys[ii], vals[ii], nvals[ii],
+                                 0, 0, 0);
+        assert(err == LIBCOUCHBASE_SUCCESS);
+    }
+
+    /* No more than one command may be sent to each connection */
+    assert(get_server_stat("inflight_ops") <= get_server_stat("inflight_window"));
+    assert(get_server_stat("held_ops") > 0);
+
+    /*
+     * The quiet commands are held behind them, and they have to go out
+     * together with their NOOP once they get their turn
+     */
+    err = libcouchbase_mstore(session, &rv, LIBCOUCHBASE_SET, 26,
+                              (const void * const *)keys, nkeys,
+                              vals, nvals, NULL, NULL, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_SUCCESS);
+    assert(rv.counter == 0);
+    assert(get_server_stat("held_ops") == 0);
+    assert(get_server_stat("held_ops_shed") == 0);
+
+    libcouchbase_behavior_set_inflight_window(session, 0);
+    for (ii = 0; ii < 26; ii++) {
+        free((void *)keys[ii]);
+    }
+}
+
+static libcouchbase_ssize_t (*old_recvv)(struct libcouchbase_io_opt_st *iops,
+                                         libcouchbase_socket_t sock,
+                                         struct libcouchbase_iovec_st *iov,
+                                         libcouchbase_size_t niov);
+/* Fail the next response with this opcode with TMPFAIL (-1 for none) */
+static int tmpfail_opcode = -1;
+/* The opcode of the last response read */
+static int last_opcode = -1;
+
+static libcouchbase_ssize_t tmpfail_recvv(struct libcouchbase_io_opt_st *iops,
+                                          libcouchbase_socket_t sock,
+                                          struct libcouchbase_iovec_st *iov,
+                                          libcouchbase_size_t niov)
+{
+    libcouchbase_ssize_t nr = old_recvv(iops, sock, iov, niov);
+    unsigned char *header = (unsigned char *)iov[0].iov_base;
+
+    if (nr >= 24 && iov[0].iov_len >= 24 && header[0] == PROTOCOL_BINARY_RES) {
+        last_opcode = header[1];
+        if (header[1] == tmpfail_opcode) {
+            header[6] = 0;
+            header[7] = PROTOCOL_BINARY_RESPONSE_ETMPFAIL;
+            tmpfail_opcode = -1;
+        }
+    }
+    return nr;
+}
+
+static void test_retry_backoff1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    struct rvbuf srv;
+    const char *keys[2] = { "retry1", "retry2" };
+    libcouchbase_size_t nkeys[2] = { 6, 6 };
+    libcouchbase_uint64_t retried = get_client_stat("retried");
+
+    libcouchbase_behavior_set_retry_backoff(session, 1000);
+    assert(libcouchbase_behavior_get_retry_backoff(session) == 1000);
+    old_recvv = io->recvv;
+    io->recvv = tmpfail_recvv;
+
+    /* A store the server fails with TMPFAIL is sent again */
+    (void)libcouchbase_set_storage_callback(session, mstore_callback);
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 2;
+    tmpfail_opcode = PROTOCOL_BINARY_CMD_SET;
+    err = libcouchbase_store_by_key(session, &rv, LIBCOUCHBASE_SET, "retry", 5,
+                                    keys[0], nkeys[0], "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    err = libcouchbase_store_by_key(session, &rv, LIBCOUCHBASE_SET, "retry", 5,
+                                    keys[1], nkeys[1], "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_SUCCESS);
+    assert(tmpfail_opcode == -1);
+    assert(get_client_stat("retried") == retried + 1);
+
+    /* A quiet get is sent again as a plain one (it has no NOOP now) */
+    (void)libcouchbase_set_get_callback(session, get_callback);
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 2;
+    tmpfail_opcode = PROTOCOL_BINARY_CMD_GETQ;
+    err = libcouchbase_mget_by_key(session, &rv, "retry", 5, 2,
+                                   (const void * const *)keys, nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+    assert(tmpfail_opcode == -1);
+    assert(last_opcode == PROTOCOL_BINARY_CMD_GET);
+    assert(get_client_stat("retried") == retried + 2);
+
+    /*
+     * A get sent while a store waits for its retry may read the old
+     * value, but it's not served from the near cache after the store
+     */
+    assert(libcouchbase_enable_near_cache(session, 1024 * 1024, 10000000) == LIBCOUCHBASE_SUCCESS);
+    memset(&rv, 0, sizeof(rv));
+    memset(&srv, 0, sizeof(srv));
+    rv.error = srv.error = LIBCOUCHBASE_ERROR;
+    srv.counter = 1;
+    tmpfail_opcode = PROTOCOL_BINARY_CMD_SET;
+    err = libcouchbase_store(session, &srv, LIBCOUCHBASE_SET, keys[0], nkeys[0],
+                             "qux", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)keys, nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    while (rv.error == LIBCOUCHBASE_ERROR || srv.counter > 0) {
+        io->run_event_loop(io);
+    }
+    assert(srv.errors == LIBCOUCHBASE_SUCCESS);
+    assert(tmpfail_opcode == -1);
+    assert(get_client_stat("retried") == retried + 3);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)keys, nkeys, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "qux", 3) == 0);
+    assert(libcouchbase_disable_near_cache(session) == LIBCOUCHBASE_SUCCESS);
+
+    /* ..and the vbucket map is right */
+    assert(get_client_stat("not_my_vbucket") == 0);
+    assert(get_client_stat("not_my_vbucket_parked") == 0);
+
+    io->recvv = old_recvv;
+    libcouchbase_behavior_set_retry_backoff(session, 0);
+}
+
+static void test_hedged1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    const char *key = "hedged1";
+    libcouchbase_size_t nkey = strlen(key);
+    libcouchbase_uint64_t hedged = get_client_stat("get_hedged");
+    libcouchbase_uint64_t won = get_client_stat("get_hedged_replica_won");
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey,
+                             "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+
+    /* The master answers within the delay, so the replica isn't asked */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 1;
+    err = libcouchbase_mget_hedged(session, &rv, 1, (const void * const *)&key,
+                                   &nkey, 1000000);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+    assert(get_client_stat("get_hedged") == hedged);
+
+    /* The master fails, so the replica is asked right away */
+    old_recvv = io->recvv;
+    io->recvv = tmpfail_recvv;
+    tmpfail_opcode = PROTOCOL_BINARY_CMD_GET;
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 1;
+    err = libcouchbase_mget_hedged(session, &rv, 1, (const void * const *)&key,
+                                   &nkey, 1000000);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    io->recvv = old_recvv;
+    assert(tmpfail_opcode == -1);
+    assert(rv.counter == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+    assert(get_client_stat("get_hedged") == hedged + 1);
+    assert(get_client_stat("get_hedged_replica_won") == won + 1);
+}
+
+static void test_circuit_breaker1(void)
+{
+    libcouchbase_behavior_set_breaker_threshold(session, 3);
+    assert(libcouchbase_behavior_get_breaker_threshold(session) == 3);
+    libcouchbase_behavior_set_breaker_reset(session, 500000);
+    assert(libcouchbase_behavior_get_breaker_reset(session) == 500000);
+
+    /* The mock is up, so the breakers stay closed */
+    test_set1();
+    test_get1();
+    assert(get_server_stat("breaker_state") == 0);
+    assert(get_server_stat("breaker_trips") == 0);
+    assert(get_server_stat("breaker_rejected") == 0);
+
+    libcouchbase_behavior_set_breaker_threshold(session, 0);
+}
+
+static void test_keepalive1(void)
+{
+    libcouchbase_behavior_set_keepalive_interval(session, 100000);
+    assert(libcouchbase_behavior_get_keepalive_interval(session) == 100000);
+
+    /* The mock answers the probes (if any were sent) */
+    test_set1();
+    test_get1();
+    assert(get_client_stat("keepalive_failures") == 0);
+
+    libcouchbase_behavior_set_keepalive_interval(session, 0);
+}
+
+static void unexpected_storage_callback(libcouchbase_t instance,
+                                        const void *cookie,
+                                        libcouchbase_storage_t operation,
+                                        libcouchbase_error_t error,
+                                        const void *key, libcouchbase_size_t nkey,
+                                        libcouchbase_cas_t cas)
+{
+    (void)instance; (void)cookie; (void)operation; (void)error;
+    (void)key; (void)nkey; (void)cas;
+    assert(0);
+}
+
+static void unexpected_get_callback(libcouchbase_t instance,
+                                    const void *cookie,
+                                    libcouchbase_error_t error,
+                                    const void *key, libcouchbase_size_t nkey,
+                                    const void *bytes, libcouchbase_size_t nbytes,
+                                    libcouchbase_uint32_t flags, libcouchbase_cas_t cas)
+{
+    (void)instance; (void)cookie; (void)error; (void)key; (void)nkey;
+    (void)bytes; (void)nbytes; (void)flags; (void)cas;
+    assert(0);
+}
+
+static void test_with_callback1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    const char *key = "foo", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+
+    /* The results should only be passed to the callbacks for the commands */
+    (void)libcouchbase_set_storage_callback(session, unexpected_storage_callback);
+    (void)libcouchbase_set_get_callback(session, unexpected_get_callback);
+
+    err = libcouchbase_store_with_callback(session, &rv, store_callback,
+                                           LIBCOUCHBASE_SET, NULL, 0,
+                                           key, nkey, val, nval, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.operation == LIBCOUCHBASE_SET);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_get_with_callback(session, &rv, get_callback, NULL, 0,
+                                         key, nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == nval);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+}
+
+static void get_batch_callback(libcouchbase_t instance,
+                               const void *cookie,
+                               const libcouchbase_get_result_t *results,
+                               libcouchbase_size_t nresults)
+{
+    struct rvbuf *rv = (struct rvbuf *)cookie;
+    libcouchbase_size_t ii;
+
+    for (ii = 0; ii < nresults; ++ii) {
+        if (results[ii].error == LIBCOUCHBASE_SUCCESS) {
+            assert(results[ii].nkey == 3 && memcmp(results[ii].key, "foo", 3) == 0);
+            assert(results[ii].nbytes == 3 && memcmp(results[ii].bytes, "bar", 3) == 0);
+        } else {
+            assert(results[ii].error == LIBCOUCHBASE_KEY_ENOENT);
+            rv->errors++;
+        }
+    }
+    rv->counter -= (int)nresults;
+    if (rv->counter <= 0) {
+        io->stop_event_loop(io);
+    }
+    (void)instance;
+}
+
+static void test_get_batch1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    const char *keys[] = { "foo", "test_get_batch1_missing" };
+    libcouchbase_size_t nkey[2];
+
+    nkey[0] = strlen(keys[0]);
+    nkey[1] = strlen(keys[1]);
+    test_set1();
+
+    (void)libcouchbase_set_get_callback(session, unexpected_get_callback);
+    assert(libcouchbase_set_get_batch_callback(session, get_batch_callback) == NULL);
+
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 2;
+    err = libcouchbase_mget(session, &rv, 2, (const void * const *)keys, nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.errors == 1);
+
+    /* Turning the batches off doesn't affect the multi-gets issued */
+    memset(&rv, 0, sizeof(rv));
+    rv.counter = 2;
+    err = libcouchbase_mget(session, &rv, 2, (const void * const *)keys, nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_set_get_batch_callback(session, NULL) == get_batch_callback);
+    io->run_event_loop(io);
+    assert(rv.counter == 0);
+    assert(rv.errors == 1);
+
+    (void)libcouchbase_set_get_callback(session, get_callback);
+}
+
+static void test_execute_ops1(void)
+{
+    libcouchbase_op_t ops[3];
+
+    memset(ops, 0, sizeof(ops));
+    ops[0].type = LIBCOUCHBASE_OP_STORE;
+    ops[0].operation = LIBCOUCHBASE_SET;
+    ops[0].key = "test_execute_ops1";
+    ops[0].nkey = strlen(ops[0].key);
+    ops[0].bytes = "bar";
+    ops[0].nbytes = 3;
+    ops[1].type = LIBCOUCHBASE_OP_GET;
+    ops[1].key = ops[0].key;
+    ops[1].nkey = ops[0].nkey;
+    ops[2].type = LIBCOUCHBASE_OP_REMOVE;
+    ops[2].key = "test_execute_ops1_missing";
+    ops[2].nkey = strlen(ops[2].key);
+
+    /* The instance callbacks aren't used for these */
+    (void)libcouchbase_set_storage_callback(session, unexpected_storage_callback);
+    (void)libcouchbase_set_get_callback(session, unexpected_get_callback);
+
+    assert(libcouchbase_execute_ops(session, ops, 3) == LIBCOUCHBASE_SUCCESS);
+    assert(ops[0].error == LIBCOUCHBASE_SUCCESS);
+    assert(ops[1].error == LIBCOUCHBASE_SUCCESS);
+    assert(ops[1].nbytes == 3 && memcmp(ops[1].bytes, "bar", 3) == 0);
+    assert(ops[2].error == LIBCOUCHBASE_KEY_ENOENT);
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+}
+
+static void test_outstanding1(void)
+{
+    /* Nothing is left in the buffers once the operations complete */
+    test_set1();
+    assert(get_client_stat("outstanding_ops") == 0);
+    assert(get_client_stat("queued_bytes") == 0);
+}
+
+static void test_tick1(void)
+{
+    libcouchbase_error_t err;
+    libcouchbase_pollfd_t fds[16];
+    struct rvbuf rv;
+    int ii;
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    memset(&rv, 0, sizeof(rv));
+    rv.error = LIBCOUCHBASE_ERROR;
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, "foo", 3,
+                             "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+
+    /* The connections to the servers are registered */
+    assert(libcouchbase_get_pollfds(session, fds, 16) > 0);
+    assert(libcouchbase_get_pollfds(session, NULL, 0) > 0);
+
+    for (ii = 0; ii < 100 && get_client_stat("outstanding_ops") != 0; ++ii) {
+        assert(libcouchbase_tick(session, 10000) == LIBCOUCHBASE_SUCCESS);
+    }
+    assert(get_client_stat("outstanding_ops") == 0);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+
+    /* Nothing is ready, so we return right away */
+    assert(libcouchbase_tick(session, 0) == LIBCOUCHBASE_SUCCESS);
+}
+
+static int memory_limit_exceeded = -1;
+
+static void memory_limit_callback(libcouchbase_t instance, int exceeded)
+{
+    (void)instance;
+    memory_limit_exceeded = exceeded;
+}
+
+static void test_memory_limit1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+
+    (void)libcouchbase_set_memory_limit_callback(session, memory_limit_callback);
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+
+    /* The buffers allocated by the previous tests are above the limit */
+    assert(libcouchbase_get_buffered_bytes(session) > 0);
+    libcouchbase_behavior_set_memory_limit(session, 1);
+    assert(libcouchbase_behavior_get_memory_limit(session) == 1);
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, "foo", 3,
+                             "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_EMEMLIMIT);
+    assert(memory_limit_exceeded == 1);
+
+    /* Removing the limit lets us through again */
+    libcouchbase_behavior_set_memory_limit(session, 0);
+    assert(memory_limit_exceeded == 0);
+    test_set1();
+}
+
+static void test_near_cache1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    struct rvbuf srv;
+    const char *key = "foo";
+    libcouchbase_size_t nkey = strlen(key);
+    libcouchbase_uint64_t hits;
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+
+    assert(libcouchbase_enable_near_cache(session, 1024 * 1024, 10000000) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_enable_near_cache(session, 1024 * 1024, 10000000) == LIBCOUCHBASE_KEY_EEXISTS);
+
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey, "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+
+    /* The first get populates the cache, and the second one is a hit */
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    hits = get_client_stat("near_cache_hits");
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+    assert(get_client_stat("near_cache_hits") == hits + 1);
+    assert(get_client_stat("near_cache_items") == 1);
+
+    /* A store invalidates the entry */
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey, "baz", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(get_client_stat("near_cache_items") == 0);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "baz", 3) == 0);
+    assert(get_client_stat("near_cache_hits") == hits + 1);
+
+    /* The response to a get sent before a store isn't cached */
+    assert(libcouchbase_disable_near_cache(session) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_enable_near_cache(session, 1024 * 1024, 10000000) == LIBCOUCHBASE_SUCCESS);
+    memset(&rv, 0, sizeof(rv));
+    memset(&srv, 0, sizeof(srv));
+    rv.error = srv.error = LIBCOUCHBASE_ERROR;
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    err = libcouchbase_store(session, &srv, LIBCOUCHBASE_SET, key, nkey, "qux", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    while (rv.error == LIBCOUCHBASE_ERROR || srv.error == LIBCOUCHBASE_ERROR) {
+        io->run_event_loop(io);
+    }
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(srv.error == LIBCOUCHBASE_SUCCESS);
+    assert(get_client_stat("near_cache_items") == 0);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "qux", 3) == 0);
+
+    assert(libcouchbase_disable_near_cache(session) == LIBCOUCHBASE_SUCCESS);
+    assert(libcouchbase_disable_near_cache(session) == LIBCOUCHBASE_KEY_ENOENT);
+}
+
+static void test_negative_cache1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    struct rvbuf srv;
+    const char *key = "negative_cache1";
+    libcouchbase_size_t nkey = strlen(key);
+    libcouchbase_uint64_t hits;
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_get_callback(session, get_callback);
+
+    assert(libcouchbase_enable_negative_cache(session, 100, 10000000) == LIBCOUCHBASE_SUCCESS);
+
+    /* The first miss is remembered, and the second one is a hit */
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_KEY_ENOENT);
+    hits = get_client_stat("negative_cache_hits");
+    assert(get_client_stat("negative_cache_items") == 1);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_KEY_ENOENT);
+    assert(rv.nkey == nkey);
+    assert(memcmp(rv.key, key, nkey) == 0);
+    assert(get_client_stat("negative_cache_hits") == hits + 1);
+
+    /* A store invalidates the entry */
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey, "bar", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(get_client_stat("negative_cache_items") == 0);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "bar", 3) == 0);
+
+    /* A miss for a get sent before a store isn't remembered */
+    (void)libcouchbase_set_remove_callback(session, mremove_callback);
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_remove(session, &rv, key, nkey, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.errors == LIBCOUCHBASE_SUCCESS);
+
+    memset(&rv, 0, sizeof(rv));
+    memset(&srv, 0, sizeof(srv));
+    rv.error = srv.error = LIBCOUCHBASE_ERROR;
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    err = libcouchbase_store(session, &srv, LIBCOUCHBASE_SET, key, nkey, "qux", 3, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    while (rv.error == LIBCOUCHBASE_ERROR || srv.error == LIBCOUCHBASE_ERROR) {
+        io->run_event_loop(io);
+    }
+    assert(rv.error == LIBCOUCHBASE_KEY_ENOENT);
+    assert(srv.error == LIBCOUCHBASE_SUCCESS);
+    assert(get_client_stat("negative_cache_items") == 0);
+
+    memset(&rv, 0, sizeof(rv));
+    err = libcouchbase_mget(session, &rv, 1, (const void * const *)&key, &nkey, NULL);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.nbytes == 3);
+    assert(memcmp(rv.bytes, "qux", 3) == 0);
+
+    assert(libcouchbase_disable_negative_cache(session) == LIBCOUCHBASE_SUCCESS);
+}
+
+static void test_touch1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    char *key = "fooX", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+    char **keys;
+    libcouchbase_size_t *nkeys, ii;
+    libcouchbase_time_t *ttls;
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    (void)libcouchbase_set_touch_callback(session, touch_callback);
+
+    keys = malloc(26 * sizeof(char *));
+    nkeys = malloc(26 * sizeof(libcouchbase_size_t));
+    ttls = malloc(26 * sizeof(libcouchbase_time_t));
+    if (keys == NULL || nkeys == NULL || ttls == NULL) {
+        err_exit("Failed to allocate memory for keys");
+    }
+    for (ii = 0; ii < 26; ii++) {
+        nkeys[ii] = nkey;
+        keys[ii] = strdup(key);
+        ttls[ii] = 1;
+        if (keys[ii] == NULL) {
+            err_exit("Failed to allocate memory for key");
+        }
+        keys[ii][3] = (char)ii + 'a';
+        err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, keys[ii], nkeys[ii], val, nval, 0, 0, 0);
+        assert(err == LIBCOUCHBASE_SUCCESS);
+        io->run_event_loop(io);
+        assert(rv.error == LIBCOUCHBASE_SUCCESS);
+        memset(&rv, 0, sizeof(rv));
+    }
+
+    rv.counter = 26;
+    err = libcouchbase_mtouch(session, &rv, 26, (const void * const *)keys, nkeys, ttls);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    for (ii = 0; ii < 26; ii++) {
+        free(keys[ii]);
+    }
+    free(keys);
+    free(ttls);
+    free(nkeys);
+}
+
+static libcouchbase_error_t test_connect(char **argv, const char *username,
+                                         const char *password,
+                                         const char *bucket)
+{
+    const char *endpoint;
+    libcouchbase_error_t rc;
+
+    assert(session == NULL);
+    assert(mock == NULL);
+    assert(io == NULL);
+
+    io = get_test_io_opts();
+    if (io == NULL) {
+        err_exit("Failed to create IO session");
+    }
+
+    mock = start_mock_server(argv);
+    if (mock == NULL) {
+        err_exit("Failed to start mock server");
+    }
+
+    endpoint = get_mock_http_server(mock);
+    session = libcouchbase_create(endpoint, username, password, bucket, io);
+    if (session == NULL) {
+        err_exit("Failed to create libcouchbase session");
+    }
+
+    (void)libcouchbase_set_error_callback(session, error_callback2);
+
+    if (libcouchbase_connect(session) != LIBCOUCHBASE_SUCCESS) {
+        err_exit("Failed to connect to server");
+    }
+    libcouchbase_wait(session);
+    rc = global_error;
+
+    libcouchbase_destroy(session);
+    session = NULL;
+    io = NULL;
+    shutdown_mock_server(mock);
+    mock = NULL;
+
+    return rc;
+}
+
+RESPONSE_HANDLER old_sasl_auth_response_handler;
+RESPONSE_HANDLER response_handlers[0x100];
+const RESPONSE_HANDLER *old_response_handlers;
+libcouchbase_error_t sasl_auth_rc;
+
+static void sasl_auth_response_handler(libcouchbase_server_t *server,
+                                       const void *command_cookie,
+                                       protocol_binary_response_header *res)
+{
+    sasl_auth_rc = ntohs(res->response.status);
+    old_sasl_auth_response_handler(server, command_cookie, res);
+}
+
+static void test_set3(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+    const char *key = "foo", *val = "bar";
+    libcouchbase_size_t nkey = strlen(key), nval = strlen(val);
+
+    /* The handler tables are shared, so use a copy for this instance */
+    old_response_handlers = session->response_handler;
+    memcpy(response_handlers, old_response_handlers, sizeof(response_handlers));
+    old_sasl_auth_response_handler = response_handlers[PROTOCOL_BINARY_CMD_SASL_AUTH];
+    response_handlers[PROTOCOL_BINARY_CMD_SASL_AUTH] = sasl_auth_response_handler;
+    session->response_handler = response_handlers;
+    sasl_auth_rc = -1;
+
+    (void)libcouchbase_set_storage_callback(session, store_callback);
+    err = libcouchbase_store(session, &rv, LIBCOUCHBASE_SET, key, nkey, val, nval, 0, 0, 0);
+    assert(err == LIBCOUCHBASE_SUCCESS);
+    io->run_event_loop(io);
+    assert(rv.error == LIBCOUCHBASE_SUCCESS);
+    assert(rv.operation == LIBCOUCHBASE_SET);
+    assert(memcmp(rv.key, "foo", 3) == 0);
+    assert(sasl_auth_rc == LIBCOUCHBASE_SUCCESS);
+    session->response_handler = old_response_handlers;
+}
+
+static void test_version1(void)
+{
+    libcouchbase_error_t err;
+    struct rvbuf rv;
+
+    (void)libcouchbase_set_version_callback(session, version_callback);
+    err = libcouchbase_server_versions(session, &rv);
+
+    assert(err == LIBCOUCHBASE_SUCCESS);
+
+    rv.counter = total_node_count;
+
+    io->run_event_loop(io);
+
+    /* Ensure all version responses have been received */
+    assert(rv.counter == 0);
+}
+
+static void test_spurious_saslerr(void)
+{
+    const char *key = "KEY";
+    int iterations = 50;
+    struct rvbuf rvs[50];
+    int i;
+    libcouchbase_error_t err;
+    libcouchbase_set_storage_callback(session, mstore_callback);
+
+    memset(rvs, 0, sizeof(rvs));
+
+    for (i = 0; i < iterations; i++) {
+        rvs[i].counter = 999; /*don't trigger a stop_event_loop*/
+        err = libcouchbase_store(session, rvs + i, LIBCOUCHBASE_SET, key, 3, key, 3, 0, 0, 0);
+        if (err != LIBCOUCHBASE_SUCCESS) {
+            err_exit("Store operation failed");
+        }
+    }
+    libcouchbase_wait(session);
+
+    for (i = 0; i < iterations; i++) {
+        char *errinfo = NULL;
+        if (rvs[i].errors != LIBCOUCHBASE_SUCCESS) {
+            errinfo = "Did not get success response";
+        } else if (rvs[i].nkey != 3) {
+            errinfo = "Did not get expected key length";
+        } else if (memcmp(rvs[i].key, key, 3) != 0) {
+            errinfo = "Weird key size";
+        }
+        if (errinfo) {
+            err_exit("%s", errinfo);
+        }
+    }
+}
+
+/* libcouchbase_wait() blocks forever if there is nothing queued */
+static void test_issue_59(void)
+{
+    libcouchbase_wait(session);
+    libcouchbase_wait(session);
+    libcouchbase_wait(session);
+    libcouchbase_wait(session);
+    libcouchbase_wait(session);
+}
+
+int main(int argc, char **argv)
+{
+    char str_node_count[16];
+    const char *args[] = {"--nodes", "",
+                           "--buckets=default::memcache", NULL};
 
     if (getenv("LIBCOUCHBASE_VERBOSE_TESTS") == NULL) {
         freopen("/dev/null", "w", stdout);
@@ -524,6 +1757,29 @@ int main(int argc, char **argv)
     test_set2();
     test_get1();
     test_get2();
+    test_mstore1();
+    test_mget_stream1();
+    test_getk1();
+    test_mremove1();
+    test_marithmetic1();
+    test_coalesce1();
+    test_submission_queue1();
+    test_sharded1();
+    test_shared_config1();
+    test_resident_bytes1();
+    test_memory_limit1();
+    test_inflight_window1();
+    test_retry_backoff1();
+    test_hedged1();
+    test_circuit_breaker1();
+    test_keepalive1();
+    test_with_callback1();
+    test_get_batch1();
+    test_execute_ops1();
+    test_outstanding1();
+    test_tick1();
+    test_near_cache1();
+    test_negative_cache1();
     test_version1();
     test_issue_59();
     teardown();
@@ -534,9 +1790,37 @@ int main(int argc, char **argv)
     test_set2();
     test_get1();
     test_get2();
+    test_mstore1();
+    test_mget_stream1();
+    test_getk1();
+    test_mremove1();
+    test_marithmetic1();
+    test_coalesce1();
+    test_submission_queue1();
+    test_sharded1();
+    test_shared_config1();
+    test_near_cache1();
+    test_negative_cache1();
+    test_touch1();
+    test_version1();
+    teardown();
+
+    /* Run the tests again with multiple connections to each server */
+    connections_per_node = 3;
+    setup((char **)args, "Administrator", "password", "default");
+    test_set1();
+    test_set2();
+    test_get1();
+    test_get2();
+    test_mstore1();
+    test_mget_stream1();
+    test_getk1();
+    test_mremove1();
+    test_marithmetic1();
     test_touch1();
     test_version1();
     teardown();
+    connections_per_node = 1;
 
     assert(test_connect((char **)args, "Administrator", "password", "missing") == LIBCOUCHBASE_BUCKET_ENOENT);
 